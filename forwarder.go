@@ -4,13 +4,24 @@ import (
 	"errors"
 	"fmt"
 	"os"
+	"sort"
 )
 
 type forwardEntry struct {
 	localPort     uint16
 	remotePort    uint32
 	remoteAddress string
+	// count > 1 forwards the port range [localPort, localPort+count) to [remotePort, remotePort+count)
+	count uint16
 }
+
+func (e forwardEntry) String() string {
+	if e.count > 1 {
+		return fmt.Sprintf("ports %v-%v to %s:%v-%v", e.localPort, uint32(e.localPort)+uint32(e.count)-1, e.remoteAddress, e.remotePort, e.remotePort+uint32(e.count)-1)
+	}
+	return fmt.Sprintf("port %v to %s:%v", e.localPort, e.remoteAddress, e.remotePort)
+}
+
 type forwarder struct {
 	nativeUDP  uintptr
 	nativeTCP  uintptr
@@ -48,12 +59,17 @@ func (f *forwarder) addTCP(entry forwardEntry) error {
 	if _, ok := f.tcpEntries[entry]; ok {
 		return nil
 	}
-	err := forwarding_tcp_addEntry(f.nativeTCP, entry.localPort, entry.remotePort, entry.remoteAddress)
+	var err error
+	if entry.count > 1 {
+		err = forwarding_tcp_addRangeEntry(f.nativeTCP, entry.localPort, entry.count, entry.remotePort, entry.remoteAddress)
+	} else {
+		err = forwarding_tcp_addEntry(f.nativeTCP, entry.localPort, entry.remotePort, entry.remoteAddress)
+	}
 	if err != nil {
-		fmt.Fprintf(os.Stderr, "Failed to forward tcp port %v to %s:%v\n", entry.localPort, entry.remoteAddress, entry.remotePort)
+		fmt.Fprintf(os.Stderr, "Failed to forward tcp %v\n", entry)
 		return err
 	}
-	fmt.Printf("Forwarding tcp port %v to %s:%v\n", entry.localPort, entry.remoteAddress, entry.remotePort)
+	fmt.Printf("Forwarding tcp %v\n", entry)
 	f.tcpEntries[entry] = struct{}{}
 	return nil
 }
@@ -66,7 +82,7 @@ func (f *forwarder) removeTCP(entry forwardEntry) error {
 		return nil
 	}
 	forwarding_tcp_removeEntry(f.nativeTCP, entry.localPort)
-	fmt.Printf("Stopped forwarding tcp port %v to %s:%v\n", entry.localPort, entry.remoteAddress, entry.remotePort)
+	fmt.Printf("Stopped forwarding tcp %v\n", entry)
 	delete(f.tcpEntries, entry)
 	return nil
 }
@@ -78,12 +94,17 @@ func (f *forwarder) addUDP(entry forwardEntry) error {
 	if _, ok := f.udpEntries[entry]; ok {
 		return nil
 	}
-	err := forwarding_udp_addEntry(f.nativeUDP, entry.localPort, entry.remotePort, entry.remoteAddress)
+	var err error
+	if entry.count > 1 {
+		err = forwarding_udp_addRangeEntry(f.nativeUDP, entry.localPort, entry.count, entry.remotePort, entry.remoteAddress)
+	} else {
+		err = forwarding_udp_addEntry(f.nativeUDP, entry.localPort, entry.remotePort, entry.remoteAddress)
+	}
 	if err != nil {
-		fmt.Fprintf(os.Stderr, "Failed to forward udp port %v to %s:%v\n", entry.localPort, entry.remoteAddress, entry.remotePort)
+		fmt.Fprintf(os.Stderr, "Failed to forward udp %v\n", entry)
 		return err
 	}
-	fmt.Printf("Forwarding udp port %v to %s:%v\n", entry.localPort, entry.remoteAddress, entry.remotePort)
+	fmt.Printf("Forwarding udp %v\n", entry)
 	f.udpEntries[entry] = struct{}{}
 	return nil
 }
@@ -96,11 +117,76 @@ func (f *forwarder) removeUDP(entry forwardEntry) error {
 		return nil
 	}
 	forwarding_udp_removeEntry(f.nativeUDP, entry.localPort)
-	fmt.Printf("Stopped forwarding udp port %v to %s:%v\n", entry.localPort, entry.remoteAddress, entry.remotePort)
+	fmt.Printf("Stopped forwarding udp %v\n", entry)
 	delete(f.udpEntries, entry)
 	return nil
 }
 
+// updateTCP points the listeners of from to the remote of to, which covers the same local ports. Falls back to replacing the
+// entry when the forwarder can't update it
+func (f *forwarder) updateTCP(from, to forwardEntry) error {
+	if f.closed {
+		return errors.New("forwarder is closed")
+	}
+	if err := forwarding_tcp_updateEntryRemote(f.nativeTCP, to.localPort, to.remotePort, to.remoteAddress); err != nil {
+		if err = f.removeTCP(from); err != nil {
+			return err
+		}
+		return f.addTCP(to)
+	}
+	fmt.Printf("Forwarding tcp %v instead of %v\n", to, from)
+	delete(f.tcpEntries, from)
+	f.tcpEntries[to] = struct{}{}
+	return nil
+}
+
+func (f *forwarder) updateUDP(from, to forwardEntry) error {
+	if f.closed {
+		return errors.New("forwarder is closed")
+	}
+	if err := forwarding_udp_updateEntryRemote(f.nativeUDP, to.localPort, to.remotePort, to.remoteAddress); err != nil {
+		if err = f.removeUDP(from); err != nil {
+			return err
+		}
+		return f.addUDP(to)
+	}
+	fmt.Printf("Forwarding udp %v instead of %v\n", to, from)
+	delete(f.udpEntries, from)
+	f.udpEntries[to] = struct{}{}
+	return nil
+}
+
+type entryUpdate struct {
+	from forwardEntry
+	to   forwardEntry
+}
+
+// entryUpdates pairs the removed and added entries covering the same local ports: their remote can be changed in place,
+// without closing the listeners
+func entryUpdates(toAdd, toRemove []forwardEntry) (updates []entryUpdate, restAdd, restRemove []forwardEntry) {
+	type span struct {
+		localPort uint16
+		count     uint16
+	}
+	removed := make(map[span]forwardEntry)
+	for _, e := range toRemove {
+		removed[span{e.localPort, e.count}] = e
+	}
+	for _, e := range toAdd {
+		s := span{e.localPort, e.count}
+		if from, ok := removed[s]; ok {
+			updates = append(updates, entryUpdate{from: from, to: e})
+			delete(removed, s)
+			continue
+		}
+		restAdd = append(restAdd, e)
+	}
+	for _, e := range removed {
+		restRemove = append(restRemove, e)
+	}
+	return
+}
+
 func entriesDiff(current, toApply map[forwardEntry]struct{}) (toAdd, toRemove []forwardEntry) {
 	for c := range current {
 		if _, ok := toApply[c]; !ok {
@@ -115,13 +201,56 @@ func entriesDiff(current, toApply map[forwardEntry]struct{}) (toAdd, toRemove []
 	return
 }
 
+// coalesceRanges merges single port entries that are contiguous on both sides and target the same address into range entries
+func coalesceRanges(entries []forwardEntry) map[forwardEntry]struct{} {
+	sort.Slice(entries, func(i, j int) bool {
+		return entries[i].localPort < entries[j].localPort
+	})
+	result := make(map[forwardEntry]struct{})
+	var current *forwardEntry
+	for i := range entries {
+		e := entries[i]
+		if current != nil && uint32(e.localPort) < uint32(current.localPort)+uint32(current.count) {
+			// the same port is listed once per host binding (e.g. ipv4 and ipv6)
+			continue
+		}
+		if current != nil && current.count < 0xffff &&
+			e.remoteAddress == current.remoteAddress &&
+			uint32(e.localPort) == uint32(current.localPort)+uint32(current.count) &&
+			e.remotePort == current.remotePort+uint32(current.count) {
+			current.count++
+			continue
+		}
+		if current != nil {
+			result[*current] = struct{}{}
+		}
+		e.count = 1
+		current = &e
+	}
+	if current != nil {
+		result[*current] = struct{}{}
+	}
+	return result
+}
+
 func (f *forwarder) apply(tcp, udp map[forwardEntry]struct{}) error {
 	if f.closed {
 		return errors.New("forwarder is closed")
 	}
 
-	tcpAdd, tcpRemove := entriesDiff(f.tcpEntries, tcp)
-	udpAdd, udpRemove := entriesDiff(f.udpEntries, udp)
+	tcpUpdates, tcpAdd, tcpRemove := entryUpdates(entriesDiff(f.tcpEntries, tcp))
+	udpUpdates, udpAdd, udpRemove := entryUpdates(entriesDiff(f.udpEntries, udp))
+
+	for _, u := range tcpUpdates {
+		if err := f.updateTCP(u.from, u.to); err != nil {
+			return err
+		}
+	}
+	for _, u := range udpUpdates {
+		if err := f.updateUDP(u.from, u.to); err != nil {
+			return err
+		}
+	}
 
 	for _, e := range tcpRemove {
 		err := f.removeTCP(e)
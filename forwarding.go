@@ -5,11 +5,28 @@ package main
 //sys forwarding_udp_start(ptr uintptr) = forwarding.forwarding_udp_start
 //sys forwarding_udp_stop(ptr uintptr) = forwarding.forwarding_udp_stop
 //sys forwarding_udp_addEntry(ptr uintptr, localport uint16, remotePort uint32, remoteAddress string) (err error)[failretval!=0] = forwarding.forwarding_udp_addEntry
+//sys forwarding_udp_addRangeEntry(ptr uintptr, localPortStart uint16, count uint16, remotePortStart uint32, remoteAddress string) (err error)[failretval!=0] = forwarding.forwarding_udp_addRangeEntry
 //sys forwarding_udp_removeEntry(ptr uintptr, localport uint16) = forwarding.forwarding_udp_removeEntry
+//sys forwarding_udp_updateEntryRemote(ptr uintptr, localport uint16, remotePortStart uint32, remoteAddress string) (err error)[failretval!=0] = forwarding.forwarding_udp_updateEntryRemote
+//sys forwarding_udp_duplicateEntry(ptr uintptr, localport uint16, processID uint32, handoff *byte, handoffCapacity uint32, handoffLength *uint32) (err error)[failretval!=0] = forwarding.forwarding_udp_duplicateEntry
+//sys forwarding_udp_adoptRangeEntry(ptr uintptr, localPortStart uint16, count uint16, remotePortStart uint32, remoteAddress string, handoff *byte, handoffLength uint32) (err error)[failretval!=0] = forwarding.forwarding_udp_adoptRangeEntry
+//sys forwarding_udp_releaseEntry(ptr uintptr, localport uint16) (err error)[failretval!=0] = forwarding.forwarding_udp_releaseEntry
+//sys forwarding_udp_restoreSnapshot(ptr uintptr, snapshot uintptr) (count uint32) = forwarding.forwarding_udp_restoreSnapshot
 
 //sys forwarding_tcp_new() (ptr uintptr) = forwarding.forwarding_tcp_new
 //sys forwarding_tcp_delete(ptr uintptr) = forwarding.forwarding_tcp_delete
 //sys forwarding_tcp_start(ptr uintptr) = forwarding.forwarding_tcp_start
 //sys forwarding_tcp_stop(ptr uintptr) = forwarding.forwarding_tcp_stop
 //sys forwarding_tcp_addEntry(ptr uintptr, localport uint16, remotePort uint32, remoteAddress string) (err error)[failretval!=0] = forwarding.forwarding_tcp_addEntry
+//sys forwarding_tcp_addRangeEntry(ptr uintptr, localPortStart uint16, count uint16, remotePortStart uint32, remoteAddress string) (err error)[failretval!=0] = forwarding.forwarding_tcp_addRangeEntry
 //sys forwarding_tcp_removeEntry(ptr uintptr, localport uint16) = forwarding.forwarding_tcp_removeEntry
+//sys forwarding_tcp_updateEntryRemote(ptr uintptr, localport uint16, remotePortStart uint32, remoteAddress string) (err error)[failretval!=0] = forwarding.forwarding_tcp_updateEntryRemote
+//sys forwarding_tcp_duplicateEntry(ptr uintptr, localport uint16, processID uint32, handoff *byte, handoffCapacity uint32, handoffLength *uint32) (err error)[failretval!=0] = forwarding.forwarding_tcp_duplicateEntry
+//sys forwarding_tcp_adoptRangeEntry(ptr uintptr, localPortStart uint16, count uint16, remotePortStart uint32, remoteAddress string, handoff *byte, handoffLength uint32) (err error)[failretval!=0] = forwarding.forwarding_tcp_adoptRangeEntry
+//sys forwarding_tcp_releaseEntry(ptr uintptr, localport uint16) (err error)[failretval!=0] = forwarding.forwarding_tcp_releaseEntry
+//sys forwarding_tcp_restoreSnapshot(ptr uintptr, snapshot uintptr) (count uint32) = forwarding.forwarding_tcp_restoreSnapshot
+//sys forwarding_tcp_activeConnections(ptr uintptr) (count uint64) = forwarding.forwarding_tcp_activeConnections
+
+//sys forwarding_snapshot_open(path string, snapshot *uintptr) (err error)[failretval!=0] = forwarding.forwarding_snapshot_open
+//sys forwarding_snapshot_delete(ptr uintptr) = forwarding.forwarding_snapshot_delete
+//sys forwarding_snapshot_entries(ptr uintptr, entries *snapshotEntry, capacity uint32, count *uint32) (err error)[failretval!=0] = forwarding.forwarding_snapshot_entries
@@ -0,0 +1,160 @@
+#include "harness.h"
+#include "Loopback.h"
+#include <client.h>
+#include <psapi.h>
+#include <algorithm>
+#include <thread>
+// many concurrent mostly idle pairs through a TcpForwarder over loopback while some of them reconnect, for what the pairs
+// cost in memory, handles and cpu, and for what they leave behind once torn down. Each pair holds two ephemeral ports, the
+// one of its client and the one of the upstream connection of the forwarder: holding more pairs than half the dynamic port
+// range needs it raised with netsh int ipv4 set dynamicport tcp
+
+using namespace forwarding;
+using namespace forwarding::bench;
+using namespace std::chrono;
+
+namespace {
+	struct ProcessUsage {
+		std::uint64_t privateBytes = 0;
+		std::uint64_t handles = 0;
+		nanoseconds cpu{};
+	};
+
+	ProcessUsage MeasureProcess() {
+		ProcessUsage usage;
+		PROCESS_MEMORY_COUNTERS_EX memory;
+		ZeroMemory(&memory, sizeof(memory));
+		if (GetProcessMemoryInfo(GetCurrentProcess(), reinterpret_cast<PROCESS_MEMORY_COUNTERS*>(&memory), sizeof(memory))) {
+			usage.privateBytes = memory.PrivateUsage;
+		}
+		DWORD handles = 0;
+		if (GetProcessHandleCount(GetCurrentProcess(), &handles)) {
+			usage.handles = handles;
+		}
+		usage.cpu = ProcessCpuTime();
+		return usage;
+	}
+
+	struct HeldPair {
+		SafeSocket client;
+		SafeSocket upstream;
+	};
+
+	// connects through the forwarder and sends a byte, returning once the upstream received it
+	HeldPair Open(std::uint16_t localPort, LoopbackListener& server) {
+		HeldPair pair;
+		pair.client = ConnectLoopback(localPort);
+		char first = 'x';
+		REQUIRE(1 == send(pair.client.Get(), &first, 1, 0));
+		pair.upstream = server.Accept();
+		char received;
+		REQUIRE(1 == recv(pair.upstream.Get(), &received, 1, 0));
+		return pair;
+	}
+
+	void Close(HeldPair& pair) {
+		CloseWithReset(pair.client);
+		CloseWithReset(pair.upstream);
+	}
+}
+
+// --pairs: concurrent pairs held, --churn: pairs closed and reopened while they are held, --churn-rate: reconnects per
+// second, --idle-ms: how long the idle cpu is measured
+FORWARDING_SCENARIO(TcpChurn)
+{
+	const std::uint16_t localPort = 8200;
+	const std::uint16_t remotePort = 9200;
+	auto pairCount = static_cast<std::size_t>(Parameter("pairs", 5000));
+	auto churnCount = static_cast<std::size_t>(Parameter("churn", 5000));
+	auto churnRate = Parameter("churn-rate", 1000);
+	auto idleTime = milliseconds(Parameter("idle-ms", 2000));
+
+	LoopbackListener server(remotePort);
+	{
+		// what the sockets cost on their own, to tell the forwarder apart in the memory of the process. It also has winsock
+		// set up what it keeps for the process before the handles are counted
+		std::vector<HeldPair> direct;
+		direct.reserve(pairCount);
+		auto beforeDirect = MeasureProcess();
+		auto openStart = steady_clock::now();
+		for (std::size_t i = 0; i < pairCount; ++i) {
+			HeldPair pair;
+			pair.client = ConnectLoopback(remotePort);
+			pair.upstream = server.Accept();
+			direct.push_back(std::move(pair));
+		}
+		auto openTime = steady_clock::now() - openStart;
+		auto afterDirect = MeasureProcess();
+		state.counters["socket_bytes"] = static_cast<double>(afterDirect.privateBytes - beforeDirect.privateBytes) / (2 * pairCount);
+		state.counters["direct_opened_pairs_per_second"] = pairCount / duration_cast<duration<double>>(openTime).count();
+		for (auto& pair : direct) {
+			Close(pair);
+		}
+	}
+	auto before = MeasureProcess();
+	{
+		Runtime runtime;
+		TcpForwarder forwarder(runtime);
+		forwarder.AddEntry(localPort, remotePort, "127.0.0.1");
+		forwarder.Start();
+
+		std::vector<HeldPair> pairs;
+		pairs.reserve(pairCount);
+		auto beforePairs = MeasureProcess();
+		auto openStart = steady_clock::now();
+		for (std::size_t i = 0; i < pairCount; ++i) {
+			pairs.push_back(Open(localPort, server));
+		}
+		auto openTime = steady_clock::now() - openStart;
+		REQUIRE(WaitUntil([&]() {return forwarder.ActiveConnections() == pairCount; }));
+		auto afterPairs = MeasureProcess();
+		auto bytesPerPair = static_cast<double>(afterPairs.privateBytes - beforePairs.privateBytes) / pairCount;
+		state.counters["private_bytes_per_pair"] = bytesPerPair;
+		// each pair holds four sockets: the client, both sides of the forwarder and the upstream
+		state.counters["forwarder_bytes_per_pair"] = bytesPerPair - 4 * state.counters["socket_bytes"];
+		state.counters["handles_per_pair"] = (static_cast<double>(afterPairs.handles) - beforePairs.handles) / pairCount;
+		state.counters["opened_pairs_per_second"] = pairCount / duration_cast<duration<double>>(openTime).count();
+
+		// reconnect waves: the oldest pairs are replaced at the churn rate while the others stay connected
+		Latencies acceptToFirstByte;
+		acceptToFirstByte.Reserve(churnCount);
+		auto interval = duration_cast<steady_clock::duration>(duration<double>(1.0 / std::max<std::uint64_t>(churnRate, 1)));
+		auto next = steady_clock::now();
+		for (std::size_t i = 0; i < churnCount; ++i) {
+			std::this_thread::sleep_until(next);
+			next += interval;
+			auto& replaced = pairs[i % pairCount];
+			Close(replaced);
+			auto start = steady_clock::now();
+			replaced = Open(localPort, server);
+			acceptToFirstByte.Add(steady_clock::now() - start);
+		}
+		acceptToFirstByte.Report(state.counters, "accept_to_first_byte");
+		REQUIRE(WaitUntil([&]() {return forwarder.ActiveConnections() == pairCount; }));
+
+		std::uint64_t busiest = 0;
+		std::uint64_t idlest = ~std::uint64_t(0);
+		for (auto& bridge : forwarder.GetBridgeStats()) {
+			busiest = std::max(busiest, bridge.busiestSlotPairs);
+			idlest = std::min(idlest, bridge.idlestSlotPairs);
+		}
+		state.counters["busiest_slot_pairs"] = static_cast<double>(busiest);
+		state.counters["idlest_slot_pairs"] = static_cast<double>(idlest);
+
+		// nothing moves: the forwarder should not burn cpu for the pairs it holds
+		auto idleStart = MeasureProcess();
+		std::this_thread::sleep_for(idleTime);
+		auto idleEnd = MeasureProcess();
+		state.counters["idle_cpu_percent"] = 100.0 * (idleEnd.cpu - idleStart.cpu).count() / duration_cast<nanoseconds>(idleTime).count();
+
+		for (auto& pair : pairs) {
+			Close(pair);
+		}
+		REQUIRE(WaitUntil([&]() {return forwarder.ActiveConnections() == 0; }, seconds(60)));
+	}
+	auto after = MeasureProcess();
+	// the runtime, the forwarder and every pair are gone: what is left was leaked, sockets being handles too
+	state.counters["leaked_handles"] = static_cast<double>(after.handles) - static_cast<double>(before.handles);
+	REQUIRE(after.handles <= before.handles);
+	state.counters["pairs"] = static_cast<double>(pairCount);
+}
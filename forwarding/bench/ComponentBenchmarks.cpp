@@ -0,0 +1,204 @@
+#include "harness.h"
+#include "SendQueue.h"
+#include "Tuning.h"
+#include "UdpFlow.h"
+#include <client.h>
+#include <algorithm>
+#include <map>
+#include <random>
+// the building blocks of the forwarders on their own, over a SimulatedNetwork so that the kernel does not blur them
+
+using namespace forwarding;
+using namespace forwarding::bench;
+using namespace std::chrono;
+
+namespace {
+	// a connected pair of simulated sockets
+	struct SocketPair {
+		SafeSocket client;
+		SafeSocket server;
+		SocketPair(std::uint16_t port) {
+			SafeSocket listener(ListenOn(port));
+			client = ConnectTo(port);
+			server = AcceptFrom(listener.Get());
+		}
+	};
+
+	const std::size_t SegmentSize = 1460;
+}
+
+FORWARDING_BENCHMARK(SendQueueAppendAndPartialFlush)
+{
+	Simulation simulation;
+	simulation.Network().SetMaxWriteSize(4096);
+	SocketPair remote(9100);
+	ChunkPool pool;
+	SendQueue queue;
+	std::vector<char> segment(SegmentSize, 'x');
+	std::size_t received = 0;
+	for (auto i = state.Iterations(); i > 0; --i) {
+		queue.Append(segment.data(), segment.size(), pool);
+		// what a pair checks before reading more from the other side
+		if (queue.size() >= DefaultQueueThreshold) {
+			queue.Flush(remote.client.Get(), pool, 4096);
+			DrainSome(remote.server.Get(), received);
+		}
+	}
+	state.counters["bytes_per_iteration"] = SegmentSize;
+}
+
+FORWARDING_BENCHMARK(SendQueueReceiveIntoTail)
+{
+	Simulation simulation;
+	SocketPair local(9101);
+	SocketPair remote(9102);
+	ChunkPool pool;
+	SendQueue queue;
+	std::vector<char> segment(SegmentSize, 'x');
+	std::size_t received = 0;
+	for (auto i = state.Iterations(); i > 0; --i) {
+		SendSome(local.client.Get(), segment.data(), segment.size());
+		std::size_t room = 0;
+		auto tail = queue.Tail(pool, room);
+		auto read = socketApi().Recv(local.server.Get(), tail, static_cast<int>(room));
+		queue.CommitTail(read > 0 ? read : 0, pool);
+		if (queue.size() >= DefaultQueueThreshold) {
+			queue.Flush(remote.client.Get(), pool);
+			DrainSome(remote.server.Get(), received);
+		}
+	}
+}
+
+FORWARDING_BENCHMARK(UdpFlowLookup)
+{
+	const std::size_t flowCount = 10000;
+	std::map<UdpFlowKey, UdpPair> flows;
+	std::vector<UdpFlowKey> keys;
+	std::mt19937 random(42);
+	for (std::size_t i = 0; i < flowCount; ++i) {
+		UdpFlowKey key;
+		ZeroMemory(&key, sizeof(key));
+		key.index = static_cast<std::uint16_t>(random() % 4);
+		key.clientAddr.sin_family = AF_INET;
+		key.clientAddr.sin_addr.s_addr = htonl(0x0a000000 | (random() & 0xffff));
+		key.clientAddr.sin_port = htons(static_cast<u_short>(1024 + random() % 60000));
+		if (flows.emplace(key, UdpPair()).second) {
+			keys.push_back(key);
+		}
+	}
+	std::shuffle(keys.begin(), keys.end(), random);
+	std::size_t next = 0;
+	for (auto i = state.Iterations(); i > 0; --i) {
+		auto found = flows.find(keys[next]);
+		DoNotOptimize(found);
+		next = next + 1 == keys.size() ? 0 : next + 1;
+	}
+	state.counters["flows"] = static_cast<double>(keys.size());
+}
+
+FORWARDING_BENCHMARK(UdpFlowSendRequests)
+{
+	Simulation simulation;
+	SafeSocket server(BindUdp(9103));
+	UdpPair pair(Loopback(7103), 0, SafeSocket(socketApi().Socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP)));
+	auto serverAddress = Loopback(9103);
+	REQUIRE(0 == socketApi().Connect(pair.remote.Get(), reinterpret_cast<const sockaddr*>(&serverAddress), sizeof(serverAddress)));
+	UdpRequest request(64, 'x');
+	char buffer[2048];
+	for (auto i = state.Iterations(); i > 0; --i) {
+		pair.pendingRequests.push_back(request);
+		if (pair.pendingRequests.size() == FlowDrainBatch) {
+			REQUIRE(pair.trySendRequests(FlowDrainBatch));
+			while (socketApi().RecvFrom(server.Get(), buffer, sizeof(buffer), nullptr, nullptr) > 0) {
+			}
+		}
+	}
+}
+
+FORWARDING_BENCHMARK(UdpFlowReadReply)
+{
+	Simulation simulation;
+	SafeSocket server(BindUdp(9104));
+	UdpPair pair(Loopback(7104), 0, SafeSocket(BindUdp(9105)));
+	auto remoteAddress = Loopback(9105);
+	char reply[64] = {};
+	std::vector<char> data;
+	for (auto i = state.Iterations(); i > 0; --i) {
+		socketApi().SendTo(server.Get(), reply, sizeof(reply), reinterpret_cast<const sockaddr*>(&remoteAddress), sizeof(remoteAddress));
+		REQUIRE(pair.tryReadReply(data));
+	}
+}
+
+// the pairs of a slot are collected with remove_if once closed: with many long lived pairs in the slot, each collection
+// walks all of them
+FORWARDING_BENCHMARK(TcpPairCollection)
+{
+	const std::size_t heldPairs = 1000;
+	Simulation simulation;
+	Runtime runtime(1);
+	TcpForwarder forwarder(runtime);
+	SafeSocket server(ListenOn(9106));
+	forwarder.AddEntry(8106, 9106, "127.0.0.1");
+	forwarder.Start();
+	std::vector<SafeSocket> held;
+	for (std::size_t i = 0; i < heldPairs; ++i) {
+		held.push_back(ConnectTo(8106));
+		held.push_back(AcceptFrom(server.Get()));
+	}
+	REQUIRE(WaitUntil([&]() {return forwarder.ActiveConnections() == heldPairs; }));
+	for (auto i = state.Iterations(); i > 0; --i) {
+		state.PauseTiming();
+		SafeSocket client(ConnectTo(8106));
+		SafeSocket upstream(AcceptFrom(server.Get()));
+		REQUIRE(WaitUntil([&]() {return forwarder.ActiveConnections() == heldPairs + 1; }));
+		state.ResumeTiming();
+		client.Close();
+		upstream.Close();
+		REQUIRE(WaitUntil([&]() {return forwarder.ActiveConnections() == heldPairs; }));
+	}
+	state.counters["held_pairs"] = heldPairs;
+}
+
+FORWARDING_BENCHMARK(ResolveNumericIpv4)
+{
+	for (auto i = state.Iterations(); i > 0; --i) {
+		auto address = Resolve("127.0.0.1", 8080);
+		DoNotOptimize(address);
+	}
+}
+
+FORWARDING_BENCHMARK(ResolveNumericIpv6)
+{
+	for (auto i = state.Iterations(); i > 0; --i) {
+		auto address = Resolve("::1", 8080);
+		DoNotOptimize(address);
+	}
+}
+
+FORWARDING_BENCHMARK(BufferViewSubBuffer)
+{
+	std::vector<char> buffer(64 * 1024);
+	BufferView view(buffer.data(), static_cast<std::uint32_t>(buffer.size()));
+	std::uint32_t offset = 0;
+	for (auto i = state.Iterations(); i > 0; --i) {
+		auto segment = view.subBuffer(offset, SegmentSize);
+		DoNotOptimize(segment);
+		offset += SegmentSize;
+		if (offset + SegmentSize > view.size()) {
+			offset = 0;
+		}
+	}
+}
+
+FORWARDING_BENCHMARK(BufferizeRoundTrip)
+{
+	struct Header {
+		std::uint32_t length;
+		std::uint32_t flags;
+	} header{ 1500, 1 };
+	for (auto i = state.Iterations(); i > 0; --i) {
+		auto view = Bufferize(header);
+		auto length = Unbufferize<Header>(view)->length;
+		DoNotOptimize(length);
+	}
+}
@@ -0,0 +1,205 @@
+#include "Loopback.h"
+#include "harness.h"
+#include <afunix.h>
+#include <algorithm>
+#include <cstring>
+
+using namespace forwarding;
+using namespace forwarding::bench;
+using namespace std::chrono;
+
+namespace {
+	const std::size_t BufferSize = 256 * 1024;
+
+	bool SendAll(SOCKET s, const char* data, std::size_t size) {
+		while (size > 0) {
+			auto sent = send(s, data, static_cast<int>(size), 0);
+			if (sent <= 0) {
+				return false;
+			}
+			data += sent;
+			size -= sent;
+		}
+		return true;
+	}
+
+	bool ReceiveAll(SOCKET s, char* data, std::size_t size) {
+		while (size > 0) {
+			auto received = recv(s, data, static_cast<int>(size), 0);
+			if (received <= 0) {
+				return false;
+			}
+			data += received;
+			size -= received;
+		}
+		return true;
+	}
+}
+
+forwarding::bench::LoopbackServer::LoopbackServer(const char* address, std::uint16_t port, ServerMode mode) : _mode(mode)
+{
+	auto resolved = Resolve(address, port);
+	if (resolved->Family() == AF_UNIX) {
+		// a path left by a previous run would fail the bind
+		DeleteFileA(reinterpret_cast<const sockaddr_un*>(resolved->SockAddr())->sun_path);
+	}
+	_listener = socket(resolved->Family(), SOCK_STREAM, 0);
+	REQUIRE(0 == bind(_listener.Get(), resolved->SockAddr(), resolved->SockAddrLen()));
+	REQUIRE(0 == listen(_listener.Get(), SOMAXCONN));
+	auto listener = _listener.Get();
+	_acceptThread = std::thread([this, listener]() {Accept(listener); });
+}
+
+forwarding::bench::LoopbackServer::~LoopbackServer()
+{
+	// fails the pending accept
+	_listener.Close();
+	_acceptThread.join();
+	{
+		std::lock_guard<std::mutex> lg(_mut);
+		for (auto s : _connections) {
+			shutdown(s, SD_BOTH);
+		}
+	}
+	for (auto& thread : _threads) {
+		thread.join();
+	}
+	for (auto s : _connections) {
+		closesocket(s);
+	}
+}
+
+void forwarding::bench::LoopbackServer::Accept(SOCKET listener)
+{
+	for (;;) {
+		auto s = accept(listener, nullptr, nullptr);
+		if (s == INVALID_SOCKET) {
+			return;
+		}
+		std::lock_guard<std::mutex> lg(_mut);
+		_connections.push_back(s);
+		_threads.emplace_back([this, s]() {Serve(s); });
+	}
+}
+
+void forwarding::bench::LoopbackServer::Serve(SOCKET s)
+{
+	std::vector<char> buffer(BufferSize);
+	if (_mode == ServerMode::Echo) {
+		for (;;) {
+			auto received = recv(s, buffer.data(), static_cast<int>(buffer.size()), 0);
+			if (received <= 0 || !SendAll(s, buffer.data(), received)) {
+				return;
+			}
+		}
+	}
+	for (;;) {
+		std::uint64_t total = 0;
+		if (!ReceiveAll(s, reinterpret_cast<char*>(&total), sizeof(total))) {
+			return;
+		}
+		while (total > 0) {
+			auto received = recv(s, buffer.data(), static_cast<int>(std::min<std::uint64_t>(total, buffer.size())), 0);
+			if (received <= 0) {
+				return;
+			}
+			total -= received;
+		}
+		char ack = 1;
+		if (!SendAll(s, &ack, 1)) {
+			return;
+		}
+	}
+}
+
+forwarding::bench::UdpEchoServer::UdpEchoServer(std::uint16_t port)
+{
+	auto address = ResolveUdp("127.0.0.1", port);
+	_socket = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+	REQUIRE(0 == bind(_socket.Get(), address->SockAddr(), address->SockAddrLen()));
+	auto s = _socket.Get();
+	_thread = std::thread([s]() {
+		char buffer[64 * 1024];
+		for (;;) {
+			sockaddr_in from;
+			int fromLen = sizeof(from);
+			auto received = recvfrom(s, buffer, sizeof(buffer), 0, reinterpret_cast<sockaddr*>(&from), &fromLen);
+			// the connection reset of an unreachable client is reported on the next receive
+			if (received < 0 && WSAGetLastError() == WSAECONNRESET) {
+				continue;
+			}
+			if (received < 0) {
+				return;
+			}
+			sendto(s, buffer, received, 0, reinterpret_cast<const sockaddr*>(&from), fromLen);
+		}
+	});
+}
+
+forwarding::bench::UdpEchoServer::~UdpEchoServer()
+{
+	// fails the pending receive
+	_socket.Close();
+	_thread.join();
+}
+
+forwarding::bench::LoopbackListener::LoopbackListener(std::uint16_t port)
+{
+	auto address = Resolve("127.0.0.1", port);
+	_listener = socket(AF_INET, SOCK_STREAM, 0);
+	REQUIRE(0 == bind(_listener.Get(), address->SockAddr(), address->SockAddrLen()));
+	REQUIRE(0 == listen(_listener.Get(), SOMAXCONN));
+}
+
+SafeSocket forwarding::bench::LoopbackListener::Accept()
+{
+	return SafeSocket(accept(_listener.Get(), nullptr, nullptr));
+}
+
+SafeSocket forwarding::bench::ConnectLoopback(std::uint16_t port)
+{
+	auto address = Resolve("127.0.0.1", port);
+	SafeSocket s = socket(AF_INET, SOCK_STREAM, 0);
+	REQUIRE(0 == connect(s.Get(), address->SockAddr(), address->SockAddrLen()));
+	return s;
+}
+
+void forwarding::bench::CloseWithReset(SafeSocket& s)
+{
+	linger reset{ 1, 0 };
+	setsockopt(s.Get(), SOL_SOCKET, SO_LINGER, reinterpret_cast<const char*>(&reset), sizeof(reset));
+	closesocket(s.Release());
+}
+
+forwarding::bench::LoopbackClient::LoopbackClient(std::uint16_t port) : _socket(ConnectLoopback(port))
+{
+	BOOL noDelay = TRUE;
+	setsockopt(_socket.Get(), IPPROTO_TCP, TCP_NODELAY, reinterpret_cast<const char*>(&noDelay), sizeof(noDelay));
+}
+
+steady_clock::duration forwarding::bench::LoopbackClient::RoundTrip(std::size_t size)
+{
+	std::vector<char> message(size, 'x');
+	auto start = steady_clock::now();
+	REQUIRE(SendAll(_socket.Get(), message.data(), size));
+	REQUIRE(ReceiveAll(_socket.Get(), message.data(), size));
+	return steady_clock::now() - start;
+}
+
+void forwarding::bench::LoopbackClient::Stream(std::uint64_t total, std::size_t writeSize)
+{
+	std::vector<char> buffer(writeSize, 'x');
+	REQUIRE(SendAll(_socket.Get(), reinterpret_cast<const char*>(&total), sizeof(total)));
+	for (auto left = total; left > 0;) {
+		auto size = static_cast<std::size_t>(std::min<std::uint64_t>(left, writeSize));
+		REQUIRE(SendAll(_socket.Get(), buffer.data(), size));
+		left -= size;
+	}
+	char ack = 0;
+	REQUIRE(ReceiveAll(_socket.Get(), &ack, 1));
+}
+
+double forwarding::bench::Throughput(std::uint64_t bytes, steady_clock::duration elapsed)
+{
+	return bytes / (1024.0 * 1024.0) / duration_cast<duration<double>>(elapsed).count();
+}
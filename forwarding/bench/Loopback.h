@@ -0,0 +1,80 @@
+#pragma once
+#include <common.h>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <vector>
+// servers and clients on native loopback sockets, for the scenarios that measure the forwarders end to end, socket options
+// and kernel transitions included
+namespace forwarding {
+	namespace bench {
+		enum class ServerMode {
+			// sends back what it receives, for round trips
+			Echo,
+			// reads the streams of LoopbackClient::Stream and acknowledges each once fully received
+			Sink
+		};
+
+		// serves each connection on a thread of its own, until destroyed
+		class LoopbackServer {
+		private:
+			ServerMode _mode;
+			SafeSocket _listener;
+			std::thread _acceptThread;
+			std::mutex _mut;
+			std::vector<SOCKET> _connections;
+			std::vector<std::thread> _threads;
+
+			void Accept(SOCKET listener);
+			void Serve(SOCKET s);
+		public:
+			// on 127.0.0.1, or on a unix socket path prefixed with UnixSocketPrefix
+			LoopbackServer(const char* address, std::uint16_t port, ServerMode mode);
+			LoopbackServer(const LoopbackServer&) = delete;
+			LoopbackServer& operator =(const LoopbackServer&) = delete;
+			~LoopbackServer();
+		};
+
+		// sends each datagram back to where it came from, until destroyed
+		class UdpEchoServer {
+		private:
+			SafeSocket _socket;
+			std::thread _thread;
+		public:
+			explicit UdpEchoServer(std::uint16_t port);
+			UdpEchoServer(const UdpEchoServer&) = delete;
+			UdpEchoServer& operator =(const UdpEchoServer&) = delete;
+			~UdpEchoServer();
+		};
+
+		// accepts on the thread of the caller, for the scenarios holding more connections than they could run threads
+		class LoopbackListener {
+		private:
+			SafeSocket _listener;
+		public:
+			explicit LoopbackListener(std::uint16_t port);
+			SafeSocket Accept();
+		};
+
+		// a blocking connection to 127.0.0.1
+		SafeSocket ConnectLoopback(std::uint16_t port);
+		// closes with a reset rather than a shutdown, so that no TIME_WAIT holds the port of the connection
+		void CloseWithReset(SafeSocket& s);
+
+		class LoopbackClient {
+		private:
+			SafeSocket _socket;
+		public:
+			// connects to 127.0.0.1 with Nagle disabled, like an RPC client
+			explicit LoopbackClient(std::uint16_t port);
+			// sends size bytes to an Echo server and waits for them to come back
+			std::chrono::steady_clock::duration RoundTrip(std::size_t size);
+			// sends total bytes in writes of writeSize to a Sink server and waits for its acknowledgement
+			void Stream(std::uint64_t total, std::size_t writeSize);
+		};
+
+		// megabytes per second
+		double Throughput(std::uint64_t bytes, std::chrono::steady_clock::duration elapsed);
+	}
+}
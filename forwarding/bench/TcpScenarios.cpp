@@ -0,0 +1,292 @@
+#include "harness.h"
+#include "Loopback.h"
+#include <client.h>
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+// tcp forwarding over loopback, next to the same traffic going straight to the servers
+
+using namespace forwarding;
+using namespace forwarding::bench;
+using namespace std::chrono;
+
+namespace {
+	const std::size_t RpcSize = 64;
+	const std::size_t StreamWriteSize = 64 * 1024;
+
+	// round trips of small messages on one connection, then a bulk stream on another
+	void MeasureTraffic(std::uint16_t echoPort, std::uint16_t sinkPort, Counters& counters, const std::string& name) {
+		auto roundTrips = static_cast<std::size_t>(Parameter("round-trips", 10000));
+		auto streamBytes = Parameter("stream-mb", 512) * 1024 * 1024;
+		{
+			LoopbackClient client(echoPort);
+			// connection setup and the first wakeups of the loops are not what is measured
+			for (int i = 0; i < 100; ++i) {
+				client.RoundTrip(RpcSize);
+			}
+			Latencies latencies;
+			latencies.Reserve(roundTrips);
+			for (std::size_t i = 0; i < roundTrips; ++i) {
+				latencies.Add(client.RoundTrip(RpcSize));
+			}
+			latencies.Report(counters, name + "_rtt");
+		}
+		LoopbackClient client(sinkPort);
+		auto start = steady_clock::now();
+		client.Stream(streamBytes, StreamWriteSize);
+		counters[name + "_stream_mb_per_s"] = Throughput(streamBytes, steady_clock::now() - start);
+	}
+}
+
+// --round-trips: rpc round trips per profile, --stream-mb: bulk stream size per profile
+FORWARDING_SCENARIO(TcpTuningProfiles)
+{
+	const std::uint16_t echoPort = 9300;
+	const std::uint16_t sinkPort = 9301;
+	struct {
+		const char* name;
+		TuningProfile profile;
+	} profiles[] = {
+		{ "default", TuningProfile::Default },
+		{ "latency", TuningProfile::Latency },
+		{ "throughput", TuningProfile::Throughput },
+		{ "auto", TuningProfile::Auto },
+	};
+	LoopbackServer echo("127.0.0.1", echoPort, ServerMode::Echo);
+	LoopbackServer sink("127.0.0.1", sinkPort, ServerMode::Sink);
+	MeasureTraffic(echoPort, sinkPort, state.counters, "direct");
+
+	Runtime runtime;
+	TcpForwarder forwarder(runtime);
+	std::uint16_t localPort = 8300;
+	for (auto& profile : profiles) {
+		forwarder.AddEntry(localPort, echoPort, "127.0.0.1");
+		forwarder.AddEntry(localPort + 1, sinkPort, "127.0.0.1");
+		REQUIRE(forwarder.SetEntryTuning(localPort, profile.profile));
+		REQUIRE(forwarder.SetEntryTuning(localPort + 1, profile.profile));
+		localPort += 2;
+	}
+	forwarder.Start();
+	localPort = 8300;
+	for (auto& profile : profiles) {
+		MeasureTraffic(localPort, localPort + 1, state.counters, profile.name);
+		localPort += 2;
+	}
+}
+
+// the same entries forwarding to servers on loopback tcp and on unix sockets
+FORWARDING_SCENARIO(TcpUnixUpstream)
+{
+	char temp[MAX_PATH];
+	REQUIRE(0 != GetTempPathA(sizeof(temp), temp));
+	auto echoPath = std::string(UnixSocketPrefix) + temp + "forwarding-bench-echo.sock";
+	auto sinkPath = std::string(UnixSocketPrefix) + temp + "forwarding-bench-sink.sock";
+	LoopbackServer tcpEcho("127.0.0.1", 9310, ServerMode::Echo);
+	LoopbackServer tcpSink("127.0.0.1", 9311, ServerMode::Sink);
+	LoopbackServer unixEcho(echoPath.c_str(), 0, ServerMode::Echo);
+	LoopbackServer unixSink(sinkPath.c_str(), 0, ServerMode::Sink);
+
+	Runtime runtime;
+	TcpForwarder forwarder(runtime);
+	forwarder.AddEntry(8310, 9310, "127.0.0.1");
+	forwarder.AddEntry(8311, 9311, "127.0.0.1");
+	forwarder.AddEntry(8312, 0, echoPath.c_str());
+	forwarder.AddEntry(8313, 0, sinkPath.c_str());
+	forwarder.Start();
+	MeasureTraffic(8310, 8311, state.counters, "tcp_upstream");
+	MeasureTraffic(8312, 8313, state.counters, "unix_upstream");
+}
+
+// --clients: concurrent streams, --backends: most backends behind the entry, --stream-mb: bytes sent by all the clients
+FORWARDING_SCENARIO(TcpBackendScaling)
+{
+	const std::uint16_t firstSinkPort = 9320;
+	auto clientCount = static_cast<std::size_t>(Parameter("clients", 8));
+	auto maxBackends = static_cast<std::uint16_t>(Parameter("backends", 4));
+	auto streamBytes = Parameter("stream-mb", 512) * 1024 * 1024;
+	std::vector<std::unique_ptr<LoopbackServer>> sinks;
+	for (std::uint16_t i = 0; i < maxBackends; ++i) {
+		sinks.push_back(std::make_unique<LoopbackServer>("127.0.0.1", firstSinkPort + i, ServerMode::Sink));
+	}
+	Runtime runtime;
+	TcpForwarder forwarder(runtime);
+	// an entry per backend count, each backend of an entry with the same weight
+	for (std::uint16_t backends = 1; backends <= maxBackends; ++backends) {
+		std::uint16_t localPort = 8320 + backends;
+		forwarder.AddEntry(localPort, firstSinkPort, "127.0.0.1");
+		for (std::uint16_t i = 1; i < backends; ++i) {
+			REQUIRE(forwarder.AddBackend(localPort, firstSinkPort + i, "127.0.0.1", 1));
+		}
+		REQUIRE(forwarder.SetBalancingPolicy(localPort, BalancingPolicy::LeastConnections));
+	}
+	forwarder.Start();
+	for (std::uint16_t backends = 1; backends <= maxBackends; ++backends) {
+		std::uint16_t localPort = 8320 + backends;
+		std::atomic<bool> failed{ false };
+		std::vector<std::thread> clients;
+		auto start = steady_clock::now();
+		for (std::size_t i = 0; i < clientCount; ++i) {
+			clients.emplace_back([&]() {
+				try {
+					LoopbackClient client(localPort);
+					client.Stream(streamBytes / clientCount, StreamWriteSize);
+				}
+				catch (...) {
+					failed = true;
+				}
+			});
+		}
+		for (auto& client : clients) {
+			client.join();
+		}
+		REQUIRE(!failed);
+		state.counters["backends_" + std::to_string(backends) + "_mb_per_s"] = Throughput(streamBytes / clientCount * clientCount, steady_clock::now() - start);
+	}
+}
+
+// bulk streams through entries with zero-copy sends from different thresholds: sends of at least the threshold go straight
+// from the forwarder buffers, the best threshold being where they start paying off. --stream-mb: bytes streamed per entry
+FORWARDING_SCENARIO(TcpZeroCopyCrossover)
+{
+	const std::uint16_t sinkPort = 9330;
+	// within the queue threshold of the Throughput profile, so that each can be reached. 0 is the copying path
+	const std::uint32_t thresholds[] = { 0, 4 * 1024, 16 * 1024, 64 * 1024, 256 * 1024 };
+	auto streamBytes = Parameter("stream-mb", 1024) * 1024 * 1024;
+	LoopbackServer sink("127.0.0.1", sinkPort, ServerMode::Sink);
+	Runtime runtime;
+	TcpForwarder forwarder(runtime);
+	std::uint16_t localPort = 8330;
+	for (auto threshold : thresholds) {
+		forwarder.AddEntry(localPort, sinkPort, "127.0.0.1");
+		REQUIRE(forwarder.SetEntryTuning(localPort, TuningProfile::Throughput));
+		REQUIRE(forwarder.SetEntryZeroCopy(localPort, threshold));
+		++localPort;
+	}
+	forwarder.Start();
+
+	localPort = 8330;
+	double copyThroughput = 0;
+	double bestThroughput = 0;
+	for (auto threshold : thresholds) {
+		LoopbackClient client(localPort++);
+		auto cpuStart = ProcessCpuTime();
+		auto start = steady_clock::now();
+		client.Stream(streamBytes, 1024 * 1024);
+		auto throughput = Throughput(streamBytes, steady_clock::now() - start);
+		auto cpu = ProcessCpuTime() - cpuStart;
+		auto name = threshold == 0 ? std::string("copy") : "zero_copy_" + std::to_string(threshold / 1024) + "k";
+		state.counters[name + "_mb_per_s"] = throughput;
+		// the client and the sink are in the process too, and cost the same whatever the threshold
+		state.counters[name + "_cpu_ms_per_gb"] = duration_cast<duration<double, std::milli>>(cpu).count() * (1024.0 * 1024 * 1024) / streamBytes;
+		if (threshold == 0) {
+			copyThroughput = throughput;
+		}
+		else if (throughput > copyThroughput && (bestThroughput == 0 || throughput > bestThroughput)) {
+			bestThroughput = throughput;
+			state.counters["crossover_threshold_bytes"] = threshold;
+		}
+	}
+}
+
+// small rpcs through the same data bridge as saturating bulk streams: the per visit byte budget bounds what the streams
+// add to their tail latency, and interactive entries are served first. --bulk-streams: concurrent bulk streams
+FORWARDING_SCENARIO(TcpRpcNextToBulk)
+{
+	const std::uint16_t echoPort = 9350;
+	const std::uint16_t sinkPort = 9351;
+	auto bulkStreams = static_cast<std::size_t>(Parameter("bulk-streams", 2));
+	auto roundTrips = static_cast<std::size_t>(Parameter("round-trips", 10000));
+	LoopbackServer echo("127.0.0.1", echoPort, ServerMode::Echo);
+	LoopbackServer sink("127.0.0.1", sinkPort, ServerMode::Sink);
+	// a single loop, so that every pair shares its bridge
+	Runtime runtime(1);
+	TcpForwarder forwarder(runtime);
+	forwarder.AddEntry(8350, echoPort, "127.0.0.1");
+	forwarder.AddEntry(8351, echoPort, "127.0.0.1");
+	forwarder.AddEntry(8352, sinkPort, "127.0.0.1");
+	REQUIRE(forwarder.SetEntryTuning(8350, TuningProfile::Latency));
+	REQUIRE(forwarder.SetEntryTuning(8351, TuningProfile::Latency));
+	REQUIRE(forwarder.SetEntryInteractive(8351, true));
+	REQUIRE(forwarder.SetEntryTuning(8352, TuningProfile::Throughput));
+	forwarder.Start();
+
+	auto measureRpcs = [&](std::uint16_t port, const std::string& name) {
+		LoopbackClient client(port);
+		for (int i = 0; i < 100; ++i) {
+			client.RoundTrip(RpcSize);
+		}
+		Latencies latencies;
+		latencies.Reserve(roundTrips);
+		for (std::size_t i = 0; i < roundTrips; ++i) {
+			latencies.Add(client.RoundTrip(RpcSize));
+		}
+		latencies.Report(state.counters, name);
+	};
+	measureRpcs(8350, "alone_rtt");
+
+	std::atomic<bool> stop{ false };
+	std::atomic<bool> failed{ false };
+	std::atomic<std::uint64_t> bulkBytes{ 0 };
+	std::vector<std::thread> streams;
+	for (std::size_t i = 0; i < bulkStreams; ++i) {
+		streams.emplace_back([&]() {
+			try {
+				LoopbackClient client(8352);
+				while (!stop) {
+					client.Stream(64 * 1024 * 1024, StreamWriteSize);
+					bulkBytes += 64 * 1024 * 1024;
+				}
+			}
+			catch (...) {
+				failed = true;
+			}
+		});
+	}
+	auto start = steady_clock::now();
+	measureRpcs(8350, "next_to_bulk_rtt");
+	measureRpcs(8351, "interactive_next_to_bulk_rtt");
+	stop = true;
+	for (auto& stream : streams) {
+		stream.join();
+	}
+	REQUIRE(!failed);
+	state.counters["bulk_mb_per_s"] = Throughput(bulkBytes, steady_clock::now() - start);
+}
+
+// round trips through the blocking loops of a runtime and through its low latency loop, which polls before blocking.
+// --spin-us: how long the low latency loop polls after each wakeup
+FORWARDING_SCENARIO(TcpBusyPoll)
+{
+	const std::uint16_t echoPort = 9360;
+	auto roundTrips = static_cast<std::size_t>(Parameter("round-trips", 10000));
+	LowLatencyOptions lowLatency;
+	lowLatency.spinMicroseconds = static_cast<std::uint32_t>(Parameter("spin-us", lowLatency.spinMicroseconds));
+	LoopbackServer echo("127.0.0.1", echoPort, ServerMode::Echo);
+	Runtime runtime(0, lowLatency);
+	TcpForwarder forwarder(runtime);
+	forwarder.AddEntry(8360, echoPort, "127.0.0.1");
+	forwarder.AddEntry(8361, echoPort, "127.0.0.1");
+	REQUIRE(forwarder.SetEntryTuning(8360, TuningProfile::Latency));
+	REQUIRE(forwarder.SetEntryTuning(8361, TuningProfile::Latency));
+	REQUIRE(forwarder.SetEntryLatencyCritical(8361, true));
+	forwarder.Start();
+
+	auto measure = [&](std::uint16_t port, const std::string& name) {
+		LoopbackClient client(port);
+		for (int i = 0; i < 100; ++i) {
+			client.RoundTrip(RpcSize);
+		}
+		Latencies latencies;
+		latencies.Reserve(roundTrips);
+		auto cpuStart = ProcessCpuTime();
+		for (std::size_t i = 0; i < roundTrips; ++i) {
+			latencies.Add(client.RoundTrip(RpcSize));
+		}
+		// polling trades cpu for latency
+		state.counters[name + "_cpu_us_per_round_trip"] = duration_cast<duration<double, std::micro>>(ProcessCpuTime() - cpuStart).count() / roundTrips;
+		latencies.Report(state.counters, name + "_rtt");
+	};
+	measure(8360, "blocking");
+	measure(8361, "busy_poll");
+}
@@ -0,0 +1,261 @@
+#include "harness.h"
+#include "Loopback.h"
+#include <client.h>
+#include <windows.h>
+#include <wincrypt.h>
+#define SECURITY_WIN32
+#include <security.h>
+#include <schannel.h>
+#include <algorithm>
+#include <cstring>
+#include <string>
+#include <vector>
+// tls terminated by the forwarder, against a client speaking schannel over loopback with a self-signed certificate made for
+// the run
+
+using namespace forwarding;
+using namespace forwarding::bench;
+using namespace std::chrono;
+
+namespace {
+	const wchar_t* const KeyContainer = L"forwarding-bench-tls";
+	const ULONG ClientRequirements = ISC_REQ_SEQUENCE_DETECT | ISC_REQ_REPLAY_DETECT | ISC_REQ_CONFIDENTIALITY |
+		ISC_REQ_EXTENDED_ERROR | ISC_REQ_ALLOCATE_MEMORY | ISC_REQ_STREAM | ISC_REQ_MANUAL_CRED_VALIDATION;
+
+	// a certificate for localhost with an exportable key, its key container being deleted on destruction
+	class SelfSignedCertificate {
+	private:
+		TlsCertificate _certificate;
+	public:
+		SelfSignedCertificate() {
+			HCRYPTPROV provider = 0;
+			CryptAcquireContextW(&provider, KeyContainer, MS_ENH_RSA_AES_PROV_W, PROV_RSA_AES, CRYPT_DELETEKEYSET);
+			REQUIRE(CryptAcquireContextW(&provider, KeyContainer, MS_ENH_RSA_AES_PROV_W, PROV_RSA_AES, CRYPT_NEWKEYSET));
+			HCRYPTKEY key = 0;
+			REQUIRE(CryptGenKey(provider, AT_KEYEXCHANGE, (2048 << 16) | CRYPT_EXPORTABLE, &key));
+			CryptDestroyKey(key);
+
+			BYTE encodedName[256];
+			CERT_NAME_BLOB subject{ sizeof(encodedName), encodedName };
+			REQUIRE(CertStrToNameW(X509_ASN_ENCODING, L"CN=localhost", CERT_X500_NAME_STR, nullptr, encodedName, &subject.cbData, nullptr));
+			CRYPT_KEY_PROV_INFO keyInfo;
+			ZeroMemory(&keyInfo, sizeof(keyInfo));
+			keyInfo.pwszContainerName = const_cast<LPWSTR>(KeyContainer);
+			keyInfo.pwszProvName = const_cast<LPWSTR>(MS_ENH_RSA_AES_PROV_W);
+			keyInfo.dwProvType = PROV_RSA_AES;
+			keyInfo.dwKeySpec = AT_KEYEXCHANGE;
+			CRYPT_ALGORITHM_IDENTIFIER signature;
+			ZeroMemory(&signature, sizeof(signature));
+			signature.pszObjId = const_cast<LPSTR>(szOID_RSA_SHA256RSA);
+			auto certificate = CertCreateSelfSignCertificate(provider, &subject, 0, &keyInfo, &signature, nullptr, nullptr, nullptr);
+			CryptReleaseContext(provider, 0);
+			REQUIRE(certificate != nullptr);
+
+			auto store = CertOpenStore(CERT_STORE_PROV_MEMORY, 0, 0, 0, nullptr);
+			CertAddCertificateContextToStore(store, certificate, CERT_STORE_ADD_ALWAYS, nullptr);
+			CertFreeCertificateContext(certificate);
+			_certificate.password = "bench";
+			CRYPT_DATA_BLOB pfx{ 0, nullptr };
+			auto exported = PFXExportCertStoreEx(store, &pfx, L"bench", nullptr, EXPORT_PRIVATE_KEYS | REPORT_NOT_ABLE_TO_EXPORT_PRIVATE_KEY);
+			if (exported) {
+				_certificate.pfx.resize(pfx.cbData);
+				pfx.pbData = reinterpret_cast<BYTE*>(_certificate.pfx.data());
+				exported = PFXExportCertStoreEx(store, &pfx, L"bench", nullptr, EXPORT_PRIVATE_KEYS | REPORT_NOT_ABLE_TO_EXPORT_PRIVATE_KEY);
+			}
+			CertCloseStore(store, 0);
+			REQUIRE(exported);
+		}
+		SelfSignedCertificate(const SelfSignedCertificate&) = delete;
+		SelfSignedCertificate& operator =(const SelfSignedCertificate&) = delete;
+		~SelfSignedCertificate() {
+			HCRYPTPROV provider = 0;
+			CryptAcquireContextW(&provider, KeyContainer, MS_ENH_RSA_AES_PROV_W, PROV_RSA_AES, CRYPT_DELETEKEYSET);
+		}
+		const TlsCertificate& Get() const {
+			return _certificate;
+		}
+	};
+
+	// client side of a tls connection over a blocking socket. The server certificate is not validated
+	class TlsClient {
+	private:
+		SafeSocket _socket;
+		CredHandle _credentials;
+		CtxtHandle _context;
+		bool _hasContext = false;
+		SecPkgContext_StreamSizes _sizes;
+		std::vector<char> _input;
+
+		void SendToken(SecBuffer& token) {
+			if (token.pvBuffer) {
+				auto sent = send(_socket.Get(), static_cast<const char*>(token.pvBuffer), token.cbBuffer, 0);
+				FreeContextBuffer(token.pvBuffer);
+				REQUIRE(sent == static_cast<int>(token.cbBuffer));
+			}
+		}
+		void ReceiveMore() {
+			char buffer[16 * 1024];
+			auto received = recv(_socket.Get(), buffer, sizeof(buffer), 0);
+			REQUIRE(received > 0);
+			_input.insert(_input.end(), buffer, buffer + received);
+		}
+	public:
+		explicit TlsClient(std::uint16_t port) {
+			SCHANNEL_CRED credentials;
+			ZeroMemory(&credentials, sizeof(credentials));
+			credentials.dwVersion = SCHANNEL_CRED_VERSION;
+			credentials.dwFlags = SCH_CRED_MANUAL_CRED_VALIDATION | SCH_CRED_NO_DEFAULT_CREDS | SCH_USE_STRONG_CRYPTO;
+			REQUIRE(SEC_E_OK == AcquireCredentialsHandleW(nullptr, const_cast<LPWSTR>(UNISP_NAME_W), SECPKG_CRED_OUTBOUND, nullptr, &credentials, nullptr, nullptr, &_credentials, nullptr));
+			auto address = Resolve("127.0.0.1", port);
+			_socket = socket(AF_INET, SOCK_STREAM, 0);
+			REQUIRE(0 == connect(_socket.Get(), address->SockAddr(), address->SockAddrLen()));
+			BOOL noDelay = TRUE;
+			setsockopt(_socket.Get(), IPPROTO_TCP, TCP_NODELAY, reinterpret_cast<const char*>(&noDelay), sizeof(noDelay));
+		}
+		TlsClient(const TlsClient&) = delete;
+		TlsClient& operator =(const TlsClient&) = delete;
+		~TlsClient() {
+			if (_hasContext) {
+				DeleteSecurityContext(&_context);
+			}
+			FreeCredentialsHandle(&_credentials);
+		}
+
+		void Handshake() {
+			for (;;) {
+				SecBuffer inBuffers[2];
+				inBuffers[0] = SecBuffer{ static_cast<ULONG>(_input.size()), SECBUFFER_TOKEN, _input.empty() ? nullptr : &_input[0] };
+				inBuffers[1] = SecBuffer{ 0, SECBUFFER_EMPTY, nullptr };
+				SecBufferDesc inDesc{ SECBUFFER_VERSION, 2, inBuffers };
+				SecBuffer outBuffers[1];
+				outBuffers[0] = SecBuffer{ 0, SECBUFFER_TOKEN, nullptr };
+				SecBufferDesc outDesc{ SECBUFFER_VERSION, 1, outBuffers };
+				ULONG attributes = 0;
+				auto status = InitializeSecurityContextW(&_credentials, _hasContext ? &_context : nullptr, const_cast<LPWSTR>(L"localhost"),
+					ClientRequirements, 0, 0, _hasContext ? &inDesc : nullptr, 0, _hasContext ? nullptr : &_context, &outDesc, &attributes, nullptr);
+				if (status == SEC_E_INCOMPLETE_MESSAGE) {
+					ReceiveMore();
+					continue;
+				}
+				_hasContext = true;
+				SendToken(outBuffers[0]);
+				REQUIRE(status == SEC_E_OK || status == SEC_I_CONTINUE_NEEDED);
+				std::size_t extra = inBuffers[1].BufferType == SECBUFFER_EXTRA ? inBuffers[1].cbBuffer : 0;
+				_input.erase(_input.begin(), _input.end() - extra);
+				if (status == SEC_E_OK) {
+					REQUIRE(SEC_E_OK == QueryContextAttributesW(&_context, SECPKG_ATTR_STREAM_SIZES, &_sizes));
+					return;
+				}
+				if (_input.empty()) {
+					ReceiveMore();
+				}
+			}
+		}
+
+		void Send(const char* data, std::size_t size) {
+			std::vector<char> record;
+			while (size > 0) {
+				auto length = std::min<std::size_t>(size, _sizes.cbMaximumMessage);
+				record.resize(_sizes.cbHeader + length + _sizes.cbTrailer);
+				memcpy(&record[_sizes.cbHeader], data, length);
+				SecBuffer buffers[4];
+				buffers[0] = SecBuffer{ _sizes.cbHeader, SECBUFFER_STREAM_HEADER, &record[0] };
+				buffers[1] = SecBuffer{ static_cast<ULONG>(length), SECBUFFER_DATA, &record[_sizes.cbHeader] };
+				buffers[2] = SecBuffer{ _sizes.cbTrailer, SECBUFFER_STREAM_TRAILER, &record[_sizes.cbHeader + length] };
+				buffers[3] = SecBuffer{ 0, SECBUFFER_EMPTY, nullptr };
+				SecBufferDesc desc{ SECBUFFER_VERSION, 4, buffers };
+				REQUIRE(SEC_E_OK == EncryptMessage(&_context, 0, &desc, 0));
+				auto recordSize = buffers[0].cbBuffer + buffers[1].cbBuffer + buffers[2].cbBuffer;
+				for (std::size_t sent = 0; sent < recordSize;) {
+					auto written = send(_socket.Get(), &record[sent], static_cast<int>(recordSize - sent), 0);
+					REQUIRE(written > 0);
+					sent += written;
+				}
+				data += length;
+				size -= length;
+			}
+		}
+
+		// decrypts records until size bytes of plaintext came in
+		void Receive(char* data, std::size_t size) {
+			while (size > 0) {
+				if (_input.empty()) {
+					ReceiveMore();
+				}
+				SecBuffer buffers[4];
+				buffers[0] = SecBuffer{ static_cast<ULONG>(_input.size()), SECBUFFER_DATA, &_input[0] };
+				for (int i = 1; i < 4; ++i) {
+					buffers[i] = SecBuffer{ 0, SECBUFFER_EMPTY, nullptr };
+				}
+				SecBufferDesc desc{ SECBUFFER_VERSION, 4, buffers };
+				auto status = DecryptMessage(&_context, &desc, 0, nullptr);
+				if (status == SEC_E_INCOMPLETE_MESSAGE) {
+					ReceiveMore();
+					continue;
+				}
+				REQUIRE(status == SEC_E_OK);
+				std::size_t extra = 0;
+				for (auto& buffer : buffers) {
+					if (buffer.BufferType == SECBUFFER_DATA && buffer.cbBuffer > 0) {
+						auto length = std::min<std::size_t>(buffer.cbBuffer, size);
+						memcpy(data, buffer.pvBuffer, length);
+						data += length;
+						size -= length;
+					}
+					else if (buffer.BufferType == SECBUFFER_EXTRA) {
+						extra = buffer.cbBuffer;
+					}
+				}
+				_input.erase(_input.begin(), _input.end() - extra);
+			}
+		}
+	};
+}
+
+// --handshakes: connections opened for the handshake rate, --stream-mb: bytes of the encrypted stream
+FORWARDING_SCENARIO(TlsTermination)
+{
+	const std::uint16_t sinkPort = 9340;
+	auto handshakes = static_cast<std::size_t>(Parameter("handshakes", 1000));
+	auto streamBytes = Parameter("stream-mb", 256) * 1024 * 1024;
+	SelfSignedCertificate certificate;
+	LoopbackServer sink("127.0.0.1", sinkPort, ServerMode::Sink);
+	Runtime runtime;
+	TcpForwarder forwarder(runtime);
+	forwarder.AddEntry(8340, sinkPort, "127.0.0.1", certificate.Get());
+	forwarder.AddEntry(8341, sinkPort, "127.0.0.1");
+	forwarder.Start();
+
+	// full handshakes, as every client starts without a session to resume
+	Latencies latencies;
+	latencies.Reserve(handshakes);
+	auto start = steady_clock::now();
+	for (std::size_t i = 0; i < handshakes; ++i) {
+		TlsClient client(8340);
+		auto handshakeStart = steady_clock::now();
+		client.Handshake();
+		latencies.Add(steady_clock::now() - handshakeStart);
+	}
+	state.counters["handshakes_per_s"] = handshakes / duration_cast<duration<double>>(steady_clock::now() - start).count();
+	latencies.Report(state.counters, "handshake");
+
+	// the stream protocol of the sink, encrypted, next to the plaintext entry
+	TlsClient client(8340);
+	client.Handshake();
+	std::vector<char> buffer(64 * 1024, 'x');
+	start = steady_clock::now();
+	client.Send(reinterpret_cast<const char*>(&streamBytes), sizeof(streamBytes));
+	for (auto left = streamBytes; left > 0;) {
+		auto size = static_cast<std::size_t>(std::min<std::uint64_t>(left, buffer.size()));
+		client.Send(buffer.data(), size);
+		left -= size;
+	}
+	char ack = 0;
+	client.Receive(&ack, 1);
+	state.counters["tls_stream_mb_per_s"] = Throughput(streamBytes, steady_clock::now() - start);
+
+	LoopbackClient plaintext(8341);
+	start = steady_clock::now();
+	plaintext.Stream(streamBytes, buffer.size());
+	state.counters["plaintext_stream_mb_per_s"] = Throughput(streamBytes, steady_clock::now() - start);
+}
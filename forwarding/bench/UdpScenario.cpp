@@ -0,0 +1,69 @@
+#include "harness.h"
+#include "Loopback.h"
+#include <client.h>
+#include <algorithm>
+#include <cstring>
+#include <vector>
+// bursts of datagrams through a UdpForwarder to a loopback echo server: the replies of a burst queue up in the forwarder
+// when its sockets would block, and are drained as they become writable
+
+using namespace forwarding;
+using namespace forwarding::bench;
+using namespace std::chrono;
+
+// --bursts: bursts sent, --burst: datagrams per burst, --datagram: bytes per datagram
+FORWARDING_SCENARIO(UdpBurstLatency)
+{
+	const std::uint16_t echoPort = 9370;
+	const std::uint16_t localPort = 8370;
+	auto bursts = static_cast<std::size_t>(Parameter("bursts", 100));
+	auto burstSize = static_cast<std::size_t>(Parameter("burst", 256));
+	auto datagramSize = std::max<std::size_t>(static_cast<std::size_t>(Parameter("datagram", 64)), sizeof(std::uint32_t));
+	UdpEchoServer echo(echoPort);
+	Runtime runtime;
+	UdpForwarder forwarder(runtime);
+	forwarder.AddEntry(localPort, echoPort, "127.0.0.1");
+	forwarder.Start();
+
+	auto target = ResolveUdp("127.0.0.1", localPort);
+	SafeSocket client = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+	// a whole burst of replies fits, so that losses are the forwarder's
+	int bufferSize = 4 * 1024 * 1024;
+	setsockopt(client.Get(), SOL_SOCKET, SO_RCVBUF, reinterpret_cast<const char*>(&bufferSize), sizeof(bufferSize));
+	DWORD receiveTimeoutMs = 1000;
+	setsockopt(client.Get(), SOL_SOCKET, SO_RCVTIMEO, reinterpret_cast<const char*>(&receiveTimeoutMs), sizeof(receiveTimeoutMs));
+
+	Latencies latencies;
+	latencies.Reserve(bursts * burstSize);
+	std::vector<steady_clock::time_point> sentAt(burstSize);
+	std::vector<char> datagram(datagramSize, 'x');
+	std::size_t lost = 0;
+	for (std::size_t burst = 0; burst < bursts; ++burst) {
+		for (std::uint32_t i = 0; i < burstSize; ++i) {
+			memcpy(datagram.data(), &i, sizeof(i));
+			sentAt[i] = steady_clock::now();
+			sendto(client.Get(), datagram.data(), static_cast<int>(datagram.size()), 0, target->SockAddr(), target->SockAddrLen());
+		}
+		std::size_t received = 0;
+		while (received < burstSize) {
+			auto read = recv(client.Get(), datagram.data(), static_cast<int>(datagram.size()), 0);
+			if (read < static_cast<int>(sizeof(std::uint32_t))) {
+				// timed out: the rest of the burst was dropped
+				break;
+			}
+			std::uint32_t index;
+			memcpy(&index, datagram.data(), sizeof(index));
+			if (index < burstSize) {
+				latencies.Add(steady_clock::now() - sentAt[index]);
+			}
+			++received;
+		}
+		lost += burstSize - received;
+	}
+	latencies.Report(state.counters, "reply");
+	state.counters["lost_datagrams"] = static_cast<double>(lost);
+	UdpEntryStats stats;
+	REQUIRE(forwarder.GetEntryStats(localPort, stats));
+	state.counters["queue_dropped_packets"] = static_cast<double>(stats.queueDroppedPackets);
+	state.counters["max_reply_queue_delay_us"] = static_cast<double>(stats.maxReplyQueueDelayUs);
+}
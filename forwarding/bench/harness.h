@@ -0,0 +1,128 @@
+#pragma once
+#include <simulation.h>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+// a benchmark is a function registered with FORWARDING_BENCHMARK, run with more and more iterations until it runs long
+// enough to be timed. Scenarios, registered with FORWARDING_SCENARIO, run once and report their own measures. main writes
+// the results as JSON, in the layout of Google Benchmark, so that a run can be compared against a stored baseline
+namespace forwarding {
+	namespace bench {
+		// what a benchmark reports besides its time per iteration, like throughputs or latency percentiles
+		using Counters = std::map<std::string, double>;
+
+		class State {
+		private:
+			std::uint64_t _iterations;
+			std::chrono::steady_clock::duration _paused{};
+			std::chrono::steady_clock::time_point _pausedAt;
+		public:
+			Counters counters;
+
+			explicit State(std::uint64_t iterations) : _iterations(iterations) {}
+			std::uint64_t Iterations() const {
+				return _iterations;
+			}
+			// keeps the setup of an iteration out of the measured time
+			void PauseTiming() {
+				_pausedAt = std::chrono::steady_clock::now();
+			}
+			void ResumeTiming() {
+				_paused += std::chrono::steady_clock::now() - _pausedAt;
+			}
+			std::chrono::steady_clock::duration Paused() const {
+				return _paused;
+			}
+		};
+
+		struct Benchmark {
+			std::string name;
+			bool scenario;
+			std::function<void(State&)> run;
+		};
+		std::vector<Benchmark>& registry();
+
+		struct Registration {
+			Registration(const char* name, bool scenario, std::function<void(State&)> run) {
+				registry().push_back(Benchmark{ name, scenario, std::move(run) });
+			}
+		};
+
+		// keeps the compiler from optimizing away the computation of value
+		extern const void* volatile g_sink;
+		template<typename T>
+		inline void DoNotOptimize(const T& value) {
+			g_sink = &value;
+			std::atomic_signal_fence(std::memory_order_seq_cst);
+		}
+
+		// latency samples, reported as percentiles in microseconds
+		class Latencies {
+		private:
+			std::vector<double> _samples;
+		public:
+			void Reserve(std::size_t count) {
+				_samples.reserve(count);
+			}
+			void Add(std::chrono::steady_clock::duration latency);
+			std::size_t Count() const {
+				return _samples.size();
+			}
+			// adds name_p50_us, name_p99_us and name_max_us
+			void Report(Counters& counters, const std::string& name);
+		};
+
+		// the value of --name=value on the command line, for the sizes and rates of the scenarios
+		std::uint64_t Parameter(const char* name, std::uint64_t defaultValue);
+
+		// user and kernel time of all the threads of the process, for the cpu cost of what a scenario measured
+		std::chrono::nanoseconds ProcessCpuTime();
+
+		// spins, without the sleeps of a poll that would hide the latencies measured
+		bool WaitUntil(const std::function<bool()>& condition, std::chrono::milliseconds timeout = std::chrono::seconds(10));
+		// throws std::runtime_error, ending the benchmark with an error in the results
+		void Require(bool condition, const char* expression);
+
+		// installs a SimulatedNetwork as the socket api and its virtual clock as the clock for the duration of a benchmark
+		class Simulation {
+		private:
+			std::shared_ptr<SimulatedNetwork> _network;
+		public:
+			Simulation();
+			Simulation(const Simulation&) = delete;
+			Simulation& operator =(const Simulation&) = delete;
+			~Simulation();
+			SimulatedNetwork& Network() {
+				return *_network;
+			}
+		};
+
+		// sockets on 127.0.0.1 through socketApi(), for SafeSocket to close
+		SOCKET ListenOn(std::uint16_t port);
+		// the connect completes asynchronously, through the forwarder when port is forwarded
+		SOCKET ConnectTo(std::uint16_t port);
+		SOCKET AcceptFrom(SOCKET listener);
+		SOCKET BindUdp(std::uint16_t port);
+		sockaddr_in Loopback(std::uint16_t port);
+		// sends what the socket takes, returning the bytes sent
+		std::size_t SendSome(SOCKET s, const char* data, std::size_t size);
+		// adds the bytes read until the socket would block to received, returning false once the peer closed
+		bool DrainSome(SOCKET s, std::size_t& received);
+	}
+}
+
+#define FORWARDING_BENCHMARK(name) \
+	static void name(forwarding::bench::State& state); \
+	static forwarding::bench::Registration name##Registration(#name, false, name); \
+	static void name(forwarding::bench::State& state)
+
+#define FORWARDING_SCENARIO(name) \
+	static void name(forwarding::bench::State& state); \
+	static forwarding::bench::Registration name##Registration(#name, true, name); \
+	static void name(forwarding::bench::State& state)
+
+#define REQUIRE(condition) forwarding::bench::Require((condition), #condition)
@@ -0,0 +1,298 @@
+#include "harness.h"
+#include "compat.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+
+using namespace forwarding;
+using namespace forwarding::bench;
+using namespace std::chrono;
+
+namespace {
+	// benchmarks run with more iterations until they take that long
+	const milliseconds DefaultMinTime{ 500 };
+	const std::uint64_t MaxIterations = 1000000000;
+
+	std::map<std::string, std::uint64_t> g_parameters;
+
+	struct Result {
+		std::string name;
+		std::uint64_t iterations = 0;
+		double realTimeNs = 0;
+		Counters counters;
+		std::string error;
+	};
+
+	Result Measure(const Benchmark& benchmark, milliseconds minTime) {
+		Result result;
+		result.name = benchmark.name;
+		std::uint64_t iterations = 1;
+		for (;;) {
+			State state(iterations);
+			auto start = steady_clock::now();
+			benchmark.run(state);
+			auto elapsed = steady_clock::now() - start - state.Paused();
+			if (benchmark.scenario || elapsed >= minTime || iterations >= MaxIterations) {
+				result.iterations = iterations;
+				result.realTimeNs = static_cast<double>(duration_cast<nanoseconds>(elapsed).count()) / iterations;
+				result.counters = std::move(state.counters);
+				return result;
+			}
+			// aims past minTime so that the next run is likely the last, without growing more than tenfold from a noisy one
+			auto scale = elapsed.count() > 0 ? 1.4 * duration_cast<steady_clock::duration>(minTime).count() / elapsed.count() : 10.0;
+			iterations = std::min(MaxIterations, static_cast<std::uint64_t>(iterations * std::max(2.0, std::min(10.0, scale))));
+		}
+	}
+
+	std::string Escape(const std::string& value) {
+		std::string escaped;
+		for (auto c : value) {
+			if (c == '"' || c == '\\') {
+				escaped += '\\';
+			}
+			escaped += c;
+		}
+		return escaped;
+	}
+
+	void WriteJson(std::ostream& out, const std::vector<Result>& results) {
+		char date[64];
+		auto now = std::time(nullptr);
+		std::tm local;
+		localtime_s(&local, &now);
+		std::strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%S", &local);
+		out << "{\n  \"context\": {\n    \"date\": \"" << date << "\",\n    \"num_cpus\": " << std::thread::hardware_concurrency() << "\n  },\n";
+		out << "  \"benchmarks\": [";
+		for (std::size_t i = 0; i < results.size(); ++i) {
+			auto& result = results[i];
+			out << (i == 0 ? "\n" : ",\n") << "    {\n      \"name\": \"" << Escape(result.name) << "\",\n";
+			if (!result.error.empty()) {
+				out << "      \"error_occurred\": true,\n      \"error_message\": \"" << Escape(result.error) << "\"\n    }";
+				continue;
+			}
+			out << "      \"iterations\": " << result.iterations << ",\n      \"real_time\": " << result.realTimeNs << ",\n";
+			for (auto& counter : result.counters) {
+				out << "      \"" << Escape(counter.first) << "\": " << counter.second << ",\n";
+			}
+			out << "      \"time_unit\": \"ns\"\n    }";
+		}
+		out << "\n  ]\n}\n";
+	}
+}
+
+const void* volatile forwarding::bench::g_sink = nullptr;
+
+std::vector<Benchmark>& forwarding::bench::registry()
+{
+	static std::vector<Benchmark> benchmarks;
+	return benchmarks;
+}
+
+void forwarding::bench::Latencies::Add(steady_clock::duration latency)
+{
+	_samples.push_back(duration_cast<duration<double, std::micro>>(latency).count());
+}
+
+void forwarding::bench::Latencies::Report(Counters& counters, const std::string& name)
+{
+	if (_samples.empty()) {
+		return;
+	}
+	std::sort(_samples.begin(), _samples.end());
+	auto percentile = [this](double p) {
+		auto index = static_cast<std::size_t>(std::ceil(p * _samples.size())) - 1;
+		return _samples[std::min(index, _samples.size() - 1)];
+	};
+	counters[name + "_p50_us"] = percentile(0.5);
+	counters[name + "_p99_us"] = percentile(0.99);
+	counters[name + "_max_us"] = _samples.back();
+}
+
+std::uint64_t forwarding::bench::Parameter(const char* name, std::uint64_t defaultValue)
+{
+	auto found = g_parameters.find(name);
+	return found == g_parameters.end() ? defaultValue : found->second;
+}
+
+nanoseconds forwarding::bench::ProcessCpuTime()
+{
+	FILETIME creation, exit, kernel, user;
+	if (!GetProcessTimes(GetCurrentProcess(), &creation, &exit, &kernel, &user)) {
+		return nanoseconds(0);
+	}
+	auto ticks = [](const FILETIME& time) {return (static_cast<std::uint64_t>(time.dwHighDateTime) << 32) | time.dwLowDateTime; };
+	// 100ns ticks
+	return nanoseconds((ticks(kernel) + ticks(user)) * 100);
+}
+
+bool forwarding::bench::WaitUntil(const std::function<bool()>& condition, milliseconds timeout)
+{
+	auto until = steady_clock::now() + timeout;
+	while (!condition()) {
+		if (steady_clock::now() >= until) {
+			return false;
+		}
+		std::this_thread::yield();
+	}
+	return true;
+}
+
+void forwarding::bench::Require(bool condition, const char* expression)
+{
+	if (!condition) {
+		throw std::runtime_error(expression);
+	}
+}
+
+forwarding::bench::Simulation::Simulation() : _network(std::make_shared<SimulatedNetwork>())
+{
+	overrideSocketApi(_network);
+	overrideClock(_network->VirtualClock());
+}
+
+forwarding::bench::Simulation::~Simulation()
+{
+	resetClock();
+	resetSocketApi();
+}
+
+sockaddr_in forwarding::bench::Loopback(std::uint16_t port)
+{
+	sockaddr_in address;
+	ZeroMemory(&address, sizeof(address));
+	address.sin_family = AF_INET;
+	address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	address.sin_port = htons(port);
+	return address;
+}
+
+SOCKET forwarding::bench::ListenOn(std::uint16_t port)
+{
+	auto s = socketApi().Socket(AF_INET, SOCK_STREAM, 0);
+	auto address = Loopback(port);
+	REQUIRE(0 == socketApi().Bind(s, reinterpret_cast<const sockaddr*>(&address), sizeof(address)));
+	REQUIRE(0 == socketApi().Listen(s, SOMAXCONN));
+	REQUIRE(0 == socketApi().SetNonBlocking(s));
+	return s;
+}
+
+SOCKET forwarding::bench::ConnectTo(std::uint16_t port)
+{
+	auto s = socketApi().Socket(AF_INET, SOCK_STREAM, 0);
+	REQUIRE(0 == socketApi().SetNonBlocking(s));
+	auto address = Loopback(port);
+	auto result = socketApi().Connect(s, reinterpret_cast<const sockaddr*>(&address), sizeof(address));
+	REQUIRE(result == 0 || WSAGetLastError() == WSAEWOULDBLOCK);
+	return s;
+}
+
+SOCKET forwarding::bench::AcceptFrom(SOCKET listener)
+{
+	auto accepted = INVALID_SOCKET;
+	REQUIRE(WaitUntil([&]() {
+		accepted = socketApi().Accept(listener, nullptr, nullptr);
+		return accepted != INVALID_SOCKET;
+	}));
+	REQUIRE(0 == socketApi().SetNonBlocking(accepted));
+	return accepted;
+}
+
+SOCKET forwarding::bench::BindUdp(std::uint16_t port)
+{
+	auto s = socketApi().Socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+	auto address = Loopback(port);
+	REQUIRE(0 == socketApi().Bind(s, reinterpret_cast<const sockaddr*>(&address), sizeof(address)));
+	REQUIRE(0 == socketApi().SetNonBlocking(s));
+	return s;
+}
+
+std::size_t forwarding::bench::SendSome(SOCKET s, const char* data, std::size_t size)
+{
+	std::size_t sent = 0;
+	while (sent < size) {
+		auto written = socketApi().Send(s, data + sent, static_cast<int>(size - sent));
+		if (written <= 0) {
+			REQUIRE(WSAGetLastError() == WSAEWOULDBLOCK || WSAGetLastError() == WSAENOTCONN);
+			break;
+		}
+		sent += written;
+	}
+	return sent;
+}
+
+bool forwarding::bench::DrainSome(SOCKET s, std::size_t& received)
+{
+	char buffer[64 * 1024];
+	for (;;) {
+		auto read = socketApi().Recv(s, buffer, sizeof(buffer));
+		if (read == 0) {
+			return false;
+		}
+		if (read < 0) {
+			REQUIRE(WSAGetLastError() == WSAEWOULDBLOCK);
+			return true;
+		}
+		received += read;
+	}
+}
+
+// bench [--out=results.json] [--min-time=ms] [--parameter=value...] [names...]: runs the benchmarks named, or all of them,
+// and writes their results to stdout or to the --out file
+int main(int argc, char** argv)
+{
+	init_transport();
+	std::string outPath;
+	auto minTime = DefaultMinTime;
+	std::vector<std::string> names;
+	for (int i = 1; i < argc; ++i) {
+		if (0 == strncmp(argv[i], "--out=", 6)) {
+			outPath = argv[i] + 6;
+		}
+		else if (0 == strncmp(argv[i], "--min-time=", 11)) {
+			minTime = milliseconds(atoi(argv[i] + 11));
+		}
+		else if (0 == strncmp(argv[i], "--", 2) && strchr(argv[i], '=')) {
+			auto separator = strchr(argv[i], '=');
+			g_parameters[std::string(argv[i] + 2, separator)] = _strtoui64(separator + 1, nullptr, 10);
+		}
+		else {
+			names.push_back(argv[i]);
+		}
+	}
+	std::vector<Result> results;
+	for (auto& benchmark : registry()) {
+		if (!names.empty() && std::find(names.begin(), names.end(), benchmark.name) == names.end()) {
+			continue;
+		}
+		std::cerr << benchmark.name << "..." << std::endl;
+		try {
+			results.push_back(Measure(benchmark, minTime));
+		}
+		catch (const std::exception& ex) {
+			Result failed;
+			failed.name = benchmark.name;
+			failed.error = ex.what();
+			results.push_back(failed);
+		}
+		catch (const TransportErrorException& ex) {
+			Result failed;
+			failed.name = benchmark.name;
+			failed.error = "transport error " + std::to_string(static_cast<int>(ex.Error));
+			results.push_back(failed);
+		}
+	}
+	if (outPath.empty()) {
+		WriteJson(std::cout, results);
+	}
+	else {
+		std::ofstream out(outPath);
+		WriteJson(out, results);
+	}
+	return std::any_of(results.begin(), results.end(), [](const Result& r) {return !r.error.empty(); }) ? 1 : 0;
+}
@@ -0,0 +1,220 @@
+#pragma once
+#include "common.h"
+#include <experimental/coroutine>
+#include <exception>
+#include <chrono>
+#include <memory>
+#include <utility>
+// coroutine versions of Connection, Listener and ConnectTo. Requires /await
+namespace forwarding {
+
+	class Runtime;
+
+	// single threaded reactor, run by a loop of a runtime like the forwarders. Each socket is selected on an event of its
+	// own, so that a loop can serve thousands of sockets and a signal only touches its socket
+	class EventLoop {
+	private:
+		class Impl;
+		std::shared_ptr<Impl> _impl;
+	public:
+		// on the runtime of the forwarders created without one
+		EventLoop();
+		explicit EventLoop(Runtime& runtime);
+		~EventLoop();
+		void Start();
+		// coroutines still waiting when the loop stops are not resumed
+		void Stop();
+
+		// runs callback on the loop thread. Can be called from any thread
+		void Post(std::function<void()> callback);
+		bool IsLoopThread() const;
+
+		// loop thread only. callback is invoked once on the loop thread, with the recorded events among events (FD_CLOSE is always
+		// reported) and the connect error if any, or with no events and WSAETIMEDOUT when timeout expires first. A timeout
+		// of 0 waits forever
+		void WaitFor(SOCKET s, long events, std::chrono::milliseconds timeout, std::function<void(long events, int error)> callback);
+		// loop thread only: stops watching s. Its pending waits complete with WSAENOTSOCK
+		void Forget(SOCKET s);
+		// forgets and closes socket on the loop thread. Can be called from any thread
+		void CloseSocket(SafeSocket&& socket);
+	};
+
+	template<typename Promise>
+	struct TaskFinalAwaiter {
+		bool await_ready() noexcept { return false; }
+		void await_suspend(std::experimental::coroutine_handle<Promise> handle) noexcept {
+			auto continuation = handle.promise().continuation;
+			if (continuation) {
+				continuation.resume();
+			}
+		}
+		void await_resume() noexcept {}
+	};
+
+	template<typename Promise>
+	struct TaskPromiseBase {
+		std::experimental::coroutine_handle<> continuation;
+		std::exception_ptr error;
+
+		std::experimental::suspend_always initial_suspend() { return {}; }
+		TaskFinalAwaiter<Promise> final_suspend() noexcept { return {}; }
+		void unhandled_exception() {
+			error = std::current_exception();
+		}
+	};
+
+	// lazily started coroutine, run when awaited. T must be default constructible
+	template<typename T>
+	class Task {
+	public:
+		struct promise_type : TaskPromiseBase<promise_type> {
+			T value{};
+			Task get_return_object() {
+				return Task(std::experimental::coroutine_handle<promise_type>::from_promise(*this));
+			}
+			void return_value(T v) {
+				value = std::move(v);
+			}
+		};
+	private:
+		std::experimental::coroutine_handle<promise_type> _handle;
+	public:
+		explicit Task(std::experimental::coroutine_handle<promise_type> handle) : _handle(handle) {}
+		Task(const Task&) = delete;
+		Task& operator =(const Task&) = delete;
+		Task(Task&& moved) : _handle(moved._handle) {
+			moved._handle = nullptr;
+		}
+		Task& operator =(Task&& moved) {
+			if (this != &moved) {
+				std::swap(_handle, moved._handle);
+			}
+			return *this;
+		}
+		~Task() {
+			if (_handle) {
+				_handle.destroy();
+			}
+		}
+
+		bool await_ready() { return false; }
+		void await_suspend(std::experimental::coroutine_handle<> continuation) {
+			_handle.promise().continuation = continuation;
+			_handle.resume();
+		}
+		T await_resume() {
+			if (_handle.promise().error) {
+				std::rethrow_exception(_handle.promise().error);
+			}
+			return std::move(_handle.promise().value);
+		}
+	};
+
+	template<>
+	class Task<void> {
+	public:
+		struct promise_type : TaskPromiseBase<promise_type> {
+			Task get_return_object() {
+				return Task(std::experimental::coroutine_handle<promise_type>::from_promise(*this));
+			}
+			void return_void() {}
+		};
+	private:
+		std::experimental::coroutine_handle<promise_type> _handle;
+	public:
+		explicit Task(std::experimental::coroutine_handle<promise_type> handle) : _handle(handle) {}
+		Task(const Task&) = delete;
+		Task& operator =(const Task&) = delete;
+		Task(Task&& moved) : _handle(moved._handle) {
+			moved._handle = nullptr;
+		}
+		Task& operator =(Task&& moved) {
+			if (this != &moved) {
+				std::swap(_handle, moved._handle);
+			}
+			return *this;
+		}
+		~Task() {
+			if (_handle) {
+				_handle.destroy();
+			}
+		}
+
+		bool await_ready() { return false; }
+		void await_suspend(std::experimental::coroutine_handle<> continuation) {
+			_handle.promise().continuation = continuation;
+			_handle.resume();
+		}
+		void await_resume() {
+			if (_handle.promise().error) {
+				std::rethrow_exception(_handle.promise().error);
+			}
+		}
+	};
+
+	struct SocketEvents {
+		long events;
+		int error;
+	};
+
+	// suspends until one of events is recorded on a socket, see EventLoop::WaitFor
+	class SocketReady {
+	private:
+		EventLoop& _loop;
+		SOCKET _socket;
+		long _events;
+		std::chrono::milliseconds _timeout;
+		SocketEvents _result{ 0, 0 };
+	public:
+		SocketReady(EventLoop& loop, SOCKET s, long events, std::chrono::milliseconds timeout = std::chrono::milliseconds(0))
+			: _loop(loop), _socket(s), _events(events), _timeout(timeout) {}
+		bool await_ready() { return false; }
+		void await_suspend(std::experimental::coroutine_handle<> handle) {
+			_loop.WaitFor(_socket, _events, _timeout, [this, handle](long events, int error) {
+				_result = SocketEvents{ events, error };
+				handle.resume();
+			});
+		}
+		SocketEvents await_resume() {
+			return _result;
+		}
+	};
+
+	// must be used and destroyed on the loop thread
+	class AsyncConnection {
+	private:
+		EventLoop& _loop;
+		SafeSocket _socket;
+	public:
+		AsyncConnection(EventLoop& loop, SafeSocket&& s);
+		AsyncConnection(const AsyncConnection&) = delete;
+		AsyncConnection& operator =(const AsyncConnection&) = delete;
+		~AsyncConnection();
+		// completes once the whole buffer is sent
+		Task<void> Send(BufferView buf);
+		// completes once the whole buffer is filled, like Connection::Receive. Throws SendReceiveFailed if the peer closes first
+		Task<void> Receive(BufferView buf);
+		void Close();
+		bool Valid() const {
+			return _socket.Get() != INVALID_SOCKET;
+		}
+	};
+
+	class AsyncListener {
+	private:
+		EventLoop& _loop;
+		SafeSocket _listeningSocket;
+	public:
+		AsyncListener(EventLoop& loop, const char* address, int port);
+		AsyncListener(const AsyncListener&) = delete;
+		AsyncListener& operator =(const AsyncListener&) = delete;
+		~AsyncListener();
+		Task<std::unique_ptr<AsyncConnection>> Accept();
+	};
+
+	// throws ConnectFailed when the connection is refused or does not complete within timeout
+	Task<std::unique_ptr<AsyncConnection>> ConnectToAsync(EventLoop& loop, const ResolvedAddress& address, std::chrono::milliseconds timeout);
+
+	// runs task on the loop until it completes. Exceptions escaping the task are dropped
+	void Spawn(EventLoop& loop, Task<void>&& task);
+}
@@ -1,19 +1,317 @@
 #pragma once
 #include "common.h"
+#include <string>
+#include <vector>
 namespace forwarding {
 
+	enum class OverloadPolicy {
+		// accept and immediately reset connections over the limit
+		Refuse,
+		// leave connections over the limit in the listen backlog until the entry drops back under its limits
+		PauseAccept
+	};
+
+	enum class TuningProfile {
+		// system defaults
+		Default,
+		// no Nagle, fast keepalive, small forwarder buffers
+		Latency,
+		// large socket and forwarder buffers
+		Throughput,
+		// starts as Latency and switches each connection between Latency and Throughput depending on its observed read sizes
+		Auto
+	};
+
+	enum class BalancingPolicy {
+		// smooth weighted round robin
+		RoundRobin,
+		// fewest active connections (or udp flows) relative to the backend weight
+		LeastConnections,
+		// picks two backends at random, weighted, and keeps the one with the lowest connect latency
+		PowerOfTwoChoices
+	};
+
+	enum class BackendHealth {
+		// not probed yet, or health checking disabled: the backend is selected
+		Unknown,
+		Healthy,
+		// ejected: not selected for new connections or flows until probes succeed again
+		Unhealthy
+	};
+
+	// server certificate of a TLS entry: a PKCS#12 blob holding the certificate and its private key
+	struct TlsCertificate {
+		std::vector<char> pfx;
+		std::string password;
+	};
+
+	// token bucket limits. 0 means unlimited, and a burst of 0 is one second worth of its rate
+	struct RateLimit {
+		std::uint64_t bytesPerSecond = 0;
+		std::uint64_t burstBytes = 0;
+		// udp only: tcp has no datagrams to count
+		std::uint64_t packetsPerSecond = 0;
+		std::uint64_t burstPackets = 0;
+	};
+
+	// probes are a tcp connect for tcp entries, and a datagram expecting a reply for udp entries
+	struct HealthCheck {
+		// 0 disables health checking
+		std::uint32_t intervalMs = 0;
+		std::uint32_t timeoutMs = 1000;
+		// consecutive failed probes before a backend is ejected
+		std::uint32_t unhealthyThreshold = 2;
+		// consecutive successful probes before an ejected backend is selected again
+		std::uint32_t healthyThreshold = 2;
+		// udp only: sent to the backend, which must reply with a datagram starting with expectedReply (any reply if empty)
+		std::string probePayload;
+		std::string expectedReply;
+	};
+
+	// 0 means unlimited
+	struct TcpEntryLimits {
+		std::uint32_t maxConnections = 0;
+		// applies to connections accepted after the limits are set
+		std::uint32_t idleTimeoutMs = 0;
+		// total bytes buffered by the forwarder across all the connections of the entry
+		std::uint64_t maxQueuedBytes = 0;
+		OverloadPolicy overloadPolicy = OverloadPolicy::Refuse;
+	};
+
+	struct TcpEntryStats {
+		std::uint64_t activeConnections = 0;
+		std::uint64_t acceptedConnections = 0;
+		std::uint64_t queuedBytes = 0;
+		// times the entry went over the limit, not the connections refused or held back while over it
+		std::uint64_t connectionLimitTrips = 0;
+		std::uint64_t queuedBytesLimitTrips = 0;
+		std::uint64_t idleTimeoutTrips = 0;
+		// accept or upstream socket creation failures, typically caused by socket exhaustion
+		std::uint64_t socketExhaustionTrips = 0;
+		std::uint64_t autoTuningSwitches = 0;
+		std::uint64_t bytesToRemote = 0;
+		std::uint64_t bytesToLocal = 0;
+		// clients reset because no backend was selectable, typically because they were all ejected by health checks
+		std::uint64_t noBackendRefusals = 0;
+		// overlapped sends made from the forwarder buffers, see SetEntryZeroCopy
+		std::uint64_t zeroCopySends = 0;
+		std::uint64_t zeroCopyBytes = 0;
+		std::uint64_t tlsHandshakes = 0;
+		std::uint64_t tlsHandshakeFailures = 0;
+		// time from accept to the first byte forwarded back to the client, summed over firstBytePairs pairs
+		std::uint64_t firstBytePairs = 0;
+		std::uint64_t firstByteLatencyUs = 0;
+		std::uint64_t maxFirstByteLatencyUs = 0;
+		// reads and flushes cut short by the per visit budget of the data bridges, for the other pairs to be served
+		std::uint64_t budgetYields = 0;
+		// reads paused because a rate limit of the entry or of the client was reached
+		std::uint64_t rateLimitPauses = 0;
+		// upstream connects that carried the first bytes of the client, see SetEntryFastOpen. The handshake time of these
+		// connects is what the first bytes saved when the upstream accepted them in the SYN: winsock does not tell whether it
+		// did, so it is an upper bound
+		std::uint64_t fastOpenConnects = 0;
+		std::uint64_t fastOpenBytes = 0;
+		std::uint64_t fastOpenSavedUs = 0;
+		// connects made the regular way because the system does not support fast open
+		std::uint64_t fastOpenFallbacks = 0;
+	};
+
+	struct UdpEntryStats {
+		std::uint64_t flows = 0;
+		// datagrams dropped by the rate limits, in both directions
+		std::uint64_t rateLimitedPackets = 0;
+		std::uint64_t rateLimitedBytes = 0;
+		// datagrams waiting for the socket they go out through to become writable, in both directions. Each flow keeps a
+		// bounded number of them per direction, the datagrams past it being dropped
+		std::uint64_t queuedPackets = 0;
+		std::uint64_t queueDroppedPackets = 0;
+		std::uint64_t queueDroppedBytes = 0;
+		// the longest a reply waited for its local socket
+		std::uint64_t maxReplyQueueDelayUs = 0;
+	};
+
+	// pairs of a data bridge, spread over its event slots. New pairs go to the least loaded bridge and slot. The bridge of the
+	// latency-critical entries, once there is one, comes last
+	struct TcpBridgeStats {
+		std::uint64_t pairs = 0;
+		std::uint64_t busiestSlotPairs = 0;
+		std::uint64_t idlestSlotPairs = 0;
+	};
+
+	enum class FlightEvent {
+		// tcp connection accepted, or udp flow created
+		Accept,
+		// value is the winsock error of the upstream connect, 0 on success
+		ConnectResult,
+		// value is 0 when the forwarder stopped reading the local side because too much is queued for the remote, 1 for the
+		// opposite direction
+		BackpressureOn,
+		BackpressureOff,
+		// value is a CloseReason, bytes are the totals forwarded by the connection or flow
+		Close
+	};
+
+	enum class CloseReason {
+		LocalClosed,
+		RemoteClosed,
+		ConnectFailed,
+		IdleTimeout
+	};
+
+	struct FlightRecord {
+		// QueryPerformanceCounter time, in microseconds
+		std::uint64_t timestampUs;
+		std::uint32_t threadId;
+		// shared by tcp connections and udp flows
+		std::uint32_t connectionId;
+		FlightEvent event;
+		std::uint16_t localPort;
+		std::int32_t value;
+		std::uint64_t bytesToRemote;
+		std::uint64_t bytesToLocal;
+	};
+
+	// every forwarder thread keeps its last FlightRingSize lifecycle records. Returns the records of all threads, oldest first
+	std::vector<FlightRecord> SnapshotFlightRecorder();
+
+	// the loop of the latency-critical entries of a runtime, started with the first of them. It polls its events without
+	// blocking for a while after each wakeup, as a wakeup from a blocking wait goes through the scheduler
+	struct LowLatencyOptions {
+		// 0 blocks right away, like the other loops
+		std::uint32_t spinMicroseconds = 50;
+		// processors the loop thread is pinned to, 0 leaves it unpinned. The other loops of the runtime are kept off them, so
+		// that the loop runs isolated on a dedicated processor
+		std::uint64_t affinityMask = 0;
+	};
+
+	// event-loop threads shared by the forwarders created on it: the thread count is the loop count however many forwarders
+	// there are, and forwarders without traffic cost no thread. Forwarders keep the loops of their runtime running until they
+	// are destroyed
+	class Runtime {
+	public:
+		class Impl;
+	private:
+		std::shared_ptr<Impl> _impl;
+		// the runtime of the forwarders created without one, with a loop per processor
+		static std::shared_ptr<Impl> Default();
+		friend class TcpForwarder;
+		friend class UdpForwarder;
+		friend class EventLoop;
+	public:
+		// 0 starts a loop per processor. Throws LoopSetupFailed when the completion port of a loop cannot be created
+		explicit Runtime(std::uint32_t loopCount = 0, const LowLatencyOptions& lowLatency = LowLatencyOptions());
+		~Runtime();
+		std::uint32_t LoopCount() const;
+	};
+
+	enum class SnapshotProtocol {
+		Tcp,
+		Udp
+	};
+
+	struct SnapshotEntry {
+		SnapshotProtocol protocol = SnapshotProtocol::Tcp;
+		std::uint16_t localPort = 0;
+		std::uint16_t count = 1;
+		std::uint32_t remotePort = 0;
+		std::string remoteAddress;
+	};
+
+	// the entries of a TCP and a UDP forwarder, kept in a versioned file mapped in memory so that a restarted process binds
+	// them again right away, before whatever feeds it its entries caught up. Each add, update or removal rewrites a single
+	// record in place, alternating between two copies of it so that a record torn by a crash reads as its previous version.
+	// Only the remote an entry was added or updated with is recorded: TLS entries, limits, tuning and extra backends are not
+	class EntrySnapshot {
+	public:
+		class Impl;
+	private:
+		std::shared_ptr<Impl> _impl;
+		friend class TcpForwarder;
+		friend class UdpForwarder;
+	public:
+		// opens the snapshot at path, atomically replacing a missing file, or one of another version, by an empty snapshot.
+		// Throws SnapshotFailed when the file cannot be created or mapped
+		explicit EntrySnapshot(const char* path);
+		~EntrySnapshot();
+		std::vector<SnapshotEntry> Entries();
+	};
+
 	class TcpForwarder  {
 	private:
 		class Impl;
 		std::shared_ptr<Impl> _impl;
 	public:
+		// on the default runtime
 		TcpForwarder();
+		// with a data bridge per loop of runtime
+		explicit TcpForwarder(Runtime& runtime);
 		void Start();
 		void Stop();
 		~TcpForwarder();
 
+		// remoteAddress can be a unix socket path prefixed with UnixSocketPrefix, in which case remotePort is ignored. A host name
+		// no other entry uses is resolved on the calling thread, blocking on getaddrinfo so that failures are thrown as
+		// NameResolutionFailed: the entry methods taking a remoteAddress are not to be called from a loop thread
 		void AddEntry(std::uint16_t localPort, std::uint32_t remotePort, const char* remoteAddress);
+		// terminates TLS on the local side with certificate and forwards plaintext to the remote. Throws TlsSetupFailed when the
+		// certificate cannot be imported
+		void AddEntry(std::uint16_t localPort, std::uint32_t remotePort, const char* remoteAddress, const TlsCertificate& certificate);
+		// forwards local ports [localPortStart, localPortStart+count) to remote ports [remotePortStart, remotePortStart+count).
+		// Adding an entry again does nothing. Throws BindFailed when the ports overlap another entry, or when an entry at the
+		// same start has another count or remote
+		void AddRangeEntry(std::uint16_t localPortStart, std::uint16_t count, std::uint32_t remotePortStart, const char* remoteAddress);
+		// removes the single port or range entry starting at localPort
 		void RemoveEntry(std::uint16_t localPort);
+		// points the entry at a new remote without closing its listeners, replacing all its backends. Established connections
+		// keep their remote. Returns false if there is no such entry
+		bool UpdateEntryRemote(std::uint16_t localPort, std::uint32_t remotePortStart, const char* remoteAddress);
+
+		// hot restart: the listening sockets of an entry are duplicated for the process taking over, which adopts them with the
+		// entry metadata and starts accepting right away, pending connections included. The old process then releases the entry
+		// and drains its established connections. TLS, limits, tuning and extra backends are not carried over
+		bool DuplicateEntry(std::uint16_t localPort, DWORD processId, std::vector<WSAPROTOCOL_INFOW>& sockets);
+		void AdoptRangeEntry(std::uint16_t localPortStart, std::uint16_t count, std::uint32_t remotePortStart, const char* remoteAddress, const std::vector<WSAPROTOCOL_INFOW>& sockets);
+		// removes an entry whose sockets were adopted by another process without shutting them down
+		bool ReleaseEntry(std::uint16_t localPort);
+		// adds the TCP entries of snapshot that do not overlap an entry of the forwarder, adopted ones included, then keeps
+		// snapshot in sync with the entries of the forwarder. Entries that could not be added are dropped from it, and released
+		// entries are left to the process that adopted them. Returns the number of entries restored
+		std::size_t RestoreSnapshot(EntrySnapshot& snapshot);
+		// pairs still forwarding, across all entries including released ones
+		std::uint64_t ActiveConnections();
+		// the entry is identified by its first local port; returns false if there is no such entry
+		bool SetEntryLimits(std::uint16_t localPort, const TcpEntryLimits& limits);
+		bool GetEntryStats(std::uint16_t localPort, TcpEntryStats& stats);
+		std::vector<TcpBridgeStats> GetBridgeStats();
+		// applies to the listeners immediately and to connections accepted afterwards
+		bool SetEntryTuning(std::uint16_t localPort, TuningProfile profile);
+		// connections accepted afterwards send through overlapped sends made straight from the forwarder buffers once at least
+		// thresholdBytes are queued for a socket, with send buffering disabled. Smaller writes keep the copying path. A threshold
+		// over the queue threshold of the entry tuning is never reached. 0 disables
+		bool SetEntryZeroCopy(std::uint16_t localPort, std::uint32_t thresholdBytes);
+		// connections accepted afterwards are served before the other pairs sharing their event slot, without the per visit byte
+		// budget that keeps bulk transfers from delaying the other pairs of a data bridge. Meant for small request/response traffic
+		bool SetEntryInteractive(std::uint16_t localPort, bool interactive);
+		// connections accepted afterwards are forwarded by a data bridge of their own on the low latency loop of the runtime,
+		// see LowLatencyOptions. Meant to be combined with TuningProfile::Latency
+		bool SetEntryLatencyCritical(std::uint16_t localPort, bool latencyCritical);
+		// enables TCP fast open on the listeners, and has the upstream connects of the connections accepted afterwards carry
+		// the bytes the client already sent in their SYN. Not used for TLS entries upstream
+		bool SetEntryFastOpen(std::uint16_t localPort, bool fastOpen);
+		// limits the bytes read from both sides of the connections of the entry, as a whole and per client address. Reading
+		// pauses when a limit is reached, which pushes back on the sender. Connections accepted before the first limits were set
+		// are not limited, later changes apply to all limited connections
+		bool SetEntryRateLimit(std::uint16_t localPort, const RateLimit& entry, const RateLimit& perClient);
+
+		// the remote given to AddEntry is the first backend of the entry, with a weight of 1. A weight of 0 drains the backend:
+		// it is kept for existing connections but not selected anymore. Adding an existing backend updates its weight
+		bool AddBackend(std::uint16_t localPort, std::uint32_t remotePort, const char* remoteAddress, std::uint32_t weight);
+		// established connections to the removed backend are kept
+		bool RemoveBackend(std::uint16_t localPort, std::uint32_t remotePort, const char* remoteAddress);
+		bool SetBalancingPolicy(std::uint16_t localPort, BalancingPolicy policy);
+		// probes all the backends of the entry from the accept loop. Disabling health checks resets backends to Unknown
+		bool SetHealthCheck(std::uint16_t localPort, const HealthCheck& check);
+		bool GetBackendHealth(std::uint16_t localPort, std::uint32_t remotePort, const char* remoteAddress, BackendHealth& health);
 	};
 
 	class UdpForwarder {
@@ -22,11 +320,36 @@ namespace forwarding {
 		std::shared_ptr<Impl> _impl;
 	public:
 		UdpForwarder();
+		explicit UdpForwarder(Runtime& runtime);
 		void Start();
 		void Stop();
 		~UdpForwarder();
 
+		// resolves remoteAddress like TcpForwarder::AddEntry, possibly blocking the calling thread
 		void AddEntry(std::uint16_t localPort, std::uint32_t remotePort, const char* remoteAddress);
+		// forwards local ports [localPortStart, localPortStart+count) to remote ports [remotePortStart, remotePortStart+count),
+		// added again and checked like TcpForwarder::AddRangeEntry
+		void AddRangeEntry(std::uint16_t localPortStart, std::uint16_t count, std::uint32_t remotePortStart, const char* remoteAddress);
+		// removes the single port or range entry starting at localPort
 		void RemoveEntry(std::uint16_t localPort);
+		// see TcpForwarder: existing flows keep their remote until they expire
+		bool UpdateEntryRemote(std::uint16_t localPort, std::uint32_t remotePortStart, const char* remoteAddress);
+		// see TcpForwarder. Flows are not carried over: the adopting process creates new ones as datagrams come in
+		bool DuplicateEntry(std::uint16_t localPort, DWORD processId, std::vector<WSAPROTOCOL_INFOW>& sockets);
+		void AdoptRangeEntry(std::uint16_t localPortStart, std::uint16_t count, std::uint32_t remotePortStart, const char* remoteAddress, const std::vector<WSAPROTOCOL_INFOW>& sockets);
+		bool ReleaseEntry(std::uint16_t localPort);
+		// see TcpForwarder, with the UDP entries of snapshot
+		std::size_t RestoreSnapshot(EntrySnapshot& snapshot);
+		bool GetEntryStats(std::uint16_t localPort, UdpEntryStats& stats);
+		// see TcpForwarder. Datagrams over the limits are dropped, requests and replies alike
+		bool SetEntryRateLimit(std::uint16_t localPort, const RateLimit& entry, const RateLimit& perClient);
+
+		// see TcpForwarder: backends are selected when a new client flow is created, and flows stick to their backend
+		bool AddBackend(std::uint16_t localPort, std::uint32_t remotePort, const char* remoteAddress, std::uint32_t weight);
+		bool RemoveBackend(std::uint16_t localPort, std::uint32_t remotePort, const char* remoteAddress);
+		bool SetBalancingPolicy(std::uint16_t localPort, BalancingPolicy policy);
+		// a timed out probe or an ICMP port unreachable counts as a failure
+		bool SetHealthCheck(std::uint16_t localPort, const HealthCheck& check);
+		bool GetBackendHealth(std::uint16_t localPort, std::uint32_t remotePort, const char* remoteAddress, BackendHealth& health);
 	};
 }
\ No newline at end of file
@@ -15,24 +15,217 @@ enum forwarding_error{
 	FORWARDING_UNKNOWN_ERROR = 1,
     FORWARDING_NAME_RESOLUTION_FAILED = 2,
     FORWARDING_BIND_FAILED = 3,
+    FORWARDING_ENTRY_NOT_FOUND = 4,
+    FORWARDING_UNSUPPORTED_ADDRESS = 5,
+    FORWARDING_TLS_SETUP_FAILED = 6,
+    FORWARDING_BUFFER_TOO_SMALL = 7,
+    FORWARDING_SNAPSHOT_FAILED = 8,
 };
 
+enum forwarding_overload_policy {
+    FORWARDING_OVERLOAD_REFUSE = 0,
+    FORWARDING_OVERLOAD_PAUSE_ACCEPT = 1,
+};
+
+enum forwarding_balancing_policy {
+    FORWARDING_BALANCING_ROUND_ROBIN = 0,
+    FORWARDING_BALANCING_LEAST_CONNECTIONS = 1,
+    FORWARDING_BALANCING_POWER_OF_TWO_CHOICES = 2,
+};
+
+enum forwarding_backend_health {
+    FORWARDING_BACKEND_HEALTH_UNKNOWN = 0,
+    FORWARDING_BACKEND_HEALTH_HEALTHY = 1,
+    FORWARDING_BACKEND_HEALTH_UNHEALTHY = 2,
+};
+
+enum forwarding_tuning_profile {
+    FORWARDING_TUNING_DEFAULT = 0,
+    FORWARDING_TUNING_LATENCY = 1,
+    FORWARDING_TUNING_THROUGHPUT = 2,
+    FORWARDING_TUNING_AUTO = 3,
+};
+
+typedef struct {
+    uint64_t activeConnections;
+    uint64_t acceptedConnections;
+    uint64_t queuedBytes;
+    uint64_t connectionLimitTrips;
+    uint64_t queuedBytesLimitTrips;
+    uint64_t idleTimeoutTrips;
+    uint64_t socketExhaustionTrips;
+    uint64_t autoTuningSwitches;
+    uint64_t bytesToRemote;
+    uint64_t bytesToLocal;
+    uint64_t noBackendRefusals;
+    uint64_t zeroCopySends;
+    uint64_t zeroCopyBytes;
+    uint64_t tlsHandshakes;
+    uint64_t tlsHandshakeFailures;
+    uint64_t firstBytePairs;
+    uint64_t firstByteLatencyUs;
+    uint64_t maxFirstByteLatencyUs;
+    uint64_t budgetYields;
+    uint64_t rateLimitPauses;
+    uint64_t fastOpenConnects;
+    uint64_t fastOpenBytes;
+    uint64_t fastOpenSavedUs;
+    uint64_t fastOpenFallbacks;
+} forwarding_tcp_entry_stats;
+
+typedef struct {
+    uint64_t flows;
+    uint64_t rateLimitedPackets;
+    uint64_t rateLimitedBytes;
+    uint64_t queuedPackets;
+    uint64_t queueDroppedPackets;
+    uint64_t queueDroppedBytes;
+    uint64_t maxReplyQueueDelayUs;
+} forwarding_udp_entry_stats;
+
+// 0 means unlimited, and a burst of 0 is one second worth of its rate. Packet limits only apply to udp
+typedef struct {
+    uint64_t bytesPerSecond;
+    uint64_t burstBytes;
+    uint64_t packetsPerSecond;
+    uint64_t burstPackets;
+} forwarding_rate_limit;
+
+typedef struct {
+    uint64_t pairs;
+    uint64_t busiestSlotPairs;
+    uint64_t idlestSlotPairs;
+} forwarding_tcp_bridge_stats;
+
+enum forwarding_flight_event {
+    FORWARDING_FLIGHT_ACCEPT = 0,
+    FORWARDING_FLIGHT_CONNECT_RESULT = 1,
+    FORWARDING_FLIGHT_BACKPRESSURE_ON = 2,
+    FORWARDING_FLIGHT_BACKPRESSURE_OFF = 3,
+    FORWARDING_FLIGHT_CLOSE = 4,
+};
+
+enum forwarding_close_reason {
+    FORWARDING_CLOSE_LOCAL_CLOSED = 0,
+    FORWARDING_CLOSE_REMOTE_CLOSED = 1,
+    FORWARDING_CLOSE_CONNECT_FAILED = 2,
+    FORWARDING_CLOSE_IDLE_TIMEOUT = 3,
+};
+
+typedef struct {
+    uint64_t timestampUs;
+    uint32_t threadId;
+    uint32_t connectionId;
+    forwarding_flight_event event;
+    uint16_t localPort;
+    // winsock error for connect results, forwarding_close_reason for closes, direction for backpressure
+    int32_t value;
+    uint64_t bytesToRemote;
+    uint64_t bytesToLocal;
+} forwarding_flight_record;
+
+typedef struct {
+    // 0 for tcp, 1 for udp
+    int udp;
+    uint16_t localPort;
+    uint16_t count;
+    uint32_t remotePort;
+    // nul terminated
+    char remoteAddress[233];
+} forwarding_snapshot_entry;
+
+typedef void* forwarding_runtime;
+typedef void* forwarding_snapshot;
 typedef void* forwarding_udp;
 typedef void* forwarding_tcp;
 
+// event-loop threads shared by the forwarders created on the runtime, loopCount being 0 for one per processor. Forwarders keep
+// the threads of their runtime running: it can be deleted before them
+FORWARDING_DLL forwarding_runtime forwarding_runtime_new(uint32_t loopCount);
+// with the low latency loop of the latency-critical entries spinning for spinMicroseconds before blocking, and pinned to the
+// processors of affinityMask unless it is 0
+FORWARDING_DLL forwarding_runtime forwarding_runtime_newWithLowLatency(uint32_t loopCount, uint32_t spinMicroseconds, uint64_t affinityMask);
+FORWARDING_DLL void forwarding_runtime_delete(forwarding_runtime);
+FORWARDING_DLL uint32_t forwarding_runtime_loopCount(forwarding_runtime);
+
+// forwarders created with forwarding_udp_new and forwarding_tcp_new share a default runtime with a loop per processor
+// the functions taking a remoteAddress resolve a host name no entry uses yet on the calling thread, and return once it is
+// resolved or failed to
 FORWARDING_DLL forwarding_udp forwarding_udp_new();
+FORWARDING_DLL forwarding_udp forwarding_udp_newOnRuntime(forwarding_runtime);
 FORWARDING_DLL void forwarding_udp_delete(forwarding_udp);
 FORWARDING_DLL void forwarding_udp_start(forwarding_udp);
 FORWARDING_DLL void forwarding_udp_stop(forwarding_udp);
 FORWARDING_DLL forwarding_error forwarding_udp_addEntry(forwarding_udp, uint16_t localPort, uint32_t remotePort, char* remoteAddress);
+FORWARDING_DLL forwarding_error forwarding_udp_addRangeEntry(forwarding_udp, uint16_t localPortStart, uint16_t count, uint32_t remotePortStart, char* remoteAddress);
 FORWARDING_DLL void forwarding_udp_removeEntry(forwarding_udp, uint16_t localPort);
+// keeps the local sockets of the entry, see forwarding_tcp_updateEntryRemote
+FORWARDING_DLL forwarding_error forwarding_udp_updateEntryRemote(forwarding_udp, uint16_t localPort, uint32_t remotePortStart, char* remoteAddress);
+// hot restart, see forwarding_tcp_duplicateEntry
+FORWARDING_DLL forwarding_error forwarding_udp_duplicateEntry(forwarding_udp, uint16_t localPort, uint32_t processId, char* handoff, uint32_t handoffCapacity, uint32_t* handoffLength);
+FORWARDING_DLL forwarding_error forwarding_udp_adoptRangeEntry(forwarding_udp, uint16_t localPortStart, uint16_t count, uint32_t remotePortStart, char* remoteAddress, char* handoff, uint32_t handoffLength);
+FORWARDING_DLL forwarding_error forwarding_udp_releaseEntry(forwarding_udp, uint16_t localPort);
+// see forwarding_tcp_restoreSnapshot
+FORWARDING_DLL uint32_t forwarding_udp_restoreSnapshot(forwarding_udp, forwarding_snapshot);
+FORWARDING_DLL forwarding_error forwarding_udp_getEntryStats(forwarding_udp, uint16_t localPort, forwarding_udp_entry_stats* stats);
+// limits may be null for unlimited
+FORWARDING_DLL forwarding_error forwarding_udp_setEntryRateLimit(forwarding_udp, uint16_t localPort, const forwarding_rate_limit* entry, const forwarding_rate_limit* perClient);
+FORWARDING_DLL forwarding_error forwarding_udp_addBackend(forwarding_udp, uint16_t localPort, uint32_t remotePort, char* remoteAddress, uint32_t weight);
+FORWARDING_DLL forwarding_error forwarding_udp_removeBackend(forwarding_udp, uint16_t localPort, uint32_t remotePort, char* remoteAddress);
+FORWARDING_DLL forwarding_error forwarding_udp_setBalancingPolicy(forwarding_udp, uint16_t localPort, forwarding_balancing_policy policy);
+// an intervalMs of 0 disables health checking. The probe is sent to each backend, which must reply with a datagram starting with expectedReply
+FORWARDING_DLL forwarding_error forwarding_udp_setHealthCheck(forwarding_udp, uint16_t localPort, uint32_t intervalMs, uint32_t timeoutMs, uint32_t unhealthyThreshold, uint32_t healthyThreshold,
+    char* probePayload, uint32_t probePayloadLength, char* expectedReply, uint32_t expectedReplyLength);
+FORWARDING_DLL forwarding_error forwarding_udp_getBackendHealth(forwarding_udp, uint16_t localPort, uint32_t remotePort, char* remoteAddress, forwarding_backend_health* health);
 
 FORWARDING_DLL forwarding_tcp forwarding_tcp_new();
+FORWARDING_DLL forwarding_tcp forwarding_tcp_newOnRuntime(forwarding_runtime);
 FORWARDING_DLL void forwarding_tcp_delete(forwarding_tcp);
 FORWARDING_DLL void forwarding_tcp_start(forwarding_tcp);
 FORWARDING_DLL void forwarding_tcp_stop(forwarding_tcp);
 FORWARDING_DLL forwarding_error forwarding_tcp_addEntry(forwarding_tcp, uint16_t localPort, uint32_t remotePort, char* remoteAddress);
+FORWARDING_DLL forwarding_error forwarding_tcp_addTlsEntry(forwarding_tcp, uint16_t localPort, uint32_t remotePort, char* remoteAddress, char* pfx, uint32_t pfxLength, char* password);
+FORWARDING_DLL forwarding_error forwarding_tcp_addRangeEntry(forwarding_tcp, uint16_t localPortStart, uint16_t count, uint32_t remotePortStart, char* remoteAddress);
 FORWARDING_DLL void forwarding_tcp_removeEntry(forwarding_tcp, uint16_t localPort);
+// points an entry at a new remote without closing its listeners; established connections keep their remote
+FORWARDING_DLL forwarding_error forwarding_tcp_updateEntryRemote(forwarding_tcp, uint16_t localPort, uint32_t remotePortStart, char* remoteAddress);
+// hot restart: handoff receives an opaque blob to pass to forwarding_tcp_adoptRangeEntry in process processId. When handoffCapacity is
+// too small, FORWARDING_BUFFER_TOO_SMALL is returned with the needed size in handoffLength
+FORWARDING_DLL forwarding_error forwarding_tcp_duplicateEntry(forwarding_tcp, uint16_t localPort, uint32_t processId, char* handoff, uint32_t handoffCapacity, uint32_t* handoffLength);
+FORWARDING_DLL forwarding_error forwarding_tcp_adoptRangeEntry(forwarding_tcp, uint16_t localPortStart, uint16_t count, uint32_t remotePortStart, char* remoteAddress, char* handoff, uint32_t handoffLength);
+FORWARDING_DLL forwarding_error forwarding_tcp_releaseEntry(forwarding_tcp, uint16_t localPort);
+// adds the tcp entries of the snapshot not overlapping an entry of the forwarder, and returns how many were added. The snapshot
+// then follows the entries of the forwarder, and can be deleted before it
+FORWARDING_DLL uint32_t forwarding_tcp_restoreSnapshot(forwarding_tcp, forwarding_snapshot);
+FORWARDING_DLL uint64_t forwarding_tcp_activeConnections(forwarding_tcp);
+// limits set to 0 are unlimited
+FORWARDING_DLL forwarding_error forwarding_tcp_setEntryLimits(forwarding_tcp, uint16_t localPort, uint32_t maxConnections, uint32_t idleTimeoutMs, uint64_t maxQueuedBytes, forwarding_overload_policy overloadPolicy);
+FORWARDING_DLL forwarding_error forwarding_tcp_getEntryStats(forwarding_tcp, uint16_t localPort, forwarding_tcp_entry_stats* stats);
+// copies the stats of the data bridges, one per loop of the runtime, and returns how many were copied
+FORWARDING_DLL uint32_t forwarding_tcp_getBridgeStats(forwarding_tcp, forwarding_tcp_bridge_stats* stats, uint32_t capacity);
+FORWARDING_DLL forwarding_error forwarding_tcp_setEntryTuning(forwarding_tcp, uint16_t localPort, forwarding_tuning_profile profile);
+FORWARDING_DLL forwarding_error forwarding_tcp_setEntryZeroCopy(forwarding_tcp, uint16_t localPort, uint32_t thresholdBytes);
+FORWARDING_DLL forwarding_error forwarding_tcp_setEntryInteractive(forwarding_tcp, uint16_t localPort, int interactive);
+// connections accepted afterwards are forwarded from the low latency loop of the runtime
+FORWARDING_DLL forwarding_error forwarding_tcp_setEntryLatencyCritical(forwarding_tcp, uint16_t localPort, int latencyCritical);
+FORWARDING_DLL forwarding_error forwarding_tcp_setEntryFastOpen(forwarding_tcp, uint16_t localPort, int fastOpen);
+// limits may be null for unlimited
+FORWARDING_DLL forwarding_error forwarding_tcp_setEntryRateLimit(forwarding_tcp, uint16_t localPort, const forwarding_rate_limit* entry, const forwarding_rate_limit* perClient);
+FORWARDING_DLL forwarding_error forwarding_tcp_addBackend(forwarding_tcp, uint16_t localPort, uint32_t remotePort, char* remoteAddress, uint32_t weight);
+FORWARDING_DLL forwarding_error forwarding_tcp_removeBackend(forwarding_tcp, uint16_t localPort, uint32_t remotePort, char* remoteAddress);
+FORWARDING_DLL forwarding_error forwarding_tcp_setBalancingPolicy(forwarding_tcp, uint16_t localPort, forwarding_balancing_policy policy);
+// an intervalMs of 0 disables health checking
+FORWARDING_DLL forwarding_error forwarding_tcp_setHealthCheck(forwarding_tcp, uint16_t localPort, uint32_t intervalMs, uint32_t timeoutMs, uint32_t unhealthyThreshold, uint32_t healthyThreshold);
+FORWARDING_DLL forwarding_error forwarding_tcp_getBackendHealth(forwarding_tcp, uint16_t localPort, uint32_t remotePort, char* remoteAddress, forwarding_backend_health* health);
+
+// the entry table persisted at path, created empty when missing or unreadable
+FORWARDING_DLL forwarding_error forwarding_snapshot_open(const char* path, forwarding_snapshot* snapshot);
+FORWARDING_DLL void forwarding_snapshot_delete(forwarding_snapshot);
+// when capacity is too small, FORWARDING_BUFFER_TOO_SMALL is returned with the needed capacity in count
+FORWARDING_DLL forwarding_error forwarding_snapshot_entries(forwarding_snapshot, forwarding_snapshot_entry* entries, uint32_t capacity, uint32_t* count);
+
+// copies the most recent flight records of all forwarder threads, oldest first, and returns how many were copied
+FORWARDING_DLL uint32_t forwarding_flightRecorder_snapshot(forwarding_flight_record* records, uint32_t capacity);
 
 #ifdef __cplusplus
 }
@@ -14,12 +14,70 @@ namespace forwarding{
 		ListenFailed,
 		SendReceiveFailed,
 		NameResolutionFailed,
-		ConnectFailed
+		ConnectFailed,
+		UnsupportedAddress,
+		TlsSetupFailed,
+		SnapshotFailed,
+		LoopSetupFailed
 	};
 	struct TransportErrorException{
 		TransportError Error;
 		TransportErrorException(TransportError e);
 	};
+	// the socket calls of the forwarders data path and of the coroutine transport, so that they can run over something else
+	// than winsock, like the SimulatedNetwork of simulation.h. Errors are reported like winsock does: SOCKET_ERROR or
+	// INVALID_SOCKET, with the error code for WSAGetLastError set by WSASetLastError
+	class SocketApi {
+	public:
+		virtual ~SocketApi() {}
+
+		virtual SOCKET Socket(int family, int type, int protocol) = 0;
+		virtual int Bind(SOCKET s, const sockaddr* address, int addressLen) = 0;
+		virtual int Listen(SOCKET s, int backlog) = 0;
+		virtual SOCKET Accept(SOCKET s, sockaddr* address, int* addressLen) = 0;
+		virtual int Connect(SOCKET s, const sockaddr* address, int addressLen) = 0;
+		virtual int Recv(SOCKET s, char* buffer, int len) = 0;
+		virtual int RecvFrom(SOCKET s, char* buffer, int len, sockaddr* from, int* fromLen) = 0;
+		virtual int Send(SOCKET s, const char* buffer, int len) = 0;
+		virtual int SendTo(SOCKET s, const char* buffer, int len, const sockaddr* to, int toLen) = 0;
+		// non overlapped gather send, returns 0 and the bytes sent on success
+		virtual int SendBuffers(SOCKET s, WSABUF* buffers, DWORD count, DWORD* sent) = 0;
+		// FIONREAD: the bytes of a stream, or the size of the next datagram
+		virtual int Available(SOCKET s, u_long* available) = 0;
+		virtual int SetNonBlocking(SOCKET s) = 0;
+		virtual int SetOption(SOCKET s, int level, int name, const char* value, int len) = 0;
+		virtual int SetKeepAlive(SOCKET s, ULONG timeMs, ULONG intervalMs) = 0;
+		virtual int PeerName(SOCKET s, sockaddr* address, int* addressLen) = 0;
+		virtual int EventSelect(SOCKET s, HANDLE event, long networkEvents) = 0;
+		virtual int EnumNetworkEvents(SOCKET s, WSANETWORKEVENTS* events) = 0;
+		virtual int Shutdown(SOCKET s, int how) = 0;
+		virtual int Close(SOCKET s) = 0;
+	};
+
+	// the winsock implementation, used unless overridden
+	SocketApi& nativeSocketApi();
+	SocketApi& socketApi();
+	// like overrideResolver, meant to be called before any forwarder is created. Overlapped sends and socket duplication
+	// for handoffs always use winsock
+	void overrideSocketApi(std::shared_ptr<SocketApi> api);
+	void resetSocketApi();
+
+	// the time read by the timers of the forwarders, like the idle timeouts, the udp flow expiry, the connect timeouts and the
+	// name ttls, so that they can run on the virtual clock of a SimulatedNetwork
+	class Clock {
+	public:
+		virtual ~Clock() {}
+		virtual std::chrono::steady_clock::time_point Now() = 0;
+	};
+
+	// steady_clock unless overridden
+	std::chrono::steady_clock::time_point clockNow();
+	// like overrideSocketApi, meant to be called before any forwarder is created
+	void overrideClock(std::shared_ptr<Clock> clock);
+	void resetClock();
+	// wakes the runtime loops up for their timers to be checked against a clock that moved, see SimulatedNetwork::Advance
+	void clockAdvanced();
+
 	class SafeSocket {
 	private:
 		SOCKET _socket;
@@ -48,8 +106,8 @@ namespace forwarding{
 		}
 		void Close() {
 			if (_socket != INVALID_SOCKET) {
-				shutdown(_socket, SD_BOTH);
-				if (0 != closesocket(_socket))
+				socketApi().Shutdown(_socket, SD_BOTH);
+				if (0 != socketApi().Close(_socket))
 				{
 					std::cerr << "close socket failed errno: " << errno << std::endl;
 				}
@@ -65,6 +123,13 @@ namespace forwarding{
 		SOCKET Get() const {
 			return _socket;
 		}
+
+		// gives up ownership without closing, for sockets that must be closed differently
+		SOCKET Release() {
+			auto s = _socket;
+			_socket = INVALID_SOCKET;
+			return s;
+		}
 	};
 
 	class BufferView{
@@ -148,10 +213,28 @@ namespace forwarding{
 
 		virtual const sockaddr* SockAddr()const = 0;
 		virtual int SockAddrLen() const = 0;
+
+		int Family() const {
+			return SockAddr()->sa_family;
+		}
 	};
+	// host names starting with this prefix are unix socket paths; the port is then ignored
+	const char* const UnixSocketPrefix = "unix:";
+	// numeric IPv4 addresses are converted without going through getaddrinfo
 	std::unique_ptr<ResolvedAddress> Resolve(const char* hostName, int port);
+	// unix sockets are stream only on Windows: unix socket paths are rejected with UnsupportedAddress
 	std::unique_ptr<ResolvedAddress> ResolveUdp(const char* hostName, int port);
 
+	// resolves the host names of forwarded remotes, socketType being SOCK_STREAM or SOCK_DGRAM, and sets how long the result
+	// can be cached. Throws TransportErrorException on failure. The first resolution of a name is called on the thread adding
+	// the entry, the refreshes once it expired on the forwarders resolver threads. Never called for numeric addresses or unix
+	// socket paths
+	using ResolveFunction = std::function<std::unique_ptr<ResolvedAddress>(const char* hostName, int socketType, std::chrono::seconds& ttl)>;
+	// getaddrinfo does not expose record TTLs: the default resolver caches its results for DefaultResolveTtl
+	const std::chrono::seconds DefaultResolveTtl{ 30 };
+	void overrideResolver(ResolveFunction resolver);
+	void resetResolver();
+
 	std::unique_ptr<Connection> ConnectTo(const ResolvedAddress& address);
 	std::unique_ptr<Connection> ConnectTo(const ResolvedAddress& address, std::chrono::milliseconds timeout);
 }
\ No newline at end of file
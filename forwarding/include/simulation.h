@@ -0,0 +1,75 @@
+#pragma once
+#include "common.h"
+#include <chrono>
+#include <map>
+#include <memory>
+#include <mutex>
+namespace forwarding {
+
+	// in-memory network, installed with overrideSocketApi, that the forwarders run over deterministically and without the
+	// kernel: sends move bytes between the buffers of simulated sockets, and network events are recorded and signaled like
+	// winsock does. Only IPv4 is simulated. Handles it does not know, like the winsock sockets of a test client, are passed
+	// to winsock. Created with make_shared, for VirtualClock. Not built into the dll: the test and benchmark projects compile
+	// src/SimulatedNetwork.cpp with the library sources
+	class SimulatedNetwork : public SocketApi, public std::enable_shared_from_this<SimulatedNetwork> {
+	private:
+		struct SimSocket;
+		std::mutex _mut;
+		std::map<SOCKET, std::shared_ptr<SimSocket>> _sockets;
+		SOCKET _nextSocket;
+		u_short _nextPort = 49152;
+		std::size_t _receiveBufferSize = 64 * 1024;
+		std::size_t _maxWriteSize = SIZE_MAX;
+		std::chrono::milliseconds _connectDelay{ 0 };
+		// the virtual clock, only moved by Advance
+		std::chrono::milliseconds _now{ 0 };
+
+		std::shared_ptr<SimSocket> Find(SOCKET s);
+		SOCKET Add(std::shared_ptr<SimSocket> socket);
+		void AutoBind(SimSocket& socket);
+		std::shared_ptr<SimSocket> FindBound(int type, const sockaddr_in& address, bool listening);
+		void CompleteConnect(const std::shared_ptr<SimSocket>& socket);
+		int StreamSend(SimSocket& socket, const char* buffer, std::size_t len);
+		int DatagramSend(SimSocket& socket, const char* buffer, std::size_t len, const sockaddr_in& to);
+		void Disconnect(SimSocket& socket, int error);
+	public:
+		SimulatedNetwork();
+
+		// bytes a socket buffers before sends to it would block, and datagrams to it are dropped
+		void SetReceiveBufferSize(std::size_t bytes);
+		// caps the bytes taken by a single send, to exercise partial writes
+		void SetMaxWriteSize(std::size_t bytes);
+		// connects complete once the virtual clock moved that much further. Without delay they complete right away, still
+		// through FD_CONNECT
+		void SetConnectDelay(std::chrono::milliseconds delay);
+		// also wakes the runtime loops up, for the timers of the forwarders to fire when they run on VirtualClock
+		void Advance(std::chrono::milliseconds elapsed);
+		std::chrono::milliseconds Now();
+		// the virtual clock for overrideClock, so that idle timeouts, flow expiry and connect timeouts only move with Advance
+		std::shared_ptr<Clock> VirtualClock();
+		// resets the connection of s: its peer gets FD_CLOSE and its calls fail with WSAECONNRESET
+		void Reset(SOCKET s);
+		// simulated sockets not closed yet, to find leaks
+		std::size_t SocketCount();
+
+		SOCKET Socket(int family, int type, int protocol) override;
+		int Bind(SOCKET s, const sockaddr* address, int addressLen) override;
+		int Listen(SOCKET s, int backlog) override;
+		SOCKET Accept(SOCKET s, sockaddr* address, int* addressLen) override;
+		int Connect(SOCKET s, const sockaddr* address, int addressLen) override;
+		int Recv(SOCKET s, char* buffer, int len) override;
+		int RecvFrom(SOCKET s, char* buffer, int len, sockaddr* from, int* fromLen) override;
+		int Send(SOCKET s, const char* buffer, int len) override;
+		int SendTo(SOCKET s, const char* buffer, int len, const sockaddr* to, int toLen) override;
+		int SendBuffers(SOCKET s, WSABUF* buffers, DWORD count, DWORD* sent) override;
+		int Available(SOCKET s, u_long* available) override;
+		int SetNonBlocking(SOCKET s) override;
+		int SetOption(SOCKET s, int level, int name, const char* value, int len) override;
+		int SetKeepAlive(SOCKET s, ULONG timeMs, ULONG intervalMs) override;
+		int PeerName(SOCKET s, sockaddr* address, int* addressLen) override;
+		int EventSelect(SOCKET s, HANDLE event, long networkEvents) override;
+		int EnumNetworkEvents(SOCKET s, WSANETWORKEVENTS* events) override;
+		int Shutdown(SOCKET s, int how) override;
+		int Close(SOCKET s) override;
+	};
+}
@@ -0,0 +1,154 @@
+#include <async.h>
+#include <ws2tcpip.h>
+#include "compat.h"
+
+using namespace forwarding;
+using namespace std::chrono;
+
+void init_transport_once();
+
+namespace {
+	struct Detached {
+		struct promise_type {
+			Detached get_return_object() { return {}; }
+			std::experimental::suspend_never initial_suspend() { return {}; }
+			std::experimental::suspend_never final_suspend() noexcept { return {}; }
+			void return_void() {}
+			void unhandled_exception() {}
+		};
+	};
+
+	Detached RunDetached(Task<void> task) {
+		try {
+			co_await std::move(task);
+		}
+		catch (...) {
+		}
+	}
+}
+
+forwarding::AsyncConnection::AsyncConnection(EventLoop& loop, SafeSocket&& s) : _loop(loop), _socket(std::move(s))
+{
+	// accepted sockets inherit the event selection of their listener, and connected ones may still be watched for FD_CONNECT
+	_loop.Forget(_socket.Get());
+	socketApi().EventSelect(_socket.Get(), nullptr, 0);
+	socketApi().SetNonBlocking(_socket.Get());
+}
+
+forwarding::AsyncConnection::~AsyncConnection()
+{
+	Close();
+}
+
+void forwarding::AsyncConnection::Close()
+{
+	if (_socket.Get() != INVALID_SOCKET) {
+		_loop.CloseSocket(std::move(_socket));
+	}
+}
+
+Task<void> forwarding::AsyncConnection::Send(BufferView buf)
+{
+	std::uint32_t sent = 0;
+	while (sent < buf.size()) {
+		auto written = socketApi().Send(_socket.Get(), buf.begin() + sent, static_cast<int>(buf.size() - sent));
+		if (written > 0) {
+			sent += written;
+			continue;
+		}
+		if (WSAGetLastError() != WSAEWOULDBLOCK) {
+			throw TransportErrorException{ TransportError::SendReceiveFailed };
+		}
+		// FD_WRITE is only recorded again once a send would block, which is the case here
+		auto ready = co_await SocketReady(_loop, _socket.Get(), FD_WRITE);
+		if ((ready.events & FD_WRITE) == 0) {
+			throw TransportErrorException{ TransportError::SendReceiveFailed };
+		}
+	}
+}
+
+Task<void> forwarding::AsyncConnection::Receive(BufferView buf)
+{
+	std::uint32_t received = 0;
+	while (received < buf.size()) {
+		auto read = socketApi().Recv(_socket.Get(), buf.begin() + received, static_cast<int>(buf.size() - received));
+		if (read > 0) {
+			received += read;
+			continue;
+		}
+		if (read == 0 || WSAGetLastError() != WSAEWOULDBLOCK) {
+			throw TransportErrorException{ TransportError::SendReceiveFailed };
+		}
+		// a pending FD_CLOSE completes the wait too: the next recv then reports the end of the stream
+		auto ready = co_await SocketReady(_loop, _socket.Get(), FD_READ);
+		if (ready.events == 0) {
+			throw TransportErrorException{ TransportError::SendReceiveFailed };
+		}
+	}
+}
+
+forwarding::AsyncListener::AsyncListener(EventLoop& loop, const char* address, int port) : _loop(loop)
+{
+	init_transport_once();
+	auto resolved = Resolve(address, port);
+	_listeningSocket = socketApi().Socket(AF_INET, SOCK_STREAM, 0);
+	int yes = 1;
+	socketApi().SetOption(_listeningSocket.Get(), SOL_SOCKET, SO_REUSEADDR, (char*)&yes, sizeof(yes));
+	if (0 != socketApi().Bind(_listeningSocket.Get(), resolved->SockAddr(), resolved->SockAddrLen())) {
+		throw TransportErrorException{ TransportError::BindFailed };
+	}
+	if (0 != socketApi().Listen(_listeningSocket.Get(), SOMAXCONN)) {
+		throw TransportErrorException{ TransportError::ListenFailed };
+	}
+	socketApi().SetNonBlocking(_listeningSocket.Get());
+}
+
+forwarding::AsyncListener::~AsyncListener()
+{
+	_loop.CloseSocket(std::move(_listeningSocket));
+}
+
+Task<std::unique_ptr<AsyncConnection>> forwarding::AsyncListener::Accept()
+{
+	for (;;) {
+		auto rawSock = socketApi().Accept(_listeningSocket.Get(), nullptr, nullptr);
+		if (INVALID_SOCKET != rawSock) {
+			co_return std::make_unique<AsyncConnection>(_loop, SafeSocket(rawSock));
+		}
+		if (WSAGetLastError() != WSAEWOULDBLOCK) {
+			throw TransportErrorException{ TransportError::InvalidSocket };
+		}
+		// accept re-enables FD_ACCEPT
+		auto ready = co_await SocketReady(_loop, _listeningSocket.Get(), FD_ACCEPT);
+		if ((ready.events & FD_ACCEPT) == 0) {
+			throw TransportErrorException{ TransportError::InvalidSocket };
+		}
+	}
+}
+
+Task<std::unique_ptr<AsyncConnection>> forwarding::ConnectToAsync(EventLoop& loop, const ResolvedAddress& address, milliseconds timeout)
+{
+	init_transport_once();
+	SafeSocket s = socketApi().Socket(address.Family(), SOCK_STREAM, 0);
+	socketApi().SetNonBlocking(s.Get());
+	if (0 != socketApi().Connect(s.Get(), address.SockAddr(), address.SockAddrLen())) {
+		if (WSAGetLastError() != WSAEWOULDBLOCK) {
+			throw TransportErrorException{ TransportError::ConnectFailed };
+		}
+		auto ready = co_await SocketReady(loop, s.Get(), FD_CONNECT, timeout);
+		if ((ready.events & FD_CONNECT) == 0 || ready.error != 0) {
+			loop.Forget(s.Get());
+			throw TransportErrorException{ TransportError::ConnectFailed };
+		}
+	}
+	co_return std::make_unique<AsyncConnection>(loop, std::move(s));
+}
+
+void forwarding::Spawn(EventLoop& loop, Task<void>&& task)
+{
+	// std::function needs a copyable callback
+	auto shared = std::make_shared<Task<void>>(std::move(task));
+	loop.Post([shared]() {
+		RunDetached(std::move(*shared));
+	});
+}
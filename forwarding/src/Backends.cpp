@@ -0,0 +1,304 @@
+#include "Backends.h"
+#include "Forwarders.h"
+#include <algorithm>
+#include <cstring>
+
+using namespace forwarding;
+using namespace std::chrono;
+
+void forwarding::BackendCounters::OnConnected(microseconds latency)
+{
+	// racing updates from several bridges may lose a sample, which does not matter for a moving average
+	auto sample = static_cast<std::uint64_t>(std::max<microseconds::rep>(latency.count(), 1));
+	auto current = connectLatencyUs.load();
+	connectLatencyUs = current == 0 ? sample : current - current / 8 + sample / 8;
+}
+
+forwarding::BackendLease::BackendLease(std::shared_ptr<BackendCounters> counters) : _counters(std::move(counters))
+{
+	++_counters->active;
+	++_counters->total;
+}
+
+forwarding::BackendLease::~BackendLease()
+{
+	if (_counters) {
+		--_counters->active;
+	}
+}
+
+std::uint32_t forwarding::BackendSet::NextRandom()
+{
+	// xorshift32, good enough to pick two candidates
+	_random ^= _random << 13;
+	_random ^= _random >> 17;
+	_random ^= _random << 5;
+	return _random;
+}
+
+void forwarding::BackendSet::Add(const char* address, std::uint32_t port, std::uint32_t weight, std::shared_ptr<ResolvedName> name)
+{
+	auto found = std::find_if(_backends.begin(), _backends.end(), [address, port](const Backend& b) {return b.port == port && b.address == address; });
+	if (found != _backends.end()) {
+		found->weight = weight;
+		return;
+	}
+	Backend backend;
+	backend.address = address;
+	backend.port = port;
+	backend.weight = weight;
+	backend.name = std::move(name);
+	backend.counters = std::make_shared<BackendCounters>();
+	_backends.push_back(std::move(backend));
+}
+
+bool forwarding::BackendSet::Remove(const char* address, std::uint32_t port)
+{
+	auto found = std::find_if(_backends.begin(), _backends.end(), [address, port](const Backend& b) {return b.port == port && b.address == address; });
+	if (found == _backends.end()) {
+		return false;
+	}
+	_backends.erase(found);
+	for (auto& b : _backends) {
+		b.currentWeight = 0;
+	}
+	return true;
+}
+
+void forwarding::BackendSet::Replace(const char* address, std::uint32_t port, std::shared_ptr<ResolvedName> name)
+{
+	auto found = std::find_if(_backends.begin(), _backends.end(), [address, port](const Backend& b) {return b.port == port && b.address == address; });
+	if (found != _backends.end()) {
+		auto kept = std::move(*found);
+		_backends.clear();
+		_backends.push_back(std::move(kept));
+	}
+	else {
+		_backends.clear();
+		Add(address, port, 1, std::move(name));
+	}
+	_backends[0].currentWeight = 0;
+}
+
+Backend* forwarding::BackendSet::Select()
+{
+	if (_backends.size() == 1) {
+		return _backends[0].EffectiveWeight() != 0 ? &_backends[0] : nullptr;
+	}
+	switch (_policy) {
+	case BalancingPolicy::LeastConnections:
+		return SelectLeastConnections();
+	case BalancingPolicy::PowerOfTwoChoices:
+		return SelectPowerOfTwoChoices();
+	default:
+		return SelectRoundRobin();
+	}
+}
+
+Backend* forwarding::BackendSet::SelectRoundRobin()
+{
+	// smooth weighted round robin: spreads the picks of heavy backends instead of bursting them
+	Backend* selected = nullptr;
+	std::int64_t total = 0;
+	for (auto& b : _backends) {
+		auto weight = b.EffectiveWeight();
+		if (weight == 0) {
+			continue;
+		}
+		b.currentWeight += weight;
+		total += weight;
+		if (!selected || b.currentWeight > selected->currentWeight) {
+			selected = &b;
+		}
+	}
+	if (selected) {
+		selected->currentWeight -= total;
+	}
+	return selected;
+}
+
+Backend* forwarding::BackendSet::SelectLeastConnections()
+{
+	Backend* selected = nullptr;
+	for (auto& b : _backends) {
+		if (b.EffectiveWeight() == 0) {
+			continue;
+		}
+		// active/weight comparison without divisions
+		if (!selected || b.counters->active * selected->weight < selected->counters->active * b.weight) {
+			selected = &b;
+		}
+	}
+	return selected;
+}
+
+Backend* forwarding::BackendSet::SelectPowerOfTwoChoices()
+{
+	std::uint64_t totalWeight = 0;
+	for (auto& b : _backends) {
+		totalWeight += b.EffectiveWeight();
+	}
+	if (totalWeight == 0) {
+		return nullptr;
+	}
+	auto pick = [this, totalWeight]() {
+		auto r = NextRandom() % totalWeight;
+		for (auto& b : _backends) {
+			auto weight = b.EffectiveWeight();
+			if (r < weight) {
+				return &b;
+			}
+			r -= weight;
+		}
+		return &_backends.back();
+	};
+	auto first = pick();
+	auto second = pick();
+	// backends that never completed a connect have a latency of 0 and get probed first
+	auto firstLatency = first->counters->connectLatencyUs.load();
+	auto secondLatency = second->counters->connectLatencyUs.load();
+	if (firstLatency != secondLatency) {
+		return firstLatency < secondLatency ? first : second;
+	}
+	return first->counters->active <= second->counters->active ? first : second;
+}
+
+bool forwarding::BackendSet::Any(const std::function<bool(const Backend&)>& predicate) const
+{
+	return std::any_of(_backends.begin(), _backends.end(), predicate);
+}
+
+void forwarding::BackendSet::SetHealthCheck(const HealthCheck& check)
+{
+	_healthCheck = check;
+	for (auto& b : _backends) {
+		if (b.probe.socket.Get() != INVALID_SOCKET) {
+			AbortiveClose(b.probe.socket.Release());
+		}
+		b.probe = HealthProbe{};
+		if (!HealthChecked()) {
+			b.health = BackendHealth::Unknown;
+		}
+	}
+}
+
+void forwarding::BackendSet::StartProbe(Backend& backend, int socketType, HANDLE probeEvent, steady_clock::time_point now)
+{
+	backend.probe.deadline = now + milliseconds(_healthCheck.timeoutMs);
+	auto resolved = backend.name->Current();
+	auto raw = socketApi().Socket(resolved->Family(), socketType, 0);
+	if (INVALID_SOCKET == raw) {
+		// not the backend's fault: try again at the next interval
+		backend.probe.next = now + milliseconds(_healthCheck.intervalMs);
+		return;
+	}
+	SafeSocket probe = raw;
+	sockaddr_storage addr;
+	auto addrLen = SockAddrWithPort(*resolved, backend.port, addr);
+	// selecting events first makes the socket non blocking
+	socketApi().EventSelect(probe.Get(), probeEvent, socketType == SOCK_STREAM ? FD_CONNECT : FD_READ);
+	if (0 != socketApi().Connect(probe.Get(), reinterpret_cast<const sockaddr*>(&addr), addrLen) && WSAGetLastError() != WSAEWOULDBLOCK) {
+		OnProbeResult(backend, false);
+		backend.probe.next = now + milliseconds(_healthCheck.intervalMs);
+		return;
+	}
+	if (socketType == SOCK_DGRAM) {
+		auto& payload = _healthCheck.probePayload;
+		if (socketApi().Send(probe.Get(), payload.data(), static_cast<int>(payload.size())) < 0) {
+			OnProbeResult(backend, false);
+			backend.probe.next = now + milliseconds(_healthCheck.intervalMs);
+			return;
+		}
+	}
+	backend.probe.socket = std::move(probe);
+}
+
+int forwarding::BackendSet::PollProbe(Backend& backend, int socketType)
+{
+	WSANETWORKEVENTS events;
+	socketApi().EnumNetworkEvents(backend.probe.socket.Get(), &events);
+	if (socketType == SOCK_STREAM) {
+		if ((events.lNetworkEvents & FD_CONNECT) == 0) {
+			return 0;
+		}
+		return events.iErrorCode[FD_CONNECT_BIT] == 0 ? 1 : -1;
+	}
+	if ((events.lNetworkEvents & FD_READ) == 0) {
+		return 0;
+	}
+	auto& expected = _healthCheck.expectedReply;
+	std::vector<char> reply(std::max<std::size_t>(expected.size(), 1));
+	auto read = socketApi().Recv(backend.probe.socket.Get(), &reply[0], static_cast<int>(reply.size()));
+	if (read < 0) {
+		auto err = WSAGetLastError();
+		if (err == WSAEWOULDBLOCK) {
+			return 0;
+		}
+		// a longer reply is truncated to what we compare
+		if (err != WSAEMSGSIZE) {
+			// WSAECONNRESET is how an ICMP port unreachable surfaces
+			return -1;
+		}
+		read = static_cast<int>(reply.size());
+	}
+	if (static_cast<std::size_t>(read) < expected.size()) {
+		return -1;
+	}
+	return 0 == memcmp(&reply[0], expected.data(), expected.size()) ? 1 : -1;
+}
+
+void forwarding::BackendSet::OnProbeResult(Backend& backend, bool succeeded)
+{
+	auto& probe = backend.probe;
+	if (succeeded) {
+		probe.failures = 0;
+		++probe.successes;
+		// a backend that was never ejected does not need to prove itself several times
+		if (backend.health == BackendHealth::Unknown || (backend.health == BackendHealth::Unhealthy && probe.successes >= _healthCheck.healthyThreshold)) {
+			backend.health = BackendHealth::Healthy;
+		}
+	}
+	else {
+		probe.successes = 0;
+		++probe.failures;
+		if (backend.health != BackendHealth::Unhealthy && probe.failures >= _healthCheck.unhealthyThreshold) {
+			backend.health = BackendHealth::Unhealthy;
+		}
+	}
+}
+
+steady_clock::time_point forwarding::BackendSet::RunHealthChecks(int socketType, HANDLE probeEvent, steady_clock::time_point now)
+{
+	auto next = steady_clock::time_point::max();
+	if (!HealthChecked()) {
+		return next;
+	}
+	for (auto& b : _backends) {
+		if (b.probe.socket.Get() != INVALID_SOCKET) {
+			auto result = PollProbe(b, socketType);
+			if (result == 0 && now >= b.probe.deadline) {
+				result = -1;
+			}
+			if (result != 0) {
+				AbortiveClose(b.probe.socket.Release());
+				OnProbeResult(b, result > 0);
+				b.probe.next = now + milliseconds(_healthCheck.intervalMs);
+			}
+		}
+		if (b.probe.socket.Get() == INVALID_SOCKET && now >= b.probe.next) {
+			StartProbe(b, socketType, probeEvent, now);
+		}
+		next = std::min(next, b.probe.socket.Get() != INVALID_SOCKET ? b.probe.deadline : b.probe.next);
+	}
+	return next;
+}
+
+bool forwarding::BackendSet::GetHealth(const char* address, std::uint32_t port, BackendHealth& health) const
+{
+	auto found = std::find_if(_backends.begin(), _backends.end(), [address, port](const Backend& b) {return b.port == port && b.address == address; });
+	if (found == _backends.end()) {
+		return false;
+	}
+	health = found->health;
+	return true;
+}
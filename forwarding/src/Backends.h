@@ -0,0 +1,115 @@
+#pragma once
+#include <client.h>
+#include "Resolver.h"
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+namespace forwarding {
+
+	// shared between a backend and the connections or flows it serves, so that they can outlive its removal
+	struct BackendCounters {
+		std::atomic<std::uint64_t> active{ 0 };
+		std::atomic<std::uint64_t> total{ 0 };
+		// moving average of the connect latency, 0 until a connection completed
+		std::atomic<std::uint64_t> connectLatencyUs{ 0 };
+
+		void OnConnected(std::chrono::microseconds latency);
+	};
+
+	// accounts a connection or a flow against its backend. Moves swap, like SafeSocket
+	class BackendLease {
+	private:
+		std::shared_ptr<BackendCounters> _counters;
+	public:
+		BackendLease() = default;
+		explicit BackendLease(std::shared_ptr<BackendCounters> counters);
+		BackendLease(const BackendLease&) = delete;
+		BackendLease& operator =(const BackendLease&) = delete;
+		BackendLease(BackendLease&& moved) : _counters(std::move(moved._counters)) {}
+		BackendLease& operator =(BackendLease&& moved) {
+			if (this != &moved) {
+				std::swap(_counters, moved._counters);
+			}
+			return *this;
+		}
+		~BackendLease();
+		void OnConnected(std::chrono::microseconds latency) {
+			if (_counters) {
+				_counters->OnConnected(latency);
+			}
+		}
+	};
+
+	struct HealthProbe {
+		// valid while a probe is in flight
+		SafeSocket socket;
+		std::chrono::steady_clock::time_point deadline;
+		std::chrono::steady_clock::time_point next;
+		std::uint32_t failures = 0;
+		std::uint32_t successes = 0;
+	};
+
+	struct Backend {
+		std::string address;
+		std::uint32_t port;
+		std::uint32_t weight;
+		std::shared_ptr<ResolvedName> name;
+		std::shared_ptr<BackendCounters> counters;
+		// smooth weighted round robin state
+		std::int64_t currentWeight = 0;
+		BackendHealth health = BackendHealth::Unknown;
+		HealthProbe probe;
+
+		// ejected backends are treated as if they were drained
+		std::uint32_t EffectiveWeight() const {
+			return health == BackendHealth::Unhealthy ? 0 : weight;
+		}
+	};
+
+	// backends of an entry, with the first port of the entry range being forwarded to port of the selected backend.
+	// Not thread safe: forwarders use it under their entries lock
+	class BackendSet {
+	private:
+		std::vector<Backend> _backends;
+		BalancingPolicy _policy = BalancingPolicy::RoundRobin;
+		std::uint32_t _random = 2463534242u;
+		HealthCheck _healthCheck;
+
+		std::uint32_t NextRandom();
+		Backend* SelectRoundRobin();
+		Backend* SelectLeastConnections();
+		Backend* SelectPowerOfTwoChoices();
+		void StartProbe(Backend& backend, int socketType, HANDLE probeEvent, std::chrono::steady_clock::time_point now);
+		// returns 1 on success, -1 on failure and 0 while the probe is still pending
+		int PollProbe(Backend& backend, int socketType);
+		void OnProbeResult(Backend& backend, bool succeeded);
+	public:
+		// replaces the weight when the backend is already there
+		void Add(const char* address, std::uint32_t port, std::uint32_t weight, std::shared_ptr<ResolvedName> name);
+		bool Remove(const char* address, std::uint32_t port);
+		// leaves the given backend alone in the set, keeping its weight if it was there already
+		void Replace(const char* address, std::uint32_t port, std::shared_ptr<ResolvedName> name);
+		void SetPolicy(BalancingPolicy policy) {
+			_policy = policy;
+		}
+		// returns nullptr when there is no backend with a non zero weight
+		Backend* Select();
+		bool Any(const std::function<bool(const Backend&)>& predicate) const;
+		// the remote the entry was added or last updated with, unless it was removed since
+		const Backend* First() const {
+			return _backends.empty() ? nullptr : &_backends.front();
+		}
+
+		void SetHealthCheck(const HealthCheck& check);
+		bool HealthChecked() const {
+			return _healthCheck.intervalMs != 0;
+		}
+		// starts due probes and collects finished ones, with all probe sockets signaling probeEvent. Returns when the set
+		// next needs to run, or time_point::max() when health checking is disabled
+		std::chrono::steady_clock::time_point RunHealthChecks(int socketType, HANDLE probeEvent, std::chrono::steady_clock::time_point now);
+		bool GetHealth(const char* address, std::uint32_t port, BackendHealth& health) const;
+	};
+}
@@ -0,0 +1,263 @@
+#include <async.h>
+#include <atomic>
+#include <map>
+#include <unordered_map>
+#include <vector>
+#include <algorithm>
+#include "Forwarders.h"
+#include "Runtime.h"
+
+using namespace forwarding;
+using namespace std::chrono;
+
+namespace forwarding {
+	struct SocketWaiter {
+		std::uint64_t id;
+		long events;
+		std::function<void(long, int)> callback;
+	};
+
+	struct WatchedSocket {
+		// the socket is selected on an event of its own, reported with this index
+		std::size_t index;
+		SafeAutoResetEvent event;
+		// mask currently selected on the socket
+		long armed = 0;
+		// recorded events nobody waited for yet. FD_CLOSE stays pending once recorded
+		long pending = 0;
+		int connectError = 0;
+		std::vector<SocketWaiter> waiters;
+	};
+
+	// a source of a loop of the runtime, so that coroutines run on the same threads as the forwarders
+	class EventLoop::Impl : public LoopSource, public std::enable_shared_from_this<EventLoop::Impl> {
+	private:
+		// keeps the loop running
+		std::shared_ptr<Runtime::Impl> _runtime;
+		std::unique_ptr<LoopAttachment> _attachment;
+		std::unordered_map<std::size_t, SOCKET> _events;
+		std::size_t _nextEvent = 0;
+		std::map<SOCKET, WatchedSocket> _sockets;
+		// expired waiters are looked up by id, so that completed waits do not have to remove their deadline
+		std::multimap<steady_clock::time_point, std::pair<SOCKET, std::uint64_t>> _deadlines;
+		std::uint64_t _nextWaiterId = 0;
+
+		std::atomic<bool> _running;
+
+		void Arm(SOCKET s, WatchedSocket& watched) {
+			long mask = FD_CLOSE;
+			for (auto& w : watched.waiters) {
+				mask |= w.events;
+			}
+			// interest is only widened: dropping events would need a kernel transition each time a wait completes
+			mask |= watched.armed;
+			if (mask != watched.armed) {
+				socketApi().EventSelect(s, watched.event.get(), mask);
+				watched.armed = mask;
+			}
+		}
+
+		// completes the waiters satisfied by the pending events, one at a time as a completion may change the waiters
+		void Dispatch(SOCKET s) {
+			for (;;) {
+				auto found = _sockets.find(s);
+				if (found == _sockets.end()) {
+					return;
+				}
+				auto& watched = found->second;
+				auto waiter = std::find_if(watched.waiters.begin(), watched.waiters.end(), [&watched](const SocketWaiter& w) {
+					return (watched.pending & (w.events | FD_CLOSE)) != 0;
+				});
+				if (waiter == watched.waiters.end()) {
+					return;
+				}
+				auto events = watched.pending & (waiter->events | FD_CLOSE);
+				watched.pending &= ~(events & ~FD_CLOSE);
+				auto error = (events & FD_CONNECT) != 0 ? watched.connectError : 0;
+				auto callback = std::move(waiter->callback);
+				watched.waiters.erase(waiter);
+				callback(events, error);
+			}
+		}
+
+		void OnSocketSignaled(SOCKET s) {
+			auto found = _sockets.find(s);
+			if (found == _sockets.end()) {
+				return;
+			}
+			WSANETWORKEVENTS events;
+			if (0 != socketApi().EnumNetworkEvents(s, &events) || events.lNetworkEvents == 0) {
+				return;
+			}
+			found->second.pending |= events.lNetworkEvents;
+			if ((events.lNetworkEvents & FD_CONNECT) != 0) {
+				found->second.connectError = events.iErrorCode[FD_CONNECT_BIT];
+			}
+			Dispatch(s);
+		}
+
+		void ExpireDeadlines() {
+			auto now = clockNow();
+			while (!_deadlines.empty() && _deadlines.begin()->first <= now) {
+				auto target = _deadlines.begin()->second;
+				_deadlines.erase(_deadlines.begin());
+				auto found = _sockets.find(target.first);
+				if (found == _sockets.end()) {
+					continue;
+				}
+				auto& waiters = found->second.waiters;
+				auto waiter = std::find_if(waiters.begin(), waiters.end(), [&target](const SocketWaiter& w) {return w.id == target.second; });
+				if (waiter == waiters.end()) {
+					continue;
+				}
+				auto callback = std::move(waiter->callback);
+				waiters.erase(waiter);
+				callback(0, WSAETIMEDOUT);
+			}
+		}
+
+	public:
+		explicit Impl(std::shared_ptr<Runtime::Impl> runtime) : _runtime(std::move(runtime)), _running(false) {
+			_attachment = _runtime->Attach(*this, 0, "EventLoop");
+		}
+		~Impl() {
+			Stop();
+		}
+
+		void OnSignaled(std::size_t index) override {
+			// forgotten while its signal was dispatched
+			auto found = _events.find(index);
+			if (found != _events.end()) {
+				OnSocketSignaled(found->second);
+			}
+		}
+		void OnDeadline() override {
+			ExpireDeadlines();
+		}
+		steady_clock::time_point NextDeadline() override {
+			return _deadlines.empty() ? steady_clock::time_point::max() : _deadlines.begin()->first;
+		}
+
+		void Start() {
+			if (_running) {
+				return;
+			}
+			_running = true;
+			_attachment->Enable();
+		}
+		void Stop() {
+			if (!_running) {
+				return;
+			}
+			_running = false;
+			_attachment->Disable();
+		}
+
+		// callbacks posted before a stop still run, for the sockets handed to CloseSocket to be closed
+		void Post(std::function<void()> callback) {
+			_attachment->Post(std::move(callback));
+		}
+		bool IsLoopThread() const {
+			return _attachment->IsLoopThread();
+		}
+
+		void WaitFor(SOCKET s, long events, milliseconds timeout, std::function<void(long, int)> callback) {
+			auto found = _sockets.find(s);
+			if (found == _sockets.end()) {
+				WatchedSocket watched;
+				watched.index = _nextEvent++;
+				watched.event = _attachment->AddEvent(watched.index);
+				_events.emplace(watched.index, s);
+				found = _sockets.insert(std::make_pair(s, std::move(watched))).first;
+			}
+			auto& watched = found->second;
+			auto id = ++_nextWaiterId;
+			watched.waiters.push_back(SocketWaiter{ id, events, std::move(callback) });
+			if (timeout.count() > 0) {
+				_deadlines.insert(std::make_pair(clockNow() + timeout, std::make_pair(s, id)));
+			}
+			Arm(s, watched);
+			if ((watched.pending & (events | FD_CLOSE)) != 0) {
+				// already recorded: completing from here would resume the waiting coroutine from within its own suspension
+				auto weak = std::weak_ptr<EventLoop::Impl>(shared_from_this());
+				Post([weak, s]() {
+					auto that = weak.lock();
+					if (that) {
+						that->Dispatch(s);
+					}
+				});
+			}
+		}
+		void Forget(SOCKET s) {
+			auto found = _sockets.find(s);
+			if (found == _sockets.end()) {
+				return;
+			}
+			auto waiters = std::move(found->second.waiters);
+			socketApi().EventSelect(s, nullptr, 0);
+			_attachment->RemoveEvent(found->second.event);
+			_events.erase(found->second.index);
+			_sockets.erase(found);
+			for (auto& w : waiters) {
+				auto callback = std::move(w.callback);
+				Post([callback]() {
+					callback(0, WSAENOTSOCK);
+				});
+			}
+		}
+		void CloseSocket(SafeSocket&& socket) {
+			if (IsLoopThread()) {
+				Forget(socket.Get());
+				socket.Close();
+				return;
+			}
+			auto s = socket.Release();
+			auto weak = std::weak_ptr<EventLoop::Impl>(shared_from_this());
+			Post([weak, s]() {
+				auto that = weak.lock();
+				if (that) {
+					that->Forget(s);
+				}
+				SafeSocket closing = s;
+			});
+		}
+	};
+
+	EventLoop::EventLoop() : _impl(std::make_shared<Impl>(Runtime::Default()))
+	{
+	}
+	EventLoop::EventLoop(Runtime& runtime) : _impl(std::make_shared<Impl>(runtime._impl))
+	{
+	}
+	EventLoop::~EventLoop()
+	{
+	}
+	void EventLoop::Start()
+	{
+		_impl->Start();
+	}
+	void EventLoop::Stop()
+	{
+		_impl->Stop();
+	}
+	void EventLoop::Post(std::function<void()> callback)
+	{
+		_impl->Post(std::move(callback));
+	}
+	bool EventLoop::IsLoopThread() const
+	{
+		return _impl->IsLoopThread();
+	}
+	void EventLoop::WaitFor(SOCKET s, long events, milliseconds timeout, std::function<void(long, int)> callback)
+	{
+		_impl->WaitFor(s, events, timeout, std::move(callback));
+	}
+	void EventLoop::Forget(SOCKET s)
+	{
+		_impl->Forget(s);
+	}
+	void EventLoop::CloseSocket(SafeSocket&& socket)
+	{
+		_impl->CloseSocket(std::move(socket));
+	}
+}
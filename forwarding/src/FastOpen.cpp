@@ -0,0 +1,151 @@
+#include "FastOpen.h"
+#include <ws2tcpip.h>
+#include <mswsock.h>
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <mutex>
+#include <vector>
+
+using namespace forwarding;
+
+namespace forwarding {
+	struct FastOpenOperation {
+		WSAOVERLAPPED overlapped;
+		LPFN_CONNECTEX connectEx = nullptr;
+		sockaddr_storage address;
+		int addressLen = 0;
+		char data[FastOpenDataSize];
+		std::size_t size = 0;
+		bool started = false;
+		bool completed = false;
+	};
+}
+
+namespace {
+	// the extension is the same for all the tcp sockets of the process
+	std::atomic<LPFN_CONNECTEX> g_connectEx{ nullptr };
+
+	// connects whose pair was collected while they were pending, until the system completes them
+	std::mutex g_abandonedMut;
+	std::vector<std::unique_ptr<FastOpenOperation>> g_abandoned;
+
+	LPFN_CONNECTEX LoadConnectEx(SOCKET s) {
+		auto connectEx = g_connectEx.load();
+		if (connectEx) {
+			return connectEx;
+		}
+		GUID guid = WSAID_CONNECTEX;
+		DWORD returned = 0;
+		if (0 != WSAIoctl(s, SIO_GET_EXTENSION_FUNCTION_POINTER, &guid, sizeof(guid), &connectEx, sizeof(connectEx), &returned, nullptr, nullptr)) {
+			return nullptr;
+		}
+		g_connectEx.store(connectEx);
+		return connectEx;
+	}
+
+	void ReclaimAbandoned() {
+		std::lock_guard<std::mutex> lg(g_abandonedMut);
+		g_abandoned.erase(std::remove_if(g_abandoned.begin(), g_abandoned.end(), [](const std::unique_ptr<FastOpenOperation>& operation) {
+			return HasOverlappedIoCompleted(&operation->overlapped);
+		}), g_abandoned.end());
+	}
+}
+
+bool forwarding::EnableFastOpenListener(SOCKET s)
+{
+	DWORD enabled = 1;
+	return 0 == setsockopt(s, IPPROTO_TCP, TCP_FASTOPEN, reinterpret_cast<const char*>(&enabled), sizeof(enabled));
+}
+
+forwarding::FastOpenConnect::FastOpenConnect()
+{
+}
+
+forwarding::FastOpenConnect::~FastOpenConnect()
+{
+	if (_operation && _operation->started && !_operation->completed && !HasOverlappedIoCompleted(&_operation->overlapped)) {
+		std::lock_guard<std::mutex> lg(g_abandonedMut);
+		g_abandoned.push_back(std::move(_operation));
+	}
+}
+
+bool forwarding::FastOpenConnect::Prepare(SOCKET s, int family, const sockaddr* address, int addressLen)
+{
+	ReclaimAbandoned();
+	if ((family != AF_INET && family != AF_INET6) || addressLen > static_cast<int>(sizeof(sockaddr_storage))) {
+		return false;
+	}
+	auto connectEx = LoadConnectEx(s);
+	if (!connectEx) {
+		return false;
+	}
+	DWORD enabled = 1;
+	if (0 != setsockopt(s, IPPROTO_TCP, TCP_FASTOPEN, reinterpret_cast<const char*>(&enabled), sizeof(enabled))) {
+		return false;
+	}
+	sockaddr_storage any;
+	ZeroMemory(&any, sizeof(any));
+	any.ss_family = static_cast<short>(family);
+	auto anyLen = family == AF_INET ? sizeof(sockaddr_in) : sizeof(sockaddr_in6);
+	if (0 != bind(s, reinterpret_cast<const sockaddr*>(&any), static_cast<int>(anyLen))) {
+		return false;
+	}
+	_operation = std::make_unique<FastOpenOperation>();
+	_operation->connectEx = connectEx;
+	std::memcpy(&_operation->address, address, addressLen);
+	_operation->addressLen = addressLen;
+	return true;
+}
+
+std::size_t forwarding::FastOpenConnect::ReadFirstBytes(SOCKET client)
+{
+	if (!_operation || _operation->started) {
+		return 0;
+	}
+	auto read = socketApi().Recv(client, _operation->data + _operation->size, static_cast<int>(FastOpenDataSize - _operation->size));
+	if (read <= 0) {
+		return 0;
+	}
+	_operation->size += read;
+	return static_cast<std::size_t>(read);
+}
+
+bool forwarding::FastOpenConnect::Start(SOCKET s, HANDLE completionEvent, int& error)
+{
+	error = 0;
+	ZeroMemory(&_operation->overlapped, sizeof(_operation->overlapped));
+	_operation->overlapped.hEvent = completionEvent;
+	DWORD sent = 0;
+	if (!_operation->connectEx(s, reinterpret_cast<const sockaddr*>(&_operation->address), _operation->addressLen,
+		_operation->size == 0 ? nullptr : _operation->data, static_cast<DWORD>(_operation->size), &sent, &_operation->overlapped)) {
+		error = WSAGetLastError();
+		if (error != WSA_IO_PENDING) {
+			return false;
+		}
+		error = 0;
+	}
+	// completing right away still signals the event
+	_operation->started = true;
+	return true;
+}
+
+bool forwarding::FastOpenConnect::TakeCompletion(SOCKET s, int& error, std::size_t& sent)
+{
+	if (!_operation || !_operation->started || _operation->completed || !HasOverlappedIoCompleted(&_operation->overlapped)) {
+		return false;
+	}
+	_operation->completed = true;
+	DWORD bytes = 0;
+	DWORD flags = 0;
+	if (!WSAGetOverlappedResult(s, &_operation->overlapped, &bytes, FALSE, &flags)) {
+		error = WSAGetLastError();
+		sent = 0;
+		return true;
+	}
+	// shutdown and getpeername only work on a socket connected by ConnectEx once its context is updated
+	setsockopt(s, SOL_SOCKET, SO_UPDATE_CONNECT_CONTEXT, nullptr, 0);
+	error = 0;
+	sent = bytes;
+	return true;
+}
@@ -0,0 +1,37 @@
+#pragma once
+#include <common.h>
+#include <memory>
+namespace forwarding {
+	// the most of the first bytes of a client carried by the SYN of the upstream connect, about what fits in one segment
+	const std::size_t FastOpenDataSize = 1400;
+
+	// lets clients carry data in their SYN, which is then readable as soon as the connection is accepted. Returns false when
+	// the system does not support TCP fast open
+	bool EnableFastOpenListener(SOCKET s);
+
+	struct FastOpenOperation;
+
+	// an upstream connect made with ConnectEx, which carries the first bytes of the client in its SYN once the upstream handed
+	// out a fast open cookie, and sends them right after the handshake otherwise. Like overlapped sends, it always uses winsock
+	class FastOpenConnect {
+	private:
+		std::unique_ptr<FastOpenOperation> _operation;
+	public:
+		FastOpenConnect();
+		FastOpenConnect(const FastOpenConnect&) = delete;
+		FastOpenConnect& operator =(const FastOpenConnect&) = delete;
+		// a connect still pending is left to complete on its own: its overlapped structure and data are reclaimed once the
+		// system is done with them
+		~FastOpenConnect();
+
+		// enables fast open on s and binds it, as ConnectEx requires. Returns false when fast open cannot be used for s, which
+		// is then left to be connected the regular way
+		bool Prepare(SOCKET s, int family, const sockaddr* address, int addressLen);
+		// takes what the client sent so far, up to FastOpenDataSize, for the SYN to carry it. Returns the bytes taken
+		std::size_t ReadFirstBytes(SOCKET client);
+		// completionEvent is signaled when the connect completes. Returns false with the winsock error when it failed right away
+		bool Start(SOCKET s, HANDLE completionEvent, int& error);
+		// true once after the connect completed, with its winsock error and the bytes carried
+		bool TakeCompletion(SOCKET s, int& error, std::size_t& sent);
+	};
+}
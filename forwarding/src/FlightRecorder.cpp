@@ -0,0 +1,93 @@
+#include "FlightRecorder.h"
+#include <algorithm>
+#include <mutex>
+#include <vector>
+
+using namespace forwarding;
+
+namespace {
+	// rings of exited threads are kept for their history, up to this count
+	const std::size_t MaxRetiredRings = 16;
+
+	std::mutex g_ringsMut;
+	std::vector<std::shared_ptr<FlightRing>> g_rings;
+	std::atomic<std::uint32_t> g_nextConnectionId{ 0 };
+
+	struct ThreadRing {
+		std::shared_ptr<FlightRing> ring;
+		ThreadRing() : ring(std::make_shared<FlightRing>()) {
+			ring->threadId = GetCurrentThreadId();
+			std::lock_guard<std::mutex> lg(g_ringsMut);
+			auto retired = std::count_if(g_rings.begin(), g_rings.end(), [](const std::shared_ptr<FlightRing>& r) {return r->retired.load(); });
+			if (static_cast<std::size_t>(retired) >= MaxRetiredRings) {
+				// rings are registered in creation order: the first retired one is the oldest
+				g_rings.erase(std::find_if(g_rings.begin(), g_rings.end(), [](const std::shared_ptr<FlightRing>& r) {return r->retired.load(); }));
+			}
+			g_rings.push_back(ring);
+		}
+		~ThreadRing() {
+			ring->retired = true;
+		}
+	};
+
+	void CopyRing(const FlightRing& ring, std::vector<std::pair<PackedFlightRecord, std::uint32_t>>& out) {
+		auto end = ring.head.load(std::memory_order_acquire);
+		auto begin = end > FlightRingSize ? end - FlightRingSize : 0;
+		auto first = out.size();
+		for (auto i = begin; i < end; ++i) {
+			out.push_back(std::make_pair(ring.records[i % FlightRingSize], ring.threadId));
+		}
+		// the writer may have lapped us while copying: records at or before the slot it is writing are not trustworthy
+		std::atomic_thread_fence(std::memory_order_acquire);
+		auto after = ring.head.load(std::memory_order_relaxed);
+		auto overwritten = after >= FlightRingSize ? after - FlightRingSize + 1 : 0;
+		if (overwritten > begin) {
+			auto drop = static_cast<std::size_t>(std::min(overwritten, end) - begin);
+			out.erase(out.begin() + first, out.begin() + first + drop);
+		}
+	}
+}
+
+FlightRing& forwarding::ThreadFlightRing()
+{
+	thread_local ThreadRing threadRing;
+	return *threadRing.ring;
+}
+
+std::uint32_t forwarding::NewConnectionId()
+{
+	return ++g_nextConnectionId;
+}
+
+std::vector<FlightRecord> forwarding::SnapshotFlightRecorder()
+{
+	std::vector<std::shared_ptr<FlightRing>> rings;
+	{
+		std::lock_guard<std::mutex> lg(g_ringsMut);
+		rings = g_rings;
+	}
+	std::vector<std::pair<PackedFlightRecord, std::uint32_t>> packed;
+	for (auto& ring : rings) {
+		CopyRing(*ring, packed);
+	}
+	std::sort(packed.begin(), packed.end(), [](const std::pair<PackedFlightRecord, std::uint32_t>& lhs, const std::pair<PackedFlightRecord, std::uint32_t>& rhs) {
+		return lhs.first.ticks < rhs.first.ticks;
+	});
+	LARGE_INTEGER frequency;
+	QueryPerformanceFrequency(&frequency);
+	std::vector<FlightRecord> result;
+	result.reserve(packed.size());
+	for (auto& p : packed) {
+		FlightRecord record;
+		record.timestampUs = static_cast<std::uint64_t>(p.first.ticks / frequency.QuadPart * 1000000 + p.first.ticks % frequency.QuadPart * 1000000 / frequency.QuadPart);
+		record.threadId = p.second;
+		record.connectionId = p.first.connectionId;
+		record.event = static_cast<FlightEvent>(p.first.event);
+		record.localPort = p.first.localPort;
+		record.value = p.first.value;
+		record.bytesToRemote = p.first.bytesToRemote;
+		record.bytesToLocal = p.first.bytesToLocal;
+		result.push_back(record);
+	}
+	return result;
+}
@@ -0,0 +1,49 @@
+#pragma once
+#include <client.h>
+#include <windows.h>
+#include <atomic>
+#include <cstdint>
+namespace forwarding {
+	const std::size_t FlightRingSize = 4096;
+
+	struct PackedFlightRecord {
+		std::int64_t ticks;
+		std::uint32_t connectionId;
+		std::uint16_t localPort;
+		std::uint8_t event;
+		std::int32_t value;
+		std::uint64_t bytesToRemote;
+		std::uint64_t bytesToLocal;
+	};
+
+	// written by its thread only. Readers copy records without synchronizing with the writer, and drop the ones that may have
+	// been overwritten while they were copying
+	struct FlightRing {
+		std::uint32_t threadId;
+		std::atomic<std::uint64_t> head{ 0 };
+		std::atomic<bool> retired{ false };
+		PackedFlightRecord records[FlightRingSize];
+	};
+
+	// ring of the calling thread, registered on first use
+	FlightRing& ThreadFlightRing();
+
+	std::uint32_t NewConnectionId();
+
+	inline void RecordFlight(FlightEvent event, std::uint32_t connectionId, std::uint16_t localPort, std::int32_t value = 0,
+		std::uint64_t bytesToRemote = 0, std::uint64_t bytesToLocal = 0) {
+		auto& ring = ThreadFlightRing();
+		auto head = ring.head.load(std::memory_order_relaxed);
+		auto& record = ring.records[head % FlightRingSize];
+		LARGE_INTEGER ticks;
+		QueryPerformanceCounter(&ticks);
+		record.ticks = ticks.QuadPart;
+		record.connectionId = connectionId;
+		record.localPort = localPort;
+		record.event = static_cast<std::uint8_t>(event);
+		record.value = value;
+		record.bytesToRemote = bytesToRemote;
+		record.bytesToLocal = bytesToLocal;
+		ring.head.store(head + 1, std::memory_order_release);
+	}
+}
@@ -1,5 +1,7 @@
 #pragma once 
 #include <client.h>
+#include <cstring>
+#include <vector>
 namespace forwarding {
 	using SafeAutoResetEvent = std::shared_ptr<void>;
 	inline SafeAutoResetEvent MakeAutoResetEvent()
@@ -10,4 +12,48 @@ namespace forwarding {
 			}
 		});
 	}
+
+	// copies a resolved address and patches its port, so that a range entry can share one resolution across all its ports
+	inline int SockAddrWithPort(const ResolvedAddress& addr, std::uint32_t port, sockaddr_storage& out)
+	{
+		auto len = addr.SockAddrLen();
+		memcpy(&out, addr.SockAddr(), len);
+		if (out.ss_family == AF_INET) {
+			reinterpret_cast<sockaddr_in&>(out).sin_port = htons(static_cast<u_short>(port));
+		}
+		return len;
+	}
+
+	// the process the sockets are duplicated for keeps their pending connections and datagrams, see ReleaseSockets
+	inline std::vector<WSAPROTOCOL_INFOW> DuplicateSockets(const std::vector<SafeSocket>& sockets, DWORD processId) {
+		std::vector<WSAPROTOCOL_INFOW> result(sockets.size());
+		for (std::size_t i = 0; i < sockets.size(); ++i) {
+			if (0 != WSADuplicateSocketW(sockets[i].Get(), processId, &result[i])) {
+				throw TransportErrorException{ TransportError::InvalidSocket };
+			}
+		}
+		return result;
+	}
+
+	inline SafeSocket AdoptSocket(const WSAPROTOCOL_INFOW& info) {
+		return WSASocketW(FROM_PROTOCOL_INFO, FROM_PROTOCOL_INFO, FROM_PROTOCOL_INFO, const_cast<LPWSAPROTOCOL_INFOW>(&info), 0, WSA_FLAG_OVERLAPPED);
+	}
+
+	// shutting down a socket handed over to another process would shut it down there too: only our descriptor is closed.
+	// Event selection must not be touched either, as it is shared with the other process
+	inline void ReleaseSockets(std::vector<SafeSocket>& sockets) {
+		for (auto& s : sockets) {
+			closesocket(s.Release());
+		}
+		sockets.clear();
+	}
+
+	// resets the connection instead of going through the graceful shutdown of SafeSocket::Close
+	inline void AbortiveClose(SOCKET s) {
+		linger l;
+		l.l_onoff = 1;
+		l.l_linger = 0;
+		socketApi().SetOption(s, SOL_SOCKET, SO_LINGER, (char*)&l, sizeof(l));
+		socketApi().Close(s);
+	}
 }
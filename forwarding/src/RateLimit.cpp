@@ -0,0 +1,201 @@
+#include "RateLimit.h"
+#include <algorithm>
+
+using namespace forwarding;
+using namespace std::chrono;
+
+namespace {
+	// an empty byte bucket is retried once it can pay for a read worth its wakeup, rather than for a single byte
+	const double MinRefillBytes = 4 * 1024;
+}
+
+void forwarding::TokenBucket::Configure(std::uint64_t rate, std::uint64_t burst, steady_clock::time_point now)
+{
+	auto wasUnlimited = Unlimited();
+	_rate = static_cast<double>(rate);
+	_burst = static_cast<double>(burst != 0 ? burst : rate);
+	// a bucket starts full
+	_tokens = wasUnlimited ? _burst : std::min(_tokens, _burst);
+	_last = now;
+}
+
+void forwarding::TokenBucket::Refill(steady_clock::time_point now)
+{
+	if (Unlimited() || now <= _last) {
+		return;
+	}
+	_tokens = std::min(_burst, _tokens + _rate * duration<double>(now - _last).count());
+	_last = now;
+}
+
+steady_clock::duration forwarding::TokenBucket::UntilAvailable(double tokens) const
+{
+	auto missing = std::min(tokens, _burst) - _tokens;
+	if (Unlimited() || missing <= 0) {
+		return steady_clock::duration::zero();
+	}
+	return duration_cast<steady_clock::duration>(duration<double>(missing / _rate));
+}
+
+forwarding::RateShaper::RateShaper(const RateLimit& limit, steady_clock::time_point now)
+{
+	Configure(limit, now);
+}
+
+void forwarding::RateShaper::Configure(const RateLimit& limit, steady_clock::time_point now)
+{
+	std::lock_guard<std::mutex> lg(_mut);
+	_bytes.Refill(now);
+	_packets.Refill(now);
+	_bytes.Configure(limit.bytesPerSecond, limit.burstBytes, now);
+	_packets.Configure(limit.packetsPerSecond, limit.burstPackets, now);
+}
+
+std::size_t forwarding::RateShaper::Allowance(steady_clock::time_point now)
+{
+	std::lock_guard<std::mutex> lg(_mut);
+	_packets.Refill(now);
+	if (!_packets.Unlimited() && _packets.Tokens() < 1) {
+		return 0;
+	}
+	if (_bytes.Unlimited()) {
+		return SIZE_MAX;
+	}
+	_bytes.Refill(now);
+	return _bytes.Tokens() < 1 ? 0 : static_cast<std::size_t>(_bytes.Tokens());
+}
+
+void forwarding::RateShaper::Consume(std::size_t bytes, std::size_t packets)
+{
+	std::lock_guard<std::mutex> lg(_mut);
+	if (!_bytes.Unlimited()) {
+		_bytes.Take(static_cast<double>(bytes));
+	}
+	if (!_packets.Unlimited()) {
+		_packets.Take(static_cast<double>(packets));
+	}
+}
+
+void forwarding::RateShaper::Refund(std::size_t bytes, std::size_t packets)
+{
+	std::lock_guard<std::mutex> lg(_mut);
+	if (!_bytes.Unlimited()) {
+		_bytes.Take(-static_cast<double>(bytes));
+	}
+	if (!_packets.Unlimited()) {
+		_packets.Take(-static_cast<double>(packets));
+	}
+}
+
+bool forwarding::RateShaper::TryConsume(std::size_t bytes, steady_clock::time_point now)
+{
+	std::lock_guard<std::mutex> lg(_mut);
+	_bytes.Refill(now);
+	_packets.Refill(now);
+	if ((!_bytes.Unlimited() && _bytes.Tokens() < static_cast<double>(bytes)) || (!_packets.Unlimited() && _packets.Tokens() < 1)) {
+		return false;
+	}
+	if (!_bytes.Unlimited()) {
+		_bytes.Take(static_cast<double>(bytes));
+	}
+	if (!_packets.Unlimited()) {
+		_packets.Take(1);
+	}
+	return true;
+}
+
+steady_clock::time_point forwarding::RateShaper::ReadyAt(steady_clock::time_point now)
+{
+	std::lock_guard<std::mutex> lg(_mut);
+	return now + std::max(_bytes.UntilAvailable(MinRefillBytes), _packets.UntilAvailable(1));
+}
+
+std::size_t forwarding::PairShaping::Allowance(steady_clock::time_point now)
+{
+	auto allowed = entry ? entry->Allowance(now) : SIZE_MAX;
+	if (client && allowed != 0) {
+		allowed = std::min(allowed, client->Allowance(now));
+	}
+	return allowed;
+}
+
+void forwarding::PairShaping::Consume(std::size_t bytes, std::size_t packets)
+{
+	if (entry) {
+		entry->Consume(bytes, packets);
+	}
+	if (client) {
+		client->Consume(bytes, packets);
+	}
+}
+
+bool forwarding::PairShaping::TryConsume(std::size_t bytes, steady_clock::time_point now)
+{
+	if (client && !client->TryConsume(bytes, now)) {
+		return false;
+	}
+	if (entry && !entry->TryConsume(bytes, now)) {
+		// the client does not pay for a datagram dropped by its entry
+		if (client) {
+			client->Refund(bytes, 1);
+		}
+		return false;
+	}
+	return true;
+}
+
+steady_clock::time_point forwarding::PairShaping::ReadyAt(steady_clock::time_point now)
+{
+	auto ready = now;
+	if (entry) {
+		ready = std::max(ready, entry->ReadyAt(now));
+	}
+	if (client) {
+		ready = std::max(ready, client->ReadyAt(now));
+	}
+	return ready;
+}
+
+void forwarding::EntryShaper::Configure(const RateLimit& entry, const RateLimit& perClient)
+{
+	auto now = clockNow();
+	std::lock_guard<std::mutex> lg(_mut);
+	if (_entry) {
+		_entry->Configure(entry, now);
+	}
+	else if (IsLimited(entry)) {
+		_entry = std::make_shared<RateShaper>(entry, now);
+	}
+	_perClient = perClient;
+	for (auto& client : _clients) {
+		if (auto shaper = client.second.lock()) {
+			shaper->Configure(perClient, now);
+		}
+	}
+}
+
+PairShaping forwarding::EntryShaper::ForClient(const sockaddr_in& client)
+{
+	std::lock_guard<std::mutex> lg(_mut);
+	PairShaping shaping;
+	shaping.entry = _entry;
+	if (!IsLimited(_perClient)) {
+		return shaping;
+	}
+	auto& known = _clients[client.sin_addr.s_addr];
+	shaping.client = known.lock();
+	if (!shaping.client) {
+		shaping.client = std::make_shared<RateShaper>(_perClient, clockNow());
+		known = shaping.client;
+		// forgets the clients without pairs or flows left while we are at it
+		for (auto it = _clients.begin(); it != _clients.end();) {
+			if (it->second.expired()) {
+				it = _clients.erase(it);
+			}
+			else {
+				++it;
+			}
+		}
+	}
+	return shaping;
+}
@@ -0,0 +1,85 @@
+#pragma once
+#include <client.h>
+#include <chrono>
+#include <map>
+#include <memory>
+#include <mutex>
+namespace forwarding {
+
+	// refilled lazily from the elapsed time when used, so that no timer runs while an entry is under its limits
+	class TokenBucket {
+	private:
+		double _rate = 0;
+		double _burst = 0;
+		// goes negative when concurrent users overdraw it, which delays the next refill accordingly
+		double _tokens = 0;
+		std::chrono::steady_clock::time_point _last;
+	public:
+		// a rate of 0 is unlimited. A burst of 0 is one second worth of the rate
+		void Configure(std::uint64_t rate, std::uint64_t burst, std::chrono::steady_clock::time_point now);
+		bool Unlimited() const {
+			return _rate == 0;
+		}
+		void Refill(std::chrono::steady_clock::time_point now);
+		double Tokens() const {
+			return _tokens;
+		}
+		void Take(double tokens) {
+			_tokens -= tokens;
+		}
+		// time until the bucket holds tokens, capped by its burst
+		std::chrono::steady_clock::duration UntilAvailable(double tokens) const;
+	};
+
+	// the byte and packet buckets of an entry, or of one client of an entry. Shared by the pairs or flows it limits, which may
+	// run on different threads
+	class RateShaper {
+	private:
+		std::mutex _mut;
+		TokenBucket _bytes;
+		TokenBucket _packets;
+	public:
+		RateShaper(const RateLimit& limit, std::chrono::steady_clock::time_point now);
+		void Configure(const RateLimit& limit, std::chrono::steady_clock::time_point now);
+		// bytes that can be read now, SIZE_MAX when unlimited
+		std::size_t Allowance(std::chrono::steady_clock::time_point now);
+		void Consume(std::size_t bytes, std::size_t packets);
+		void Refund(std::size_t bytes, std::size_t packets);
+		// takes a whole datagram, or nothing when it is over the limit
+		bool TryConsume(std::size_t bytes, std::chrono::steady_clock::time_point now);
+		// when reading is worth retrying after Allowance returned 0
+		std::chrono::steady_clock::time_point ReadyAt(std::chrono::steady_clock::time_point now);
+	};
+
+	// what limits a pair or a flow: the buckets of its entry and of its client address. Either may be missing
+	struct PairShaping {
+		std::shared_ptr<RateShaper> entry;
+		std::shared_ptr<RateShaper> client;
+
+		explicit operator bool() const {
+			return entry || client;
+		}
+		std::size_t Allowance(std::chrono::steady_clock::time_point now);
+		void Consume(std::size_t bytes, std::size_t packets);
+		bool TryConsume(std::size_t bytes, std::chrono::steady_clock::time_point now);
+		std::chrono::steady_clock::time_point ReadyAt(std::chrono::steady_clock::time_point now);
+	};
+
+	// rate limits of an entry. Only created once limits are set, so that entries without limits cost a null check
+	class EntryShaper {
+	private:
+		std::mutex _mut;
+		std::shared_ptr<RateShaper> _entry;
+		RateLimit _perClient;
+		// clients are forgotten once their last pair or flow is gone
+		std::map<ULONG, std::weak_ptr<RateShaper>> _clients;
+	public:
+		// applies to the pairs and flows already shaped by the entry too
+		void Configure(const RateLimit& entry, const RateLimit& perClient);
+		PairShaping ForClient(const sockaddr_in& client);
+	};
+
+	inline bool IsLimited(const RateLimit& limit) {
+		return limit.bytesPerSecond != 0 || limit.packetsPerSecond != 0;
+	}
+}
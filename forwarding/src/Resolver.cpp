@@ -0,0 +1,163 @@
+#include "Resolver.h"
+#include "compat.h"
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <algorithm>
+
+using namespace forwarding;
+using namespace std;
+using namespace std::chrono;
+
+namespace {
+	const int ResolverThreadCount = 2;
+	// a failed refresh keeps the previous address and is retried after this delay
+	const seconds FailedRefreshRetry{ 5 };
+
+	unique_ptr<ResolvedAddress> DefaultResolve(const char* hostName, int socketType, seconds& ttl) {
+		ttl = DefaultResolveTtl;
+		return socketType == SOCK_DGRAM ? ResolveUdp(hostName, 0) : Resolve(hostName, 0);
+	}
+
+	int64_t ExpiryFrom(seconds ttl) {
+		return (clockNow() + max(ttl, seconds(1))).time_since_epoch().count();
+	}
+
+	class Resolver {
+	private:
+		mutex _mut;
+		condition_variable _cv;
+		deque<function<void()>> _queue;
+		bool _started = false;
+		ResolveFunction _resolve = DefaultResolve;
+		map<pair<string, int>, weak_ptr<ResolvedName>> _cache;
+
+		void Work() {
+			for (;;) {
+				function<void()> job;
+				{
+					unique_lock<mutex> lk(_mut);
+					_cv.wait(lk, [this]() {return !_queue.empty(); });
+					job = move(_queue.front());
+					_queue.pop_front();
+				}
+				job();
+			}
+		}
+	public:
+		// never destroyed: its threads are detached and only end with the process
+		static Resolver& Instance() {
+			static Resolver* instance = new Resolver();
+			return *instance;
+		}
+
+		void Post(function<void()> job) {
+			lock_guard<mutex> lg(_mut);
+			if (!_started) {
+				for (int i = 0; i < ResolverThreadCount; ++i) {
+					startThread([this]() {Work(); });
+				}
+				_started = true;
+			}
+			_queue.push_back(move(job));
+			_cv.notify_one();
+		}
+
+		ResolveFunction Function() {
+			lock_guard<mutex> lg(_mut);
+			return _resolve;
+		}
+
+		// cached names resolved by the previous function are dropped, so that an override applies to the next entries
+		void SetFunction(ResolveFunction resolve) {
+			lock_guard<mutex> lg(_mut);
+			_resolve = move(resolve);
+			_cache.clear();
+		}
+
+		shared_ptr<ResolvedName> Lookup(const pair<string, int>& key) {
+			lock_guard<mutex> lg(_mut);
+			auto found = _cache.find(key);
+			if (found == _cache.end()) {
+				return nullptr;
+			}
+			auto name = found->second.lock();
+			if (!name) {
+				_cache.erase(found);
+			}
+			return name;
+		}
+
+		// returns the name cached by a concurrent resolution if there is one
+		shared_ptr<ResolvedName> Insert(const pair<string, int>& key, shared_ptr<ResolvedName> name) {
+			lock_guard<mutex> lg(_mut);
+			auto& cached = _cache[key];
+			auto existing = cached.lock();
+			if (existing) {
+				return existing;
+			}
+			cached = name;
+			return name;
+		}
+	};
+}
+
+forwarding::ResolvedName::ResolvedName(const char* hostName, int socketType, shared_ptr<const ResolvedAddress> address, seconds ttl)
+	: _hostName(hostName), _socketType(socketType), _current(move(address)), _expires(ttl.count() == 0 ? 0 : ExpiryFrom(ttl)), _refreshing(false)
+{
+}
+
+shared_ptr<const ResolvedAddress> forwarding::ResolvedName::Current()
+{
+	auto expires = _expires.load();
+	if (expires != 0 && clockNow().time_since_epoch().count() >= expires && !_refreshing.exchange(true)) {
+		Refresh();
+	}
+	return atomic_load(&_current);
+}
+
+void forwarding::ResolvedName::Refresh()
+{
+	auto self = shared_from_this();
+	Resolver::Instance().Post([self]() {
+		auto resolve = Resolver::Instance().Function();
+		auto ttl = DefaultResolveTtl;
+		try {
+			shared_ptr<const ResolvedAddress> address = resolve(self->_hostName.c_str(), self->_socketType, ttl);
+			atomic_store(&self->_current, address);
+		}
+		catch (...) {
+			ttl = FailedRefreshRetry;
+		}
+		self->_expires = ExpiryFrom(ttl);
+		self->_refreshing = false;
+	});
+}
+
+shared_ptr<ResolvedName> forwarding::ResolveName(const char* hostName, int socketType)
+{
+	if (IsLiteralAddress(hostName)) {
+		shared_ptr<const ResolvedAddress> address = socketType == SOCK_DGRAM ? ResolveUdp(hostName, 0) : Resolve(hostName, 0);
+		return make_shared<ResolvedName>(hostName, socketType, move(address), seconds(0));
+	}
+	auto& resolver = Resolver::Instance();
+	auto key = make_pair(string(hostName), socketType);
+	auto cached = resolver.Lookup(key);
+	if (cached) {
+		return cached;
+	}
+	auto ttl = DefaultResolveTtl;
+	shared_ptr<const ResolvedAddress> address = resolver.Function()(hostName, socketType, ttl);
+	return resolver.Insert(key, make_shared<ResolvedName>(hostName, socketType, move(address), ttl));
+}
+
+void forwarding::overrideResolver(ResolveFunction resolver)
+{
+	Resolver::Instance().SetFunction(move(resolver));
+}
+
+void forwarding::resetResolver()
+{
+	Resolver::Instance().SetFunction(DefaultResolve);
+}
@@ -0,0 +1,30 @@
+#pragma once
+#include <common.h>
+#include <atomic>
+#include <memory>
+#include <string>
+namespace forwarding {
+
+	// a remote host name shared by all the backends of the TCP and UDP forwarders targeting it. Once its TTL expires, the next
+	// use refreshes it in the background and keeps returning the previous address until the new one is there
+	class ResolvedName : public std::enable_shared_from_this<ResolvedName> {
+	private:
+		std::string _hostName;
+		int _socketType;
+		// swapped with atomic_store, so that a connection never sees a half updated address
+		std::shared_ptr<const ResolvedAddress> _current;
+		// steady_clock ticks, 0 for addresses that never expire
+		std::atomic<std::int64_t> _expires;
+		std::atomic<bool> _refreshing;
+
+		void Refresh();
+	public:
+		ResolvedName(const char* hostName, int socketType, std::shared_ptr<const ResolvedAddress> address, std::chrono::seconds ttl);
+		// the port of the returned address is meaningless: callers patch it with SockAddrWithPort
+		std::shared_ptr<const ResolvedAddress> Current();
+	};
+
+	// numeric addresses and unix socket paths are converted on the calling thread. Other names are served from the cache,
+	// or resolved on the calling thread the first time so that failures are reported to AddEntry
+	std::shared_ptr<ResolvedName> ResolveName(const char* hostName, int socketType);
+}
@@ -0,0 +1,589 @@
+#include "Runtime.h"
+#include "Tracing.h"
+#include <algorithm>
+#include <atomic>
+#include <future>
+#include <thread>
+#include <unordered_map>
+
+using namespace forwarding;
+using namespace std::chrono;
+
+namespace forwarding {
+	class RuntimeLoop;
+}
+
+namespace {
+	std::mutex g_threadStarterMut;
+	std::function<void(const std::function<void(void)>&)> g_threadStarter;
+
+	// the running loops, woken up by clockAdvanced
+	std::mutex g_loopsMut;
+	std::vector<std::weak_ptr<forwarding::RuntimeLoop>> g_loops;
+}
+
+void forwarding::startThread(const std::function<void(void)>& callback)
+{
+	std::function<void(const std::function<void(void)>&)> starter;
+	{
+		std::lock_guard<std::mutex> lg(g_threadStarterMut);
+		starter = g_threadStarter;
+	}
+	if (starter) {
+		starter(callback);
+		return;
+	}
+	std::thread(callback).detach();
+}
+
+void forwarding::overrideStartThread(std::function<void(const std::function<void(void)>&)> threadStarter)
+{
+	std::lock_guard<std::mutex> lg(g_threadStarterMut);
+	g_threadStarter = std::move(threadStarter);
+}
+
+void forwarding::resetStartThread()
+{
+	std::lock_guard<std::mutex> lg(g_threadStarterMut);
+	g_threadStarter = nullptr;
+}
+
+namespace {
+	std::shared_ptr<void> MakeHandle(HANDLE handle) {
+		return std::shared_ptr<void>(handle, [](void* h) {
+			if (h) {
+				CloseHandle(h);
+			}
+		});
+	}
+
+	// what a wait of the thread pool queues to the port of its loop each time its event is signaled
+	struct WaitCompletion {
+		HANDLE port;
+		ULONG_PTR key;
+	};
+
+	void CALLBACK OnWaitSatisfied(PTP_CALLBACK_INSTANCE, PVOID context, PTP_WAIT, TP_WAIT_RESULT) {
+		auto completion = static_cast<const WaitCompletion*>(context);
+		PostQueuedCompletionStatus(completion->port, 0, completion->key, nullptr);
+	}
+
+	// the wait only runs a callback once set again after each signal. Its callbacks are cancelled or waited for before it is
+	// closed, so that none posts to the port once it is released
+	std::shared_ptr<void> MakeWait(HANDLE port, ULONG_PTR key) {
+		auto completion = std::make_shared<WaitCompletion>(WaitCompletion{ port, key });
+		auto wait = CreateThreadpoolWait(OnWaitSatisfied, completion.get(), nullptr);
+		if (!wait) {
+			throw TransportErrorException{ TransportError::LoopSetupFailed };
+		}
+		return std::shared_ptr<void>(wait, [completion](void* w) {
+			auto wait = static_cast<PTP_WAIT>(w);
+			SetThreadpoolWait(wait, nullptr, nullptr);
+			WaitForThreadpoolWaitCallbacks(wait, TRUE);
+			CloseThreadpoolWait(wait);
+		});
+	}
+
+	// the key of the completions posted to wake the loop up, events have keys from 1
+	const ULONG_PTR WakeKey = 0;
+	// completions dequeued per wait
+	const ULONG CompletionBatch = 64;
+}
+
+namespace forwarding {
+	struct AttachedSource {
+		LoopSource* source;
+		const char* name;
+		// the key of each event of the source, guarded by the mutex of the loop
+		std::vector<std::pair<HANDLE, ULONG_PTR>> keys;
+		// set by Enable and cleared by Disable from any thread. The loop thread only calls the source while it is set, with
+		// callMut held so that Disable can wait out a call from another thread without waiting for the loop
+		std::atomic<bool> enabled{ false };
+		std::mutex callMut;
+		// only touched by the loop thread
+		steady_clock::time_point deadline = steady_clock::time_point::max();
+	};
+
+	// an event of a source, queued to the port of the loop by its wait each time it is signaled
+	struct LoopEvent {
+		std::shared_ptr<AttachedSource> attached;
+		std::size_t index;
+		SafeAutoResetEvent event;
+		std::shared_ptr<void> wait;
+	};
+
+	// one thread waiting on the completion port the events of all the sources attached to it are queued to. Each event
+	// belongs to a single source and is dispatched to it alone, however many sources and events the loop has
+	class RuntimeLoop : public std::enable_shared_from_this<RuntimeLoop> {
+	private:
+		std::shared_ptr<void> _port;
+		// only touched by the loop thread
+		std::vector<std::shared_ptr<AttachedSource>> _enabled;
+
+		std::mutex _mut;
+		std::unordered_map<ULONG_PTR, LoopEvent> _loopEvents;
+		ULONG_PTR _nextKey = WakeKey + 1;
+		std::vector<std::function<void()>> _posted;
+		// cleared once the loop thread ran the callbacks posted before it stopped, later ones are refused
+		bool _acceptingPosts = true;
+		// serializes the callbacks RunOnLoop runs on their caller once the loop thread exited
+		std::mutex _stoppedMut;
+
+		std::atomic<bool> _running;
+		std::atomic<DWORD> _threadId;
+		std::promise<void> _exited;
+		std::shared_future<void> _exitedFuture;
+		const microseconds _spin;
+		const DWORD_PTR _affinity;
+		const int _priority;
+
+		void RunPosted() {
+			std::vector<std::function<void()>> posted;
+			{
+				std::lock_guard<std::mutex> lg(_mut);
+				posted.swap(_posted);
+			}
+			for (auto& callback : posted) {
+				callback();
+			}
+			// posted work may have timed work of a source, like the waits of an EventLoop
+			for (auto& attached : _enabled) {
+				Call(*attached, [](LoopSource&) {});
+			}
+		}
+
+		// calls the source unless it got disabled, and asks for its next deadline
+		template <typename F>
+		static void Call(AttachedSource& attached, F call) {
+			std::lock_guard<std::mutex> lg(attached.callMut);
+			if (attached.enabled) {
+				call(*attached.source);
+				attached.deadline = attached.source->NextDeadline();
+			}
+		}
+
+		// the wait is set again before the source runs, so that a signal recorded while it runs is not lost
+		static void Arm(const LoopEvent& loopEvent) {
+			SetThreadpoolWait(static_cast<PTP_WAIT>(loopEvent.wait.get()), loopEvent.event.get(), nullptr);
+		}
+
+		void Dispatch(ULONG_PTR key) {
+			std::shared_ptr<AttachedSource> attached;
+			std::size_t index;
+			{
+				std::lock_guard<std::mutex> lg(_mut);
+				// removed since it got queued
+				auto found = _loopEvents.find(key);
+				if (found == _loopEvents.end()) {
+					return;
+				}
+				Arm(found->second);
+				attached = found->second.attached;
+				index = found->second.index;
+			}
+			Call(*attached, [index](LoopSource& source) {source.OnSignaled(index); });
+		}
+
+		void RunDeadlines() {
+			// the sources disabled from another thread are dropped here, by the thread that owns the list
+			_enabled.erase(std::remove_if(_enabled.begin(), _enabled.end(), [](const std::shared_ptr<AttachedSource>& a) {return !a->enabled; }), _enabled.end());
+			auto now = clockNow();
+			auto enabled = _enabled;
+			for (auto& attached : enabled) {
+				if (attached->deadline <= now) {
+					Call(*attached, [](LoopSource& source) {source.OnDeadline(); });
+				}
+			}
+		}
+
+		DWORD WaitTimeout() const {
+			auto next = steady_clock::time_point::max();
+			for (auto& attached : _enabled) {
+				if (attached->enabled) {
+					next = std::min(next, attached->deadline);
+				}
+			}
+			if (next == steady_clock::time_point::max()) {
+				return INFINITE;
+			}
+			auto now = clockNow();
+			if (next <= now) {
+				return 0;
+			}
+			// rounded up so that we do not wake up just before the deadline
+			return static_cast<DWORD>(duration_cast<milliseconds>(next - now).count()) + 1;
+		}
+
+		// polling the port keeps the thread runnable, so that a signal is picked up without the scheduler waking the thread
+		// up. Only the wait after the spin blocks
+		DWORD Wait(OVERLAPPED_ENTRY* completions, ULONG& removed) {
+			if (_spin.count() > 0) {
+				auto spinUntil = steady_clock::now() + _spin;
+				do {
+					if (GetQueuedCompletionStatusEx(_port.get(), completions, CompletionBatch, &removed, 0, TRUE)) {
+						return WAIT_OBJECT_0;
+					}
+					auto err = GetLastError();
+					if (err != WAIT_TIMEOUT || WaitTimeout() == 0) {
+						return err;
+					}
+					YieldProcessor();
+				} while (steady_clock::now() < spinUntil);
+			}
+			if (GetQueuedCompletionStatusEx(_port.get(), completions, CompletionBatch, &removed, WaitTimeout(), TRUE)) {
+				return WAIT_OBJECT_0;
+			}
+			return GetLastError();
+		}
+
+		void Run() {
+			_threadId = GetCurrentThreadId();
+			if (_affinity != 0) {
+				SetThreadAffinityMask(GetCurrentThread(), _affinity);
+			}
+			if (_priority != THREAD_PRIORITY_NORMAL) {
+				SetThreadPriority(GetCurrentThread(), _priority);
+			}
+			std::vector<OVERLAPPED_ENTRY> completions(CompletionBatch);
+			LoopProfiler profiler("RuntimeLoop", this);
+			while (_running) {
+				ULONG removed = 0;
+				profiler.BeforeWait();
+				// alertable, for the completions of the overlapped sends started by the sources to run
+				auto waitResult = Wait(&completions[0], removed);
+				profiler.AfterWait(waitResult);
+				if (!_running) {
+					break;
+				}
+				if (waitResult == WAIT_OBJECT_0) {
+					// the port hands out completions in the order they were queued, so that busy events do not starve the others
+					for (ULONG i = 0; i < removed && _running; ++i) {
+						if (completions[i].lpCompletionKey == WakeKey) {
+							RunPosted();
+						}
+						else {
+							Dispatch(completions[i].lpCompletionKey);
+						}
+					}
+				}
+				RunDeadlines();
+			}
+			// the callbacks posted before the stop still run, so that none is left waiting for its loop
+			std::vector<std::function<void()>> posted;
+			{
+				std::lock_guard<std::mutex> lg(_mut);
+				_acceptingPosts = false;
+				posted.swap(_posted);
+			}
+			for (auto& callback : posted) {
+				callback();
+			}
+			_threadId = 0;
+			_exited.set_value();
+		}
+
+		// false once the loop stopped, the callback being dropped
+		bool TryPost(std::function<void()> callback) {
+			{
+				std::lock_guard<std::mutex> lg(_mut);
+				if (!_acceptingPosts) {
+					return false;
+				}
+				_posted.push_back(std::move(callback));
+			}
+			Wake();
+			return true;
+		}
+
+
+		// with the mutex held
+		void RemoveLoopEvent(AttachedSource& attached, std::size_t position) {
+			auto found = _loopEvents.find(attached.keys[position].second);
+			if (found != _loopEvents.end()) {
+				// releasing the wait stops its callbacks. Keys are not reused, so that a completion it already queued is
+				// ignored by Dispatch
+				_loopEvents.erase(found);
+			}
+			attached.keys.erase(attached.keys.begin() + position);
+		}
+
+	public:
+		void Wake() {
+			PostQueuedCompletionStatus(_port.get(), 0, WakeKey, nullptr);
+		}
+		bool IsLoopThread() const {
+			return _threadId == GetCurrentThreadId();
+		}
+
+		RuntimeLoop(microseconds spin, DWORD_PTR affinity, int priority)
+			: _port(MakeHandle(CreateIoCompletionPort(INVALID_HANDLE_VALUE, nullptr, 0, 1))), _running(false), _threadId(0),
+			_spin(spin), _affinity(affinity), _priority(priority) {
+			_exitedFuture = _exited.get_future().share();
+			if (!_port) {
+				throw TransportErrorException{ TransportError::LoopSetupFailed };
+			}
+		}
+
+		void Start() {
+			_running = true;
+			// the thread keeps the loop alive until it exits
+			auto self = shared_from_this();
+			{
+				std::lock_guard<std::mutex> lg(g_loopsMut);
+				g_loops.erase(std::remove_if(g_loops.begin(), g_loops.end(), [](const std::weak_ptr<RuntimeLoop>& l) {return l.expired(); }), g_loops.end());
+				g_loops.push_back(self);
+			}
+			startThread([self]() {
+				self->Run();
+			});
+		}
+		void Stop() {
+			if (!_running) {
+				return;
+			}
+			_running = false;
+			Wake();
+			if (!IsLoopThread()) {
+				_exitedFuture.wait();
+			}
+		}
+
+		std::size_t Used() {
+			std::lock_guard<std::mutex> lg(_mut);
+			return _loopEvents.size();
+		}
+
+		void Post(std::function<void()> callback) {
+			TryPost(std::move(callback));
+		}
+
+		void RunOnLoop(const std::function<void()>& callback) {
+			if (IsLoopThread()) {
+				callback();
+				return;
+			}
+			std::promise<void> done;
+			auto posted = TryPost([&callback, &done]() {
+				callback();
+				done.set_value();
+			});
+			if (posted) {
+				done.get_future().wait();
+				return;
+			}
+			// the loop thread ran its last callbacks: the callers run theirs, one at a time like the loop did
+			_exitedFuture.wait();
+			std::lock_guard<std::mutex> lg(_stoppedMut);
+			callback();
+		}
+
+		std::shared_ptr<AttachedSource> Attach(LoopSource& source, const char* name) {
+			auto attached = std::make_shared<AttachedSource>();
+			attached->source = &source;
+			attached->name = name;
+			return attached;
+		}
+		void Detach(const std::shared_ptr<AttachedSource>& attached) {
+			Disable(attached);
+			std::lock_guard<std::mutex> lg(_mut);
+			while (!attached->keys.empty()) {
+				RemoveLoopEvent(*attached, attached->keys.size() - 1);
+			}
+		}
+
+		SafeAutoResetEvent AddEvent(const std::shared_ptr<AttachedSource>& attached, std::size_t index) {
+			std::lock_guard<std::mutex> lg(_mut);
+			auto key = _nextKey++;
+			LoopEvent loopEvent{ attached, index, MakeAutoResetEvent(), MakeWait(_port.get(), key) };
+			Arm(loopEvent);
+			attached->keys.emplace_back(loopEvent.event.get(), key);
+			auto event = loopEvent.event;
+			_loopEvents.emplace(key, std::move(loopEvent));
+			return event;
+		}
+		void RemoveEvent(const std::shared_ptr<AttachedSource>& attached, const SafeAutoResetEvent& event) {
+			std::lock_guard<std::mutex> lg(_mut);
+			for (std::size_t i = 0; i < attached->keys.size(); ++i) {
+				if (attached->keys[i].first == event.get()) {
+					RemoveLoopEvent(*attached, i);
+					return;
+				}
+			}
+		}
+
+		void Enable(const std::shared_ptr<AttachedSource>& attached) {
+			if (attached->enabled.exchange(true)) {
+				return;
+			}
+			auto self = shared_from_this();
+			Post([self, attached]() {
+				// disabled again before the loop got to it
+				if (!attached->enabled) {
+					return;
+				}
+				if (std::find(self->_enabled.begin(), self->_enabled.end(), attached) == self->_enabled.end()) {
+					self->_enabled.push_back(attached);
+				}
+				TraceLoggingWrite(g_forwardingTraceProvider, "LoopSourceEnable",
+					TraceLoggingLevel(WINEVENT_LEVEL_INFO),
+					TraceLoggingKeyword(TraceKeywordLoop),
+					TraceLoggingString(attached->name, "Source"),
+					TraceLoggingPointer(self.get(), "LoopId"));
+				// signals dispatched while the source was disabled were dropped
+				std::vector<std::size_t> indexes;
+				{
+					std::lock_guard<std::mutex> lg(self->_mut);
+					for (auto& key : attached->keys) {
+						indexes.push_back(self->_loopEvents.at(key.second).index);
+					}
+				}
+				for (auto index : indexes) {
+					Call(*attached, [index](LoopSource& source) {source.OnSignaled(index); });
+				}
+				Call(*attached, [](LoopSource&) {});
+			});
+		}
+		void Disable(const std::shared_ptr<AttachedSource>& attached) {
+			if (IsLoopThread()) {
+				attached->enabled = false;
+				return;
+			}
+			// waits out a call of the source in progress, but not the loop: a loop thread disabling a source of another loop
+			// would otherwise block on that loop, which may be waiting on it
+			std::lock_guard<std::mutex> lg(attached->callMut);
+			attached->enabled = false;
+		}
+	};
+
+	LoopAttachment::LoopAttachment(std::shared_ptr<RuntimeLoop> loop, LoopSource& source, std::size_t eventCount, const char* name) : _loop(std::move(loop))
+	{
+		_source = _loop->Attach(source, name);
+		try {
+			for (std::size_t i = 0; i < eventCount; ++i) {
+				_events.push_back(_loop->AddEvent(_source, i));
+			}
+		}
+		catch (const TransportErrorException&) {
+			_loop->Detach(_source);
+			throw;
+		}
+	}
+	LoopAttachment::~LoopAttachment()
+	{
+		_loop->Detach(_source);
+	}
+	SafeAutoResetEvent LoopAttachment::AddEvent(std::size_t index)
+	{
+		return _loop->AddEvent(_source, index);
+	}
+	void LoopAttachment::RemoveEvent(const SafeAutoResetEvent& event)
+	{
+		_loop->RemoveEvent(_source, event);
+	}
+	void LoopAttachment::Enable()
+	{
+		_loop->Enable(_source);
+	}
+	void LoopAttachment::Disable()
+	{
+		_loop->Disable(_source);
+	}
+	void LoopAttachment::Post(std::function<void()> callback)
+	{
+		_loop->Post(std::move(callback));
+	}
+	void LoopAttachment::RunOnLoop(const std::function<void()>& callback)
+	{
+		_loop->RunOnLoop(callback);
+	}
+	bool LoopAttachment::IsLoopThread() const
+	{
+		return _loop->IsLoopThread();
+	}
+
+	void clockAdvanced()
+	{
+		std::vector<std::shared_ptr<RuntimeLoop>> loops;
+		{
+			std::lock_guard<std::mutex> lg(g_loopsMut);
+			for (auto& loop : g_loops) {
+				if (auto running = loop.lock()) {
+					loops.push_back(std::move(running));
+				}
+			}
+		}
+		// the deadlines are checked after each wakeup
+		for (auto& loop : loops) {
+			loop->Wake();
+		}
+	}
+
+	Runtime::Impl::Impl(std::uint32_t loopCount, const LowLatencyOptions& lowLatency) : _lowLatency(lowLatency)
+	{
+		if (loopCount == 0) {
+			loopCount = std::max(1u, std::thread::hardware_concurrency());
+		}
+		// keeps the processors of the low latency loop for it alone, unless that leaves no processor to the others
+		DWORD_PTR affinity = 0;
+		DWORD_PTR processAffinity = 0;
+		DWORD_PTR systemAffinity = 0;
+		if (lowLatency.affinityMask != 0 && GetProcessAffinityMask(GetCurrentProcess(), &processAffinity, &systemAffinity)) {
+			affinity = processAffinity & ~static_cast<DWORD_PTR>(lowLatency.affinityMask);
+		}
+		for (std::uint32_t i = 0; i < loopCount; ++i) {
+			_loops.push_back(std::make_shared<RuntimeLoop>(microseconds(0), affinity, THREAD_PRIORITY_NORMAL));
+		}
+		// once they all exist, so that a loop failing to be created leaves none running
+		for (auto& loop : _loops) {
+			loop->Start();
+		}
+	}
+	Runtime::Impl::~Impl()
+	{
+		for (auto& loop : _loops) {
+			loop->Stop();
+		}
+		if (_lowLatencyLoop) {
+			_lowLatencyLoop->Stop();
+		}
+	}
+	std::unique_ptr<LoopAttachment> Runtime::Impl::Attach(LoopSource& source, std::size_t eventCount, const char* name)
+	{
+		auto least = std::min_element(_loops.begin(), _loops.end(), [](const std::shared_ptr<RuntimeLoop>& lhs, const std::shared_ptr<RuntimeLoop>& rhs) {
+			return lhs->Used() < rhs->Used();
+		});
+		return std::make_unique<LoopAttachment>(*least, source, eventCount, name);
+	}
+	std::unique_ptr<LoopAttachment> Runtime::Impl::AttachLowLatency(LoopSource& source, std::size_t eventCount, const char* name)
+	{
+		std::shared_ptr<RuntimeLoop> loop;
+		{
+			std::lock_guard<std::mutex> lg(_mut);
+			if (!_lowLatencyLoop) {
+				_lowLatencyLoop = std::make_shared<RuntimeLoop>(microseconds(_lowLatency.spinMicroseconds),
+					static_cast<DWORD_PTR>(_lowLatency.affinityMask), THREAD_PRIORITY_HIGHEST);
+				_lowLatencyLoop->Start();
+			}
+			loop = _lowLatencyLoop;
+		}
+		return std::make_unique<LoopAttachment>(loop, source, eventCount, name);
+	}
+
+	Runtime::Runtime(std::uint32_t loopCount, const LowLatencyOptions& lowLatency) : _impl(std::make_shared<Impl>(loopCount, lowLatency))
+	{
+	}
+	Runtime::~Runtime()
+	{
+	}
+	std::uint32_t Runtime::LoopCount() const
+	{
+		return _impl->LoopCount();
+	}
+	// never destroyed, like the resolver: stopping its loops from the static destructors would wait on threads while the
+	// loader lock is held
+	std::shared_ptr<Runtime::Impl> Runtime::Default()
+	{
+		static auto instance = new std::shared_ptr<Impl>(std::make_shared<Impl>(0, LowLatencyOptions()));
+		return *instance;
+	}
+}
@@ -0,0 +1,81 @@
+#pragma once
+#include <client.h>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include "Forwarders.h"
+namespace forwarding {
+	// the event loop of a forwarder, run by a loop of its runtime. A source is only ever called from the thread of its loop,
+	// so that it keeps the single threaded handling it had with a thread of its own
+	class LoopSource {
+	public:
+		virtual ~LoopSource() {}
+		// index is the position of the signaled event in LoopAttachment::Events, or the index it was added with. Events
+		// belong to their source alone, but calls can still be spurious: sources find out what happened from their sockets
+		virtual void OnSignaled(std::size_t index) = 0;
+		// runs the timed work that is due. Called once NextDeadline passed
+		virtual void OnDeadline() = 0;
+		// asked after each call of the source, time_point::max() when nothing is timed
+		virtual std::chrono::steady_clock::time_point NextDeadline() = 0;
+	};
+
+	class RuntimeLoop;
+	struct AttachedSource;
+
+	// binds a source to a loop for as long as it lives. The events are handed out right away, for sockets to be selected on
+	// them before the source is enabled
+	class LoopAttachment {
+	private:
+		std::shared_ptr<RuntimeLoop> _loop;
+		std::shared_ptr<AttachedSource> _source;
+		std::vector<SafeAutoResetEvent> _events;
+	public:
+		LoopAttachment(std::shared_ptr<RuntimeLoop> loop, LoopSource& source, std::size_t eventCount, const char* name);
+		LoopAttachment(const LoopAttachment&) = delete;
+		LoopAttachment& operator =(const LoopAttachment&) = delete;
+		~LoopAttachment();
+
+		const std::vector<SafeAutoResetEvent>& Events() const {
+			return _events;
+		}
+		// one more event for the source, reported with index, for sources that give each socket an event of its own. Indexes
+		// are the source's to keep apart from the ones of Events. Can be called from any thread. Throws LoopSetupFailed when
+		// the thread pool cannot create the wait of the event
+		SafeAutoResetEvent AddEvent(std::size_t index);
+		// signals of the event are not reported once it returns, but for a call the loop may be making. Can be called from
+		// any thread
+		void RemoveEvent(const SafeAutoResetEvent& event);
+		// the source is called once for each of its events, for what was recorded while it was disabled
+		void Enable();
+		// once it returns, the source is not running and will not be called again until enabled. Can be called from the
+		// source. Only waits for a call of the source in progress, not for the loop
+		void Disable();
+		// runs callback on the loop thread, between the calls of the sources. Callbacks posted once the loop stopped are
+		// dropped
+		void Post(std::function<void()> callback);
+		// runs callback on the loop thread and waits for it, right away when called from the loop thread, and on the calling
+		// thread once the loop stopped
+		void RunOnLoop(const std::function<void()>& callback);
+		bool IsLoopThread() const;
+	};
+
+	class Runtime::Impl {
+	private:
+		std::vector<std::shared_ptr<RuntimeLoop>> _loops;
+		LowLatencyOptions _lowLatency;
+		std::mutex _mut;
+		std::shared_ptr<RuntimeLoop> _lowLatencyLoop;
+	public:
+		Impl(std::uint32_t loopCount, const LowLatencyOptions& lowLatency);
+		~Impl();
+		std::uint32_t LoopCount() const {
+			return static_cast<std::uint32_t>(_loops.size());
+		}
+		// sources go to the loop with the fewest events
+		std::unique_ptr<LoopAttachment> Attach(LoopSource& source, std::size_t eventCount, const char* name);
+		// on the low latency loop, started on first use
+		std::unique_ptr<LoopAttachment> AttachLowLatency(LoopSource& source, std::size_t eventCount, const char* name);
+	};
+}
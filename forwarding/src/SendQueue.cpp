@@ -0,0 +1,207 @@
+#include "SendQueue.h"
+#include <algorithm>
+#include <cstring>
+
+using namespace forwarding;
+
+namespace {
+	const DWORD MaxGatherBuffers = 16;
+
+	struct OverlappedSend {
+		// must stay first: the completion routine gets the overlapped structure back
+		WSAOVERLAPPED overlapped;
+		std::vector<QueuedChunk> chunks;
+		std::vector<WSABUF> buffers;
+		std::shared_ptr<OverlappedSendState> state;
+		std::shared_ptr<ChunkPool> pool;
+		HANDLE completionEvent;
+	};
+
+	// runs on the loop thread that started the send, during an alertable wait. The loop outlives the bridge and its event, and
+	// keeps running the other sources once the bridge is gone. Sends still in flight when a loop stops are leaked with their
+	// chunks, as their completion never runs
+	void CALLBACK OnOverlappedSent(DWORD error, DWORD, LPWSAOVERLAPPED overlapped, DWORD) {
+		std::unique_ptr<OverlappedSend> send(reinterpret_cast<OverlappedSend*>(overlapped));
+		for (auto& queued : send->chunks) {
+			send->pool->Release(std::move(queued.chunk));
+		}
+		send->state->completed = true;
+		send->state->error = error;
+		SetEvent(send->completionEvent);
+	}
+}
+
+std::unique_ptr<Chunk> forwarding::ChunkPool::Acquire()
+{
+	if (_free.empty()) {
+		return std::make_unique<Chunk>();
+	}
+	auto chunk = std::move(_free.back());
+	_free.pop_back();
+	return chunk;
+}
+
+void forwarding::ChunkPool::Release(std::unique_ptr<Chunk>&& chunk)
+{
+	if (chunk && _free.size() < MaxFreeChunks) {
+		_free.push_back(std::move(chunk));
+	}
+	chunk.reset();
+}
+
+forwarding::SendQueue::SendQueue(SendQueue&& moved) : _chunks(std::move(moved._chunks)), _size(moved._size), _overlapped(std::move(moved._overlapped))
+{
+	moved._chunks.clear();
+	moved._size = 0;
+}
+
+SendQueue& forwarding::SendQueue::operator=(SendQueue&& moved)
+{
+	if (this != &moved) {
+		std::swap(_chunks, moved._chunks);
+		std::swap(_size, moved._size);
+		std::swap(_overlapped, moved._overlapped);
+	}
+	return *this;
+}
+
+void forwarding::SendQueue::Consume(std::size_t sent)
+{
+	_size -= sent;
+	for (auto& queued : _chunks) {
+		auto consumed = std::min(sent, queued.end - queued.begin);
+		queued.begin += consumed;
+		sent -= consumed;
+		if (sent == 0) {
+			return;
+		}
+	}
+}
+
+void forwarding::SendQueue::ReleaseConsumed(ChunkPool& pool)
+{
+	// idle pairs do not hold chunks: the tail goes back to the pool too once it has been sent
+	while (!_chunks.empty() && _chunks.front().begin == _chunks.front().end) {
+		pool.Release(std::move(_chunks.front().chunk));
+		_chunks.pop_front();
+	}
+}
+
+char* forwarding::SendQueue::Tail(ChunkPool& pool, std::size_t& room)
+{
+	if (_chunks.empty() || ChunkSize - _chunks.back().end < MinChunkRoom) {
+		QueuedChunk queued;
+		queued.chunk = pool.Acquire();
+		_chunks.push_back(std::move(queued));
+	}
+	auto& tail = _chunks.back();
+	room = ChunkSize - tail.end;
+	return tail.chunk->data + tail.end;
+}
+
+void forwarding::SendQueue::CommitTail(std::size_t received, ChunkPool& pool)
+{
+	_chunks.back().end += received;
+	_size += received;
+	if (received == 0) {
+		ReleaseConsumed(pool);
+	}
+}
+
+void forwarding::SendQueue::Append(const char* data, std::size_t size, ChunkPool& pool)
+{
+	while (size > 0) {
+		std::size_t room = 0;
+		auto tail = Tail(pool, room);
+		auto length = std::min(room, size);
+		memcpy(tail, data, length);
+		CommitTail(length, pool);
+		data += length;
+		size -= length;
+	}
+}
+
+std::size_t forwarding::SendQueue::Flush(SOCKET s, ChunkPool& pool, std::size_t limit)
+{
+	if (SendInFlight()) {
+		return 0;
+	}
+	std::size_t total = 0;
+	while (total < limit) {
+		WSABUF buffers[MaxGatherBuffers];
+		DWORD count = 0;
+		auto remaining = limit - total;
+		for (auto& queued : _chunks) {
+			if (count == MaxGatherBuffers || remaining == 0) {
+				break;
+			}
+			if (queued.begin != queued.end) {
+				auto length = std::min(queued.end - queued.begin, remaining);
+				buffers[count].buf = queued.chunk->data + queued.begin;
+				buffers[count].len = static_cast<ULONG>(length);
+				remaining -= length;
+				++count;
+			}
+		}
+		if (count == 0) {
+			break;
+		}
+		DWORD sent = 0;
+		if (0 != socketApi().SendBuffers(s, buffers, count, &sent) || sent == 0) {
+			break;
+		}
+		Consume(sent);
+		total += sent;
+	}
+	ReleaseConsumed(pool);
+	return total;
+}
+
+bool forwarding::SendQueue::SendOverlapped(SOCKET s, const std::shared_ptr<ChunkPool>& pool, HANDLE completionEvent)
+{
+	if (SendInFlight() || _size == 0) {
+		return false;
+	}
+	auto send = std::make_unique<OverlappedSend>();
+	ZeroMemory(&send->overlapped, sizeof(send->overlapped));
+	for (auto& queued : _chunks) {
+		if (queued.begin != queued.end) {
+			WSABUF buffer;
+			buffer.buf = queued.chunk->data + queued.begin;
+			buffer.len = static_cast<ULONG>(queued.end - queued.begin);
+			send->buffers.push_back(buffer);
+		}
+	}
+	if (!_overlapped) {
+		_overlapped = std::make_shared<OverlappedSendState>();
+	}
+	send->state = _overlapped;
+	send->pool = pool;
+	send->completionEvent = completionEvent;
+	if (0 != WSASend(s, &send->buffers[0], static_cast<DWORD>(send->buffers.size()), nullptr, 0, &send->overlapped, OnOverlappedSent)
+		&& WSAGetLastError() != WSA_IO_PENDING) {
+		return false;
+	}
+	// the chunks are pinned by the send until its completion gives them back to the pool
+	for (auto& queued : _chunks) {
+		send->chunks.push_back(std::move(queued));
+	}
+	_chunks.clear();
+	_overlapped->inFlight = true;
+	_overlapped->completed = false;
+	_overlapped->error = 0;
+	_overlapped->bytes = _size;
+	send.release();
+	return true;
+}
+
+bool forwarding::SendQueue::TakeCompletion(bool& failed)
+{
+	if (!_overlapped || !_overlapped->completed) {
+		return false;
+	}
+	failed = _overlapped->error != 0;
+	_size -= _overlapped->bytes;
+	*_overlapped = OverlappedSendState{};
+	return true;
+}
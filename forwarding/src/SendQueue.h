@@ -0,0 +1,81 @@
+#pragma once
+#include <common.h>
+#include <deque>
+#include <memory>
+#include <vector>
+namespace forwarding {
+	const std::size_t ChunkSize = 64 * 1024;
+	// receiving into less room than this would cost a kernel transition for a few bytes: a new chunk is started instead
+	const std::size_t MinChunkRoom = 4 * 1024;
+
+	struct Chunk {
+		char data[ChunkSize];
+	};
+
+	// recycles the chunks of one bridge. Only used from the loop thread of the bridge
+	class ChunkPool {
+	private:
+		const std::size_t MaxFreeChunks = 64;
+		std::vector<std::unique_ptr<Chunk>> _free;
+	public:
+		std::unique_ptr<Chunk> Acquire();
+		void Release(std::unique_ptr<Chunk>&& chunk);
+	};
+
+	struct QueuedChunk {
+		std::unique_ptr<Chunk> chunk;
+		std::size_t begin = 0;
+		std::size_t end = 0;
+	};
+
+	// shared with the context of an overlapped send, which outlives its queue when the pair is collected first
+	struct OverlappedSendState {
+		bool inFlight = false;
+		bool completed = false;
+		DWORD error = 0;
+		std::size_t bytes = 0;
+	};
+
+	// bytes waiting to be sent to one socket of a pair. Data is received straight into pooled chunks and sent from them, so
+	// that bytes are never moved once received
+	class SendQueue {
+	private:
+		std::deque<QueuedChunk> _chunks;
+		// includes the bytes of the overlapped send in flight, which still hold their chunks
+		std::size_t _size = 0;
+		std::shared_ptr<OverlappedSendState> _overlapped;
+
+		void Consume(std::size_t sent);
+		void ReleaseConsumed(ChunkPool& pool);
+	public:
+		SendQueue() = default;
+		SendQueue(const SendQueue&) = delete;
+		SendQueue& operator =(const SendQueue&) = delete;
+		SendQueue(SendQueue&& moved);
+		SendQueue& operator =(SendQueue&& moved);
+
+		std::size_t size() const {
+			return _size;
+		}
+		bool empty() const {
+			return _size == 0;
+		}
+		// room to receive into at the tail of the queue. CommitTail must be called before anything else touches the queue
+		char* Tail(ChunkPool& pool, std::size_t& room);
+		void CommitTail(std::size_t received, ChunkPool& pool);
+		// copies bytes produced by the forwarder itself, like TLS records, at the tail of the queue
+		void Append(const char* data, std::size_t size, ChunkPool& pool);
+		// gather writes until everything is sent, the socket would block or limit bytes were sent. Nothing is sent while an
+		// overlapped send is in flight, so that bytes are never reordered
+		std::size_t Flush(SOCKET s, ChunkPool& pool, std::size_t limit = SIZE_MAX);
+		// hands every queued chunk to a single overlapped send, completed by an APC on the calling thread which sets
+		// completionEvent. The send shares the pool, as its completion can run after the bridge is gone. Returns false when
+		// the send could not be started, leaving the queue untouched
+		bool SendOverlapped(SOCKET s, const std::shared_ptr<ChunkPool>& pool, HANDLE completionEvent);
+		bool SendInFlight() const {
+			return _overlapped && _overlapped->inFlight;
+		}
+		// true once after an overlapped send finished, failed being set when its bytes could not be sent
+		bool TakeCompletion(bool& failed);
+	};
+}
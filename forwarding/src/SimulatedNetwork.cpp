@@ -0,0 +1,709 @@
+#include <simulation.h>
+#include <algorithm>
+#include <cstring>
+#include <deque>
+#include <vector>
+
+using namespace forwarding;
+using namespace std::chrono;
+
+namespace {
+	// far above the handles winsock hands out, so that both can be told apart
+	const SOCKET FirstSimulatedSocket = 0x40000000;
+	const int DefaultBacklog = 200;
+
+	int Fail(int error) {
+		WSASetLastError(error);
+		return SOCKET_ERROR;
+	}
+
+	class SimulatedClock : public Clock {
+	private:
+		std::shared_ptr<SimulatedNetwork> _network;
+	public:
+		explicit SimulatedClock(std::shared_ptr<SimulatedNetwork> network) : _network(std::move(network)) {}
+		steady_clock::time_point Now() override {
+			return steady_clock::time_point(duration_cast<steady_clock::duration>(_network->Now()));
+		}
+	};
+
+	bool SameEndpoint(const sockaddr_in& bound, const sockaddr_in& address) {
+		return bound.sin_port == address.sin_port
+			&& (bound.sin_addr.s_addr == address.sin_addr.s_addr || bound.sin_addr.s_addr == htonl(INADDR_ANY) || address.sin_addr.s_addr == htonl(INADDR_ANY));
+	}
+}
+
+struct forwarding::SimulatedNetwork::SimSocket {
+	enum class State {
+		Open,
+		Listening,
+		Connecting,
+		Connected,
+		Closed
+	};
+	int type;
+	State state = State::Open;
+	bool bound = false;
+	sockaddr_in local;
+	sockaddr_in remote;
+	std::weak_ptr<SimSocket> peer;
+	std::deque<char> received;
+	std::deque<std::pair<sockaddr_in, std::vector<char>>> datagrams;
+	std::size_t datagramBytes = 0;
+	// set by a reset, returned by the calls on the socket from then on
+	int error = 0;
+	bool peerShutdown = false;
+	bool sendShutdown = false;
+	// SO_LINGER with a zero timeout: closing resets the connection
+	bool abortive = false;
+	// a send would have blocked: FD_WRITE is recorded once the peer made room
+	bool writeBlocked = false;
+	std::deque<std::shared_ptr<SimSocket>> backlog;
+	int backlogLimit = DefaultBacklog;
+	milliseconds connectAt{ 0 };
+	int connectError = 0;
+	// FD_CONNECT and FD_CLOSE are reported once, even when the socket was not selected for them yet
+	bool connectPending = false;
+	bool closePending = false;
+	HANDLE event = nullptr;
+	long selected = 0;
+	long recorded = 0;
+	int errors[FD_MAX_EVENTS];
+
+	explicit SimSocket(int type) : type(type) {
+		ZeroMemory(&local, sizeof(local));
+		ZeroMemory(&remote, sizeof(remote));
+		ZeroMemory(errors, sizeof(errors));
+	}
+
+	bool Record(long networkEvent, int bit, int err = 0) {
+		if (!(selected & networkEvent) || event == nullptr) {
+			return false;
+		}
+		recorded |= networkEvent;
+		errors[bit] = err;
+		SetEvent(event);
+		return true;
+	}
+
+	void RecordConnect(int err) {
+		connectError = err;
+		connectPending = !Record(FD_CONNECT, FD_CONNECT_BIT, err);
+	}
+
+	void RecordClose(int err) {
+		if (err != 0) {
+			error = err;
+		}
+		closePending = !Record(FD_CLOSE, FD_CLOSE_BIT, err);
+	}
+
+	bool Readable() const {
+		return type == SOCK_STREAM ? !received.empty() : !datagrams.empty();
+	}
+};
+
+forwarding::SimulatedNetwork::SimulatedNetwork() : _nextSocket(FirstSimulatedSocket)
+{
+}
+
+std::shared_ptr<SimulatedNetwork::SimSocket> forwarding::SimulatedNetwork::Find(SOCKET s)
+{
+	auto found = _sockets.find(s);
+	return found == _sockets.end() ? nullptr : found->second;
+}
+
+SOCKET forwarding::SimulatedNetwork::Add(std::shared_ptr<SimSocket> socket)
+{
+	auto s = _nextSocket;
+	_nextSocket += 4;
+	_sockets.emplace(s, std::move(socket));
+	return s;
+}
+
+void forwarding::SimulatedNetwork::AutoBind(SimSocket& socket)
+{
+	if (socket.bound) {
+		return;
+	}
+	socket.local.sin_family = AF_INET;
+	socket.local.sin_addr.s_addr = htonl(0x7f000001);
+	socket.local.sin_port = htons(_nextPort++);
+	socket.bound = true;
+}
+
+std::shared_ptr<SimulatedNetwork::SimSocket> forwarding::SimulatedNetwork::FindBound(int type, const sockaddr_in& address, bool listening)
+{
+	for (auto& socket : _sockets) {
+		auto& candidate = *socket.second;
+		if (candidate.type == type && candidate.bound && candidate.state != SimSocket::State::Closed && SameEndpoint(candidate.local, address)
+			&& (!listening || candidate.state == SimSocket::State::Listening)) {
+			return socket.second;
+		}
+	}
+	return nullptr;
+}
+
+void forwarding::SimulatedNetwork::CompleteConnect(const std::shared_ptr<SimSocket>& socket)
+{
+	auto listener = FindBound(SOCK_STREAM, socket->remote, true);
+	if (!listener || listener->backlog.size() >= static_cast<std::size_t>(listener->backlogLimit)) {
+		socket->state = SimSocket::State::Closed;
+		socket->RecordConnect(WSAECONNREFUSED);
+		return;
+	}
+	// the accepted side stays out of the bound sockets, it shares the port of its listener
+	auto accepted = std::make_shared<SimSocket>(SOCK_STREAM);
+	accepted->state = SimSocket::State::Connected;
+	accepted->local = socket->remote;
+	accepted->remote = socket->local;
+	accepted->peer = socket;
+	socket->peer = accepted;
+	socket->state = SimSocket::State::Connected;
+	listener->backlog.push_back(std::move(accepted));
+	listener->Record(FD_ACCEPT, FD_ACCEPT_BIT);
+	socket->RecordConnect(0);
+	socket->Record(FD_WRITE, FD_WRITE_BIT);
+}
+
+int forwarding::SimulatedNetwork::StreamSend(SimSocket& socket, const char* buffer, std::size_t len)
+{
+	if (socket.error != 0) {
+		return Fail(socket.error);
+	}
+	if (socket.state != SimSocket::State::Connected) {
+		return Fail(WSAENOTCONN);
+	}
+	if (socket.sendShutdown) {
+		return Fail(WSAESHUTDOWN);
+	}
+	auto peer = socket.peer.lock();
+	if (!peer) {
+		return Fail(WSAECONNRESET);
+	}
+	auto room = _receiveBufferSize > peer->received.size() ? _receiveBufferSize - peer->received.size() : 0;
+	if (room == 0) {
+		socket.writeBlocked = true;
+		return Fail(WSAEWOULDBLOCK);
+	}
+	auto sent = std::min(len, std::min(room, _maxWriteSize));
+	auto wasEmpty = peer->received.empty();
+	peer->received.insert(peer->received.end(), buffer, buffer + sent);
+	if (wasEmpty) {
+		peer->Record(FD_READ, FD_READ_BIT);
+	}
+	return static_cast<int>(sent);
+}
+
+int forwarding::SimulatedNetwork::DatagramSend(SimSocket& socket, const char* buffer, std::size_t len, const sockaddr_in& to)
+{
+	AutoBind(socket);
+	auto from = socket.local;
+	if (from.sin_addr.s_addr == htonl(INADDR_ANY)) {
+		from.sin_addr.s_addr = htonl(0x7f000001);
+	}
+	auto target = FindBound(SOCK_DGRAM, to, false);
+	// like udp, datagrams nobody can receive are dropped silently
+	if (!target || target->datagramBytes + len > _receiveBufferSize
+		|| (target->state == SimSocket::State::Connected && !SameEndpoint(target->remote, from))) {
+		return static_cast<int>(len);
+	}
+	auto wasEmpty = target->datagrams.empty();
+	target->datagrams.emplace_back(from, std::vector<char>(buffer, buffer + len));
+	target->datagramBytes += len;
+	if (wasEmpty) {
+		target->Record(FD_READ, FD_READ_BIT);
+	}
+	return static_cast<int>(len);
+}
+
+void forwarding::SimulatedNetwork::Disconnect(SimSocket& socket, int error)
+{
+	auto peer = socket.peer.lock();
+	socket.peer.reset();
+	if (!peer) {
+		return;
+	}
+	peer->peer.reset();
+	if (error == 0) {
+		peer->peerShutdown = true;
+	}
+	peer->RecordClose(error);
+}
+
+void forwarding::SimulatedNetwork::SetReceiveBufferSize(std::size_t bytes)
+{
+	std::lock_guard<std::mutex> lg(_mut);
+	_receiveBufferSize = bytes;
+}
+
+void forwarding::SimulatedNetwork::SetMaxWriteSize(std::size_t bytes)
+{
+	std::lock_guard<std::mutex> lg(_mut);
+	_maxWriteSize = bytes;
+}
+
+void forwarding::SimulatedNetwork::SetConnectDelay(milliseconds delay)
+{
+	std::lock_guard<std::mutex> lg(_mut);
+	_connectDelay = delay;
+}
+
+void forwarding::SimulatedNetwork::Advance(milliseconds elapsed)
+{
+	{
+		std::lock_guard<std::mutex> lg(_mut);
+		_now += elapsed;
+		for (auto& socket : _sockets) {
+			if (socket.second->state == SimSocket::State::Connecting && socket.second->connectAt <= _now) {
+				CompleteConnect(socket.second);
+			}
+		}
+	}
+	clockAdvanced();
+}
+
+milliseconds forwarding::SimulatedNetwork::Now()
+{
+	std::lock_guard<std::mutex> lg(_mut);
+	return _now;
+}
+
+std::shared_ptr<Clock> forwarding::SimulatedNetwork::VirtualClock()
+{
+	return std::make_shared<SimulatedClock>(shared_from_this());
+}
+
+void forwarding::SimulatedNetwork::Reset(SOCKET s)
+{
+	std::lock_guard<std::mutex> lg(_mut);
+	auto socket = Find(s);
+	if (!socket || socket->type != SOCK_STREAM) {
+		return;
+	}
+	Disconnect(*socket, WSAECONNRESET);
+	socket->RecordClose(WSAECONNRESET);
+}
+
+std::size_t forwarding::SimulatedNetwork::SocketCount()
+{
+	std::lock_guard<std::mutex> lg(_mut);
+	return _sockets.size();
+}
+
+SOCKET forwarding::SimulatedNetwork::Socket(int family, int type, int protocol)
+{
+	if (family != AF_INET) {
+		Fail(WSAEAFNOSUPPORT);
+		return INVALID_SOCKET;
+	}
+	if (type != SOCK_STREAM && type != SOCK_DGRAM) {
+		Fail(WSAEINVAL);
+		return INVALID_SOCKET;
+	}
+	std::lock_guard<std::mutex> lg(_mut);
+	return Add(std::make_shared<SimSocket>(type));
+}
+
+int forwarding::SimulatedNetwork::Bind(SOCKET s, const sockaddr* address, int addressLen)
+{
+	std::unique_lock<std::mutex> lock(_mut);
+	auto socket = Find(s);
+	if (!socket) {
+		lock.unlock();
+		return nativeSocketApi().Bind(s, address, addressLen);
+	}
+	if (address->sa_family != AF_INET || addressLen < static_cast<int>(sizeof(sockaddr_in))) {
+		return Fail(WSAEAFNOSUPPORT);
+	}
+	if (socket->bound) {
+		return Fail(WSAEINVAL);
+	}
+	sockaddr_in requested;
+	memcpy(&requested, address, sizeof(requested));
+	if (requested.sin_port == 0) {
+		requested.sin_port = htons(_nextPort++);
+	}
+	if (FindBound(socket->type, requested, false)) {
+		return Fail(WSAEADDRINUSE);
+	}
+	socket->local = requested;
+	socket->bound = true;
+	return 0;
+}
+
+int forwarding::SimulatedNetwork::Listen(SOCKET s, int backlog)
+{
+	std::unique_lock<std::mutex> lock(_mut);
+	auto socket = Find(s);
+	if (!socket) {
+		lock.unlock();
+		return nativeSocketApi().Listen(s, backlog);
+	}
+	if (socket->type != SOCK_STREAM || !socket->bound || (socket->state != SimSocket::State::Open && socket->state != SimSocket::State::Listening)) {
+		return Fail(WSAEINVAL);
+	}
+	socket->state = SimSocket::State::Listening;
+	socket->backlogLimit = backlog == SOMAXCONN ? DefaultBacklog : std::max(backlog, 1);
+	return 0;
+}
+
+SOCKET forwarding::SimulatedNetwork::Accept(SOCKET s, sockaddr* address, int* addressLen)
+{
+	std::unique_lock<std::mutex> lock(_mut);
+	auto socket = Find(s);
+	if (!socket) {
+		lock.unlock();
+		return nativeSocketApi().Accept(s, address, addressLen);
+	}
+	if (socket->state != SimSocket::State::Listening) {
+		Fail(WSAEINVAL);
+		return INVALID_SOCKET;
+	}
+	if (socket->backlog.empty()) {
+		Fail(WSAEWOULDBLOCK);
+		return INVALID_SOCKET;
+	}
+	auto accepted = std::move(socket->backlog.front());
+	socket->backlog.pop_front();
+	if (!socket->backlog.empty()) {
+		socket->Record(FD_ACCEPT, FD_ACCEPT_BIT);
+	}
+	// like winsock, accepted sockets start with the event selection of their listener
+	accepted->event = socket->event;
+	accepted->selected = socket->selected;
+	if (address && addressLen && *addressLen >= static_cast<int>(sizeof(sockaddr_in))) {
+		memcpy(address, &accepted->remote, sizeof(sockaddr_in));
+		*addressLen = sizeof(sockaddr_in);
+	}
+	return Add(std::move(accepted));
+}
+
+int forwarding::SimulatedNetwork::Connect(SOCKET s, const sockaddr* address, int addressLen)
+{
+	std::unique_lock<std::mutex> lock(_mut);
+	auto socket = Find(s);
+	if (!socket) {
+		lock.unlock();
+		return nativeSocketApi().Connect(s, address, addressLen);
+	}
+	if (address->sa_family != AF_INET || addressLen < static_cast<int>(sizeof(sockaddr_in))) {
+		return Fail(WSAEAFNOSUPPORT);
+	}
+	AutoBind(*socket);
+	memcpy(&socket->remote, address, sizeof(sockaddr_in));
+	if (socket->type == SOCK_DGRAM) {
+		socket->state = SimSocket::State::Connected;
+		return 0;
+	}
+	if (socket->state == SimSocket::State::Connecting) {
+		return Fail(WSAEALREADY);
+	}
+	if (socket->state != SimSocket::State::Open) {
+		return Fail(WSAEISCONN);
+	}
+	socket->state = SimSocket::State::Connecting;
+	socket->connectAt = _now + _connectDelay;
+	if (_connectDelay == milliseconds::zero()) {
+		CompleteConnect(socket);
+	}
+	// simulated sockets are always non blocking
+	return Fail(WSAEWOULDBLOCK);
+}
+
+int forwarding::SimulatedNetwork::Recv(SOCKET s, char* buffer, int len)
+{
+	return RecvFrom(s, buffer, len, nullptr, nullptr);
+}
+
+int forwarding::SimulatedNetwork::RecvFrom(SOCKET s, char* buffer, int len, sockaddr* from, int* fromLen)
+{
+	std::unique_lock<std::mutex> lock(_mut);
+	auto socket = Find(s);
+	if (!socket) {
+		lock.unlock();
+		return from ? nativeSocketApi().RecvFrom(s, buffer, len, from, fromLen) : nativeSocketApi().Recv(s, buffer, len);
+	}
+	if (socket->error != 0) {
+		return Fail(socket->error);
+	}
+	if (socket->type == SOCK_DGRAM) {
+		if (socket->datagrams.empty()) {
+			return Fail(WSAEWOULDBLOCK);
+		}
+		auto datagram = std::move(socket->datagrams.front());
+		socket->datagrams.pop_front();
+		socket->datagramBytes -= datagram.second.size();
+		if (!socket->datagrams.empty()) {
+			socket->Record(FD_READ, FD_READ_BIT);
+		}
+		if (from && fromLen && *fromLen >= static_cast<int>(sizeof(sockaddr_in))) {
+			memcpy(from, &datagram.first, sizeof(sockaddr_in));
+			*fromLen = sizeof(sockaddr_in);
+		}
+		auto read = std::min(datagram.second.size(), static_cast<std::size_t>(len));
+		memcpy(buffer, datagram.second.data(), read);
+		// the rest of a truncated datagram is lost, like with winsock
+		return read < datagram.second.size() ? Fail(WSAEMSGSIZE) : static_cast<int>(read);
+	}
+	if (socket->state != SimSocket::State::Connected) {
+		return Fail(WSAENOTCONN);
+	}
+	if (socket->received.empty()) {
+		return socket->peerShutdown ? 0 : Fail(WSAEWOULDBLOCK);
+	}
+	auto read = std::min(socket->received.size(), static_cast<std::size_t>(len));
+	std::copy(socket->received.begin(), socket->received.begin() + read, buffer);
+	socket->received.erase(socket->received.begin(), socket->received.begin() + read);
+	if (!socket->received.empty()) {
+		socket->Record(FD_READ, FD_READ_BIT);
+	}
+	auto peer = socket->peer.lock();
+	if (peer && peer->writeBlocked) {
+		peer->writeBlocked = false;
+		peer->Record(FD_WRITE, FD_WRITE_BIT);
+	}
+	if (from && fromLen && *fromLen >= static_cast<int>(sizeof(sockaddr_in))) {
+		memcpy(from, &socket->remote, sizeof(sockaddr_in));
+		*fromLen = sizeof(sockaddr_in);
+	}
+	return static_cast<int>(read);
+}
+
+int forwarding::SimulatedNetwork::Send(SOCKET s, const char* buffer, int len)
+{
+	std::unique_lock<std::mutex> lock(_mut);
+	auto socket = Find(s);
+	if (!socket) {
+		lock.unlock();
+		return nativeSocketApi().Send(s, buffer, len);
+	}
+	if (socket->type == SOCK_DGRAM) {
+		if (socket->state != SimSocket::State::Connected) {
+			return Fail(WSAENOTCONN);
+		}
+		return DatagramSend(*socket, buffer, len, socket->remote);
+	}
+	return StreamSend(*socket, buffer, len);
+}
+
+int forwarding::SimulatedNetwork::SendTo(SOCKET s, const char* buffer, int len, const sockaddr* to, int toLen)
+{
+	std::unique_lock<std::mutex> lock(_mut);
+	auto socket = Find(s);
+	if (!socket) {
+		lock.unlock();
+		return nativeSocketApi().SendTo(s, buffer, len, to, toLen);
+	}
+	if (socket->type == SOCK_STREAM) {
+		return StreamSend(*socket, buffer, len);
+	}
+	if (to->sa_family != AF_INET || toLen < static_cast<int>(sizeof(sockaddr_in))) {
+		return Fail(WSAEAFNOSUPPORT);
+	}
+	sockaddr_in target;
+	memcpy(&target, to, sizeof(target));
+	return DatagramSend(*socket, buffer, len, target);
+}
+
+int forwarding::SimulatedNetwork::SendBuffers(SOCKET s, WSABUF* buffers, DWORD count, DWORD* sent)
+{
+	std::unique_lock<std::mutex> lock(_mut);
+	auto socket = Find(s);
+	if (!socket) {
+		lock.unlock();
+		return nativeSocketApi().SendBuffers(s, buffers, count, sent);
+	}
+	if (socket->type == SOCK_DGRAM) {
+		if (socket->state != SimSocket::State::Connected) {
+			return Fail(WSAENOTCONN);
+		}
+		std::vector<char> datagram;
+		for (DWORD i = 0; i < count; ++i) {
+			datagram.insert(datagram.end(), buffers[i].buf, buffers[i].buf + buffers[i].len);
+		}
+		*sent = static_cast<DWORD>(DatagramSend(*socket, datagram.data(), datagram.size(), socket->remote));
+		return 0;
+	}
+	DWORD total = 0;
+	for (DWORD i = 0; i < count; ++i) {
+		auto written = StreamSend(*socket, buffers[i].buf, buffers[i].len);
+		if (written == SOCKET_ERROR) {
+			if (total == 0) {
+				return SOCKET_ERROR;
+			}
+			break;
+		}
+		total += static_cast<DWORD>(written);
+		if (static_cast<ULONG>(written) < buffers[i].len) {
+			break;
+		}
+	}
+	*sent = total;
+	return 0;
+}
+
+int forwarding::SimulatedNetwork::Available(SOCKET s, u_long* available)
+{
+	std::unique_lock<std::mutex> lock(_mut);
+	auto socket = Find(s);
+	if (!socket) {
+		lock.unlock();
+		return nativeSocketApi().Available(s, available);
+	}
+	if (socket->type == SOCK_STREAM) {
+		*available = static_cast<u_long>(socket->received.size());
+	}
+	else {
+		*available = socket->datagrams.empty() ? 0 : static_cast<u_long>(socket->datagrams.front().second.size());
+	}
+	return 0;
+}
+
+int forwarding::SimulatedNetwork::SetNonBlocking(SOCKET s)
+{
+	std::unique_lock<std::mutex> lock(_mut);
+	if (!Find(s)) {
+		lock.unlock();
+		return nativeSocketApi().SetNonBlocking(s);
+	}
+	return 0;
+}
+
+int forwarding::SimulatedNetwork::SetOption(SOCKET s, int level, int name, const char* value, int len)
+{
+	std::unique_lock<std::mutex> lock(_mut);
+	auto socket = Find(s);
+	if (!socket) {
+		lock.unlock();
+		return nativeSocketApi().SetOption(s, level, name, value, len);
+	}
+	// buffer sizes, nagle and keepalive have no effect on the simulation
+	if (level == SOL_SOCKET && name == SO_LINGER && len >= static_cast<int>(sizeof(linger))) {
+		auto l = reinterpret_cast<const linger*>(value);
+		socket->abortive = l->l_onoff != 0 && l->l_linger == 0;
+	}
+	return 0;
+}
+
+int forwarding::SimulatedNetwork::SetKeepAlive(SOCKET s, ULONG timeMs, ULONG intervalMs)
+{
+	std::unique_lock<std::mutex> lock(_mut);
+	if (!Find(s)) {
+		lock.unlock();
+		return nativeSocketApi().SetKeepAlive(s, timeMs, intervalMs);
+	}
+	return 0;
+}
+
+int forwarding::SimulatedNetwork::PeerName(SOCKET s, sockaddr* address, int* addressLen)
+{
+	std::unique_lock<std::mutex> lock(_mut);
+	auto socket = Find(s);
+	if (!socket) {
+		lock.unlock();
+		return nativeSocketApi().PeerName(s, address, addressLen);
+	}
+	if (socket->state != SimSocket::State::Connected) {
+		return Fail(WSAENOTCONN);
+	}
+	if (*addressLen < static_cast<int>(sizeof(sockaddr_in))) {
+		return Fail(WSAEFAULT);
+	}
+	memcpy(address, &socket->remote, sizeof(sockaddr_in));
+	*addressLen = sizeof(sockaddr_in);
+	return 0;
+}
+
+int forwarding::SimulatedNetwork::EventSelect(SOCKET s, HANDLE event, long networkEvents)
+{
+	std::unique_lock<std::mutex> lock(_mut);
+	auto socket = Find(s);
+	if (!socket) {
+		lock.unlock();
+		return nativeSocketApi().EventSelect(s, event, networkEvents);
+	}
+	socket->event = event;
+	socket->selected = networkEvents;
+	// like winsock, selecting records the conditions that already hold
+	if (socket->Readable()) {
+		socket->Record(FD_READ, FD_READ_BIT);
+	}
+	if (!socket->writeBlocked && socket->error == 0 && (socket->type == SOCK_DGRAM || socket->state == SimSocket::State::Connected)) {
+		socket->Record(FD_WRITE, FD_WRITE_BIT);
+	}
+	if (!socket->backlog.empty()) {
+		socket->Record(FD_ACCEPT, FD_ACCEPT_BIT);
+	}
+	if (socket->connectPending) {
+		socket->RecordConnect(socket->connectError);
+	}
+	if (socket->closePending) {
+		socket->RecordClose(socket->error);
+	}
+	return 0;
+}
+
+int forwarding::SimulatedNetwork::EnumNetworkEvents(SOCKET s, WSANETWORKEVENTS* events)
+{
+	std::unique_lock<std::mutex> lock(_mut);
+	auto socket = Find(s);
+	if (!socket) {
+		lock.unlock();
+		return nativeSocketApi().EnumNetworkEvents(s, events);
+	}
+	events->lNetworkEvents = socket->recorded;
+	memcpy(events->iErrorCode, socket->errors, sizeof(socket->errors));
+	socket->recorded = 0;
+	ZeroMemory(socket->errors, sizeof(socket->errors));
+	return 0;
+}
+
+int forwarding::SimulatedNetwork::Shutdown(SOCKET s, int how)
+{
+	std::unique_lock<std::mutex> lock(_mut);
+	auto socket = Find(s);
+	if (!socket) {
+		lock.unlock();
+		return nativeSocketApi().Shutdown(s, how);
+	}
+	if (socket->type != SOCK_STREAM || how == SD_RECEIVE || socket->sendShutdown) {
+		return 0;
+	}
+	if (socket->state != SimSocket::State::Connected) {
+		return Fail(WSAENOTCONN);
+	}
+	socket->sendShutdown = true;
+	if (auto peer = socket->peer.lock()) {
+		peer->peerShutdown = true;
+		peer->RecordClose(0);
+	}
+	return 0;
+}
+
+int forwarding::SimulatedNetwork::Close(SOCKET s)
+{
+	std::unique_lock<std::mutex> lock(_mut);
+	auto socket = Find(s);
+	if (!socket) {
+		lock.unlock();
+		return nativeSocketApi().Close(s);
+	}
+	_sockets.erase(s);
+	// connections still waiting to be accepted are reset, and so is a connection closed with data left to read
+	for (auto& pending : socket->backlog) {
+		Disconnect(*pending, WSAECONNRESET);
+	}
+	socket->backlog.clear();
+	if (socket->abortive || !socket->received.empty()) {
+		Disconnect(*socket, WSAECONNRESET);
+	}
+	else if (!socket->sendShutdown) {
+		Disconnect(*socket, 0);
+	}
+	else {
+		socket->peer.reset();
+	}
+	socket->state = SimSocket::State::Closed;
+	return 0;
+}
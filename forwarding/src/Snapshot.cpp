@@ -0,0 +1,344 @@
+#include "Snapshot.h"
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <set>
+
+using namespace forwarding;
+
+namespace {
+	const char SnapshotMagic[8] = { 'L', 'F', 'W', 'D', 'S', 'N', 'A', 'P' };
+	// bumped whenever the layout of the file changes: a file of another version is replaced by an empty snapshot
+	const std::uint32_t SnapshotVersion = 1;
+	const std::uint32_t InitialSlotCount = 1024;
+	// an entry per local port and protocol at most
+	const std::uint32_t MaxSlotCount = 2 * 65536;
+	const std::size_t MaxAddressLength = 232;
+
+	struct SnapshotHeader {
+		char magic[8];
+		std::uint32_t version;
+		// only updated once the slots it covers are part of the file
+		std::uint32_t slotCount;
+		std::uint8_t reserved[240];
+	};
+
+	struct SnapshotRecord {
+		// 0 for a copy that was never written
+		std::uint64_t generation;
+		// covers the whole record but itself, so that a torn copy is detected
+		std::uint32_t checksum;
+		std::uint8_t used;
+		std::uint8_t protocol;
+		std::uint16_t localPort;
+		std::uint16_t count;
+		std::uint16_t addressLength;
+		std::uint32_t remotePort;
+		char address[MaxAddressLength];
+	};
+	// with the header taking a record of its own, records never straddle a page
+	static_assert(sizeof(SnapshotRecord) == 256 && sizeof(SnapshotHeader) == sizeof(SnapshotRecord), "records must be page aligned");
+
+	std::uint32_t Checksum(const SnapshotRecord& record) {
+		auto bytes = reinterpret_cast<const unsigned char*>(&record);
+		const auto skipped = offsetof(SnapshotRecord, checksum);
+		std::uint32_t hash = 2166136261u;
+		for (std::size_t i = 0; i < sizeof(record); ++i) {
+			if (i >= skipped && i < skipped + sizeof(record.checksum)) {
+				continue;
+			}
+			hash = (hash ^ bytes[i]) * 16777619u;
+		}
+		return hash;
+	}
+
+	bool IsValid(const SnapshotRecord& record) {
+		return record.generation != 0 && record.checksum == Checksum(record);
+	}
+
+	SnapshotEntry Decode(const SnapshotRecord& record) {
+		SnapshotEntry entry;
+		entry.protocol = record.protocol == 0 ? SnapshotProtocol::Tcp : SnapshotProtocol::Udp;
+		entry.localPort = record.localPort;
+		entry.count = record.count;
+		entry.remotePort = record.remotePort;
+		entry.remoteAddress.assign(record.address, std::min<std::size_t>(record.addressLength, MaxAddressLength));
+		return entry;
+	}
+}
+
+namespace forwarding {
+	// written alternately, the valid copy with the highest generation being the current version of the slot
+	struct SnapshotSlot {
+		SnapshotRecord copies[2];
+
+		const SnapshotRecord* Current() const {
+			auto first = IsValid(copies[0]) ? &copies[0] : nullptr;
+			auto second = IsValid(copies[1]) ? &copies[1] : nullptr;
+			if (!first || (second && second->generation > first->generation)) {
+				return second;
+			}
+			return first;
+		}
+	};
+}
+
+forwarding::EntrySnapshot::Impl::Impl(const char* path) : _path(path)
+{
+	if (!Open()) {
+		Create();
+		if (!Open()) {
+			throw TransportErrorException{ TransportError::SnapshotFailed };
+		}
+	}
+}
+
+forwarding::EntrySnapshot::Impl::~Impl()
+{
+	Unmap();
+	if (_file != INVALID_HANDLE_VALUE) {
+		CloseHandle(_file);
+	}
+}
+
+SnapshotSlot* forwarding::EntrySnapshot::Impl::Slots() const
+{
+	return reinterpret_cast<SnapshotSlot*>(_view + sizeof(SnapshotHeader));
+}
+
+// the empty snapshot is written aside and moved over path, so that a crash never leaves a partial header behind
+void forwarding::EntrySnapshot::Impl::Create()
+{
+	auto temporary = _path + ".tmp";
+	auto file = CreateFileA(temporary.c_str(), GENERIC_READ | GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (file == INVALID_HANDLE_VALUE) {
+		throw TransportErrorException{ TransportError::SnapshotFailed };
+	}
+	SnapshotHeader header;
+	ZeroMemory(&header, sizeof(header));
+	std::memcpy(header.magic, SnapshotMagic, sizeof(header.magic));
+	header.version = SnapshotVersion;
+	header.slotCount = InitialSlotCount;
+	DWORD written = 0;
+	auto succeeded = WriteFile(file, &header, sizeof(header), &written, nullptr) && written == sizeof(header) && FlushFileBuffers(file);
+	CloseHandle(file);
+	if (!succeeded || !MoveFileExA(temporary.c_str(), _path.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH)) {
+		DeleteFileA(temporary.c_str());
+		throw TransportErrorException{ TransportError::SnapshotFailed };
+	}
+}
+
+bool forwarding::EntrySnapshot::Impl::Open()
+{
+	_file = CreateFileA(_path.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (_file == INVALID_HANDLE_VALUE) {
+		return false;
+	}
+	SnapshotHeader header;
+	DWORD read = 0;
+	if (!ReadFile(_file, &header, sizeof(header), &read, nullptr) || read != sizeof(header) ||
+		std::memcmp(header.magic, SnapshotMagic, sizeof(header.magic)) != 0 || header.version != SnapshotVersion ||
+		header.slotCount == 0 || header.slotCount > MaxSlotCount || !Map(header.slotCount)) {
+		CloseHandle(_file);
+		_file = INVALID_HANDLE_VALUE;
+		return false;
+	}
+	auto slots = Slots();
+	std::vector<std::uint32_t> duplicates;
+	for (auto i = _slotCount; i-- > 0;) {
+		auto current = slots[i].Current();
+		if (current) {
+			_generation = std::max(_generation, current->generation);
+		}
+		if (!current || !current->used || current->protocol > 1) {
+			_freeSlots.push_back(i);
+			continue;
+		}
+		if (!_slots.emplace(std::make_pair(Decode(*current).protocol, current->localPort), i).second) {
+			duplicates.push_back(i);
+		}
+	}
+	for (auto slot : duplicates) {
+		Write(slot, nullptr);
+		_freeSlots.push_back(slot);
+	}
+	return true;
+}
+
+// a mapping larger than the file extends it with zeroes, which read as free slots
+bool forwarding::EntrySnapshot::Impl::Map(std::uint32_t slotCount)
+{
+	auto size = static_cast<std::uint64_t>(sizeof(SnapshotHeader)) + static_cast<std::uint64_t>(slotCount) * sizeof(SnapshotSlot);
+	_mapping = CreateFileMappingA(_file, nullptr, PAGE_READWRITE, static_cast<DWORD>(size >> 32), static_cast<DWORD>(size), nullptr);
+	if (!_mapping) {
+		return false;
+	}
+	_view = static_cast<char*>(MapViewOfFile(_mapping, FILE_MAP_WRITE, 0, 0, static_cast<std::size_t>(size)));
+	if (!_view) {
+		CloseHandle(_mapping);
+		_mapping = nullptr;
+		return false;
+	}
+	_slotCount = slotCount;
+	return true;
+}
+
+void forwarding::EntrySnapshot::Impl::Unmap()
+{
+	if (_view) {
+		UnmapViewOfFile(_view);
+		_view = nullptr;
+	}
+	if (_mapping) {
+		CloseHandle(_mapping);
+		_mapping = nullptr;
+	}
+}
+
+bool forwarding::EntrySnapshot::Impl::Grow()
+{
+	auto previous = _slotCount;
+	auto slotCount = std::min(previous * 2, MaxSlotCount);
+	if (slotCount <= previous) {
+		return false;
+	}
+	Unmap();
+	if (!Map(slotCount)) {
+		Map(previous);
+		return false;
+	}
+	reinterpret_cast<SnapshotHeader*>(_view)->slotCount = slotCount;
+	FlushViewOfFile(_view, sizeof(SnapshotHeader));
+	for (auto i = slotCount; i-- > previous;) {
+		_freeSlots.push_back(i);
+	}
+	return true;
+}
+
+void forwarding::EntrySnapshot::Impl::Write(std::uint32_t slot, const SnapshotEntry* entry)
+{
+	if (!_view) {
+		return;
+	}
+	auto& target = Slots()[slot];
+	auto& copy = target.Current() == &target.copies[0] ? target.copies[1] : target.copies[0];
+	SnapshotRecord record;
+	ZeroMemory(&record, sizeof(record));
+	record.generation = ++_generation;
+	if (entry) {
+		record.used = 1;
+		record.protocol = entry->protocol == SnapshotProtocol::Tcp ? 0 : 1;
+		record.localPort = entry->localPort;
+		record.count = entry->count;
+		record.remotePort = entry->remotePort;
+		record.addressLength = static_cast<std::uint16_t>(entry->remoteAddress.size());
+		std::memcpy(record.address, entry->remoteAddress.data(), entry->remoteAddress.size());
+	}
+	record.checksum = Checksum(record);
+	std::memcpy(&copy, &record, sizeof(record));
+	// starts writing the page back, without waiting for the disk
+	FlushViewOfFile(&copy, sizeof(copy));
+}
+
+void forwarding::EntrySnapshot::Impl::PutLocked(const SnapshotEntry& entry)
+{
+	if (entry.remoteAddress.size() > MaxAddressLength) {
+		RemoveLocked(entry.protocol, entry.localPort);
+		return;
+	}
+	auto key = std::make_pair(entry.protocol, entry.localPort);
+	auto found = _slots.find(key);
+	if (found != _slots.end()) {
+		auto current = _view ? Slots()[found->second].Current() : nullptr;
+		if (current) {
+			auto recorded = Decode(*current);
+			if (recorded.count == entry.count && recorded.remotePort == entry.remotePort && recorded.remoteAddress == entry.remoteAddress) {
+				return;
+			}
+		}
+		Write(found->second, &entry);
+		return;
+	}
+	if (_freeSlots.empty() && !Grow()) {
+		return;
+	}
+	auto slot = _freeSlots.back();
+	_freeSlots.pop_back();
+	_slots.emplace(key, slot);
+	Write(slot, &entry);
+}
+
+void forwarding::EntrySnapshot::Impl::RemoveLocked(SnapshotProtocol protocol, std::uint16_t localPort)
+{
+	auto found = _slots.find(std::make_pair(protocol, localPort));
+	if (found == _slots.end()) {
+		return;
+	}
+	Write(found->second, nullptr);
+	_freeSlots.push_back(found->second);
+	_slots.erase(found);
+}
+
+std::vector<SnapshotEntry> forwarding::EntrySnapshot::Impl::Entries()
+{
+	std::lock_guard<std::mutex> lg(_mut);
+	std::vector<SnapshotEntry> entries;
+	if (!_view) {
+		return entries;
+	}
+	entries.reserve(_slots.size());
+	auto slots = Slots();
+	for (auto& slot : _slots) {
+		auto current = slots[slot.second].Current();
+		if (current) {
+			entries.push_back(Decode(*current));
+		}
+	}
+	return entries;
+}
+
+void forwarding::EntrySnapshot::Impl::Put(const SnapshotEntry& entry)
+{
+	std::lock_guard<std::mutex> lg(_mut);
+	PutLocked(entry);
+}
+
+void forwarding::EntrySnapshot::Impl::Remove(SnapshotProtocol protocol, std::uint16_t localPort)
+{
+	std::lock_guard<std::mutex> lg(_mut);
+	RemoveLocked(protocol, localPort);
+}
+
+void forwarding::EntrySnapshot::Impl::Reset(SnapshotProtocol protocol, const std::vector<SnapshotEntry>& entries)
+{
+	std::lock_guard<std::mutex> lg(_mut);
+	std::set<std::uint16_t> kept;
+	for (auto& entry : entries) {
+		kept.insert(entry.localPort);
+	}
+	std::vector<std::uint16_t> stale;
+	for (auto& slot : _slots) {
+		if (slot.first.first == protocol && kept.count(slot.first.second) == 0) {
+			stale.push_back(slot.first.second);
+		}
+	}
+	for (auto localPort : stale) {
+		RemoveLocked(protocol, localPort);
+	}
+	for (auto& entry : entries) {
+		PutLocked(entry);
+	}
+}
+
+namespace forwarding {
+	EntrySnapshot::EntrySnapshot(const char* path) : _impl(std::make_shared<Impl>(path))
+	{
+	}
+	EntrySnapshot::~EntrySnapshot()
+	{
+	}
+	std::vector<SnapshotEntry> EntrySnapshot::Entries()
+	{
+		return _impl->Entries();
+	}
+}
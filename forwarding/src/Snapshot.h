@@ -0,0 +1,60 @@
+#pragma once
+#include <client.h>
+#include <map>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+namespace forwarding {
+	struct SnapshotSlot;
+
+	inline SnapshotEntry MakeSnapshotEntry(SnapshotProtocol protocol, std::uint16_t localPort, std::uint16_t count, std::uint32_t remotePort, const std::string& remoteAddress) {
+		SnapshotEntry entry;
+		entry.protocol = protocol;
+		entry.localPort = localPort;
+		entry.count = count;
+		entry.remotePort = remotePort;
+		entry.remoteAddress = remoteAddress;
+		return entry;
+	}
+
+	// the records of the file are slots, each holding the latest version of an entry or nothing. Slots are reused once freed,
+	// and the file grows in place when they are all used. Recording is best effort: entries whose remote does not fit a
+	// record, or that come once the file could not grow, are left out
+	class EntrySnapshot::Impl {
+	private:
+		std::mutex _mut;
+		std::string _path;
+		HANDLE _file = INVALID_HANDLE_VALUE;
+		HANDLE _mapping = nullptr;
+		char* _view = nullptr;
+		std::uint32_t _slotCount = 0;
+		// of the last record written
+		std::uint64_t _generation = 0;
+		std::map<std::pair<SnapshotProtocol, std::uint16_t>, std::uint32_t> _slots;
+		// slots holding nothing, the lowest ones being used first after a load
+		std::vector<std::uint32_t> _freeSlots;
+
+		SnapshotSlot* Slots() const;
+		void Create();
+		bool Open();
+		bool Map(std::uint32_t slotCount);
+		void Unmap();
+		bool Grow();
+		// a null entry frees the slot
+		void Write(std::uint32_t slot, const SnapshotEntry* entry);
+		void PutLocked(const SnapshotEntry& entry);
+		void RemoveLocked(SnapshotProtocol protocol, std::uint16_t localPort);
+	public:
+		explicit Impl(const char* path);
+		Impl(const Impl&) = delete;
+		Impl& operator =(const Impl&) = delete;
+		~Impl();
+
+		std::vector<SnapshotEntry> Entries();
+		void Put(const SnapshotEntry& entry);
+		void Remove(SnapshotProtocol protocol, std::uint16_t localPort);
+		// makes entries the only ones of protocol, when a forwarder starts recording its entries
+		void Reset(SnapshotProtocol protocol, const std::vector<SnapshotEntry>& entries);
+	};
+}
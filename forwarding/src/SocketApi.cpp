@@ -0,0 +1,124 @@
+#include <common.h>
+#include <ws2tcpip.h>
+#include <mstcpip.h>
+#include <atomic>
+
+using namespace forwarding;
+
+namespace {
+	class NativeSocketApi : public SocketApi {
+	public:
+		SOCKET Socket(int family, int type, int protocol) override {
+			return ::socket(family, type, protocol);
+		}
+		int Bind(SOCKET s, const sockaddr* address, int addressLen) override {
+			return ::bind(s, address, addressLen);
+		}
+		int Listen(SOCKET s, int backlog) override {
+			return ::listen(s, backlog);
+		}
+		SOCKET Accept(SOCKET s, sockaddr* address, int* addressLen) override {
+			return WSAAccept(s, address, addressLen, nullptr, NULL);
+		}
+		int Connect(SOCKET s, const sockaddr* address, int addressLen) override {
+			return ::connect(s, address, addressLen);
+		}
+		int Recv(SOCKET s, char* buffer, int len) override {
+			return ::recv(s, buffer, len, 0);
+		}
+		int RecvFrom(SOCKET s, char* buffer, int len, sockaddr* from, int* fromLen) override {
+			return ::recvfrom(s, buffer, len, 0, from, fromLen);
+		}
+		int Send(SOCKET s, const char* buffer, int len) override {
+			return ::send(s, buffer, len, 0);
+		}
+		int SendTo(SOCKET s, const char* buffer, int len, const sockaddr* to, int toLen) override {
+			return ::sendto(s, buffer, len, 0, to, toLen);
+		}
+		int SendBuffers(SOCKET s, WSABUF* buffers, DWORD count, DWORD* sent) override {
+			return WSASend(s, buffers, count, sent, 0, nullptr, nullptr);
+		}
+		int Available(SOCKET s, u_long* available) override {
+			return ioctlsocket(s, FIONREAD, available);
+		}
+		int SetNonBlocking(SOCKET s) override {
+			u_long nonBlocking = 1;
+			return ioctlsocket(s, FIONBIO, &nonBlocking);
+		}
+		int SetOption(SOCKET s, int level, int name, const char* value, int len) override {
+			return ::setsockopt(s, level, name, value, len);
+		}
+		int SetKeepAlive(SOCKET s, ULONG timeMs, ULONG intervalMs) override {
+			tcp_keepalive keepAlive;
+			keepAlive.onoff = 1;
+			keepAlive.keepalivetime = timeMs;
+			keepAlive.keepaliveinterval = intervalMs;
+			DWORD returned = 0;
+			return WSAIoctl(s, SIO_KEEPALIVE_VALS, &keepAlive, sizeof(keepAlive), nullptr, 0, &returned, nullptr, nullptr);
+		}
+		int PeerName(SOCKET s, sockaddr* address, int* addressLen) override {
+			return ::getpeername(s, address, addressLen);
+		}
+		int EventSelect(SOCKET s, HANDLE event, long networkEvents) override {
+			return WSAEventSelect(s, event, networkEvents);
+		}
+		int EnumNetworkEvents(SOCKET s, WSANETWORKEVENTS* events) override {
+			return WSAEnumNetworkEvents(s, nullptr, events);
+		}
+		int Shutdown(SOCKET s, int how) override {
+			return ::shutdown(s, how);
+		}
+		int Close(SOCKET s) override {
+			return ::closesocket(s);
+		}
+	};
+
+	NativeSocketApi g_nativeSocketApi;
+	// keeps the override alive, g_socketApi being what the data path reads
+	std::shared_ptr<SocketApi> g_overriddenSocketApi;
+	std::atomic<SocketApi*> g_socketApi{ &g_nativeSocketApi };
+
+	std::shared_ptr<Clock> g_overriddenClock;
+	// null for steady_clock
+	std::atomic<Clock*> g_clock{ nullptr };
+}
+
+SocketApi& forwarding::nativeSocketApi()
+{
+	return g_nativeSocketApi;
+}
+
+SocketApi& forwarding::socketApi()
+{
+	return *g_socketApi.load(std::memory_order_acquire);
+}
+
+void forwarding::overrideSocketApi(std::shared_ptr<SocketApi> api)
+{
+	g_socketApi.store(api.get(), std::memory_order_release);
+	g_overriddenSocketApi = std::move(api);
+}
+
+void forwarding::resetSocketApi()
+{
+	g_socketApi.store(&g_nativeSocketApi, std::memory_order_release);
+	g_overriddenSocketApi.reset();
+}
+
+std::chrono::steady_clock::time_point forwarding::clockNow()
+{
+	auto clock = g_clock.load(std::memory_order_acquire);
+	return clock ? clock->Now() : std::chrono::steady_clock::now();
+}
+
+void forwarding::overrideClock(std::shared_ptr<Clock> clock)
+{
+	g_clock.store(clock.get(), std::memory_order_release);
+	g_overriddenClock = std::move(clock);
+}
+
+void forwarding::resetClock()
+{
+	g_clock.store(nullptr, std::memory_order_release);
+	g_overriddenClock.reset();
+}
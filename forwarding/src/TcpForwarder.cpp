@@ -1,5 +1,4 @@
 #include <vector>
-#include <thread>
 #include <atomic>
 #include <mutex>
 #include <algorithm>
@@ -8,132 +7,643 @@
 #include <string>
 #include <client.h>
 #include <map>
+#include <unordered_map>
+#include <chrono>
 #include "Forwarders.h"
+#include "Tuning.h"
+#include "Backends.h"
+#include "Tracing.h"
+#include "FlightRecorder.h"
+#include "SendQueue.h"
+#include "Tls.h"
+#include "RateLimit.h"
+#include "Runtime.h"
+#include "FastOpen.h"
+#include "Snapshot.h"
 
 using namespace forwarding;
+using namespace std::chrono;
 
 
 
 namespace forwarding {
+	const milliseconds IdleSweepInterval = 1s;
+	// bytes a budgeted pair may read from, or flush to, each of its sockets per visit of its slot, so that a bulk transfer cannot
+	// hold the loop of the bridge while the other pairs of the bridge wait
+	const std::size_t ServiceQuantum = 16 * 1024;
+	// credit kept by a pair whose reads were cut short by its queue threshold rather than its budget
+	const std::size_t MaxDeficit = 4 * ServiceQuantum;
+
+	// shared between an entry and the pairs it accepted, so that pairs can outlive their entry
+	struct EntryCounters {
+		std::atomic<std::uint64_t> activeConnections{ 0 };
+		std::atomic<std::uint64_t> acceptedConnections{ 0 };
+		std::atomic<std::int64_t> queuedBytes{ 0 };
+		std::atomic<std::uint64_t> connectionLimitTrips{ 0 };
+		std::atomic<std::uint64_t> queuedBytesLimitTrips{ 0 };
+		std::atomic<std::uint64_t> idleTimeoutTrips{ 0 };
+		std::atomic<std::uint64_t> socketExhaustionTrips{ 0 };
+		std::atomic<std::uint64_t> autoTuningSwitches{ 0 };
+		std::atomic<std::uint64_t> bytesToRemote{ 0 };
+		std::atomic<std::uint64_t> bytesToLocal{ 0 };
+		std::atomic<std::uint64_t> noBackendRefusals{ 0 };
+		std::atomic<std::uint64_t> zeroCopySends{ 0 };
+		std::atomic<std::uint64_t> zeroCopyBytes{ 0 };
+		std::atomic<std::uint64_t> tlsHandshakes{ 0 };
+		std::atomic<std::uint64_t> tlsHandshakeFailures{ 0 };
+		std::atomic<std::uint64_t> firstBytePairs{ 0 };
+		std::atomic<std::uint64_t> firstByteLatencyUs{ 0 };
+		std::atomic<std::uint64_t> maxFirstByteLatencyUs{ 0 };
+		std::atomic<std::uint64_t> budgetYields{ 0 };
+		std::atomic<std::uint64_t> rateLimitPauses{ 0 };
+		std::atomic<std::uint64_t> fastOpenConnects{ 0 };
+		std::atomic<std::uint64_t> fastOpenBytes{ 0 };
+		std::atomic<std::uint64_t> fastOpenSavedUs{ 0 };
+		std::atomic<std::uint64_t> fastOpenFallbacks{ 0 };
+		// set while the entry has connections waiting in its backlog because of PauseAccept
+		std::atomic<bool> paused{ false };
+		SafeAutoResetEvent resumeEvent;
+		explicit EntryCounters(const SafeAutoResetEvent& resumeEvent) : resumeEvent(resumeEvent) {}
+	};
+
+	// accounts a pair against its entry for as long as the pair lives. Moves swap, like SafeSocket, so that
+	// pairs can be shuffled by remove_if and released exactly once
+	class EntryLease {
+	private:
+		std::shared_ptr<EntryCounters> _counters;
+		std::int64_t _queuedBytes = 0;
+	public:
+		EntryLease() = default;
+		explicit EntryLease(std::shared_ptr<EntryCounters> counters) : _counters(std::move(counters)) {
+			++_counters->activeConnections;
+			++_counters->acceptedConnections;
+		}
+		EntryLease(const EntryLease&) = delete;
+		EntryLease& operator =(const EntryLease&) = delete;
+		EntryLease(EntryLease&& moved) : _counters(std::move(moved._counters)), _queuedBytes(moved._queuedBytes) {
+			moved._queuedBytes = 0;
+		}
+		EntryLease& operator =(EntryLease&& moved) {
+			if (this != &moved) {
+				std::swap(_counters, moved._counters);
+				std::swap(_queuedBytes, moved._queuedBytes);
+			}
+			return *this;
+		}
+		~EntryLease() {
+			if (_counters) {
+				_counters->queuedBytes -= _queuedBytes;
+				--_counters->activeConnections;
+				if (_counters->paused) {
+					SetEvent(_counters->resumeEvent.get());
+				}
+			}
+		}
+		void SetQueuedBytes(std::size_t queued) {
+			if (_counters && static_cast<std::int64_t>(queued) != _queuedBytes) {
+				_counters->queuedBytes += static_cast<std::int64_t>(queued) - _queuedBytes;
+				_queuedBytes = static_cast<std::int64_t>(queued);
+				if (queued == 0 && _counters->paused) {
+					SetEvent(_counters->resumeEvent.get());
+				}
+			}
+		}
+		void OnIdleTimeout() {
+			if (_counters) {
+				++_counters->idleTimeoutTrips;
+			}
+		}
+		void OnRetune() {
+			if (_counters) {
+				++_counters->autoTuningSwitches;
+			}
+		}
+		void OnZeroCopySend(std::size_t bytes) {
+			if (_counters) {
+				++_counters->zeroCopySends;
+				_counters->zeroCopyBytes += bytes;
+			}
+		}
+		void OnTlsHandshake(bool succeeded) {
+			if (_counters) {
+				++(succeeded ? _counters->tlsHandshakes : _counters->tlsHandshakeFailures);
+			}
+		}
+		void OnRateLimited() {
+			if (_counters) {
+				++_counters->rateLimitPauses;
+			}
+		}
+		void OnBudgetYield() {
+			if (_counters) {
+				++_counters->budgetYields;
+			}
+		}
+		void OnFastOpen(std::size_t carried, microseconds handshake) {
+			if (_counters) {
+				++_counters->fastOpenConnects;
+				_counters->fastOpenBytes += carried;
+				_counters->fastOpenSavedUs += static_cast<std::uint64_t>(handshake.count());
+			}
+		}
+		void OnFirstByte(microseconds latency) {
+			if (_counters) {
+				auto us = static_cast<std::uint64_t>(latency.count());
+				++_counters->firstBytePairs;
+				_counters->firstByteLatencyUs += us;
+				auto max = _counters->maxFirstByteLatencyUs.load();
+				while (us > max && !_counters->maxFirstByteLatencyUs.compare_exchange_weak(max, us)) {
+				}
+			}
+		}
+		void OnForwarded(std::uint64_t toRemote, std::uint64_t toLocal) {
+			if (_counters) {
+				_counters->bytesToRemote += toRemote;
+				_counters->bytesToLocal += toLocal;
+			}
+		}
+	};
 
 	struct ConnectedPair {
 		SafeSocket local;
 		SafeSocket remote;
-		std::vector<char> to_remote;
-		std::vector<char> to_local;
+		SendQueue to_remote;
+		SendQueue to_local;
 		bool closePending = false;
 		bool collectPending = false;
 		bool connected = false;
-		int id;
+		std::uint32_t id;
+		std::uint16_t localPort = 0;
+		CloseReason closeReason = CloseReason::LocalClosed;
+		EntryLease lease;
+		BackendLease backend;
+		steady_clock::time_point acceptedAt;
+		steady_clock::time_point connectStart;
+		milliseconds idleTimeout{ 0 };
+		steady_clock::time_point lastActivity = clockNow();
+		// event masks currently selected on each socket
+		long localInterest = 0;
+		long remoteInterest = 0;
+		std::uint64_t bytesToRemote = 0;
+		std::uint64_t bytesToLocal = 0;
+		TuningProfile tuning = TuningProfile::Default;
+		bool autoTuning = false;
+		std::uint32_t averageRead = 0;
+		std::size_t queueThreshold = DefaultQueueThreshold;
+		// 0 keeps every send on the copying path
+		std::uint32_t zeroCopyThreshold = 0;
+		// set for pairs of TLS entries, the local socket then carrying records
+		std::unique_ptr<TlsSession> tls;
+		// interactive pairs are served first in their slot and are not budgeted
+		bool interactive = false;
+		// deficit round robin credit of each direction, in bytes
+		std::size_t deficitToRemote = 0;
+		std::size_t deficitToLocal = 0;
+		// a flush cut short by the service quantum, resumed on the next visit of the slot
+		bool localFlushPending = false;
+		bool remoteFlushPending = false;
+		// empty for entries without rate limits
+		PairShaping shaping;
+		// reading paused by the rate limits, resumed by the bridge once the buckets refilled
+		bool throttledToRemote = false;
+		bool throttledToLocal = false;
+		// set when the upstream connect is left to the bridge, to carry the first bytes of the client in its SYN
+		std::unique_ptr<FastOpenConnect> fastOpen;
+
+		void AccountQueued() {
+			lease.SetQueuedBytes(to_remote.size() + to_local.size());
+		}
+		void Retune(TuningProfile profile) {
+			tuning = profile;
+			auto& t = TuningFor(profile);
+			ApplyTuning(local.Get(), t);
+			ApplyTuning(remote.Get(), t);
+			queueThreshold = t.queueThreshold;
+			if (zeroCopyThreshold != 0) {
+				DisableSendBuffering(local.Get());
+				DisableSendBuffering(remote.Get());
+			}
+		}
+		void OnRead(int read) {
+			if (!autoTuning || read <= 0) {
+				return;
+			}
+			averageRead = averageRead - averageRead / 8 + static_cast<std::uint32_t>(read) / 8;
+			if (tuning != TuningProfile::Throughput && averageRead >= AutoThroughputReadSize) {
+				Retune(TuningProfile::Throughput);
+				lease.OnRetune();
+			}
+			else if (tuning == TuningProfile::Throughput && averageRead <= AutoLatencyReadSize) {
+				Retune(TuningProfile::Latency);
+				lease.OnRetune();
+			}
+		}
 	};
 
 
 
+	// a single port is a range of 1: all ports of a range share the resolved names of its backends,
+	// local port start+i being forwarded to port+i of the selected backend
 	struct ForwarderEntry {
 		std::uint16_t port;
-		SafeSocket listeningSocket;
-		std::unique_ptr<ResolvedAddress> remoteAddr;
+		std::uint16_t count = 1;
+		std::vector<SafeSocket> listeningSockets;
+		BackendSet backends;
+		TcpEntryLimits limits;
+		TuningProfile tuning = TuningProfile::Default;
+		std::uint32_t zeroCopyThreshold = 0;
+		bool interactive = false;
+		bool latencyCritical = false;
+		bool fastOpen = false;
+		std::shared_ptr<TlsCredentials> tls;
+		// null until rate limits are set
+		std::shared_ptr<EntryShaper> shaper;
+		std::shared_ptr<EntryCounters> counters;
+		// listeners with connections left in their backlog while paused
+		std::vector<std::uint16_t> pausedListeners;
+		// the index of the accept event of each listening socket, see TcpForwarder::Impl::RegisterListeners
+		std::vector<std::size_t> acceptEvents;
+
+		// the limit that held on the last check, so that a trip is counted once per crossing rather than on every re-check
+		// of a paused listener
+		enum class Limit { None, Connections, QueuedBytes } overLimit = Limit::None;
+
+		bool OverLimits() {
+			auto limit = Limit::None;
+			if (limits.maxConnections != 0 && counters->activeConnections >= limits.maxConnections) {
+				limit = Limit::Connections;
+			}
+			else if (limits.maxQueuedBytes != 0 && counters->queuedBytes >= static_cast<std::int64_t>(limits.maxQueuedBytes)) {
+				limit = Limit::QueuedBytes;
+			}
+			if (limit != overLimit) {
+				if (limit == Limit::Connections) {
+					++counters->connectionLimitTrips;
+				}
+				else if (limit == Limit::QueuedBytes) {
+					++counters->queuedBytesLimitTrips;
+				}
+				overLimit = limit;
+			}
+			return limit != Limit::None;
+		}
+
+		bool Overlaps(std::uint16_t start, std::uint16_t otherCount) const {
+			return start < port + count && port < start + otherCount;
+		}
+		// whether adding the entry again with these would change nothing
+		bool Matches(std::uint16_t otherCount, std::uint32_t remotePortStart, const char* remoteAddress) const {
+			auto first = backends.First();
+			return count == otherCount && first && first->port == remotePortStart && first->address == remoteAddress;
+		}
 	};
-	struct EventPair {
-		SafeAutoResetEvent localEvent;
-		SafeAutoResetEvent remoteEvent;
-		EventPair() : localEvent(MakeAutoResetEvent()), remoteEvent(MakeAutoResetEvent()) {}
+
+	struct ListenerRef {
+		SOCKET socket;
+		ForwarderEntry* entry;
+		std::uint16_t index;
+		SafeAutoResetEvent event;
 	};
-	class TcpDataBridge {
+	// the local and remote sockets of the pairs of a slot are selected on two events of the loop the bridge runs on
+	class TcpDataBridge : public LoopSource {
 	private:
 		const int EventSlotCount = MAXIMUM_WAIT_OBJECTS / 2;
 		std::atomic<bool> _running;
-		std::thread _runningThread;
-		std::vector<EventPair> _events;
+		std::unique_ptr<LoopAttachment> _attachment;
 		std::mutex _mut;
 		std::map<int, std::vector<ConnectedPair>> _entriesSlots;
 
-		int _lastUsedSlot = -1;
+		// read by the accept loop to place new pairs without taking the bridge lock
+		std::atomic<std::size_t> _pairCount{ 0 };
+		// shared with the overlapped sends in flight
+		std::shared_ptr<ChunkPool> _pool;
+		// scratch buffers of the TLS pairs
+		const std::size_t TlsReadSize = 32 * 1024;
+		std::vector<char> _tlsReceived;
+		std::vector<char> _tlsToClient;
+		std::vector<char> _tlsPlaintext;
+		// once a pair with an idle timeout has been added, the loop wakes up periodically to sweep idle pairs
+		std::atomic<bool> _hasIdleTimeouts;
+		// earliest refill of the buckets of the pairs paused by their rate limits. Only touched by the loop thread
+		steady_clock::time_point _throttledUntil = steady_clock::time_point::max();
+		steady_clock::time_point _lastSweep = clockNow();
 
-		void OnLocalSocketSignaled(int slot) {
-			std::lock_guard<std::mutex> lg(_mut);
-			auto& entries = _entriesSlots[slot];
-			for (auto& pair : entries) {
+		HANDLE LocalEvent(int slot) const {
+			return _attachment->Events()[slot * 2].get();
+		}
+		HANDLE RemoteEvent(int slot) const {
+			return _attachment->Events()[slot * 2 + 1].get();
+		}
 
-				WSANETWORKEVENTS events;
-				WSAEnumNetworkEvents(pair.local.Get(), nullptr, &events);
-
-				if ((events.lNetworkEvents & FD_READ) == FD_READ) {
-
-					u_long available = 0;
-					ioctlsocket(pair.local.Get(), FIONREAD, &available);
-					auto oldSize = pair.to_remote.size();
-					pair.to_remote.resize(oldSize + available);
-					auto actuallyRead = recv(pair.local.Get(), &pair.to_remote[oldSize], available, 0);
-					pair.to_remote.resize(oldSize + actuallyRead);
-
-					// write what we can to remote
-					if (pair.to_remote.size() > 0) {
-						auto written = send(pair.remote.Get(), &pair.to_remote[0], static_cast<int>(pair.to_remote.size()), 0);
-						if (written > 0)
-							pair.to_remote.erase(pair.to_remote.begin(), pair.to_remote.begin() + written);
-					}
+		// interests only change when a queue crosses its threshold or gets empty: WSAEventSelect is a kernel transition, so
+		// sockets are only re-armed when their interest actually changes
+		void UpdateInterest(ConnectedPair& pair, int slot) {
+			long localEvents = FD_CLOSE;
+			if (pair.to_remote.size() < pair.queueThreshold) {
+				localEvents |= FD_READ;
+			}
+			if (pair.to_local.size() > 0) {
+				localEvents |= FD_WRITE;
+			}
+			long remoteEvents = FD_CLOSE;
+			if (!pair.connected) {
+				remoteEvents |= FD_CONNECT;
+			}
+			if (pair.to_local.size() < pair.queueThreshold) {
+				remoteEvents |= FD_READ;
+			}
+			if (pair.to_remote.size() > 0) {
+				remoteEvents |= FD_WRITE;
+			}
+			RecordBackpressure(pair, pair.localInterest, localEvents, 0);
+			RecordBackpressure(pair, pair.remoteInterest, remoteEvents, 1);
+			if (localEvents != pair.localInterest) {
+				socketApi().EventSelect(pair.local.Get(), LocalEvent(slot), localEvents);
+				pair.localInterest = localEvents;
+			}
+			if (remoteEvents != pair.remoteInterest) {
+				socketApi().EventSelect(pair.remote.Get(), RemoteEvent(slot), remoteEvents);
+				pair.remoteInterest = remoteEvents;
+			}
+		}
 
-					long localEvents = FD_CLOSE;
-					if (pair.to_remote.size() < 8192) {
-						localEvents |= FD_READ;
-					}
-					if (pair.to_local.size() > 0) {
-						localEvents |= FD_WRITE;
-					}
-					long remoteEvents = FD_CLOSE;
-					if (pair.to_local.size() < 8192) {
-						remoteEvents |= FD_READ;
-					}
-					if (pair.to_remote.size() > 0) {
-						remoteEvents |= FD_WRITE;
-					}
-					WSAEventSelect(pair.local.Get(), _events[slot].localEvent.get(), localEvents);
-					WSAEventSelect(pair.remote.Get(), _events[slot].remoteEvent.get(), remoteEvents);
+		static void RecordBackpressure(const ConnectedPair& pair, long previousInterest, long interest, std::int32_t direction) {
+			// sockets start without interest, which is not a backpressure
+			if (previousInterest == 0 || ((previousInterest ^ interest) & FD_READ) == 0) {
+				return;
+			}
+			auto event = (interest & FD_READ) == 0 ? FlightEvent::BackpressureOn : FlightEvent::BackpressureOff;
+			RecordFlight(event, pair.id, pair.localPort, direction, pair.bytesToRemote, pair.bytesToLocal);
+		}
 
-				}
-				if ((events.lNetworkEvents & FD_WRITE) == FD_WRITE) {
+		// the copying path gather-writes until the socket would block, so that FD_WRITE is guaranteed to be recorded again while
+		// data is left over. Pairs that opted in hand big queues to an overlapped send instead: with send buffering disabled, the
+		// stack transmits straight from the pinned chunks, and the completion signals completionEvent for the send to go on
+		std::size_t Flush(ConnectedPair& pair, SOCKET s, SendQueue& queue, HANDLE completionEvent, std::size_t limit = SIZE_MAX) {
+			auto queued = queue.size();
+			if (pair.zeroCopyThreshold != 0 && queued >= pair.zeroCopyThreshold && queue.SendOverlapped(s, _pool, completionEvent)) {
+				pair.lease.OnZeroCopySend(queued);
+				TraceLoggingWrite(g_forwardingTraceProvider, "ZeroCopySend",
+					TraceLoggingLevel(WINEVENT_LEVEL_VERBOSE),
+					TraceLoggingKeyword(TraceKeywordData),
+					TraceLoggingUInt32(pair.id, "PairId"),
+					TraceLoggingUInt64(queued, "Bytes"));
+				return 0;
+			}
+			auto written = queue.Flush(s, *_pool, limit);
+			TraceLoggingWrite(g_forwardingTraceProvider, "Flush",
+				TraceLoggingLevel(WINEVENT_LEVEL_VERBOSE),
+				TraceLoggingKeyword(TraceKeywordData),
+				TraceLoggingUInt64(queued, "Queued"),
+				TraceLoggingUInt64(written, "Written"));
+			return written;
+		}
 
-					if (pair.to_local.size() > 0) {
-						auto written = send(pair.local.Get(), &pair.to_local[0], static_cast<int>(pair.to_local.size()), 0);
-						if (written > 0)
-							pair.to_local.erase(pair.to_local.begin(), pair.to_local.begin() + written);
-					}
+		// data is received straight into the tail of the destination queue. When nothing was queued it is sent right away, and
+		// only what could not be sent stays queued
+		int Forward(ConnectedPair& pair, SOCKET source, SOCKET destination, SendQueue& queue, HANDLE completionEvent, std::size_t budget) {
+			auto room = pair.queueThreshold > queue.size() ? pair.queueThreshold - queue.size() : 0;
+			if (room == 0) {
+				return 0;
+			}
+			auto wasEmpty = queue.empty();
+			std::size_t tailRoom = 0;
+			auto tail = queue.Tail(*_pool, tailRoom);
+			auto toRead = static_cast<int>(std::min({ room, tailRoom, budget }));
+			auto read = socketApi().Recv(source, tail, toRead);
+			queue.CommitTail(read > 0 ? static_cast<std::size_t>(read) : 0, *_pool);
+			if (read <= 0) {
+				return 0;
+			}
+			std::size_t sent = 0;
+			if (wasEmpty) {
+				sent = Flush(pair, destination, queue, completionEvent);
+			}
+			TraceLoggingWrite(g_forwardingTraceProvider, "Forward",
+				TraceLoggingLevel(WINEVENT_LEVEL_VERBOSE),
+				TraceLoggingKeyword(TraceKeywordData),
+				TraceLoggingInt32(read, "Read"),
+				TraceLoggingUInt64(sent, "SentDirectly"));
+			return read;
+		}
 
-					long localEvents = FD_CLOSE;
-					if (pair.to_remote.size() < 8192) {
-						localEvents |= FD_READ;
-					}
-					if (pair.to_local.size() > 0) {
-						localEvents |= FD_WRITE;
-					}
-					long remoteEvents = FD_CLOSE;
-					if (pair.to_local.size() < 8192) {
-						remoteEvents |= FD_READ;
+		// bytes produced by the bridge are sent right away when nothing was queued before them
+		void Enqueue(ConnectedPair& pair, SOCKET destination, SendQueue& queue, const std::vector<char>& data, HANDLE completionEvent) {
+			if (data.empty()) {
+				return;
+			}
+			auto wasEmpty = queue.empty();
+			queue.Append(&data[0], data.size(), *_pool);
+			if (wasEmpty) {
+				Flush(pair, destination, queue, completionEvent);
+			}
+		}
+
+		// the local socket of TLS pairs carries records: handshake messages go back to the client and decrypted data upstream.
+		// Returns the number of plaintext bytes forwarded, or -1 once the session is over
+		int ForwardFromTlsClient(ConnectedPair& pair, int slot, std::size_t budget) {
+			if (pair.to_remote.size() >= pair.queueThreshold) {
+				return 0;
+			}
+			auto read = socketApi().Recv(pair.local.Get(), &_tlsReceived[0], static_cast<int>(std::min(_tlsReceived.size(), budget)));
+			if (read <= 0) {
+				return 0;
+			}
+			auto wasEstablished = pair.tls->Established();
+			_tlsToClient.clear();
+			_tlsPlaintext.clear();
+			auto result = pair.tls->OnReceived(&_tlsReceived[0], read, _tlsToClient, _tlsPlaintext);
+			Enqueue(pair, pair.local.Get(), pair.to_local, _tlsToClient, LocalEvent(slot));
+			Enqueue(pair, pair.remote.Get(), pair.to_remote, _tlsPlaintext, RemoteEvent(slot));
+			if (result == TlsSession::Result::HandshakeCompleted || (result == TlsSession::Result::Failed && !wasEstablished)) {
+				auto succeeded = result == TlsSession::Result::HandshakeCompleted;
+				pair.lease.OnTlsHandshake(succeeded);
+				TraceLoggingWrite(g_forwardingTraceProvider, "TlsHandshake",
+					TraceLoggingLevel(WINEVENT_LEVEL_INFO),
+					TraceLoggingKeyword(TraceKeywordConnections),
+					TraceLoggingUInt32(pair.id, "PairId"),
+					TraceLoggingBool(succeeded, "Succeeded"));
+			}
+			if (result == TlsSession::Result::Failed || result == TlsSession::Result::Closed) {
+				return -1;
+			}
+			return static_cast<int>(_tlsPlaintext.size());
+		}
+
+		// upstream plaintext goes to the client in records. Returns -1 when encryption failed
+		int ForwardToTlsClient(ConnectedPair& pair, int slot, std::size_t budget) {
+			auto room = pair.queueThreshold > pair.to_local.size() ? pair.queueThreshold - pair.to_local.size() : 0;
+			if (room == 0) {
+				return 0;
+			}
+			auto toRead = static_cast<int>(std::min({ room, _tlsReceived.size(), budget }));
+			auto read = socketApi().Recv(pair.remote.Get(), &_tlsReceived[0], toRead);
+			if (read <= 0) {
+				return 0;
+			}
+			_tlsToClient.clear();
+			if (!pair.tls->Encrypt(&_tlsReceived[0], read, _tlsToClient)) {
+				return -1;
+			}
+			Enqueue(pair, pair.local.Get(), pair.to_local, _tlsToClient, LocalEvent(slot));
+			return read;
+		}
+
+		// deficit round robin: every visit credits a direction with ServiceQuantum bytes. Reading the whole budget means the source
+		// may have more, which winsock signals again, and the pair yields to the other pairs of the bridge meanwhile
+		static std::size_t Credit(const ConnectedPair& pair, std::size_t& deficit) {
+			if (pair.interactive) {
+				return SIZE_MAX;
+			}
+			deficit = std::min(deficit + ServiceQuantum, MaxDeficit);
+			return deficit;
+		}
+		static void Charge(ConnectedPair& pair, std::size_t& deficit, int read) {
+			if (pair.interactive) {
+				return;
+			}
+			if (read <= 0) {
+				// an empty source does not keep credit
+				deficit = 0;
+			}
+			else if (static_cast<std::size_t>(read) >= deficit) {
+				deficit = 0;
+				pair.lease.OnBudgetYield();
+			}
+			else {
+				deficit -= read;
+			}
+		}
+
+		// the token buckets of the entry and of the client cap the read. An empty bucket pauses reading, and as FD_READ is not
+		// recorded again until we read, the loop wakes up by itself to resume the pair once the buckets refilled
+		std::size_t Shape(ConnectedPair& pair, std::size_t budget, bool& throttled, steady_clock::time_point now) {
+			if (!pair.shaping) {
+				return budget;
+			}
+			auto allowed = pair.shaping.Allowance(now);
+			if (allowed == 0) {
+				if (!throttled) {
+					pair.lease.OnRateLimited();
+				}
+				throttled = true;
+				_throttledUntil = std::min(_throttledUntil, pair.shaping.ReadyAt(now));
+				return 0;
+			}
+			throttled = false;
+			return std::min(budget, allowed);
+		}
+
+		void ResumeThrottled() {
+			std::lock_guard<std::mutex> lg(_mut);
+			_throttledUntil = steady_clock::time_point::max();
+			for (auto& slot : _entriesSlots) {
+				for (auto& pair : slot.second) {
+					if (pair.throttledToRemote) {
+						SetEvent(LocalEvent(slot.first));
 					}
-					if (pair.to_remote.size() > 0) {
-						remoteEvents |= FD_WRITE;
+					if (pair.throttledToLocal) {
+						SetEvent(RemoteEvent(slot.first));
 					}
+				}
+			}
+		}
 
-					WSAEventSelect(pair.local.Get(), _events[slot].localEvent.get(), localEvents);
-					WSAEventSelect(pair.remote.Get(), _events[slot].remoteEvent.get(), remoteEvents);
-					if (pair.to_local.size() == 0 && pair.to_remote.size() == 0 && pair.closePending) {
-						pair.collectPending = true;
-					}
+		// FD_WRITE is only recorded again once a send would block: a flush cut short by the quantum signals the slot itself
+		// to come back to the rest
+		void FlushWithinQuantum(ConnectedPair& pair, SOCKET s, SendQueue& queue, HANDLE slotEvent, bool& flushPending) {
+			flushPending = false;
+			auto limit = pair.interactive ? SIZE_MAX : ServiceQuantum;
+			auto written = Flush(pair, s, queue, slotEvent, limit);
+			if (written >= limit && !queue.empty() && !queue.SendInFlight()) {
+				flushPending = true;
+				pair.lease.OnBudgetYield();
+				SetEvent(slotEvent);
+			}
+		}
 
+		// what is still queued is sent before the pair is collected
+		static void BeginClose(ConnectedPair& pair, CloseReason reason) {
+			if (!pair.closePending) {
+				pair.closeReason = reason;
+			}
+			if (pair.to_local.size() == 0 && pair.to_remote.size() == 0) {
+				pair.collectPending = true;
+			}
+			else {
+				pair.closePending = true;
+			}
+		}
+
+		void CollectPending(std::vector<ConnectedPair>& entries) {
+			auto collected = std::remove_if(entries.begin(), entries.end(), [](const ConnectedPair& p) {return p.collectPending; });
+			for (auto it = collected; it != entries.end(); ++it) {
+				RecordFlight(FlightEvent::Close, it->id, it->localPort, static_cast<std::int32_t>(it->closeReason), it->bytesToRemote, it->bytesToLocal);
+				TraceLoggingWrite(g_forwardingTraceProvider, "PairCollect",
+					TraceLoggingLevel(WINEVENT_LEVEL_INFO),
+					TraceLoggingKeyword(TraceKeywordConnections),
+					TraceLoggingUInt32(it->id, "PairId"),
+					TraceLoggingBool(it->connected, "Connected"),
+					TraceLoggingUInt64(it->bytesToRemote, "BytesToRemote"),
+					TraceLoggingUInt64(it->bytesToLocal, "BytesToLocal"));
+			}
+			_pairCount -= static_cast<std::size_t>(entries.end() - collected);
+			entries.erase(collected, entries.end());
+		}
+
+		void OnLocalSocketSignaled(int slot) {
+			std::lock_guard<std::mutex> lg(_mut);
+			auto& entries = _entriesSlots[slot];
+			auto now = clockNow();
+			for (auto& pair : entries) {
+
+				bool sendFailed = false;
+				auto sendCompleted = pair.to_local.TakeCompletion(sendFailed);
+				WSANETWORKEVENTS events;
+				socketApi().EnumNetworkEvents(pair.local.Get(), &events);
+				if (events.lNetworkEvents == 0 && !sendCompleted && !pair.localFlushPending && !pair.throttledToRemote) {
+					continue;
+				}
+				if (sendFailed) {
+					pair.closeReason = CloseReason::LocalClosed;
+					pair.collectPending = true;
+					pair.AccountQueued();
+					continue;
+				}
+				if ((events.lNetworkEvents & (FD_READ | FD_WRITE)) != 0) {
+					pair.lastActivity = now;
 				}
-				if ((events.lNetworkEvents & FD_CLOSE) == FD_CLOSE) {
 
-					if (pair.to_local.size() == 0 && pair.to_remote.size() == 0) {
-						pair.collectPending = true;
+				auto sessionOver = false;
+				if ((events.lNetworkEvents & FD_READ) == FD_READ || pair.throttledToRemote) {
+					auto budget = Shape(pair, Credit(pair, pair.deficitToRemote), pair.throttledToRemote, now);
+					auto read = budget == 0 ? 0 : pair.tls ? ForwardFromTlsClient(pair, slot, budget) : Forward(pair, pair.local.Get(), pair.remote.Get(), pair.to_remote, RemoteEvent(slot), budget);
+					Charge(pair, pair.deficitToRemote, read);
+					sessionOver = read < 0;
+					if (read > 0) {
+						if (pair.shaping) {
+							pair.shaping.Consume(read, 0);
+						}
+						pair.bytesToRemote += read;
+						pair.lease.OnForwarded(read, 0);
+						pair.OnRead(read);
 					}
-					else {
-						pair.closePending = true;
+				}
+				if ((events.lNetworkEvents & FD_WRITE) == FD_WRITE || sendCompleted || pair.localFlushPending) {
+					FlushWithinQuantum(pair, pair.local.Get(), pair.to_local, LocalEvent(slot), pair.localFlushPending);
+					if (pair.to_local.size() == 0 && pair.to_remote.size() == 0 && pair.closePending) {
+						pair.collectPending = true;
 					}
-
 				}
+				if ((events.lNetworkEvents & FD_CLOSE) == FD_CLOSE || sessionOver) {
+					BeginClose(pair, CloseReason::LocalClosed);
+				}
+				if (!pair.collectPending) {
+					UpdateInterest(pair, slot);
+				}
+				pair.AccountQueued();
 			}
-			entries.erase(std::remove_if(entries.begin(), entries.end(), [](const ConnectedPair& p) {return p.collectPending; }), entries.end());
+			CollectPending(entries);
 		}
 
 		void OnRemoteSocketSignaled(int slot) {
@@ -142,241 +652,508 @@ namespace forwarding {
 			if (entries.size() == 0) {
 				return;
 			}
+			auto now = clockNow();
 			for (auto& pair : entries) {
+				bool sendFailed = false;
+				auto sendCompleted = pair.to_remote.TakeCompletion(sendFailed);
+				int connectError = 0;
+				std::size_t carried = 0;
+				auto fastOpenCompleted = pair.fastOpen && pair.fastOpen->TakeCompletion(pair.remote.Get(), connectError, carried);
 				WSANETWORKEVENTS events;
-				WSAEnumNetworkEvents(pair.remote.Get(), nullptr, &events);
-
-				if ((events.lNetworkEvents & FD_READ) == FD_READ) {
-
-
-					u_long available = 0;
-					ioctlsocket(pair.remote.Get(), FIONREAD, &available);
-					auto oldSize = pair.to_local.size();
-					pair.to_local.resize(oldSize + available);
-					auto actuallyRead = recv(pair.remote.Get(), &pair.to_local[oldSize], available, 0);
-					pair.to_local.resize(oldSize + actuallyRead);
-
-					// write what we can to local
-					if (pair.to_local.size() > 0) {
-						auto written = send(pair.local.Get(), &pair.to_local[0], static_cast<int>(pair.to_local.size()), 0);
-						if (written > 0)
-							pair.to_local.erase(pair.to_local.begin(), pair.to_local.begin() + written);
-					}
+				socketApi().EnumNetworkEvents(pair.remote.Get(), &events);
+				if (events.lNetworkEvents == 0 && !sendCompleted && !fastOpenCompleted && !pair.remoteFlushPending && !pair.throttledToLocal) {
+					continue;
+				}
+				if (sendFailed) {
+					pair.closeReason = CloseReason::RemoteClosed;
+					pair.collectPending = true;
+					pair.AccountQueued();
+					continue;
+				}
+				if ((events.lNetworkEvents & (FD_READ | FD_WRITE)) != 0) {
+					pair.lastActivity = now;
+				}
 
-					long localEvents = FD_CLOSE;
-					if (pair.to_remote.size() < 8192) {
-						localEvents |= FD_READ;
-					}
-					if (pair.to_local.size() > 0) {
-						localEvents |= FD_WRITE;
+				// the completion of a fast open connect is only reported through its overlapped structure
+				auto connectCompleted = fastOpenCompleted || (!pair.fastOpen && (events.lNetworkEvents & FD_CONNECT) == FD_CONNECT);
+				if (!fastOpenCompleted) {
+					connectError = events.iErrorCode[FD_CONNECT_BIT];
+				}
+				if (connectCompleted) {
+					auto handshake = duration_cast<microseconds>(now - pair.connectStart);
+					TraceLoggingWrite(g_forwardingTraceProvider, "ConnectComplete",
+						TraceLoggingLevel(WINEVENT_LEVEL_INFO),
+						TraceLoggingKeyword(TraceKeywordConnections),
+						TraceLoggingUInt32(pair.id, "PairId"),
+						TraceLoggingInt32(connectError, "Error"),
+						TraceLoggingInt64(handshake.count(), "LatencyUs"),
+						TraceLoggingUInt64(carried, "FastOpenBytes"));
+					RecordFlight(FlightEvent::ConnectResult, pair.id, pair.localPort, connectError);
+					if (connectError != 0) {
+						// the upstream refused or timed out: nothing more will happen on this pair
+						pair.closeReason = CloseReason::ConnectFailed;
+						pair.collectPending = true;
+						continue;
 					}
-					long remoteEvents = FD_CLOSE;
-					if (pair.to_local.size() < 8192) {
-						remoteEvents |= FD_READ;
+					pair.connected = true;
+					pair.backend.OnConnected(handshake);
+					if (carried > 0) {
+						// the first bytes did not wait for the handshake when the upstream accepted them in the SYN
+						pair.bytesToRemote += carried;
+						pair.lease.OnForwarded(carried, 0);
+						pair.lease.OnFastOpen(carried, handshake);
 					}
-					if (pair.to_remote.size() > 0) {
-						remoteEvents |= FD_WRITE;
+				}
+				auto sessionOver = false;
+				if ((events.lNetworkEvents & FD_READ) == FD_READ || pair.throttledToLocal) {
+					auto budget = Shape(pair, Credit(pair, pair.deficitToLocal), pair.throttledToLocal, now);
+					auto read = budget == 0 ? 0 : pair.tls ? ForwardToTlsClient(pair, slot, budget) : Forward(pair, pair.remote.Get(), pair.local.Get(), pair.to_local, LocalEvent(slot), budget);
+					Charge(pair, pair.deficitToLocal, read);
+					sessionOver = read < 0;
+					if (read > 0) {
+						if (pair.shaping) {
+							pair.shaping.Consume(read, 0);
+						}
+						if (pair.bytesToLocal == 0) {
+							pair.lease.OnFirstByte(duration_cast<microseconds>(now - pair.acceptedAt));
+						}
+						pair.bytesToLocal += read;
+						pair.lease.OnForwarded(0, read);
+						pair.OnRead(read);
 					}
-					WSAEventSelect(pair.local.Get(), _events[slot].localEvent.get(), localEvents);
-					WSAEventSelect(pair.remote.Get(), _events[slot].remoteEvent.get(), remoteEvents);
-
-
 				}
-				if ((events.lNetworkEvents & FD_WRITE) == FD_WRITE) {
+				if ((events.lNetworkEvents & FD_WRITE) == FD_WRITE || sendCompleted || fastOpenCompleted || pair.remoteFlushPending) {
 
 					if (!pair.connected) {
 						pair.connected = true;
 					}
-					if (pair.to_remote.size() > 0) {
-						auto written = send(pair.remote.Get(), &pair.to_remote[0], static_cast<int>(pair.to_remote.size()), 0);
-						if (written > 0)
-							pair.to_remote.erase(pair.to_remote.begin(), pair.to_remote.begin() + written);
-					}
-					long localEvents = FD_CLOSE;
-					if (pair.to_remote.size() < 8192) {
-						localEvents |= FD_READ;
-					}
-					if (pair.to_local.size() > 0) {
-						localEvents |= FD_WRITE;
-					}
-					long remoteEvents = FD_CLOSE;
-					if (pair.to_local.size() < 8192) {
-						remoteEvents |= FD_READ;
-					}
-					if (pair.to_remote.size() > 0) {
-						remoteEvents |= FD_WRITE;
-					}
-
-					WSAEventSelect(pair.local.Get(), _events[slot].localEvent.get(), localEvents);
-					WSAEventSelect(pair.remote.Get(), _events[slot].remoteEvent.get(), remoteEvents);
+					FlushWithinQuantum(pair, pair.remote.Get(), pair.to_remote, RemoteEvent(slot), pair.remoteFlushPending);
 					if (pair.to_local.size() == 0 && pair.to_remote.size() == 0 && pair.closePending) {
 						pair.collectPending = true;
 					}
 
 				}
+				if (sessionOver) {
+					BeginClose(pair, CloseReason::LocalClosed);
+				}
 				if ((events.lNetworkEvents & FD_CLOSE) == FD_CLOSE) {
+					BeginClose(pair, CloseReason::RemoteClosed);
+				}
+				if (!pair.collectPending) {
+					UpdateInterest(pair, slot);
+				}
+				pair.AccountQueued();
+			}
+
+			CollectPending(entries);
 
-					if (pair.to_local.size() == 0 && pair.to_remote.size() == 0) {
+		}
+
+		void SweepIdlePairs() {
+			std::lock_guard<std::mutex> lg(_mut);
+			auto now = clockNow();
+			for (auto& slot : _entriesSlots) {
+				auto& entries = slot.second;
+				for (auto& pair : entries) {
+					if (pair.idleTimeout.count() > 0 && now - pair.lastActivity > pair.idleTimeout) {
 						pair.collectPending = true;
+						pair.closeReason = CloseReason::IdleTimeout;
+						pair.lease.OnIdleTimeout();
 					}
-					else {
-						pair.closePending = true;
-					}
-
 				}
+				CollectPending(entries);
 			}
-
-			entries.erase(std::remove_if(entries.begin(), entries.end(), [](const ConnectedPair& p) {return p.collectPending; }), entries.end());
-
 		}
 	public:
-		TcpDataBridge() : _running(false)
+		TcpDataBridge(Runtime::Impl& runtime, bool lowLatency) : _running(false), _pool(std::make_shared<ChunkPool>()), _hasIdleTimeouts(false)
 		{
-			_events.resize(EventSlotCount);
+			_attachment = lowLatency ? runtime.AttachLowLatency(*this, EventSlotCount * 2, "LowLatencyTcpDataBridge") : runtime.Attach(*this, EventSlotCount * 2, "TcpDataBridge");
+			_tlsReceived.resize(TlsReadSize);
 		}
-		void Loop() {
-			std::vector<HANDLE> events;
-			for (auto& p : _events) {
-				events.push_back(p.localEvent.get());
-				events.push_back(p.remoteEvent.get());
+		void OnSignaled(std::size_t index) override {
+			auto slot = static_cast<int>(index / 2);
+			if (index % 2 == 1) {
+				OnRemoteSocketSignaled(slot);
 			}
-			while (_running) {
-				auto waitResult = WaitForMultipleObjects(static_cast<DWORD>(events.size()), &events[0], FALSE, INFINITE);
-				if (!_running) {
-					return;
-				}
-				if (waitResult >=WAIT_ABANDONED_0 || waitResult == WAIT_IO_COMPLETION || waitResult == WAIT_TIMEOUT || waitResult == WAIT_FAILED) {
-					continue;
-				}
-				else{
-					auto evIndex = waitResult - WAIT_OBJECT_0;
-					auto slotIndex = evIndex / 2;
-					bool isRemote = (evIndex % 2) == 1;
-					if (isRemote) {
-						OnRemoteSocketSignaled(slotIndex);
-					}
-					else {
-						OnLocalSocketSignaled(slotIndex);
-					}
-				}
+			else {
+				OnLocalSocketSignaled(slot);
 			}
 		}
+		void OnDeadline() override {
+			if (clockNow() >= _throttledUntil) {
+				ResumeThrottled();
+			}
+			if (_hasIdleTimeouts && clockNow() - _lastSweep >= IdleSweepInterval) {
+				SweepIdlePairs();
+				_lastSweep = clockNow();
+			}
+		}
+		steady_clock::time_point NextDeadline() override {
+			auto next = _throttledUntil;
+			if (_hasIdleTimeouts) {
+				next = std::min(next, _lastSweep + IdleSweepInterval);
+			}
+			return next;
+		}
 		void Start() {
 			if (_running) {
 				return;
 			}
 			_running = true;
-			_runningThread = std::thread([this]() {
-				this->Loop();
-			});
+			_attachment->Enable();
 		}
 		void Stop() {
 			if (!_running) {
 				return;
 			}
 			_running = false;
-			{
-				std::lock_guard<std::mutex> lg(_mut);
-				_entriesSlots.clear();
-				SetEvent(_events[0].localEvent.get());
-			}
-			_runningThread.join();
+			_attachment->Disable();
+			std::lock_guard<std::mutex> lg(_mut);
+			_entriesSlots.clear();
+			_pairCount = 0;
 		}
 		~TcpDataBridge() {
 			Stop();
 		}
+		std::size_t PairCount() const {
+			return _pairCount;
+		}
+		TcpBridgeStats Stats() {
+			std::lock_guard<std::mutex> lg(_mut);
+			TcpBridgeStats stats;
+			stats.pairs = _pairCount;
+			stats.busiestSlotPairs = 0;
+			stats.idlestSlotPairs = ~std::uint64_t(0);
+			for (int slot = 0; slot < EventSlotCount; ++slot) {
+				auto found = _entriesSlots.find(slot);
+				std::uint64_t pairs = found == _entriesSlots.end() ? 0 : found->second.size();
+				stats.busiestSlotPairs = std::max(stats.busiestSlotPairs, pairs);
+				stats.idlestSlotPairs = std::min(stats.idlestSlotPairs, pairs);
+			}
+			return stats;
+		}
+		// the connect completion signals the remote event of the slot, where it is picked up with the other remote events
+		void StartFastOpen(ConnectedPair& pair, int slot) {
+			int error = 0;
+			if (!pair.fastOpen->Start(pair.remote.Get(), RemoteEvent(slot), error)) {
+				RecordFlight(FlightEvent::ConnectResult, pair.id, pair.localPort, error);
+				pair.closeReason = CloseReason::ConnectFailed;
+				pair.collectPending = true;
+				// collected on the next visit of the slot
+				SetEvent(RemoteEvent(slot));
+			}
+		}
+
 		void AddConnectedPair(ConnectedPair&& pair) {
 
 			std::lock_guard<std::mutex> lg(_mut);
-			auto slot = (++_lastUsedSlot) % EventSlotCount;
-			auto& evs = _events[slot];
-			_entriesSlots[slot].push_back(std::move(pair));
-			if ((_entriesSlots[slot].end() - 1)->connected) {
-				WSAEventSelect((_entriesSlots[slot].end() - 1)->local.Get(), evs.localEvent.get(), FD_READ | FD_CLOSE);
-				WSAEventSelect((_entriesSlots[slot].end() - 1)->remote.Get(), evs.remoteEvent.get(), FD_READ | FD_CLOSE);
+			if (pair.idleTimeout.count() > 0 && !_hasIdleTimeouts) {
+				_hasIdleTimeouts = true;
+				// wake the loop so that it picks the sweep deadline up
+				SetEvent(LocalEvent(0));
 			}
-			else {
-				WSAEventSelect((_entriesSlots[slot].end() - 1)->local.Get(), evs.localEvent.get(), FD_READ | FD_CLOSE);
-				WSAEventSelect((_entriesSlots[slot].end() - 1)->remote.Get(), evs.remoteEvent.get(), FD_READ | FD_WRITE | FD_CLOSE);
+			// pairs of a slot are all scanned when its events fire, so a round robin that ignores closed pairs lets a few slots
+			// pile up long lived pairs while others empty out after a reconnect wave
+			auto slot = 0;
+			auto slotPairs = _entriesSlots[0].size();
+			for (int i = 1; i < EventSlotCount && slotPairs > 0; ++i) {
+				auto pairs = _entriesSlots[i].size();
+				if (pairs < slotPairs) {
+					slot = i;
+					slotPairs = pairs;
+				}
+			}
+			auto& entries = _entriesSlots[slot];
+			auto position = entries.end();
+			if (pair.interactive) {
+				position = std::find_if(entries.begin(), entries.end(), [](const ConnectedPair& p) {return !p.interactive; });
+			}
+			auto added = entries.insert(position, std::move(pair));
+			++_pairCount;
+			UpdateInterest(*added, slot);
+			if (added->fastOpen) {
+				StartFastOpen(*added, slot);
 			}
 		}
 	};
 
-	class TcpForwarder::Impl : public std::enable_shared_from_this<TcpForwarder::Impl> {
+	class TcpForwarder::Impl : public LoopSource {
 	private:
-
-		SafeAutoResetEvent _acceptEvent;
+		// keeps the loops running for the bridges
+		std::shared_ptr<Runtime::Impl> _runtime;
+		// the events handed out with the attachment, the accept events of the listeners are added after them
+		const std::size_t ResumeEventIndex = 0;
+		const std::size_t ProbeEventIndex = 1;
+		std::unique_ptr<LoopAttachment> _attachment;
+		// signaled when a paused entry may be back under its limits
+		SafeAutoResetEvent _resumeEvent;
+		// shared by all the health probes, and signaled when health checks are reconfigured
+		SafeAutoResetEvent _probeEvent;
+		// only touched by the accept loop
+		steady_clock::time_point _nextHealthCheck = steady_clock::time_point::max();
+		SafeSocket _reserveSocket;
 
 		std::mutex _entriesMut;
 		std::vector<std::unique_ptr<ForwarderEntry>> _entries;
+		// null until RestoreSnapshot
+		std::shared_ptr<EntrySnapshot::Impl> _snapshot;
+		// each listening socket has an accept event of its own, so that a signal goes straight to its socket however many
+		// ports are forwarded
+		std::unordered_map<std::size_t, ListenerRef> _listeners;
+		std::size_t _nextAcceptEvent = ProbeEventIndex + 1;
 		std::atomic<bool> _running;
-		int _bridgeSlot = 0;
-		std::unique_ptr<TcpDataBridge> _bridges[4];
-
-		std::thread _runningThread;
+		// one per loop of the runtime
+		std::vector<std::unique_ptr<TcpDataBridge>> _bridges;
+		// on the low latency loop, created with the first latency-critical entry
+		std::unique_ptr<TcpDataBridge> _lowLatencyBridge;
 
-		void OnEntryAcceptedOrClosed() {
-			{
-				std::lock_guard<std::mutex> lg(_entriesMut);
-				for (auto it = _entries.begin(); it != _entries.end(); ++it) {
-					WSANETWORKEVENTS events;
-					WSAEnumNetworkEvents(it->get()->listeningSocket.Get(), nullptr, &events);
-					if ((events.lNetworkEvents & FD_ACCEPT) == FD_ACCEPT) {
-						auto rawSock = WSAAccept(it->get()->listeningSocket.Get(), nullptr, nullptr, nullptr, NULL);
-						if (INVALID_SOCKET == rawSock) {
-							continue;
-						}
-						{
-							ConnectedPair pair;
-							pair.local = rawSock;
-							pair.remote = socket(AF_INET, SOCK_STREAM, 0);
-							unsigned long nonBlocking = 1;
-							ioctlsocket(pair.remote.Get(), FIONBIO, &nonBlocking);
-							auto connectResult = connect(pair.remote.Get(), it->get()->remoteAddr->SockAddr(), it->get()->remoteAddr->SockAddrLen());
-							if (connectResult == 0) {
-								pair.connected = true;
-								pair.id = _bridgeSlot;
-								_bridges[(_bridgeSlot++) % 4]->AddConnectedPair(std::move(pair));
-							}
-							else if (WSAGetLastError() == WSAEWOULDBLOCK) {
-								pair.id = _bridgeSlot;
-								_bridges[(_bridgeSlot++) % 4]->AddConnectedPair(std::move(pair));
-							}
-
-							// if connection error, don't do anything
-						}
-					}
+		TcpDataBridge& LeastLoadedBridge() {
+			auto* least = _bridges.front().get();
+			for (auto& bridge : _bridges) {
+				if (bridge->PairCount() < least->PairCount()) {
+					least = bridge.get();
 				}
 			}
+			return *least;
 		}
 
-	public:
-		void Loop() {
-			while (_running) {
-				HANDLE events[] = { _acceptEvent.get() };
-				auto waitResult = WaitForMultipleObjects(1, events, FALSE, INFINITE);
-				if (!_running) {
+		void AcceptFrom(ForwarderEntry& entry, std::uint16_t index) {
+			auto listeningSocket = entry.listeningSockets[index].Get();
+			if (entry.OverLimits()) {
+				if (entry.limits.overloadPolicy == OverloadPolicy::PauseAccept) {
+					// not accepting leaves FD_ACCEPT disabled until we come back to this listener
+					entry.counters->paused = true;
+					entry.pausedListeners.push_back(index);
 					return;
 				}
-				if (waitResult == WAIT_OBJECT_0) {
-					OnEntryAcceptedOrClosed();
+				auto refused = socketApi().Accept(listeningSocket, nullptr, nullptr);
+				if (INVALID_SOCKET != refused) {
+					AbortiveClose(refused);
+				}
+				return;
+			}
+			auto rawSock = socketApi().Accept(listeningSocket, nullptr, nullptr);
+			if (INVALID_SOCKET == rawSock) {
+				auto err = WSAGetLastError();
+				if (err == WSAEMFILE || err == WSAENOBUFS) {
+					++entry.counters->socketExhaustionTrips;
+					ShedWithReserve(listeningSocket);
+				}
+				return;
+			}
+			auto acceptedAt = clockNow();
+			auto localPort = static_cast<std::uint16_t>(entry.port + index);
+			auto id = NewConnectionId();
+			RecordFlight(FlightEvent::Accept, id, localPort);
+			TraceLoggingWrite(g_forwardingTraceProvider, "Accept",
+				TraceLoggingLevel(WINEVENT_LEVEL_INFO),
+				TraceLoggingKeyword(TraceKeywordConnections),
+				TraceLoggingUInt32(id, "PairId"),
+				TraceLoggingUInt16(localPort, "LocalPort"));
+			auto backend = entry.backends.Select();
+			if (!backend) {
+				++entry.counters->noBackendRefusals;
+				AbortiveClose(rawSock);
+				return;
+			}
+			// picks up the latest background re-resolution of the backend name
+			auto resolved = backend->name->Current();
+			auto rawRemote = socketApi().Socket(resolved->Family(), SOCK_STREAM, 0);
+			if (INVALID_SOCKET == rawRemote) {
+				++entry.counters->socketExhaustionTrips;
+				AbortiveClose(rawSock);
+				return;
+			}
+			sockaddr_storage remoteAddr;
+			auto remoteAddrLen = SockAddrWithPort(*resolved, backend->port + index, remoteAddr);
+			ConnectedPair pair;
+			pair.id = id;
+			pair.localPort = localPort;
+			pair.acceptedAt = acceptedAt;
+			pair.local = rawSock;
+			pair.remote = rawRemote;
+			pair.zeroCopyThreshold = entry.zeroCopyThreshold;
+			pair.interactive = entry.interactive;
+			if (entry.shaper) {
+				sockaddr_in clientAddr;
+				int clientAddrLen = sizeof(clientAddr);
+				ZeroMemory(&clientAddr, sizeof(clientAddr));
+				socketApi().PeerName(rawSock, reinterpret_cast<sockaddr*>(&clientAddr), &clientAddrLen);
+				pair.shaping = entry.shaper->ForClient(clientAddr);
+			}
+			if (entry.tls) {
+				pair.tls = std::make_unique<TlsSession>(entry.tls);
+			}
+			if (pair.zeroCopyThreshold != 0) {
+				DisableSendBuffering(pair.local.Get());
+				DisableSendBuffering(pair.remote.Get());
+			}
+			if (entry.tuning != TuningProfile::Default) {
+				// buffers must be sized before connecting for the upstream window to take them into account
+				pair.Retune(entry.tuning);
+				pair.autoTuning = entry.tuning == TuningProfile::Auto;
+			}
+			socketApi().SetNonBlocking(pair.remote.Get());
+			if (entry.fastOpen && !pair.tls) {
+				PrepareFastOpen(entry, pair, resolved->Family(), remoteAddr, remoteAddrLen);
+			}
+			pair.connectStart = clockNow();
+			int connectResult = SOCKET_ERROR;
+			auto connectError = 0;
+			if (!pair.fastOpen) {
+				connectResult = socketApi().Connect(pair.remote.Get(), reinterpret_cast<const sockaddr*>(&remoteAddr), remoteAddrLen);
+				connectError = connectResult == 0 ? 0 : WSAGetLastError();
+			}
+			TraceLoggingWrite(g_forwardingTraceProvider, "ConnectStart",
+				TraceLoggingLevel(WINEVENT_LEVEL_INFO),
+				TraceLoggingKeyword(TraceKeywordConnections),
+				TraceLoggingUInt32(id, "PairId"),
+				TraceLoggingUInt16(localPort, "LocalPort"),
+				TraceLoggingString(backend->address.c_str(), "Backend"),
+				TraceLoggingUInt32(backend->port + index, "RemotePort"),
+				TraceLoggingInt32(connectError, "Result"),
+				TraceLoggingBool(pair.fastOpen != nullptr, "FastOpen"));
+			if (connectError != 0 && connectError != WSAEWOULDBLOCK) {
+				RecordFlight(FlightEvent::ConnectResult, id, localPort, connectError);
+				RecordFlight(FlightEvent::Close, id, localPort, static_cast<std::int32_t>(CloseReason::ConnectFailed));
+			}
+			else {
+				pair.connected = connectResult == 0;
+				if (pair.connected) {
+					RecordFlight(FlightEvent::ConnectResult, id, localPort, 0);
+				}
+				pair.lease = EntryLease(entry.counters);
+				pair.backend = BackendLease(backend->counters);
+				if (pair.connected) {
+					pair.backend.OnConnected(duration_cast<microseconds>(clockNow() - pair.connectStart));
+				}
+				pair.idleTimeout = milliseconds(entry.limits.idleTimeoutMs);
+				auto& bridge = entry.latencyCritical && _lowLatencyBridge ? *_lowLatencyBridge : LeastLoadedBridge();
+				bridge.AddConnectedPair(std::move(pair));
+			}
+		}
+
+		// the first bytes of the client, already there when it used fast open itself, are carried by the SYN of the upstream
+		// connect, started by the bridge once the pair has its slot. Without fast open support the upstream is connected the
+		// regular way
+		static void PrepareFastOpen(ForwarderEntry& entry, ConnectedPair& pair, int family, const sockaddr_storage& remoteAddr, int remoteAddrLen) {
+			auto fastOpen = std::make_unique<FastOpenConnect>();
+			if (!fastOpen->Prepare(pair.remote.Get(), family, reinterpret_cast<const sockaddr*>(&remoteAddr), remoteAddrLen)) {
+				++entry.counters->fastOpenFallbacks;
+				return;
+			}
+			auto read = fastOpen->ReadFirstBytes(pair.local.Get());
+			if (read > 0 && pair.shaping) {
+				pair.shaping.Consume(read, 0);
+			}
+			pair.fastOpen = std::move(fastOpen);
+		}
+
+		// when sockets are exhausted, the spare socket is given up so that the pending client gets reset instead of hanging in the backlog
+		void ShedWithReserve(SOCKET listeningSocket) {
+			_reserveSocket.Close();
+			auto shed = socketApi().Accept(listeningSocket, nullptr, nullptr);
+			if (INVALID_SOCKET != shed) {
+				AbortiveClose(shed);
+			}
+			auto reserve = socketApi().Socket(AF_INET, SOCK_STREAM, 0);
+			if (INVALID_SOCKET != reserve) {
+				_reserveSocket = reserve;
+			}
+		}
+
+		void OnEntryAcceptedOrClosed(std::size_t acceptEvent) {
+			std::lock_guard<std::mutex> lg(_entriesMut);
+			// removed while its signal was dispatched
+			auto found = _listeners.find(acceptEvent);
+			if (found == _listeners.end()) {
+				return;
+			}
+			WSANETWORKEVENTS events;
+			socketApi().EnumNetworkEvents(found->second.socket, &events);
+			if ((events.lNetworkEvents & FD_ACCEPT) == FD_ACCEPT) {
+				AcceptFrom(*found->second.entry, found->second.index);
+			}
+		}
+
+		void OnResume() {
+			std::lock_guard<std::mutex> lg(_entriesMut);
+			for (auto& entry : _entries) {
+				if (!entry->counters->paused) {
+					continue;
+				}
+				auto paused = std::move(entry->pausedListeners);
+				entry->pausedListeners.clear();
+				entry->counters->paused = false;
+				for (auto index : paused) {
+					AcceptFrom(*entry, index);
 				}
 			}
 		}
+
+		void RunHealthChecks() {
+			std::lock_guard<std::mutex> lg(_entriesMut);
+			auto now = clockNow();
+			_nextHealthCheck = steady_clock::time_point::max();
+			for (auto& entry : _entries) {
+				_nextHealthCheck = std::min(_nextHealthCheck, entry->backends.RunHealthChecks(SOCK_STREAM, _probeEvent.get(), now));
+			}
+		}
+
+		// with _entriesMut held
+		void RegisterListeners(ForwarderEntry& entry) {
+			for (std::uint16_t i = 0; i < entry.count; ++i) {
+				auto acceptEvent = _nextAcceptEvent++;
+				auto event = _attachment->AddEvent(acceptEvent);
+				socketApi().EventSelect(entry.listeningSockets[i].Get(), event.get(), FD_ACCEPT);
+				_listeners.emplace(acceptEvent, ListenerRef{ entry.listeningSockets[i].Get(), &entry, i, std::move(event) });
+				entry.acceptEvents.push_back(acceptEvent);
+			}
+		}
+
+		void UnregisterListeners(ForwarderEntry& entry) {
+			for (auto acceptEvent : entry.acceptEvents) {
+				auto found = _listeners.find(acceptEvent);
+				if (found != _listeners.end()) {
+					_attachment->RemoveEvent(found->second.event);
+					_listeners.erase(found);
+				}
+			}
+			entry.acceptEvents.clear();
+		}
+
+	public:
+		void OnSignaled(std::size_t index) override {
+			if (index == ResumeEventIndex) {
+				OnResume();
+			}
+			else if (index == ProbeEventIndex) {
+				RunHealthChecks();
+			}
+			else {
+				OnEntryAcceptedOrClosed(index);
+			}
+		}
+		void OnDeadline() override {
+			if (clockNow() >= _nextHealthCheck) {
+				RunHealthChecks();
+			}
+		}
+		steady_clock::time_point NextDeadline() override {
+			return _nextHealthCheck;
+		}
 		void Start() {
 			if (_running) {
 				return;
 			}
-			auto weak = std::weak_ptr<TcpForwarder::Impl>(shared_from_this());
 			_running = true;
-			_runningThread = std::thread([weak]() {
-				auto that = weak.lock();
-				if (that) {
-					that->Loop();
-				}
-			});
-			for (int i = 0; i < 4; ++i) {
-				_bridges[i]->Start();
+			_attachment->Enable();
+			for (auto& bridge : _bridges) {
+				bridge->Start();
+			}
+			std::lock_guard<std::mutex> lg(_entriesMut);
+			if (_lowLatencyBridge) {
+				_lowLatencyBridge->Start();
 			}
 		}
 		void Stop() {
@@ -384,42 +1161,106 @@ namespace forwarding {
 				return;
 			}
 			_running = false;
+			_attachment->Disable();
 			{
 				std::lock_guard<std::mutex> lg(_entriesMut);
+				for (auto& entry : _entries) {
+					UnregisterListeners(*entry);
+				}
 				_entries.clear();
-				SetEvent(_acceptEvent.get());
 			}
-			_runningThread.join();
-
-			for (int i = 0; i < 4; ++i) {
-				_bridges[i]->Stop();
+			for (auto& bridge : _bridges) {
+				bridge->Stop();
+			}
+			std::lock_guard<std::mutex> lg(_entriesMut);
+			if (_lowLatencyBridge) {
+				_lowLatencyBridge->Stop();
 			}
 		}
 
 		void AddEntry(std::uint16_t localPort, std::uint32_t remotePort, const char* remoteAddress) {
+			AddRangeEntry(localPort, 1, remotePort, remoteAddress);
+		}
+		void AddEntry(std::uint16_t localPort, std::uint32_t remotePort, const char* remoteAddress, const TlsCertificate& certificate) {
+			AddRangeEntry(localPort, 1, remotePort, remoteAddress, std::make_shared<TlsCredentials>(certificate));
+		}
+		void AdoptRangeEntry(std::uint16_t localPortStart, std::uint16_t count, std::uint32_t remotePortStart, const char* remoteAddress, const std::vector<WSAPROTOCOL_INFOW>& sockets) {
+			if (sockets.size() != count) {
+				throw TransportErrorException{ TransportError::InvalidSocket };
+			}
+			AddRangeEntry(localPortStart, count, remotePortStart, remoteAddress, nullptr, &sockets);
+		}
+		// adopted sockets are already bound and listening
+		void AddRangeEntry(std::uint16_t localPortStart, std::uint16_t count, std::uint32_t remotePortStart, const char* remoteAddress,
+			std::shared_ptr<TlsCredentials> tls = nullptr, const std::vector<WSAPROTOCOL_INFOW>* adopted = nullptr) {
+			if (count == 0 || localPortStart + count - 1 > 0xffff) {
+				throw TransportErrorException{ TransportError::BindFailed };
+			}
 			{
 				std::lock_guard<std::mutex> lg(_entriesMut);
-				auto found = std::find_if(_entries.begin(), _entries.end(), [localPort](const std::unique_ptr<ForwarderEntry>& e) {return e->port == localPort; });
+				auto found = std::find_if(_entries.begin(), _entries.end(), [localPortStart](const std::unique_ptr<ForwarderEntry>& e) {return e->port == localPortStart; });
 				if (found != _entries.end()) {
-					return;
+					// another count or remote at the same start would otherwise be dropped without a word
+					if ((*found)->Matches(count, remotePortStart, remoteAddress)) {
+						return;
+					}
+					throw TransportErrorException{ TransportError::BindFailed };
+				}
+				// SO_REUSEADDR would let us silently steal a port already forwarded by another range
+				auto overlapping = std::find_if(_entries.begin(), _entries.end(), [localPortStart, count](const std::unique_ptr<ForwarderEntry>& e) {return e->Overlaps(localPortStart, count); });
+				if (overlapping != _entries.end()) {
+					throw TransportErrorException{ TransportError::BindFailed };
 				}
 			}
-			auto localAddress = Resolve("127.0.0.1", localPort);
+			auto localAddress = Resolve("127.0.0.1", localPortStart);
 			auto entry = std::make_unique<ForwarderEntry>();
-			entry->port = localPort;
-			entry->listeningSocket = socket(AF_INET, SOCK_STREAM, 0);
-			entry->remoteAddr = Resolve(remoteAddress, remotePort);
-			int yes = 1;
-			setsockopt(entry->listeningSocket.Get(), SOL_SOCKET, SO_REUSEADDR, (char*)&yes, sizeof(yes));
-			if (0 != ::bind(entry->listeningSocket.Get(), localAddress->SockAddr(), localAddress->SockAddrLen())) {
-				throw TransportErrorException{ TransportError::BindFailed };
+			entry->port = localPortStart;
+			entry->count = count;
+			auto name = ResolveName(remoteAddress, SOCK_STREAM);
+			if (name->Current()->Family() == AF_UNIX && count > 1) {
+				// a unix socket has no port to shift the range onto
+				throw TransportErrorException{ TransportError::UnsupportedAddress };
 			}
-			if (0 != listen(entry->listeningSocket.Get(), SOMAXCONN)) {
-				throw TransportErrorException{ TransportError::ListenFailed };
+			entry->backends.Add(remoteAddress, remotePortStart, 1, std::move(name));
+			entry->counters = std::make_shared<EntryCounters>(_resumeEvent);
+			entry->tls = std::move(tls);
+			entry->listeningSockets.reserve(count);
+			for (std::uint16_t i = 0; i < count; ++i) {
+				if (adopted) {
+					entry->listeningSockets.push_back(AdoptSocket((*adopted)[i]));
+					continue;
+				}
+				sockaddr_storage bindAddr;
+				auto bindAddrLen = SockAddrWithPort(*localAddress, localPortStart + i, bindAddr);
+				SafeSocket listeningSocket = socketApi().Socket(AF_INET, SOCK_STREAM, 0);
+				int yes = 1;
+				socketApi().SetOption(listeningSocket.Get(), SOL_SOCKET, SO_REUSEADDR, (char*)&yes, sizeof(yes));
+				if (0 != socketApi().Bind(listeningSocket.Get(), reinterpret_cast<const sockaddr*>(&bindAddr), bindAddrLen)) {
+					throw TransportErrorException{ TransportError::BindFailed };
+				}
+				if (0 != socketApi().Listen(listeningSocket.Get(), SOMAXCONN)) {
+					throw TransportErrorException{ TransportError::ListenFailed };
+				}
+				entry->listeningSockets.push_back(std::move(listeningSocket));
 			}
 			{
 				std::lock_guard<std::mutex> lg(_entriesMut);
-				WSAEventSelect(entry->listeningSocket.Get(), _acceptEvent.get(), FD_ACCEPT);
+				if (_reserveSocket.Get() == INVALID_SOCKET) {
+					auto reserve = socketApi().Socket(AF_INET, SOCK_STREAM, 0);
+					if (INVALID_SOCKET != reserve) {
+						_reserveSocket = reserve;
+					}
+				}
+				try {
+					RegisterListeners(*entry);
+				}
+				catch (const TransportErrorException&) {
+					UnregisterListeners(*entry);
+					throw;
+				}
+				if (_snapshot && !entry->tls) {
+					_snapshot->Put(MakeSnapshotEntry(SnapshotProtocol::Tcp, localPortStart, count, remotePortStart, remoteAddress));
+				}
 				_entries.push_back(std::move(entry));
 			}
 		}
@@ -427,16 +1268,302 @@ namespace forwarding {
 			std::lock_guard<std::mutex> lg(_entriesMut);
 			auto found = std::find_if(_entries.begin(), _entries.end(), [localPort](const std::unique_ptr<ForwarderEntry>& e) {return e->port == localPort; });
 			if (found != _entries.end()) {
+				UnregisterListeners(**found);
 				_entries.erase(found);
+				if (_snapshot) {
+					_snapshot->Remove(SnapshotProtocol::Tcp, localPort);
+				}
 			}
 		}
+		bool UpdateEntryRemote(std::uint16_t localPort, std::uint32_t remotePortStart, const char* remoteAddress) {
+			auto name = ResolveName(remoteAddress, SOCK_STREAM);
+			std::lock_guard<std::mutex> lg(_entriesMut);
+			auto found = std::find_if(_entries.begin(), _entries.end(), [localPort](const std::unique_ptr<ForwarderEntry>& e) {return e->port == localPort; });
+			if (found == _entries.end()) {
+				return false;
+			}
+			if (name->Current()->Family() == AF_UNIX && (*found)->count > 1) {
+				throw TransportErrorException{ TransportError::UnsupportedAddress };
+			}
+			// pairs hold a lease on the counters of their backend, which outlives its removal from the set
+			(*found)->backends.Replace(remoteAddress, remotePortStart, std::move(name));
+			if ((*found)->backends.HealthChecked()) {
+				SetEvent(_probeEvent.get());
+			}
+			if (_snapshot && !(*found)->tls) {
+				_snapshot->Put(MakeSnapshotEntry(SnapshotProtocol::Tcp, localPort, (*found)->count, remotePortStart, remoteAddress));
+			}
+			return true;
+		}
+		bool DuplicateEntry(std::uint16_t localPort, DWORD processId, std::vector<WSAPROTOCOL_INFOW>& sockets) {
+			std::lock_guard<std::mutex> lg(_entriesMut);
+			auto found = std::find_if(_entries.begin(), _entries.end(), [localPort](const std::unique_ptr<ForwarderEntry>& e) {return e->port == localPort; });
+			if (found == _entries.end()) {
+				return false;
+			}
+			sockets = DuplicateSockets((*found)->listeningSockets, processId);
+			return true;
+		}
+		bool ReleaseEntry(std::uint16_t localPort) {
+			std::lock_guard<std::mutex> lg(_entriesMut);
+			auto found = std::find_if(_entries.begin(), _entries.end(), [localPort](const std::unique_ptr<ForwarderEntry>& e) {return e->port == localPort; });
+			if (found == _entries.end()) {
+				return false;
+			}
+			UnregisterListeners(**found);
+			ReleaseSockets((*found)->listeningSockets);
+			// the snapshot keeps the entry for the process that adopted it
+			_entries.erase(found);
+			return true;
+		}
+		std::size_t RestoreSnapshot(std::shared_ptr<EntrySnapshot::Impl> snapshot) {
+			std::size_t restored = 0;
+			for (auto& recorded : snapshot->Entries()) {
+				if (recorded.protocol != SnapshotProtocol::Tcp) {
+					continue;
+				}
+				{
+					std::lock_guard<std::mutex> lg(_entriesMut);
+					auto overlapping = std::any_of(_entries.begin(), _entries.end(), [&recorded](const std::unique_ptr<ForwarderEntry>& e) {return e->Overlaps(recorded.localPort, recorded.count); });
+					if (overlapping) {
+						continue;
+					}
+				}
+				try {
+					AddRangeEntry(recorded.localPort, recorded.count, recorded.remotePort, recorded.remoteAddress.c_str());
+					++restored;
+				}
+				catch (const TransportErrorException&) {
+					// left out of the entries the snapshot is reset to
+				}
+			}
+			std::lock_guard<std::mutex> lg(_entriesMut);
+			std::vector<SnapshotEntry> entries;
+			for (auto& entry : _entries) {
+				auto first = entry->backends.First();
+				if (first && !entry->tls) {
+					entries.push_back(MakeSnapshotEntry(SnapshotProtocol::Tcp, entry->port, entry->count, first->port, first->address));
+				}
+			}
+			snapshot->Reset(SnapshotProtocol::Tcp, entries);
+			_snapshot = std::move(snapshot);
+			return restored;
+		}
+		std::uint64_t ActiveConnections() {
+			std::uint64_t total = 0;
+			for (auto& bridge : _bridges) {
+				total += bridge->PairCount();
+			}
+			std::lock_guard<std::mutex> lg(_entriesMut);
+			if (_lowLatencyBridge) {
+				total += _lowLatencyBridge->PairCount();
+			}
+			return total;
+		}
+		bool SetEntryLimits(std::uint16_t localPort, const TcpEntryLimits& limits) {
+			std::lock_guard<std::mutex> lg(_entriesMut);
+			auto found = std::find_if(_entries.begin(), _entries.end(), [localPort](const std::unique_ptr<ForwarderEntry>& e) {return e->port == localPort; });
+			if (found == _entries.end()) {
+				return false;
+			}
+			(*found)->limits = limits;
+			// paused listeners may be resumed by the new limits
+			SetEvent(_resumeEvent.get());
+			return true;
+		}
+		bool GetEntryStats(std::uint16_t localPort, TcpEntryStats& stats) {
+			std::lock_guard<std::mutex> lg(_entriesMut);
+			auto found = std::find_if(_entries.begin(), _entries.end(), [localPort](const std::unique_ptr<ForwarderEntry>& e) {return e->port == localPort; });
+			if (found == _entries.end()) {
+				return false;
+			}
+			auto& counters = *(*found)->counters;
+			stats.activeConnections = counters.activeConnections;
+			stats.acceptedConnections = counters.acceptedConnections;
+			auto queued = counters.queuedBytes.load();
+			stats.queuedBytes = queued > 0 ? static_cast<std::uint64_t>(queued) : 0;
+			stats.connectionLimitTrips = counters.connectionLimitTrips;
+			stats.queuedBytesLimitTrips = counters.queuedBytesLimitTrips;
+			stats.idleTimeoutTrips = counters.idleTimeoutTrips;
+			stats.socketExhaustionTrips = counters.socketExhaustionTrips;
+			stats.autoTuningSwitches = counters.autoTuningSwitches;
+			stats.bytesToRemote = counters.bytesToRemote;
+			stats.bytesToLocal = counters.bytesToLocal;
+			stats.noBackendRefusals = counters.noBackendRefusals;
+			stats.zeroCopySends = counters.zeroCopySends;
+			stats.zeroCopyBytes = counters.zeroCopyBytes;
+			stats.tlsHandshakes = counters.tlsHandshakes;
+			stats.tlsHandshakeFailures = counters.tlsHandshakeFailures;
+			stats.firstBytePairs = counters.firstBytePairs;
+			stats.firstByteLatencyUs = counters.firstByteLatencyUs;
+			stats.maxFirstByteLatencyUs = counters.maxFirstByteLatencyUs;
+			stats.budgetYields = counters.budgetYields;
+			stats.rateLimitPauses = counters.rateLimitPauses;
+			stats.fastOpenConnects = counters.fastOpenConnects;
+			stats.fastOpenBytes = counters.fastOpenBytes;
+			stats.fastOpenSavedUs = counters.fastOpenSavedUs;
+			stats.fastOpenFallbacks = counters.fastOpenFallbacks;
+			return true;
+		}
+		std::vector<TcpBridgeStats> GetBridgeStats() {
+			std::vector<TcpBridgeStats> stats;
+			for (auto& bridge : _bridges) {
+				stats.push_back(bridge->Stats());
+			}
+			std::lock_guard<std::mutex> lg(_entriesMut);
+			if (_lowLatencyBridge) {
+				stats.push_back(_lowLatencyBridge->Stats());
+			}
+			return stats;
+		}
+		bool AddBackend(std::uint16_t localPort, std::uint32_t remotePort, const char* remoteAddress, std::uint32_t weight) {
+			auto name = ResolveName(remoteAddress, SOCK_STREAM);
+			std::lock_guard<std::mutex> lg(_entriesMut);
+			auto found = std::find_if(_entries.begin(), _entries.end(), [localPort](const std::unique_ptr<ForwarderEntry>& e) {return e->port == localPort; });
+			if (found == _entries.end()) {
+				return false;
+			}
+			if (name->Current()->Family() == AF_UNIX && (*found)->count > 1) {
+				throw TransportErrorException{ TransportError::UnsupportedAddress };
+			}
+			(*found)->backends.Add(remoteAddress, remotePort, weight, std::move(name));
+			if ((*found)->backends.HealthChecked()) {
+				// probe the new backend right away
+				SetEvent(_probeEvent.get());
+			}
+			return true;
+		}
+		bool RemoveBackend(std::uint16_t localPort, std::uint32_t remotePort, const char* remoteAddress) {
+			std::lock_guard<std::mutex> lg(_entriesMut);
+			auto found = std::find_if(_entries.begin(), _entries.end(), [localPort](const std::unique_ptr<ForwarderEntry>& e) {return e->port == localPort; });
+			if (found == _entries.end()) {
+				return false;
+			}
+			return (*found)->backends.Remove(remoteAddress, remotePort);
+		}
+		bool SetBalancingPolicy(std::uint16_t localPort, BalancingPolicy policy) {
+			std::lock_guard<std::mutex> lg(_entriesMut);
+			auto found = std::find_if(_entries.begin(), _entries.end(), [localPort](const std::unique_ptr<ForwarderEntry>& e) {return e->port == localPort; });
+			if (found == _entries.end()) {
+				return false;
+			}
+			(*found)->backends.SetPolicy(policy);
+			return true;
+		}
+		bool SetHealthCheck(std::uint16_t localPort, const HealthCheck& check) {
+			std::lock_guard<std::mutex> lg(_entriesMut);
+			auto found = std::find_if(_entries.begin(), _entries.end(), [localPort](const std::unique_ptr<ForwarderEntry>& e) {return e->port == localPort; });
+			if (found == _entries.end()) {
+				return false;
+			}
+			(*found)->backends.SetHealthCheck(check);
+			SetEvent(_probeEvent.get());
+			return true;
+		}
+		bool GetBackendHealth(std::uint16_t localPort, std::uint32_t remotePort, const char* remoteAddress, BackendHealth& health) {
+			std::lock_guard<std::mutex> lg(_entriesMut);
+			auto found = std::find_if(_entries.begin(), _entries.end(), [localPort](const std::unique_ptr<ForwarderEntry>& e) {return e->port == localPort; });
+			if (found == _entries.end()) {
+				return false;
+			}
+			return (*found)->backends.GetHealth(remoteAddress, remotePort, health);
+		}
+		bool SetEntryTuning(std::uint16_t localPort, TuningProfile profile) {
+			std::lock_guard<std::mutex> lg(_entriesMut);
+			auto found = std::find_if(_entries.begin(), _entries.end(), [localPort](const std::unique_ptr<ForwarderEntry>& e) {return e->port == localPort; });
+			if (found == _entries.end()) {
+				return false;
+			}
+			(*found)->tuning = profile;
+			auto& tuning = TuningFor(profile);
+			for (auto& listeningSocket : (*found)->listeningSockets) {
+				ApplyListenerTuning(listeningSocket.Get(), tuning);
+			}
+			return true;
+		}
 
-		Impl() : _acceptEvent(MakeAutoResetEvent()), _running(false), _bridges{ std::make_unique<TcpDataBridge>(),std::make_unique<TcpDataBridge>(), std::make_unique<TcpDataBridge>(), std::make_unique<TcpDataBridge>() } {}
+		bool SetEntryZeroCopy(std::uint16_t localPort, std::uint32_t thresholdBytes) {
+			std::lock_guard<std::mutex> lg(_entriesMut);
+			auto found = std::find_if(_entries.begin(), _entries.end(), [localPort](const std::unique_ptr<ForwarderEntry>& e) {return e->port == localPort; });
+			if (found == _entries.end()) {
+				return false;
+			}
+			(*found)->zeroCopyThreshold = thresholdBytes;
+			return true;
+		}
+		bool SetEntryRateLimit(std::uint16_t localPort, const RateLimit& entryLimit, const RateLimit& perClient) {
+			std::lock_guard<std::mutex> lg(_entriesMut);
+			auto found = std::find_if(_entries.begin(), _entries.end(), [localPort](const std::unique_ptr<ForwarderEntry>& e) {return e->port == localPort; });
+			if (found == _entries.end()) {
+				return false;
+			}
+			auto& shaper = (*found)->shaper;
+			if (!shaper) {
+				if (!IsLimited(entryLimit) && !IsLimited(perClient)) {
+					return true;
+				}
+				shaper = std::make_shared<EntryShaper>();
+			}
+			shaper->Configure(entryLimit, perClient);
+			return true;
+		}
+		bool SetEntryInteractive(std::uint16_t localPort, bool interactive) {
+			std::lock_guard<std::mutex> lg(_entriesMut);
+			auto found = std::find_if(_entries.begin(), _entries.end(), [localPort](const std::unique_ptr<ForwarderEntry>& e) {return e->port == localPort; });
+			if (found == _entries.end()) {
+				return false;
+			}
+			(*found)->interactive = interactive;
+			return true;
+		}
+		bool SetEntryFastOpen(std::uint16_t localPort, bool fastOpen) {
+			std::lock_guard<std::mutex> lg(_entriesMut);
+			auto found = std::find_if(_entries.begin(), _entries.end(), [localPort](const std::unique_ptr<ForwarderEntry>& e) {return e->port == localPort; });
+			if (found == _entries.end()) {
+				return false;
+			}
+			(*found)->fastOpen = fastOpen;
+			if (fastOpen) {
+				// clients that cannot use it keep doing a regular handshake
+				for (auto& listeningSocket : (*found)->listeningSockets) {
+					EnableFastOpenListener(listeningSocket.Get());
+				}
+			}
+			return true;
+		}
+		bool SetEntryLatencyCritical(std::uint16_t localPort, bool latencyCritical) {
+			std::lock_guard<std::mutex> lg(_entriesMut);
+			auto found = std::find_if(_entries.begin(), _entries.end(), [localPort](const std::unique_ptr<ForwarderEntry>& e) {return e->port == localPort; });
+			if (found == _entries.end()) {
+				return false;
+			}
+			if (latencyCritical && !_lowLatencyBridge) {
+				_lowLatencyBridge = std::make_unique<TcpDataBridge>(*_runtime, true);
+				if (_running) {
+					_lowLatencyBridge->Start();
+				}
+			}
+			(*found)->latencyCritical = latencyCritical;
+			return true;
+		}
+
+		explicit Impl(std::shared_ptr<Runtime::Impl> runtime) : _runtime(std::move(runtime)), _running(false) {
+			_attachment = _runtime->Attach(*this, ProbeEventIndex + 1, "TcpForwarder");
+			auto& events = _attachment->Events();
+			_resumeEvent = events[ResumeEventIndex];
+			_probeEvent = events[ProbeEventIndex];
+			for (std::uint32_t i = 0; i < _runtime->LoopCount(); ++i) {
+				_bridges.push_back(std::make_unique<TcpDataBridge>(*_runtime, false));
+			}
+		}
 		~Impl() {
 			Stop();
 		}
 	};
-	TcpForwarder::TcpForwarder() : _impl(std::make_shared<Impl>())
+	TcpForwarder::TcpForwarder() : _impl(std::make_shared<Impl>(Runtime::Default()))
+	{
+	}
+	TcpForwarder::TcpForwarder(Runtime& runtime) : _impl(std::make_shared<Impl>(runtime._impl))
 	{
 	}
 	void TcpForwarder::Start()
@@ -454,8 +1581,96 @@ namespace forwarding {
 	{
 		_impl->AddEntry(localPort, remotePort, remoteAddress);
 	}
+	void TcpForwarder::AddEntry(std::uint16_t localPort, std::uint32_t remotePort, const char* remoteAddress, const TlsCertificate& certificate)
+	{
+		_impl->AddEntry(localPort, remotePort, remoteAddress, certificate);
+	}
+	void TcpForwarder::AddRangeEntry(std::uint16_t localPortStart, std::uint16_t count, std::uint32_t remotePortStart, const char* remoteAddress)
+	{
+		_impl->AddRangeEntry(localPortStart, count, remotePortStart, remoteAddress);
+	}
 	void TcpForwarder::RemoveEntry(std::uint16_t localPort)
 	{
 		_impl->RemoveEntry(localPort);
 	}
+	bool TcpForwarder::UpdateEntryRemote(std::uint16_t localPort, std::uint32_t remotePortStart, const char* remoteAddress)
+	{
+		return _impl->UpdateEntryRemote(localPort, remotePortStart, remoteAddress);
+	}
+	bool TcpForwarder::DuplicateEntry(std::uint16_t localPort, DWORD processId, std::vector<WSAPROTOCOL_INFOW>& sockets)
+	{
+		return _impl->DuplicateEntry(localPort, processId, sockets);
+	}
+	void TcpForwarder::AdoptRangeEntry(std::uint16_t localPortStart, std::uint16_t count, std::uint32_t remotePortStart, const char* remoteAddress, const std::vector<WSAPROTOCOL_INFOW>& sockets)
+	{
+		_impl->AdoptRangeEntry(localPortStart, count, remotePortStart, remoteAddress, sockets);
+	}
+	bool TcpForwarder::ReleaseEntry(std::uint16_t localPort)
+	{
+		return _impl->ReleaseEntry(localPort);
+	}
+	std::uint64_t TcpForwarder::ActiveConnections()
+	{
+		return _impl->ActiveConnections();
+	}
+	bool TcpForwarder::SetEntryLimits(std::uint16_t localPort, const TcpEntryLimits& limits)
+	{
+		return _impl->SetEntryLimits(localPort, limits);
+	}
+	bool TcpForwarder::GetEntryStats(std::uint16_t localPort, TcpEntryStats& stats)
+	{
+		return _impl->GetEntryStats(localPort, stats);
+	}
+	std::vector<TcpBridgeStats> TcpForwarder::GetBridgeStats()
+	{
+		return _impl->GetBridgeStats();
+	}
+	bool TcpForwarder::SetEntryTuning(std::uint16_t localPort, TuningProfile profile)
+	{
+		return _impl->SetEntryTuning(localPort, profile);
+	}
+	bool TcpForwarder::SetEntryZeroCopy(std::uint16_t localPort, std::uint32_t thresholdBytes)
+	{
+		return _impl->SetEntryZeroCopy(localPort, thresholdBytes);
+	}
+	bool TcpForwarder::SetEntryRateLimit(std::uint16_t localPort, const RateLimit& entry, const RateLimit& perClient)
+	{
+		return _impl->SetEntryRateLimit(localPort, entry, perClient);
+	}
+	bool TcpForwarder::SetEntryInteractive(std::uint16_t localPort, bool interactive)
+	{
+		return _impl->SetEntryInteractive(localPort, interactive);
+	}
+	std::size_t TcpForwarder::RestoreSnapshot(EntrySnapshot& snapshot)
+	{
+		return _impl->RestoreSnapshot(snapshot._impl);
+	}
+	bool TcpForwarder::SetEntryFastOpen(std::uint16_t localPort, bool fastOpen)
+	{
+		return _impl->SetEntryFastOpen(localPort, fastOpen);
+	}
+	bool TcpForwarder::SetEntryLatencyCritical(std::uint16_t localPort, bool latencyCritical)
+	{
+		return _impl->SetEntryLatencyCritical(localPort, latencyCritical);
+	}
+	bool TcpForwarder::AddBackend(std::uint16_t localPort, std::uint32_t remotePort, const char* remoteAddress, std::uint32_t weight)
+	{
+		return _impl->AddBackend(localPort, remotePort, remoteAddress, weight);
+	}
+	bool TcpForwarder::RemoveBackend(std::uint16_t localPort, std::uint32_t remotePort, const char* remoteAddress)
+	{
+		return _impl->RemoveBackend(localPort, remotePort, remoteAddress);
+	}
+	bool TcpForwarder::SetBalancingPolicy(std::uint16_t localPort, BalancingPolicy policy)
+	{
+		return _impl->SetBalancingPolicy(localPort, policy);
+	}
+	bool TcpForwarder::SetHealthCheck(std::uint16_t localPort, const HealthCheck& check)
+	{
+		return _impl->SetHealthCheck(localPort, check);
+	}
+	bool TcpForwarder::GetBackendHealth(std::uint16_t localPort, std::uint32_t remotePort, const char* remoteAddress, BackendHealth& health)
+	{
+		return _impl->GetBackendHealth(localPort, remotePort, remoteAddress, health);
+	}
 }
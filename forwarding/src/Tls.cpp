@@ -0,0 +1,215 @@
+#include "Tls.h"
+#include <algorithm>
+#include <cstring>
+#include <string>
+
+using namespace forwarding;
+
+namespace {
+	const ULONG ContextRequirements = ASC_REQ_SEQUENCE_DETECT | ASC_REQ_REPLAY_DETECT | ASC_REQ_CONFIDENTIALITY |
+		ASC_REQ_EXTENDED_ERROR | ASC_REQ_ALLOCATE_MEMORY | ASC_REQ_STREAM;
+
+	std::wstring Widen(const std::string& value) {
+		if (value.empty()) {
+			return std::wstring();
+		}
+		auto length = MultiByteToWideChar(CP_UTF8, 0, value.data(), static_cast<int>(value.size()), nullptr, 0);
+		std::wstring result(length, L'\0');
+		MultiByteToWideChar(CP_UTF8, 0, value.data(), static_cast<int>(value.size()), &result[0], length);
+		return result;
+	}
+}
+
+forwarding::TlsCredentials::TlsCredentials(const TlsCertificate& certificate)
+{
+	auto password = Widen(certificate.password);
+	CRYPT_DATA_BLOB pfx;
+	pfx.cbData = static_cast<DWORD>(certificate.pfx.size());
+	pfx.pbData = reinterpret_cast<BYTE*>(const_cast<char*>(certificate.pfx.data()));
+	// schannel uses the private key from lsass, which cannot reach keys imported with PKCS12_NO_PERSIST_KEY
+	_store = PFXImportCertStore(&pfx, password.c_str(), CRYPT_USER_KEYSET);
+	if (!_store) {
+		throw TransportErrorException{ TransportError::TlsSetupFailed };
+	}
+	_certificate = CertFindCertificateInStore(_store, X509_ASN_ENCODING | PKCS_7_ASN_ENCODING, 0, CERT_FIND_HAS_PRIVATE_KEY, nullptr, nullptr);
+	if (!_certificate) {
+		CertCloseStore(_store, 0);
+		throw TransportErrorException{ TransportError::TlsSetupFailed };
+	}
+	SCHANNEL_CRED credentials;
+	ZeroMemory(&credentials, sizeof(credentials));
+	credentials.dwVersion = SCHANNEL_CRED_VERSION;
+	credentials.cCreds = 1;
+	credentials.paCred = &_certificate;
+	credentials.dwFlags = SCH_USE_STRONG_CRYPTO;
+	if (SEC_E_OK != AcquireCredentialsHandleW(nullptr, const_cast<LPWSTR>(UNISP_NAME_W), SECPKG_CRED_INBOUND, nullptr, &credentials, nullptr, nullptr, &_handle, nullptr)) {
+		CertFreeCertificateContext(_certificate);
+		CertCloseStore(_store, 0);
+		throw TransportErrorException{ TransportError::TlsSetupFailed };
+	}
+	_hasHandle = true;
+}
+
+forwarding::TlsCredentials::~TlsCredentials()
+{
+	if (_hasHandle) {
+		FreeCredentialsHandle(&_handle);
+	}
+	CertFreeCertificateContext(_certificate);
+	CertCloseStore(_store, 0);
+}
+
+forwarding::TlsSession::TlsSession(std::shared_ptr<TlsCredentials> credentials) : _credentials(std::move(credentials))
+{
+	ZeroMemory(&_sizes, sizeof(_sizes));
+}
+
+forwarding::TlsSession::~TlsSession()
+{
+	if (_hasContext) {
+		DeleteSecurityContext(&_context);
+	}
+}
+
+bool forwarding::TlsSession::Handshake(std::vector<char>& toClient)
+{
+	while (!_input.empty()) {
+		SecBuffer inBuffers[2];
+		inBuffers[0] = SecBuffer{ static_cast<ULONG>(_input.size()), SECBUFFER_TOKEN, &_input[0] };
+		inBuffers[1] = SecBuffer{ 0, SECBUFFER_EMPTY, nullptr };
+		SecBufferDesc inDesc{ SECBUFFER_VERSION, 2, inBuffers };
+		SecBuffer outBuffers[1];
+		outBuffers[0] = SecBuffer{ 0, SECBUFFER_TOKEN, nullptr };
+		SecBufferDesc outDesc{ SECBUFFER_VERSION, 1, outBuffers };
+		ULONG attributes = 0;
+		auto status = AcceptSecurityContext(_credentials->Handle(), _hasContext ? &_context : nullptr, &inDesc, ContextRequirements, 0,
+			_hasContext ? nullptr : &_context, &outDesc, &attributes, nullptr);
+		if (status == SEC_E_INCOMPLETE_MESSAGE) {
+			return true;
+		}
+		if (status == SEC_E_OK || status == SEC_I_CONTINUE_NEEDED) {
+			_hasContext = true;
+		}
+		// on failures, the token is the alert to send thanks to ASC_REQ_EXTENDED_ERROR
+		if (outBuffers[0].pvBuffer) {
+			auto token = static_cast<const char*>(outBuffers[0].pvBuffer);
+			toClient.insert(toClient.end(), token, token + outBuffers[0].cbBuffer);
+			FreeContextBuffer(outBuffers[0].pvBuffer);
+		}
+		if (status != SEC_E_OK && status != SEC_I_CONTINUE_NEEDED) {
+			return false;
+		}
+		// what follows the handshake message belongs to the next one, or is already application data
+		std::size_t extra = inBuffers[1].BufferType == SECBUFFER_EXTRA ? inBuffers[1].cbBuffer : 0;
+		_input.erase(_input.begin(), _input.end() - extra);
+		if (status == SEC_E_OK) {
+			_established = true;
+			return SEC_E_OK == QueryContextAttributesW(&_context, SECPKG_ATTR_STREAM_SIZES, &_sizes);
+		}
+	}
+	return true;
+}
+
+TlsSession::Result forwarding::TlsSession::Decrypt(std::vector<char>& plaintext, bool& renegotiate)
+{
+	renegotiate = false;
+	while (!_input.empty()) {
+		// records are decrypted in place
+		SecBuffer buffers[4];
+		buffers[0] = SecBuffer{ static_cast<ULONG>(_input.size()), SECBUFFER_DATA, &_input[0] };
+		for (int i = 1; i < 4; ++i) {
+			buffers[i] = SecBuffer{ 0, SECBUFFER_EMPTY, nullptr };
+		}
+		SecBufferDesc desc{ SECBUFFER_VERSION, 4, buffers };
+		auto status = DecryptMessage(&_context, &desc, 0, nullptr);
+		if (status == SEC_E_INCOMPLETE_MESSAGE) {
+			return Result::Ok;
+		}
+		if (status != SEC_E_OK && status != SEC_I_RENEGOTIATE && status != SEC_I_CONTEXT_EXPIRED) {
+			return Result::Failed;
+		}
+		std::size_t extra = 0;
+		for (auto& buffer : buffers) {
+			if (buffer.BufferType == SECBUFFER_DATA && buffer.cbBuffer > 0) {
+				auto data = static_cast<const char*>(buffer.pvBuffer);
+				plaintext.insert(plaintext.end(), data, data + buffer.cbBuffer);
+			}
+			else if (buffer.BufferType == SECBUFFER_EXTRA) {
+				extra = buffer.cbBuffer;
+			}
+		}
+		_input.erase(_input.begin(), _input.end() - extra);
+		if (status == SEC_I_CONTEXT_EXPIRED) {
+			return Result::Closed;
+		}
+		if (status == SEC_I_RENEGOTIATE) {
+			// the remaining input is handshake data for AcceptSecurityContext
+			renegotiate = true;
+			return Result::Ok;
+		}
+	}
+	return Result::Ok;
+}
+
+TlsSession::Result forwarding::TlsSession::OnReceived(const char* data, std::size_t size, std::vector<char>& toClient, std::vector<char>& plaintext)
+{
+	_input.insert(_input.end(), data, data + size);
+	auto result = Result::Ok;
+	for (;;) {
+		if (!_established) {
+			if (!Handshake(toClient)) {
+				return Result::Failed;
+			}
+			if (!_established) {
+				return result;
+			}
+			result = Result::HandshakeCompleted;
+			if (!_pending.empty()) {
+				std::vector<char> pending;
+				pending.swap(_pending);
+				if (!Encrypt(&pending[0], pending.size(), toClient)) {
+					return Result::Failed;
+				}
+			}
+		}
+		bool renegotiate = false;
+		auto decrypted = Decrypt(plaintext, renegotiate);
+		if (decrypted != Result::Ok) {
+			return decrypted;
+		}
+		if (!renegotiate) {
+			return result;
+		}
+		_established = false;
+	}
+}
+
+bool forwarding::TlsSession::Encrypt(const char* data, std::size_t size, std::vector<char>& toClient)
+{
+	if (!_established) {
+		_pending.insert(_pending.end(), data, data + size);
+		return true;
+	}
+	while (size > 0) {
+		auto length = std::min<std::size_t>(size, _sizes.cbMaximumMessage);
+		auto offset = toClient.size();
+		toClient.resize(offset + _sizes.cbHeader + length + _sizes.cbTrailer);
+		auto record = &toClient[offset];
+		memcpy(record + _sizes.cbHeader, data, length);
+		SecBuffer buffers[4];
+		buffers[0] = SecBuffer{ _sizes.cbHeader, SECBUFFER_STREAM_HEADER, record };
+		buffers[1] = SecBuffer{ static_cast<ULONG>(length), SECBUFFER_DATA, record + _sizes.cbHeader };
+		buffers[2] = SecBuffer{ _sizes.cbTrailer, SECBUFFER_STREAM_TRAILER, record + _sizes.cbHeader + length };
+		buffers[3] = SecBuffer{ 0, SECBUFFER_EMPTY, nullptr };
+		SecBufferDesc desc{ SECBUFFER_VERSION, 4, buffers };
+		if (SEC_E_OK != EncryptMessage(&_context, 0, &desc, 0)) {
+			toClient.resize(offset);
+			return false;
+		}
+		// the trailer may be shorter than its maximum
+		toClient.resize(offset + buffers[0].cbBuffer + buffers[1].cbBuffer + buffers[2].cbBuffer);
+		data += length;
+		size -= length;
+	}
+	return true;
+}
@@ -0,0 +1,67 @@
+#pragma once
+#include <client.h>
+#include <windows.h>
+#include <wincrypt.h>
+#define SECURITY_WIN32
+#include <security.h>
+#include <schannel.h>
+#include <memory>
+#include <vector>
+namespace forwarding {
+
+	// the server certificate of a TLS entry, imported once and shared by the sessions of all the connections of the entry
+	class TlsCredentials {
+	private:
+		HCERTSTORE _store = nullptr;
+		PCCERT_CONTEXT _certificate = nullptr;
+		CredHandle _handle;
+		bool _hasHandle = false;
+	public:
+		// throws TlsSetupFailed when the PFX cannot be imported or holds no certificate with a private key
+		explicit TlsCredentials(const TlsCertificate& certificate);
+		TlsCredentials(const TlsCredentials&) = delete;
+		TlsCredentials& operator =(const TlsCredentials&) = delete;
+		~TlsCredentials();
+		CredHandle* Handle() {
+			return &_handle;
+		}
+	};
+
+	// server side of the TLS connection of a pair, terminated with schannel on the bridge thread
+	class TlsSession {
+	public:
+		enum class Result {
+			Ok,
+			HandshakeCompleted,
+			// the peer sent close_notify
+			Closed,
+			Failed
+		};
+	private:
+		std::shared_ptr<TlsCredentials> _credentials;
+		CtxtHandle _context;
+		bool _hasContext = false;
+		bool _established = false;
+		SecPkgContext_StreamSizes _sizes;
+		// received records not processed yet, kept until they are complete
+		std::vector<char> _input;
+		// plaintext to send before the handshake completed
+		std::vector<char> _pending;
+
+		bool Handshake(std::vector<char>& toClient);
+		Result Decrypt(std::vector<char>& plaintext, bool& renegotiate);
+	public:
+		explicit TlsSession(std::shared_ptr<TlsCredentials> credentials);
+		TlsSession(const TlsSession&) = delete;
+		TlsSession& operator =(const TlsSession&) = delete;
+		~TlsSession();
+
+		// handshake messages and alerts for the client are appended to toClient, decrypted application data to plaintext
+		Result OnReceived(const char* data, std::size_t size, std::vector<char>& toClient, std::vector<char>& plaintext);
+		bool Established() const {
+			return _established;
+		}
+		// appends the records carrying data to toClient. Returns false when encryption failed
+		bool Encrypt(const char* data, std::size_t size, std::vector<char>& toClient);
+	};
+}
@@ -0,0 +1,58 @@
+#include "Tracing.h"
+
+using namespace forwarding;
+using namespace std::chrono;
+
+TRACELOGGING_DEFINE_PROVIDER(g_forwardingTraceProvider, "LocalhostForwarder",
+	(0x89b8a103, 0x0aaa, 0x443f, 0x90, 0xd3, 0x49, 0x2a, 0xd9, 0x7e, 0xc7, 0xda));
+
+namespace {
+	struct ProviderRegistration {
+		ProviderRegistration() {
+			TraceLoggingRegister(g_forwardingTraceProvider);
+		}
+		~ProviderRegistration() {
+			TraceLoggingUnregister(g_forwardingTraceProvider);
+		}
+	};
+}
+
+void forwarding::EnsureTracing()
+{
+	static ProviderRegistration registration;
+}
+
+void forwarding::LoopProfiler::BeforeWait()
+{
+	auto profiling = TraceLoggingProviderEnabled(g_forwardingTraceProvider, WINEVENT_LEVEL_VERBOSE, TraceKeywordLoopProfile);
+	if (!profiling) {
+		_profiling = false;
+		return;
+	}
+	auto now = steady_clock::now();
+	// the first iteration after profiling got enabled has no complete wait to report
+	if (_profiling) {
+		TraceLoggingWrite(g_forwardingTraceProvider, "LoopIteration",
+			TraceLoggingLevel(WINEVENT_LEVEL_VERBOSE),
+			TraceLoggingKeyword(TraceKeywordLoopProfile),
+			TraceLoggingString(_loop, "Loop"),
+			TraceLoggingPointer(_id, "LoopId"),
+			TraceLoggingInt64(duration_cast<microseconds>(_waitEnd - _waitStart).count(), "BlockedUs"),
+			TraceLoggingInt64(duration_cast<microseconds>(now - _waitEnd).count(), "WorkedUs"));
+	}
+	_profiling = true;
+	_waitStart = now;
+}
+
+void forwarding::LoopProfiler::AfterWait(DWORD waitResult)
+{
+	if (_profiling) {
+		_waitEnd = steady_clock::now();
+	}
+	TraceLoggingWrite(g_forwardingTraceProvider, "LoopWakeup",
+		TraceLoggingLevel(WINEVENT_LEVEL_VERBOSE),
+		TraceLoggingKeyword(TraceKeywordLoop),
+		TraceLoggingString(_loop, "Loop"),
+		TraceLoggingPointer(_id, "LoopId"),
+		TraceLoggingUInt32(waitResult, "WaitResult"));
+}
@@ -0,0 +1,41 @@
+#pragma once
+#include <windows.h>
+#include <TraceLoggingProvider.h>
+#include <chrono>
+#include <cstdint>
+
+// ETW provider "LocalhostForwarder" {89b8a103-0aaa-443f-90d3-492ad97ec7da}. Events cost a flag check until a session
+// enables them, e.g. with: tracelog -start fwd -guid #89b8a103-0aaa-443f-90d3-492ad97ec7da -flag 0x1f
+TRACELOGGING_DECLARE_PROVIDER(g_forwardingTraceProvider);
+
+namespace forwarding {
+	// accept, connect start and completion, pair collection, transport errors
+	constexpr ULONGLONG TraceKeywordConnections = 0x1;
+	// read and write batch sizes
+	constexpr ULONGLONG TraceKeywordData = 0x2;
+	// udp flow creation and expiration
+	constexpr ULONGLONG TraceKeywordUdp = 0x4;
+	// event loop wakeups
+	constexpr ULONGLONG TraceKeywordLoop = 0x8;
+	// per iteration blocked and working time of event loops
+	constexpr ULONGLONG TraceKeywordLoopProfile = 0x10;
+
+	// registers the provider on first use; it is unregistered when the library is unloaded
+	void EnsureTracing();
+
+	// times the blocked and working parts of each event loop iteration, only while a session enables TraceKeywordLoopProfile
+	class LoopProfiler {
+	private:
+		const char* _loop;
+		const void* _id;
+		bool _profiling = false;
+		std::chrono::steady_clock::time_point _waitStart;
+		std::chrono::steady_clock::time_point _waitEnd;
+	public:
+		LoopProfiler(const char* loop, const void* id) : _loop(loop), _id(id) {
+			EnsureTracing();
+		}
+		void BeforeWait();
+		void AfterWait(DWORD waitResult);
+	};
+}
@@ -1,11 +1,14 @@
 #include <common.h>
 #include <mutex>
 #include "compat.h"
+#include "Tracing.h"
 #include <thread>
 #include <windows.h>
 #include <winsock2.h>
 #include <ws2tcpip.h>
+#include <afunix.h>
 #include <string>
+#include <cstring>
 using namespace forwarding;
 using namespace std;
 
@@ -91,7 +94,7 @@ void forwarding::Connection::Receive(BufferView & buf)
 std::unique_ptr<Connection> forwarding::ConnectTo(const ResolvedAddress& address)
 {
 	init_transport_once();
-	SafeSocket s = socket(AF_INET, SOCK_STREAM, 0);
+	SafeSocket s = socket(address.Family(), SOCK_STREAM, 0);
 	if (0 != connect(s.Get(), address.SockAddr(), address.SockAddrLen())) {
 		throw TransportErrorException{ TransportError::ConnectFailed };
 	}
@@ -102,12 +105,18 @@ std::unique_ptr<Connection> forwarding::ConnectTo(const ResolvedAddress& address
 forwarding::TransportErrorException::TransportErrorException(TransportError e) : Error(e)
 {
 	fprintf(stderr, "TransortErrorException %d\n", (int)e);
+	EnsureTracing();
+	TraceLoggingWrite(g_forwardingTraceProvider, "TransportError",
+		TraceLoggingLevel(WINEVENT_LEVEL_ERROR),
+		TraceLoggingKeyword(TraceKeywordConnections),
+		TraceLoggingInt32(static_cast<int>(e), "Error"),
+		TraceLoggingInt32(WSAGetLastError(), "LastError"));
 }
 
 std::unique_ptr<Connection> forwarding::ConnectTo(const ResolvedAddress& address, std::chrono::milliseconds timeout)
 {
 	init_transport_once();
-	SafeSocket s = socket(AF_INET, SOCK_STREAM, 0);
+	SafeSocket s = socket(address.Family(), SOCK_STREAM, 0);
 	unsigned long nonBlocking = 1, blocking = 0;
 	ioctlsocket(s.Get(), FIONBIO, &nonBlocking);
 	auto secs = timeout.count() / 1000;
@@ -154,9 +163,79 @@ public:
 	}
 };
 
+class UnixResolvedAddress : public ResolvedAddress {
+private:
+	sockaddr_un _addr;
+public:
+	UnixResolvedAddress(const char* path) {
+		ZeroMemory(&_addr, sizeof(_addr));
+		_addr.sun_family = AF_UNIX;
+		auto length = strlen(path);
+		if (length == 0 || length >= sizeof(_addr.sun_path)) {
+			throw TransportErrorException{ TransportError::NameResolutionFailed };
+		}
+		memcpy(_addr.sun_path, path, length);
+	}
+
+	virtual const sockaddr* SockAddr()const override {
+		return reinterpret_cast<const sockaddr*>(&_addr);
+	}
+	virtual int SockAddrLen() const  override {
+		return (int)sizeof(_addr);
+	}
+};
+
+class InetResolvedAddress : public ResolvedAddress {
+private:
+	sockaddr_in _addr;
+public:
+	InetResolvedAddress(const sockaddr_in& addr) : _addr(addr) {}
+
+	virtual const sockaddr* SockAddr()const override {
+		return reinterpret_cast<const sockaddr*>(&_addr);
+	}
+	virtual int SockAddrLen() const  override {
+		return (int)sizeof(_addr);
+	}
+};
+
+static std::unique_ptr<ResolvedAddress> ResolveNumeric(const char* hostName, int port) {
+	sockaddr_in addr;
+	ZeroMemory(&addr, sizeof(addr));
+	if (inet_pton(AF_INET, hostName, &addr.sin_addr) != 1) {
+		return nullptr;
+	}
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(static_cast<u_short>(port));
+	return std::make_unique<InetResolvedAddress>(addr);
+}
+
+static const char* UnixSocketPath(const char* hostName) {
+	auto prefixLength = strlen(UnixSocketPrefix);
+	if (strncmp(hostName, UnixSocketPrefix, prefixLength) == 0) {
+		return hostName + prefixLength;
+	}
+	return nullptr;
+}
+
+bool forwarding::IsLiteralAddress(const char* hostName)
+{
+	init_transport_once();
+	in_addr addr;
+	return UnixSocketPath(hostName) != nullptr || inet_pton(AF_INET, hostName, &addr) == 1;
+}
+
 std::unique_ptr<ResolvedAddress> forwarding::Resolve(const char * hostName, int port)
 {	
 	init_transport_once();
+	auto unixPath = UnixSocketPath(hostName);
+	if (unixPath) {
+		return std::make_unique<UnixResolvedAddress>(unixPath);
+	}
+	auto numeric = ResolveNumeric(hostName, port);
+	if (numeric) {
+		return numeric;
+	}
 	auto sPort = std::to_string(port);
 	addrinfo hints;
 	ZeroMemory(&hints, sizeof(hints));
@@ -176,6 +255,13 @@ std::unique_ptr<ResolvedAddress> forwarding::Resolve(const char * hostName, int
 std::unique_ptr<ResolvedAddress> forwarding::ResolveUdp(const char * hostName, int port)
 {
 	init_transport_once();
+	if (UnixSocketPath(hostName)) {
+		throw TransportErrorException{ TransportError::UnsupportedAddress };
+	}
+	auto numeric = ResolveNumeric(hostName, port);
+	if (numeric) {
+		return numeric;
+	}
 	auto sPort = std::to_string(port);
 	addrinfo hints;
 	ZeroMemory(&hints, sizeof(hints));
@@ -0,0 +1,64 @@
+#pragma once
+#include <client.h>
+#include <ws2tcpip.h>
+#include <mstcpip.h>
+namespace forwarding {
+	const std::size_t DefaultQueueThreshold = 8192;
+	// auto tuning switches a pair to Throughput when its average read grows over the first size, and back to Latency under the second
+	const std::uint32_t AutoThroughputReadSize = 16 * 1024;
+	const std::uint32_t AutoLatencyReadSize = 1024;
+
+	struct SocketTuning {
+		bool noDelay;
+		// 0 keeps the system default
+		int sendBufferSize;
+		int receiveBufferSize;
+		// 0 keeps keepalive disabled
+		ULONG keepAliveTimeMs;
+		ULONG keepAliveIntervalMs;
+		// bytes buffered by the forwarder for one direction of a pair before it stops reading the source
+		std::size_t queueThreshold;
+	};
+
+	inline const SocketTuning& TuningFor(TuningProfile profile) {
+		static const SocketTuning defaultTuning{ false, 0, 0, 0, 0, DefaultQueueThreshold };
+		static const SocketTuning latencyTuning{ true, 0, 0, 30000, 1000, DefaultQueueThreshold };
+		static const SocketTuning throughputTuning{ false, 1 << 20, 1 << 20, 60000, 10000, 256 * 1024 };
+		switch (profile) {
+		case TuningProfile::Latency:
+		case TuningProfile::Auto:
+			return latencyTuning;
+		case TuningProfile::Throughput:
+			return throughputTuning;
+		default:
+			return defaultTuning;
+		}
+	}
+
+	inline void ApplyTuning(SOCKET s, const SocketTuning& tuning) {
+		BOOL noDelay = tuning.noDelay ? TRUE : FALSE;
+		socketApi().SetOption(s, IPPROTO_TCP, TCP_NODELAY, (char*)&noDelay, sizeof(noDelay));
+		if (tuning.sendBufferSize != 0) {
+			socketApi().SetOption(s, SOL_SOCKET, SO_SNDBUF, (char*)&tuning.sendBufferSize, sizeof(tuning.sendBufferSize));
+		}
+		if (tuning.receiveBufferSize != 0) {
+			socketApi().SetOption(s, SOL_SOCKET, SO_RCVBUF, (char*)&tuning.receiveBufferSize, sizeof(tuning.receiveBufferSize));
+		}
+		if (tuning.keepAliveTimeMs != 0) {
+			socketApi().SetKeepAlive(s, tuning.keepAliveTimeMs, tuning.keepAliveIntervalMs);
+		}
+	}
+
+	// without send buffering, overlapped sends are transmitted from the application buffers instead of being copied by the stack
+	inline void DisableSendBuffering(SOCKET s) {
+		int zero = 0;
+		socketApi().SetOption(s, SOL_SOCKET, SO_SNDBUF, (char*)&zero, sizeof(zero));
+	}
+
+	// receive buffers must be set on the listener to be taken into account in the window negotiated by accepted connections
+	inline void ApplyListenerTuning(SOCKET s, const SocketTuning& tuning) {
+		if (tuning.receiveBufferSize != 0) {
+			socketApi().SetOption(s, SOL_SOCKET, SO_RCVBUF, (char*)&tuning.receiveBufferSize, sizeof(tuning.receiveBufferSize));
+		}
+	}
+}
@@ -0,0 +1,120 @@
+#pragma once
+#include <client.h>
+#include "Forwarders.h"
+#include "Backends.h"
+#include "RateLimit.h"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <deque>
+#include <vector>
+// the flows of UdpForwarder, apart so that the benchmarks can drive their queues
+inline const bool operator <(const sockaddr_in& lhs, const sockaddr_in& rhs) {
+	return memcmp(&lhs, &rhs, sizeof(sockaddr_in)) < 0;
+}
+namespace forwarding {
+	const std::chrono::seconds ClientTimeout{ 30 };
+	// datagrams a flow keeps in each direction while the socket they go out through would block. Newer ones are dropped
+	const std::size_t FlowQueueLimit = 256;
+	// datagrams sent for a flow before the next ready flow gets its turn
+	const std::size_t FlowDrainBatch = 32;
+
+	struct UdpReply {
+		std::vector<char> data;
+		std::chrono::steady_clock::time_point queued;
+	};
+
+	// flows are keyed by client address and by the port of the range they came in through
+	struct UdpFlowKey {
+		std::uint16_t index;
+		sockaddr_in clientAddr;
+	};
+	inline bool operator <(const UdpFlowKey& lhs, const UdpFlowKey& rhs) {
+		if (lhs.index != rhs.index) {
+			return lhs.index < rhs.index;
+		}
+		return lhs.clientAddr < rhs.clientAddr;
+	}
+	
+	using UdpRequest = std::vector<char>;
+
+	struct UdpPair {
+		sockaddr_in clientAddr;
+		std::uint16_t index = 0;
+		SafeSocket remote;
+		BackendLease backend;
+		PairShaping shaping;
+		std::deque<UdpRequest> pendingRequests;
+		std::deque<UdpReply> pendingReplies;
+		std::chrono::steady_clock::time_point last_activity;
+		std::uint32_t id = 0;
+		std::uint16_t localPort = 0;
+		std::uint64_t bytesToRemote = 0;
+		std::uint64_t bytesToLocal = 0;
+		// set while requests are queued because the remote socket would block, until it reports FD_WRITE
+		bool blocked = false;
+		// set while the flow is on the ready list of its local socket
+		bool replyReady = false;
+		// the remote socket is selected on an event of its own, so that a signal goes straight to its flow
+		std::size_t remoteEvent = 0;
+		SafeAutoResetEvent event;
+		UdpPair():last_activity(clockNow()){
+		}
+		UdpPair(const sockaddr_in& clientAddr, std::uint16_t index, SafeSocket&& remoteSock) : clientAddr(clientAddr), index(index), remote(std::move(remoteSock)), last_activity(clockNow()) {
+		}
+		UdpPair(const UdpPair&) = delete;
+		UdpPair(UdpPair&&) = default;
+		bool timedOut() const {
+			return (clockNow() - last_activity) > ClientTimeout;
+		}
+		// sends up to budget queued requests. Returns false once the remote socket would block
+		bool trySendRequests(std::size_t budget) {
+			for (; !pendingRequests.empty() && budget > 0; --budget) {
+				auto& req = pendingRequests.front();
+				auto sent = socketApi().Send(remote.Get(), req.data(), static_cast<int>(req.size()));
+				if (sent <= 0) {
+					if (WSAEWOULDBLOCK == WSAGetLastError()) { // can't send in non blocking way anymore
+						return false;
+					}
+					// if other error, simply drop the packet (conformly to UDP expecting packet losses)
+				}
+				else {
+					bytesToRemote += sent;
+				}
+				last_activity = clockNow();
+				pendingRequests.pop_front();
+			}
+			return true;
+		}
+		// sends up to budget queued replies through local. Returns false once it would block
+		bool trySendReplies(SOCKET local, std::size_t budget, std::chrono::steady_clock::duration& maxDelay) {
+			for (; !pendingReplies.empty() && budget > 0; --budget) {
+				auto& reply = pendingReplies.front();
+				auto sent = socketApi().SendTo(local, reply.data.data(), static_cast<int>(reply.data.size()),
+					(const sockaddr*)&clientAddr, static_cast<int>(sizeof(clientAddr)));
+				if (sent <= 0 && WSAEWOULDBLOCK == WSAGetLastError()) {
+					return false;
+				}
+				// if other error, simply drop the packet (conformly to UDP expecting packet losses)
+				maxDelay = std::max(maxDelay, clockNow() - reply.queued);
+				pendingReplies.pop_front();
+			}
+			return true;
+		}
+		bool tryReadReply(std::vector<char>& data) {
+			u_long available = 0;
+			socketApi().Available(remote.Get(), &available);
+			if (available > 0) {
+				data.resize(available);
+				auto read = socketApi().Recv(remote.Get(), data.data(), static_cast<int>(data.size()));
+				if (read >= 0) {
+					data.resize(read);
+					bytesToLocal += read;
+					last_activity = clockNow();
+					return true;
+				}
+			}
+			return false;
+		}
+	};
+}
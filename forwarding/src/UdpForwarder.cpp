@@ -1,5 +1,5 @@
 #include <vector>
-#include <thread>
+#include <deque>
 #include <atomic>
 #include <mutex>
 #include <algorithm>
@@ -8,8 +8,16 @@
 #include <string>
 #include <client.h>
 #include "Forwarders.h"
+#include "Backends.h"
+#include "Tracing.h"
+#include "FlightRecorder.h"
+#include "RateLimit.h"
+#include "Runtime.h"
+#include "Snapshot.h"
+#include "UdpFlow.h"
 #include <chrono>
 #include <map>
+#include <unordered_map>
 #include <cstring>
 #include <windows.h>
 
@@ -17,249 +25,461 @@ using namespace forwarding;
 using namespace std;
 using namespace std::chrono;
 
-inline const bool operator <(const sockaddr_in& lhs, const sockaddr_in& rhs) {
-	return memcmp(&lhs, &rhs, sizeof(sockaddr_in)) < 0;
-}
 namespace forwarding {
-	const seconds ClientTimeout = 30s;
-
-	struct UdpReply {
-		sockaddr_in clientAddr;
-		vector<char> data;
-		UdpReply() = default;
-		UdpReply(const UdpReply&) = default;
-		UdpReply(UdpReply&&) = default;
-		UdpReply& operator =(const UdpReply&) = default;
-		UdpReply& operator =(UdpReply&&) = default;
-		UdpReply(const sockaddr_in& addr, vector<char>&& data) : clientAddr(addr), data(move(data))
-		{}
+	// the flows with replies to send through a local socket, served in turn
+	struct UdpLocalQueue {
+		deque<UdpFlowKey> ready;
+		// set once a send would block, until the socket reports FD_WRITE
+		bool blocked = false;
+		// the event the local socket is selected on, see UdpForwarder::Impl::RegisterLocalSockets
+		std::size_t localEvent = 0;
+		SafeAutoResetEvent event;
 	};
-	
-	using UdpRequest = vector<char>;
 
-	struct UdpPair {
-		sockaddr_in clientAddr;
-		SafeSocket remote;
-		vector<UdpRequest> pendingRequests;
-		steady_clock::time_point last_activity;
-		UdpPair():last_activity(steady_clock::now()){
-		}
-		UdpPair(const sockaddr_in& clientAddr, SafeSocket&& remoteSock) : clientAddr(clientAddr), remote(move(remoteSock)), last_activity(steady_clock::now()) {
-		}
-		UdpPair(const UdpPair&) = delete;
-		UdpPair(UdpPair&&) = default;
-		bool timedOut() const {
-			return (steady_clock::now() - last_activity) > ClientTimeout;
-		}
-		void trySendRequests() {
-			while (!pendingRequests.empty()) {
-				auto sent = send(remote.Get(), &pendingRequests[0][0], static_cast<int>(pendingRequests[0].size()), 0);
-				if (sent <= 0) {
-					if (WSAEWOULDBLOCK == WSAGetLastError()) { // can't send in non blocking way anymore
-						break;
-					}
-					// if other error, simply drop the packet (conformly to UDP expecting packet losses)
+	// a single port is a range of 1, see ForwarderEntry
+	struct UdpForwarderEntry {
+		uint16_t port;
+		uint16_t count = 1;
+		vector<SafeSocket> localSockets;
+		// one per local socket
+		vector<UdpLocalQueue> localQueues;
+		BackendSet backends;
+		map<UdpFlowKey,UdpPair> pairs;
+		// null until rate limits are set
+		shared_ptr<EntryShaper> shaper;
+		uint64_t rateLimitedPackets = 0;
+		uint64_t rateLimitedBytes = 0;
+		uint64_t queueDroppedPackets = 0;
+		uint64_t queueDroppedBytes = 0;
+		steady_clock::duration maxReplyQueueDelay = steady_clock::duration::zero();
+
+		// datagrams over the limits are dropped, as udp expects packet losses
+		bool Admit(PairShaping& shaping, size_t size, steady_clock::time_point now) {
+			if (!shaping || shaping.TryConsume(size, now)) {
+				return true;
+			}
+			++rateLimitedPackets;
+			rateLimitedBytes += size;
+			return false;
+		}
+
+		bool Overlaps(uint16_t start, uint16_t otherCount) const {
+			return start < port + count && port < start + otherCount;
+		}
+		// see ForwarderEntry::Matches
+		bool Matches(uint16_t otherCount, uint32_t remotePortStart, const char* remoteAddress) const {
+			auto first = backends.First();
+			return count == otherCount && first && first->port == remotePortStart && first->address == remoteAddress;
+		}
+
+		// datagrams past the queue limit of their flow are dropped like those over the rate limits
+		bool QueueRequest(UdpPair& pair, UdpRequest&& req) {
+			if (pair.pendingRequests.size() >= FlowQueueLimit) {
+				++queueDroppedPackets;
+				queueDroppedBytes += req.size();
+				return false;
+			}
+			pair.pendingRequests.push_back(move(req));
+			return true;
+		}
+		void QueueReply(const UdpFlowKey& key, UdpPair& pair, vector<char>&& data, steady_clock::time_point now) {
+			if (pair.pendingReplies.size() >= FlowQueueLimit) {
+				++queueDroppedPackets;
+				queueDroppedBytes += data.size();
+				return;
+			}
+			pair.pendingReplies.push_back(UdpReply{ move(data), now });
+			if (!pair.replyReady) {
+				pair.replyReady = true;
+				localQueues[key.index].ready.push_back(key);
+			}
+		}
+
+		void ForgetReplies(const UdpFlowKey& key, UdpPair& pair) {
+			if (!pair.replyReady) {
+				return;
+			}
+			auto& ready = localQueues[key.index].ready;
+			ready.erase(std::remove_if(ready.begin(), ready.end(), [&key](const UdpFlowKey& k) {return !(k < key) && !(key < k); }), ready.end());
+			pair.replyReady = false;
+		}
+
+		// gives each ready flow of the local socket index a batch, until the socket would block. Returns true when flows are
+		// left ready with the socket still writable, for the caller to come back once the other sources of the loop ran
+		bool TrySendReplies(uint16_t index) {
+			auto& queue = localQueues[index];
+			if (queue.blocked) {
+				return false;
+			}
+			for (auto turns = queue.ready.size(); turns > 0 && !queue.ready.empty(); --turns) {
+				auto key = queue.ready.front();
+				queue.ready.pop_front();
+				auto found = pairs.find(key);
+				if (found == pairs.end()) {
+					continue;
 				}
-				last_activity = steady_clock::now();
-				pendingRequests.erase(pendingRequests.begin());
-			}
-		}
-		bool tryReadReply(UdpReply& reply) {
-			u_long available = 0;
-			ioctlsocket(remote.Get(), FIONREAD, &available);
-			if (available > 0) {
-				reply.data.resize(available);
-				auto read = recv(remote.Get(), &reply.data[0], static_cast<int>(reply.data.size()), 0);
-				if (read >= 0) {
-					reply.clientAddr = clientAddr;
-					reply.data.resize(read);
-					last_activity = steady_clock::now();
-					return true;
+				auto& pair = found->second;
+				pair.replyReady = false;
+				auto writable = pair.trySendReplies(localSockets[index].Get(), FlowDrainBatch, maxReplyQueueDelay);
+				if (pair.pendingReplies.empty()) {
+					continue;
+				}
+				pair.replyReady = true;
+				if (!writable) {
+					queue.ready.push_front(key);
+					queue.blocked = true;
+					return false;
 				}
+				queue.ready.push_back(key);
 			}
-			return false;
+			return !queue.ready.empty();
 		}
 	};
 
-	struct UdpForwarderEntry {
-		uint16_t port;
-		SafeSocket localSocket;
-		std::unique_ptr<ResolvedAddress> remoteAddr;
-		vector<UdpReply> pendingReplies;
-		map<sockaddr_in,UdpPair> pairs;
+	struct UdpListenerRef {
+		SOCKET socket;
+		UdpForwarderEntry* entry;
+		uint16_t index;
+	};
+
+	struct UdpFlowRef {
+		UdpForwarderEntry* entry;
+		UdpFlowKey key;
 	};
 
-	class UdpForwarder::Impl : public enable_shared_from_this<UdpForwarder::Impl> {
+	class UdpForwarder::Impl : public LoopSource {
 	private:
-		SafeAutoResetEvent _localEvent, _remoteEvent;
+		shared_ptr<Runtime::Impl> _runtime;
+		// the event handed out with the attachment, the events of the local and remote sockets are added after it
+		const std::size_t ProbeEventIndex = 0;
+		unique_ptr<LoopAttachment> _attachment;
+		// see TcpForwarder
+		SafeAutoResetEvent _probeEvent;
+		steady_clock::time_point _nextHealthCheck = steady_clock::time_point::max();
+		steady_clock::time_point _lastSweep = clockNow();
 		std::mutex _mut;
 		std::atomic<bool> _running;
-		std::thread _runningThread;
 		vector<std::unique_ptr<UdpForwarderEntry>> _entries;
-		void OnLocalSocketSignaled() {
+		// null until RestoreSnapshot
+		std::shared_ptr<EntrySnapshot::Impl> _snapshot;
+		// each local socket and each flow has an event of its own, so that a signal only touches its socket however many
+		// ports and flows there are
+		std::unordered_map<std::size_t, UdpListenerRef> _localSockets;
+		std::unordered_map<std::size_t, UdpFlowRef> _flows;
+		std::size_t _nextEvent = ProbeEventIndex + 1;
 
-			std::lock_guard<std::mutex> lg(_mut);
-			for (auto& entry : _entries) {
-				WSANETWORKEVENTS events;
-				WSAEnumNetworkEvents(entry->localSocket.Get(), nullptr, &events);
-				if ((events.lNetworkEvents & FD_READ) == FD_READ) {
-					sockaddr_in clientAddr;
-					int clientAddrLength = sizeof(clientAddr);
-					u_long available = 0;
-					ioctlsocket(entry->localSocket.Get(), FIONREAD, &available);
-					UdpRequest req;
-					req.resize(available);
-					auto readSize = recvfrom(entry->localSocket.Get(), &req[0], static_cast<int>(req.size()), 0, (sockaddr*)&clientAddr, &clientAddrLength);
-					if (readSize >= 0) {
-						req.resize(readSize);
-						auto pairIt = entry->pairs.find(clientAddr);
-						if (pairIt == entry->pairs.end()) {
-							SafeSocket remote = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
-							if (0 == connect(remote.Get(), entry->remoteAddr->SockAddr(), entry->remoteAddr->SockAddrLen())) {
-								WSAEventSelect(remote.Get(), _remoteEvent.get(), FD_READ | FD_WRITE);
-								UdpPair p(clientAddr, move(remote));
-								p.pendingRequests.push_back(move(req));
-								p.trySendRequests();
-								entry->pairs.insert(make_pair(clientAddr, move(p)));
-							}
-						}
-						else {
-							pairIt->second.pendingRequests.push_back(move(req));
-							pairIt->second.trySendRequests();
-						}
-					}
+		// with _mut held
+		void RegisterLocalSockets(UdpForwarderEntry& entry) {
+			for (uint16_t i = 0; i < entry.count; ++i) {
+				auto& queue = entry.localQueues[i];
+				queue.localEvent = _nextEvent++;
+				queue.event = _attachment->AddEvent(queue.localEvent);
+				socketApi().EventSelect(entry.localSockets[i].Get(), queue.event.get(), FD_READ | FD_WRITE);
+				_localSockets.emplace(queue.localEvent, UdpListenerRef{ entry.localSockets[i].Get(), &entry, i });
+			}
+		}
+
+		void ForgetFlow(UdpForwarderEntry& entry, const UdpFlowKey& key, UdpPair& pair) {
+			_attachment->RemoveEvent(pair.event);
+			_flows.erase(pair.remoteEvent);
+			entry.ForgetReplies(key, pair);
+		}
+
+		void UnregisterEntry(UdpForwarderEntry& entry) {
+			for (auto& queue : entry.localQueues) {
+				_attachment->RemoveEvent(queue.event);
+				_localSockets.erase(queue.localEvent);
+			}
+			for (auto& pair : entry.pairs) {
+				ForgetFlow(entry, pair.first, pair.second);
+			}
+		}
+
+		// flows stick to the backend selected for their first packet
+		void CreateFlow(UdpForwarderEntry& entry, const UdpFlowKey& key, UdpRequest&& req, PairShaping&& shaping) {
+			auto backend = entry.backends.Select();
+			if (!backend) {
+				return;
+			}
+			sockaddr_storage remoteAddr;
+			auto resolved = backend->name->Current();
+			auto remoteAddrLen = SockAddrWithPort(*resolved, backend->port + key.index, remoteAddr);
+			auto rawRemote = socketApi().Socket(resolved->Family(), SOCK_DGRAM, IPPROTO_UDP);
+			if (INVALID_SOCKET == rawRemote) {
+				return;
+			}
+			SafeSocket remote = rawRemote;
+			if (0 == socketApi().Connect(remote.Get(), reinterpret_cast<const sockaddr*>(&remoteAddr), remoteAddrLen)) {
+				UdpPair p(key.clientAddr, key.index, move(remote));
+				p.remoteEvent = _nextEvent++;
+				try {
+					p.event = _attachment->AddEvent(p.remoteEvent);
+				}
+				catch (const TransportErrorException&) {
+					// dropped like the datagram of a flow whose socket could not be created
+					return;
 				}
+				socketApi().EventSelect(p.remote.Get(), p.event.get(), FD_READ | FD_WRITE);
+				_flows.emplace(p.remoteEvent, UdpFlowRef{ &entry, key });
+				p.id = NewConnectionId();
+				p.localPort = static_cast<uint16_t>(entry.port + key.index);
+				RecordFlight(FlightEvent::Accept, p.id, p.localPort);
+				p.backend = BackendLease(backend->counters);
+				p.shaping = move(shaping);
+				auto& pair = entry.pairs.insert(make_pair(key, move(p))).first->second;
+				ForwardRequest(entry, key, pair, move(req));
+				TraceLoggingWrite(g_forwardingTraceProvider, "UdpFlowCreate",
+					TraceLoggingLevel(WINEVENT_LEVEL_INFO),
+					TraceLoggingKeyword(TraceKeywordUdp),
+					TraceLoggingUInt16(static_cast<uint16_t>(entry.port + key.index), "LocalPort"),
+					TraceLoggingUInt16(ntohs(key.clientAddr.sin_port), "ClientPort"),
+					TraceLoggingString(backend->address.c_str(), "Backend"));
+			}
+		}
 
-				// try to send pending replies
-				while (!entry->pendingReplies.empty()) {
-					auto sent = sendto(entry->localSocket.Get(), &entry->pendingReplies[0].data[0], static_cast<int>(entry->pendingReplies[0].data.size()), 0,
-						(const sockaddr*)&entry->pendingReplies[0].clientAddr, sizeof(entry->pendingReplies[0].clientAddr));
-					if (sent <= 0) {
-						if (WSAEWOULDBLOCK == WSAGetLastError()) { // can't send in non blocking way anymore
-							break;
+		void ForwardRequest(UdpForwarderEntry& entry, const UdpFlowKey& key, UdpPair& pair, UdpRequest&& req) {
+			if (!entry.QueueRequest(pair, move(req)) || pair.blocked) {
+				return;
+			}
+			if (!pair.trySendRequests(FlowDrainBatch)) {
+				pair.blocked = true;
+				RecordFlight(FlightEvent::BackpressureOn, pair.id, pair.localPort, 0, pair.bytesToRemote, pair.bytesToLocal);
+			}
+		}
+
+		void ReadReplies(UdpForwarderEntry& entry, const UdpFlowKey& key, UdpPair& pair) {
+			vector<char> data;
+			while (pair.tryReadReply(data)) {
+				auto now = clockNow();
+				if (entry.Admit(pair.shaping, data.size(), now)) {
+					entry.QueueReply(key, pair, move(data), now);
+				}
+				data = vector<char>{};
+			}
+		}
+
+		void TrySendReplies(UdpForwarderEntry& entry, uint16_t index) {
+			if (entry.TrySendReplies(index)) {
+				SetEvent(entry.localQueues[index].event.get());
+			}
+		}
+
+		// with _mut held
+		void OnLocalSocketSignaled(const UdpListenerRef& listener) {
+			auto entry = listener.entry;
+			WSANETWORKEVENTS events;
+			socketApi().EnumNetworkEvents(listener.socket, &events);
+			if ((events.lNetworkEvents & FD_READ) == FD_READ) {
+				UdpFlowKey key;
+				key.index = listener.index;
+				int clientAddrLength = sizeof(key.clientAddr);
+				u_long available = 0;
+				socketApi().Available(listener.socket, &available);
+				UdpRequest req;
+				req.resize(available);
+				auto readSize = socketApi().RecvFrom(listener.socket, &req[0], static_cast<int>(req.size()), (sockaddr*)&key.clientAddr, &clientAddrLength);
+				if (readSize >= 0) {
+					req.resize(readSize);
+					auto pairIt = entry->pairs.find(key);
+					if (pairIt == entry->pairs.end()) {
+						auto shaping = entry->shaper ? entry->shaper->ForClient(key.clientAddr) : PairShaping{};
+						if (entry->Admit(shaping, req.size(), clockNow())) {
+							CreateFlow(*entry, key, move(req), move(shaping));
 						}
-						// if other error, simply drop the packet (conformly to UDP expecting packet losses)
 					}
-					entry->pendingReplies.erase(entry->pendingReplies.begin());
+					else if (entry->Admit(pairIt->second.shaping, req.size(), clockNow())) {
+						ForwardRequest(*entry, key, pairIt->second, move(req));
+					}
 				}
 			}
+			if ((events.lNetworkEvents & FD_WRITE) == FD_WRITE) {
+				entry->localQueues[listener.index].blocked = false;
+			}
+			TrySendReplies(*entry, listener.index);
 		}
 
-		void OnRemoteSocketSignaled() {
+		// a blocked flow gets a batch of its queued requests per signal, and signals itself again while its socket stays
+		// writable, so that it goes back behind the other ready events of the loop
+		void OnRemoteSocketSignaled(const UdpFlowRef& flow) {
+			auto& entry = *flow.entry;
+			auto key = flow.key;
+			auto found = entry.pairs.find(key);
+			if (found == entry.pairs.end()) {
+				return;
+			}
+			auto& pair = found->second;
+			WSANETWORKEVENTS events;
+			socketApi().EnumNetworkEvents(pair.remote.Get(), &events);
+			if ((events.lNetworkEvents & FD_READ) == FD_READ) {
+				ReadReplies(entry, key, pair);
+			}
+			if (pair.replyReady) {
+				TrySendReplies(entry, key.index);
+			}
+			if (!pair.blocked) {
+				return;
+			}
+			auto writable = pair.trySendRequests(FlowDrainBatch);
+			if (pair.pendingRequests.empty()) {
+				pair.blocked = false;
+				RecordFlight(FlightEvent::BackpressureOff, pair.id, pair.localPort, 0, pair.bytesToRemote, pair.bytesToLocal);
+			}
+			else if (writable) {
+				SetEvent(pair.event.get());
+			}
+		}
+
+		void RunHealthChecks() {
 			std::lock_guard<std::mutex> lg(_mut);
+			auto now = clockNow();
+			_nextHealthCheck = steady_clock::time_point::max();
 			for (auto& entry : _entries) {
-				for (auto& pair : entry->pairs) {					
-					WSANETWORKEVENTS events;
-					WSAEnumNetworkEvents(pair.second.remote.Get(), nullptr, &events);
-					if ((events.lNetworkEvents & FD_READ) == FD_READ) {
-						UdpReply reply;
-						while (pair.second.tryReadReply(reply)) {
-							entry->pendingReplies.push_back(move(reply));
-							reply = UdpReply{};
-						}
+				_nextHealthCheck = std::min(_nextHealthCheck, entry->backends.RunHealthChecks(SOCK_DGRAM, _probeEvent.get(), now));
+			}
+		}
+
+		void SweepFlows() {
+			lock_guard<mutex> lg(_mut);
+			for (auto& entries : _entries) {
+				std::vector<UdpFlowKey> toRemove;
+				for (auto& pair : entries->pairs) {
+					if (pair.second.timedOut()) {
+						toRemove.push_back(pair.first);
 					}
-					pair.second.trySendRequests();
 				}
-				// try to send pending replies
-				while (!entry->pendingReplies.empty()) {
-					auto sent = sendto(entry->localSocket.Get(), &entry->pendingReplies[0].data[0], static_cast<int>(entry->pendingReplies[0].data.size()), 0,
-						(const sockaddr*)&entry->pendingReplies[0].clientAddr, static_cast<int>(sizeof(entry->pendingReplies[0].clientAddr)));
-					if (sent <= 0) {
-						if (WSAEWOULDBLOCK == WSAGetLastError()) { // can't send in non blocking way anymore
-							break;
-						}
-						// if other error, simply drop the packet (conformly to UDP expecting packet losses)
-					}
-					entry->pendingReplies.erase(entry->pendingReplies.begin());
+				for (auto& k : toRemove) {
+					auto& expired = entries->pairs.at(k);
+					ForgetFlow(*entries, k, expired);
+					RecordFlight(FlightEvent::Close, expired.id, expired.localPort, static_cast<int32_t>(CloseReason::IdleTimeout), expired.bytesToRemote, expired.bytesToLocal);
+					TraceLoggingWrite(g_forwardingTraceProvider, "UdpFlowExpire",
+						TraceLoggingLevel(WINEVENT_LEVEL_INFO),
+						TraceLoggingKeyword(TraceKeywordUdp),
+						TraceLoggingUInt16(static_cast<uint16_t>(entries->port + k.index), "LocalPort"),
+						TraceLoggingUInt16(ntohs(k.clientAddr.sin_port), "ClientPort"));
+					entries->pairs.erase(k);
 				}
 			}
 		}
 	public:
-		void Loop() {
-			auto lastSweep = steady_clock::now();
-			while (_running) {
-				HANDLE events[] = { _localEvent.get(), _remoteEvent.get() };
-				auto waitResult = WaitForMultipleObjects(2, events, FALSE, static_cast<int>(duration_cast<milliseconds>(ClientTimeout).count()));
-				if (!_running) {
-					return;
-				}
-				if (waitResult == WAIT_OBJECT_0) {
-					OnLocalSocketSignaled();
-				}
-				else if (waitResult == WAIT_OBJECT_0 + 1) {
-					OnRemoteSocketSignaled();
-				}
-				if(steady_clock::now()-lastSweep > ClientTimeout)
-				{
-					lock_guard<mutex> lg(_mut);
-					for (auto& entries : _entries) {
-						std::vector<sockaddr_in> toRemove;
-						for (auto& pair : entries->pairs) {
-							if (pair.second.timedOut()) {
-								toRemove.push_back(pair.first);
-							}
-						}
-						for (auto& k : toRemove) {
-							entries->pairs.erase(k);
-						}
-					}
-					lastSweep = steady_clock::now();
-				}
+		void OnSignaled(std::size_t index) override {
+			if (index == ProbeEventIndex) {
+				RunHealthChecks();
+				return;
+			}
+			std::lock_guard<std::mutex> lg(_mut);
+			auto flow = _flows.find(index);
+			if (flow != _flows.end()) {
+				OnRemoteSocketSignaled(flow->second);
+				return;
+			}
+			// not found once removed while its signal was dispatched
+			auto local = _localSockets.find(index);
+			if (local != _localSockets.end()) {
+				OnLocalSocketSignaled(local->second);
 			}
 		}
-		Impl() : _localEvent(MakeAutoResetEvent()), _remoteEvent(MakeAutoResetEvent()), _running(false)
-		{}
+		void OnDeadline() override {
+			if (clockNow() >= _nextHealthCheck) {
+				RunHealthChecks();
+			}
+			if (clockNow() - _lastSweep >= ClientTimeout) {
+				SweepFlows();
+				_lastSweep = clockNow();
+			}
+		}
+		steady_clock::time_point NextDeadline() override {
+			return std::min(_nextHealthCheck, _lastSweep + duration_cast<steady_clock::duration>(ClientTimeout));
+		}
+		explicit Impl(shared_ptr<Runtime::Impl> runtime) : _runtime(move(runtime)), _running(false)
+		{
+			_attachment = _runtime->Attach(*this, ProbeEventIndex + 1, "UdpForwarder");
+			_probeEvent = _attachment->Events()[ProbeEventIndex];
+		}
 		void Start() {
 			if (_running) {
 				return;
 			}
-			auto weak = std::weak_ptr<UdpForwarder::Impl>(shared_from_this());
 			_running = true;
-			_runningThread = std::thread([weak]() {
-				auto that = weak.lock();
-				if (that) {
-					that->Loop();
-				}
-			});
+			_attachment->Enable();
 		}
 		void Stop() {
 			if (!_running) {
 				return;
 			}
 			_running = false;
-			{
-				std::lock_guard<std::mutex> lg(_mut);
-				_entries.clear();
-				SetEvent(_localEvent.get());
+			_attachment->Disable();
+			std::lock_guard<std::mutex> lg(_mut);
+			for (auto& entry : _entries) {
+				UnregisterEntry(*entry);
 			}
-			_runningThread.join();
+			_entries.clear();
 		}
 		~Impl() {
 			Stop();
 		}
 
 		void AddEntry(std::uint16_t localPort, std::uint32_t remotePort, const char* remoteAddress) {
+			AddRangeEntry(localPort, 1, remotePort, remoteAddress);
+		}
+		void AdoptRangeEntry(std::uint16_t localPortStart, std::uint16_t count, std::uint32_t remotePortStart, const char* remoteAddress, const std::vector<WSAPROTOCOL_INFOW>& sockets) {
+			if (sockets.size() != count) {
+				throw TransportErrorException{ TransportError::InvalidSocket };
+			}
+			AddRangeEntry(localPortStart, count, remotePortStart, remoteAddress, &sockets);
+		}
+		// adopted sockets are already bound
+		void AddRangeEntry(std::uint16_t localPortStart, std::uint16_t count, std::uint32_t remotePortStart, const char* remoteAddress, const std::vector<WSAPROTOCOL_INFOW>* adopted = nullptr) {
+			if (count == 0 || localPortStart + count - 1 > 0xffff) {
+				throw TransportErrorException{ TransportError::BindFailed };
+			}
 			{
 				std::lock_guard<std::mutex> lg(_mut);
-				auto found = std::find_if(_entries.begin(), _entries.end(), [localPort](const std::unique_ptr<UdpForwarderEntry>& e) {return e->port == localPort; });
+				auto found = std::find_if(_entries.begin(), _entries.end(), [localPortStart](const std::unique_ptr<UdpForwarderEntry>& e) {return e->port == localPortStart; });
 				if (found != _entries.end()) {
-					return;
+					if ((*found)->Matches(count, remotePortStart, remoteAddress)) {
+						return;
+					}
+					throw TransportErrorException{ TransportError::BindFailed };
+				}
+				auto overlapping = std::find_if(_entries.begin(), _entries.end(), [localPortStart, count](const std::unique_ptr<UdpForwarderEntry>& e) {return e->Overlaps(localPortStart, count); });
+				if (overlapping != _entries.end()) {
+					throw TransportErrorException{ TransportError::BindFailed };
 				}
 			}
-			auto localAddress = ResolveUdp("127.0.0.1", localPort);
+			auto localAddress = ResolveUdp("127.0.0.1", localPortStart);
 			auto entry = std::make_unique<UdpForwarderEntry>();
-			entry->port = localPort;
-			entry->localSocket = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
-			entry->remoteAddr = ResolveUdp(remoteAddress, remotePort);
-			int yes = 1;
-			setsockopt(entry->localSocket.Get(), SOL_SOCKET, SO_REUSEADDR, (char*)&yes, sizeof(yes));
-			if (0 != ::bind(entry->localSocket.Get(), localAddress->SockAddr(), localAddress->SockAddrLen())) {
-				throw TransportErrorException{ TransportError::BindFailed };
+			entry->port = localPortStart;
+			entry->count = count;
+			entry->backends.Add(remoteAddress, remotePortStart, 1, ResolveName(remoteAddress, SOCK_DGRAM));
+			entry->localSockets.reserve(count);
+			entry->localQueues.resize(count);
+			for (uint16_t i = 0; i < count; ++i) {
+				if (adopted) {
+					entry->localSockets.push_back(AdoptSocket((*adopted)[i]));
+					continue;
+				}
+				sockaddr_storage bindAddr;
+				auto bindAddrLen = SockAddrWithPort(*localAddress, localPortStart + i, bindAddr);
+				SafeSocket localSocket = socketApi().Socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+				int yes = 1;
+				socketApi().SetOption(localSocket.Get(), SOL_SOCKET, SO_REUSEADDR, (char*)&yes, sizeof(yes));
+				if (0 != socketApi().Bind(localSocket.Get(), reinterpret_cast<const sockaddr*>(&bindAddr), bindAddrLen)) {
+					throw TransportErrorException{ TransportError::BindFailed };
+				}
+				entry->localSockets.push_back(move(localSocket));
 			}
-			unsigned long nonBlocking = 1;
 			{
 				std::lock_guard<std::mutex> lg(_mut);
-				WSAEventSelect(entry->localSocket.Get(), _localEvent.get(), FD_READ|FD_WRITE);
+				try {
+					RegisterLocalSockets(*entry);
+				}
+				catch (const TransportErrorException&) {
+					UnregisterEntry(*entry);
+					throw;
+				}
+				if (_snapshot) {
+					_snapshot->Put(MakeSnapshotEntry(SnapshotProtocol::Udp, localPortStart, count, remotePortStart, remoteAddress));
+				}
 				_entries.push_back(std::move(entry));
 			}
 		}
@@ -267,12 +487,173 @@ namespace forwarding {
 			std::lock_guard<std::mutex> lg(_mut);
 			auto found = std::find_if(_entries.begin(), _entries.end(), [localPort](const std::unique_ptr<UdpForwarderEntry>& e) {return e->port == localPort; });
 			if (found != _entries.end()) {
+				UnregisterEntry(**found);
 				_entries.erase(found);
+				if (_snapshot) {
+					_snapshot->Remove(SnapshotProtocol::Udp, localPort);
+				}
+			}
+		}
+		bool UpdateEntryRemote(std::uint16_t localPort, std::uint32_t remotePortStart, const char* remoteAddress) {
+			auto name = ResolveName(remoteAddress, SOCK_DGRAM);
+			std::lock_guard<std::mutex> lg(_mut);
+			auto found = std::find_if(_entries.begin(), _entries.end(), [localPort](const std::unique_ptr<UdpForwarderEntry>& e) {return e->port == localPort; });
+			if (found == _entries.end()) {
+				return false;
+			}
+			(*found)->backends.Replace(remoteAddress, remotePortStart, move(name));
+			if ((*found)->backends.HealthChecked()) {
+				SetEvent(_probeEvent.get());
+			}
+			if (_snapshot) {
+				_snapshot->Put(MakeSnapshotEntry(SnapshotProtocol::Udp, localPort, (*found)->count, remotePortStart, remoteAddress));
+			}
+			return true;
+		}
+		bool DuplicateEntry(std::uint16_t localPort, DWORD processId, std::vector<WSAPROTOCOL_INFOW>& sockets) {
+			std::lock_guard<std::mutex> lg(_mut);
+			auto found = std::find_if(_entries.begin(), _entries.end(), [localPort](const std::unique_ptr<UdpForwarderEntry>& e) {return e->port == localPort; });
+			if (found == _entries.end()) {
+				return false;
+			}
+			sockets = DuplicateSockets((*found)->localSockets, processId);
+			return true;
+		}
+		// the flows of the entry are dropped: the adopting process creates its own as datagrams come in
+		bool ReleaseEntry(std::uint16_t localPort) {
+			std::lock_guard<std::mutex> lg(_mut);
+			auto found = std::find_if(_entries.begin(), _entries.end(), [localPort](const std::unique_ptr<UdpForwarderEntry>& e) {return e->port == localPort; });
+			if (found == _entries.end()) {
+				return false;
+			}
+			UnregisterEntry(**found);
+			ReleaseSockets((*found)->localSockets);
+			// the snapshot keeps the entry for the process that adopted it
+			_entries.erase(found);
+			return true;
+		}
+		std::size_t RestoreSnapshot(std::shared_ptr<EntrySnapshot::Impl> snapshot) {
+			std::size_t restored = 0;
+			for (auto& recorded : snapshot->Entries()) {
+				if (recorded.protocol != SnapshotProtocol::Udp) {
+					continue;
+				}
+				{
+					std::lock_guard<std::mutex> lg(_mut);
+					auto overlapping = std::any_of(_entries.begin(), _entries.end(), [&recorded](const std::unique_ptr<UdpForwarderEntry>& e) {return e->Overlaps(recorded.localPort, recorded.count); });
+					if (overlapping) {
+						continue;
+					}
+				}
+				try {
+					AddRangeEntry(recorded.localPort, recorded.count, recorded.remotePort, recorded.remoteAddress.c_str());
+					++restored;
+				}
+				catch (const TransportErrorException&) {
+					// left out of the entries the snapshot is reset to
+				}
+			}
+			std::lock_guard<std::mutex> lg(_mut);
+			std::vector<SnapshotEntry> entries;
+			for (auto& entry : _entries) {
+				auto first = entry->backends.First();
+				if (first) {
+					entries.push_back(MakeSnapshotEntry(SnapshotProtocol::Udp, entry->port, entry->count, first->port, first->address));
+				}
+			}
+			snapshot->Reset(SnapshotProtocol::Udp, entries);
+			_snapshot = std::move(snapshot);
+			return restored;
+		}
+		bool GetEntryStats(std::uint16_t localPort, UdpEntryStats& stats) {
+			std::lock_guard<std::mutex> lg(_mut);
+			auto found = std::find_if(_entries.begin(), _entries.end(), [localPort](const std::unique_ptr<UdpForwarderEntry>& e) {return e->port == localPort; });
+			if (found == _entries.end()) {
+				return false;
+			}
+			stats.flows = (*found)->pairs.size();
+			stats.rateLimitedPackets = (*found)->rateLimitedPackets;
+			stats.rateLimitedBytes = (*found)->rateLimitedBytes;
+			std::uint64_t queued = 0;
+			for (auto& pair : (*found)->pairs) {
+				queued += pair.second.pendingRequests.size() + pair.second.pendingReplies.size();
+			}
+			stats.queuedPackets = queued;
+			stats.queueDroppedPackets = (*found)->queueDroppedPackets;
+			stats.queueDroppedBytes = (*found)->queueDroppedBytes;
+			stats.maxReplyQueueDelayUs = static_cast<uint64_t>(duration_cast<microseconds>((*found)->maxReplyQueueDelay).count());
+			return true;
+		}
+		bool SetEntryRateLimit(std::uint16_t localPort, const RateLimit& entryLimit, const RateLimit& perClient) {
+			std::lock_guard<std::mutex> lg(_mut);
+			auto found = std::find_if(_entries.begin(), _entries.end(), [localPort](const std::unique_ptr<UdpForwarderEntry>& e) {return e->port == localPort; });
+			if (found == _entries.end()) {
+				return false;
 			}
+			auto& shaper = (*found)->shaper;
+			if (!shaper) {
+				if (!IsLimited(entryLimit) && !IsLimited(perClient)) {
+					return true;
+				}
+				shaper = make_shared<EntryShaper>();
+			}
+			shaper->Configure(entryLimit, perClient);
+			return true;
+		}
+		bool AddBackend(std::uint16_t localPort, std::uint32_t remotePort, const char* remoteAddress, std::uint32_t weight) {
+			auto name = ResolveName(remoteAddress, SOCK_DGRAM);
+			std::lock_guard<std::mutex> lg(_mut);
+			auto found = std::find_if(_entries.begin(), _entries.end(), [localPort](const std::unique_ptr<UdpForwarderEntry>& e) {return e->port == localPort; });
+			if (found == _entries.end()) {
+				return false;
+			}
+			(*found)->backends.Add(remoteAddress, remotePort, weight, move(name));
+			if ((*found)->backends.HealthChecked()) {
+				SetEvent(_probeEvent.get());
+			}
+			return true;
+		}
+		bool RemoveBackend(std::uint16_t localPort, std::uint32_t remotePort, const char* remoteAddress) {
+			std::lock_guard<std::mutex> lg(_mut);
+			auto found = std::find_if(_entries.begin(), _entries.end(), [localPort](const std::unique_ptr<UdpForwarderEntry>& e) {return e->port == localPort; });
+			if (found == _entries.end()) {
+				return false;
+			}
+			return (*found)->backends.Remove(remoteAddress, remotePort);
+		}
+		bool SetBalancingPolicy(std::uint16_t localPort, BalancingPolicy policy) {
+			std::lock_guard<std::mutex> lg(_mut);
+			auto found = std::find_if(_entries.begin(), _entries.end(), [localPort](const std::unique_ptr<UdpForwarderEntry>& e) {return e->port == localPort; });
+			if (found == _entries.end()) {
+				return false;
+			}
+			(*found)->backends.SetPolicy(policy);
+			return true;
+		}
+		bool SetHealthCheck(std::uint16_t localPort, const HealthCheck& check) {
+			std::lock_guard<std::mutex> lg(_mut);
+			auto found = std::find_if(_entries.begin(), _entries.end(), [localPort](const std::unique_ptr<UdpForwarderEntry>& e) {return e->port == localPort; });
+			if (found == _entries.end()) {
+				return false;
+			}
+			(*found)->backends.SetHealthCheck(check);
+			SetEvent(_probeEvent.get());
+			return true;
+		}
+		bool GetBackendHealth(std::uint16_t localPort, std::uint32_t remotePort, const char* remoteAddress, BackendHealth& health) {
+			std::lock_guard<std::mutex> lg(_mut);
+			auto found = std::find_if(_entries.begin(), _entries.end(), [localPort](const std::unique_ptr<UdpForwarderEntry>& e) {return e->port == localPort; });
+			if (found == _entries.end()) {
+				return false;
+			}
+			return (*found)->backends.GetHealth(remoteAddress, remotePort, health);
 		}
 	};
 
-	UdpForwarder::UdpForwarder() :_impl(make_shared<UdpForwarder::Impl>())
+	UdpForwarder::UdpForwarder() :_impl(make_shared<UdpForwarder::Impl>(Runtime::Default()))
+	{
+	}
+	UdpForwarder::UdpForwarder(Runtime& runtime) : _impl(make_shared<UdpForwarder::Impl>(runtime._impl))
 	{
 	}
 	void UdpForwarder::Start()
@@ -290,8 +671,60 @@ namespace forwarding {
 	{
 		_impl->AddEntry(localPort, remotePort, remoteAddress);
 	}
+	void UdpForwarder::AddRangeEntry(std::uint16_t localPortStart, std::uint16_t count, std::uint32_t remotePortStart, const char * remoteAddress)
+	{
+		_impl->AddRangeEntry(localPortStart, count, remotePortStart, remoteAddress);
+	}
 	void UdpForwarder::RemoveEntry(std::uint16_t localPort)
 	{
 		_impl->RemoveEntry(localPort);
 	}
+	bool UdpForwarder::UpdateEntryRemote(std::uint16_t localPort, std::uint32_t remotePortStart, const char* remoteAddress)
+	{
+		return _impl->UpdateEntryRemote(localPort, remotePortStart, remoteAddress);
+	}
+	bool UdpForwarder::DuplicateEntry(std::uint16_t localPort, DWORD processId, std::vector<WSAPROTOCOL_INFOW>& sockets)
+	{
+		return _impl->DuplicateEntry(localPort, processId, sockets);
+	}
+	void UdpForwarder::AdoptRangeEntry(std::uint16_t localPortStart, std::uint16_t count, std::uint32_t remotePortStart, const char* remoteAddress, const std::vector<WSAPROTOCOL_INFOW>& sockets)
+	{
+		_impl->AdoptRangeEntry(localPortStart, count, remotePortStart, remoteAddress, sockets);
+	}
+	bool UdpForwarder::ReleaseEntry(std::uint16_t localPort)
+	{
+		return _impl->ReleaseEntry(localPort);
+	}
+	std::size_t UdpForwarder::RestoreSnapshot(EntrySnapshot& snapshot)
+	{
+		return _impl->RestoreSnapshot(snapshot._impl);
+	}
+	bool UdpForwarder::GetEntryStats(std::uint16_t localPort, UdpEntryStats& stats)
+	{
+		return _impl->GetEntryStats(localPort, stats);
+	}
+	bool UdpForwarder::SetEntryRateLimit(std::uint16_t localPort, const RateLimit& entry, const RateLimit& perClient)
+	{
+		return _impl->SetEntryRateLimit(localPort, entry, perClient);
+	}
+	bool UdpForwarder::AddBackend(std::uint16_t localPort, std::uint32_t remotePort, const char * remoteAddress, std::uint32_t weight)
+	{
+		return _impl->AddBackend(localPort, remotePort, remoteAddress, weight);
+	}
+	bool UdpForwarder::RemoveBackend(std::uint16_t localPort, std::uint32_t remotePort, const char * remoteAddress)
+	{
+		return _impl->RemoveBackend(localPort, remotePort, remoteAddress);
+	}
+	bool UdpForwarder::SetBalancingPolicy(std::uint16_t localPort, BalancingPolicy policy)
+	{
+		return _impl->SetBalancingPolicy(localPort, policy);
+	}
+	bool UdpForwarder::SetHealthCheck(std::uint16_t localPort, const HealthCheck& check)
+	{
+		return _impl->SetHealthCheck(localPort, check);
+	}
+	bool UdpForwarder::GetBackendHealth(std::uint16_t localPort, std::uint32_t remotePort, const char * remoteAddress, BackendHealth& health)
+	{
+		return _impl->GetBackendHealth(localPort, remotePort, remoteAddress, health);
+	}
 }
\ No newline at end of file
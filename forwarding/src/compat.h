@@ -2,5 +2,7 @@
 #include <memory>
 namespace forwarding {
 	void init_transport();
+	// numeric addresses and unix socket paths, which Resolve converts without getaddrinfo
+	bool IsLiteralAddress(const char* hostName);
 
 }
\ No newline at end of file
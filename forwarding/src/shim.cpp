@@ -1,9 +1,126 @@
 #include <client.h>
 #include <client_c.h>
+#include <algorithm>
+#include <cstring>
+
+static forwarding_error toForwardingError(const forwarding::TransportErrorException& ex) {
+	switch (ex.Error)
+	{
+	case forwarding::TransportError::NameResolutionFailed:
+		return FORWARDING_NAME_RESOLUTION_FAILED;
+	case forwarding::TransportError::BindFailed:
+		return FORWARDING_BIND_FAILED;
+	case forwarding::TransportError::UnsupportedAddress:
+		return FORWARDING_UNSUPPORTED_ADDRESS;
+	case forwarding::TransportError::TlsSetupFailed:
+		return FORWARDING_TLS_SETUP_FAILED;
+	case forwarding::TransportError::SnapshotFailed:
+		return FORWARDING_SNAPSHOT_FAILED;
+	default:
+		return FORWARDING_UNKNOWN_ERROR;
+	}
+}
+
+static forwarding::BalancingPolicy toBalancingPolicy(forwarding_balancing_policy policy) {
+	switch (policy)
+	{
+	case FORWARDING_BALANCING_LEAST_CONNECTIONS:
+		return forwarding::BalancingPolicy::LeastConnections;
+	case FORWARDING_BALANCING_POWER_OF_TWO_CHOICES:
+		return forwarding::BalancingPolicy::PowerOfTwoChoices;
+	default:
+		return forwarding::BalancingPolicy::RoundRobin;
+	}
+}
+
+static forwarding_backend_health toBackendHealth(forwarding::BackendHealth health) {
+	switch (health)
+	{
+	case forwarding::BackendHealth::Healthy:
+		return FORWARDING_BACKEND_HEALTH_HEALTHY;
+	case forwarding::BackendHealth::Unhealthy:
+		return FORWARDING_BACKEND_HEALTH_UNHEALTHY;
+	default:
+		return FORWARDING_BACKEND_HEALTH_UNKNOWN;
+	}
+}
+
+static forwarding::RateLimit toRateLimit(const forwarding_rate_limit* limit) {
+	forwarding::RateLimit result;
+	if (limit) {
+		result.bytesPerSecond = limit->bytesPerSecond;
+		result.burstBytes = limit->burstBytes;
+		result.packetsPerSecond = limit->packetsPerSecond;
+		result.burstPackets = limit->burstPackets;
+	}
+	return result;
+}
+
+// the handoff blob is the WSAPROTOCOL_INFOW of each socket of the entry, in port order
+template<typename Forwarder>
+static forwarding_error duplicateEntry(Forwarder* forwarder, uint16_t localPort, uint32_t processId, char* handoff, uint32_t handoffCapacity, uint32_t* handoffLength) {
+	try {
+		std::vector<WSAPROTOCOL_INFOW> sockets;
+		if (!forwarder->DuplicateEntry(localPort, processId, sockets)) {
+			return FORWARDING_ENTRY_NOT_FOUND;
+		}
+		auto length = static_cast<uint32_t>(sockets.size() * sizeof(WSAPROTOCOL_INFOW));
+		*handoffLength = length;
+		if (length > handoffCapacity) {
+			return FORWARDING_BUFFER_TOO_SMALL;
+		}
+		memcpy(handoff, sockets.data(), length);
+		return FORWARDING_OK;
+	}
+	catch (forwarding::TransportErrorException& ex) {
+		return toForwardingError(ex);
+	}
+	catch (...) {
+		return FORWARDING_UNKNOWN_ERROR;
+	}
+}
+
+template<typename Forwarder>
+static forwarding_error adoptRangeEntry(Forwarder* forwarder, uint16_t localPortStart, uint16_t count, uint32_t remotePortStart, char* remoteAddress, char* handoff, uint32_t handoffLength) {
+	if (handoffLength % sizeof(WSAPROTOCOL_INFOW) != 0) {
+		return FORWARDING_UNKNOWN_ERROR;
+	}
+	try {
+		std::vector<WSAPROTOCOL_INFOW> sockets(handoffLength / sizeof(WSAPROTOCOL_INFOW));
+		memcpy(sockets.data(), handoff, handoffLength);
+		forwarder->AdoptRangeEntry(localPortStart, count, remotePortStart, remoteAddress, sockets);
+		return FORWARDING_OK;
+	}
+	catch (forwarding::TransportErrorException& ex) {
+		return toForwardingError(ex);
+	}
+	catch (...) {
+		return FORWARDING_UNKNOWN_ERROR;
+	}
+}
+
+forwarding_runtime forwarding_runtime_new(uint32_t loopCount) {
+	return reinterpret_cast<forwarding_runtime>(new forwarding::Runtime(loopCount));
+}
+forwarding_runtime forwarding_runtime_newWithLowLatency(uint32_t loopCount, uint32_t spinMicroseconds, uint64_t affinityMask) {
+	forwarding::LowLatencyOptions lowLatency;
+	lowLatency.spinMicroseconds = spinMicroseconds;
+	lowLatency.affinityMask = affinityMask;
+	return reinterpret_cast<forwarding_runtime>(new forwarding::Runtime(loopCount, lowLatency));
+}
+void forwarding_runtime_delete(forwarding_runtime runtime) {
+	delete reinterpret_cast<forwarding::Runtime*>(runtime);
+}
+uint32_t forwarding_runtime_loopCount(forwarding_runtime runtime) {
+	return reinterpret_cast<forwarding::Runtime*>(runtime)->LoopCount();
+}
 
 forwarding_udp forwarding_udp_new() {
 	return reinterpret_cast<forwarding_udp>(new forwarding::UdpForwarder());
 }
+forwarding_udp forwarding_udp_newOnRuntime(forwarding_runtime runtime) {
+	return reinterpret_cast<forwarding_udp>(new forwarding::UdpForwarder(*reinterpret_cast<forwarding::Runtime*>(runtime)));
+}
 
 void forwarding_udp_delete(forwarding_udp udp) {
 	delete reinterpret_cast<forwarding::UdpForwarder*>(udp);
@@ -20,27 +137,136 @@ forwarding_error forwarding_udp_addEntry(forwarding_udp udp, uint16_t localPort,
 		return FORWARDING_OK;
 	}
 	catch (forwarding::TransportErrorException& ex) {
-		switch (ex.Error)
-		{
-		case forwarding::TransportError::NameResolutionFailed:
-			return FORWARDING_NAME_RESOLUTION_FAILED;
-		case forwarding::TransportError::BindFailed:
-			return FORWARDING_BIND_FAILED;
-		default:
-			return FORWARDING_UNKNOWN_ERROR;
-		}
+		return toForwardingError(ex);
 	}
 	catch(...){
 		return FORWARDING_UNKNOWN_ERROR;
 	}
 }
+forwarding_error forwarding_udp_addRangeEntry(forwarding_udp udp, uint16_t localPortStart, uint16_t count, uint32_t remotePortStart, char* remoteAddress) {
+	try {
+		reinterpret_cast<forwarding::UdpForwarder*>(udp)->AddRangeEntry(localPortStart, count, remotePortStart, remoteAddress);
+		return FORWARDING_OK;
+	}
+	catch (forwarding::TransportErrorException& ex) {
+		return toForwardingError(ex);
+	}
+	catch (...) {
+		return FORWARDING_UNKNOWN_ERROR;
+	}
+}
 void forwarding_udp_removeEntry(forwarding_udp udp, uint16_t localPort) {
 	reinterpret_cast<forwarding::UdpForwarder*>(udp)->RemoveEntry(localPort);
 }
+forwarding_error forwarding_udp_updateEntryRemote(forwarding_udp udp, uint16_t localPort, uint32_t remotePortStart, char* remoteAddress) {
+	try {
+		if (!reinterpret_cast<forwarding::UdpForwarder*>(udp)->UpdateEntryRemote(localPort, remotePortStart, remoteAddress)) {
+			return FORWARDING_ENTRY_NOT_FOUND;
+		}
+		return FORWARDING_OK;
+	}
+	catch (forwarding::TransportErrorException& ex) {
+		return toForwardingError(ex);
+	}
+	catch (...) {
+		return FORWARDING_UNKNOWN_ERROR;
+	}
+}
+forwarding_error forwarding_udp_duplicateEntry(forwarding_udp udp, uint16_t localPort, uint32_t processId, char* handoff, uint32_t handoffCapacity, uint32_t* handoffLength) {
+	return duplicateEntry(reinterpret_cast<forwarding::UdpForwarder*>(udp), localPort, processId, handoff, handoffCapacity, handoffLength);
+}
+forwarding_error forwarding_udp_adoptRangeEntry(forwarding_udp udp, uint16_t localPortStart, uint16_t count, uint32_t remotePortStart, char* remoteAddress, char* handoff, uint32_t handoffLength) {
+	return adoptRangeEntry(reinterpret_cast<forwarding::UdpForwarder*>(udp), localPortStart, count, remotePortStart, remoteAddress, handoff, handoffLength);
+}
+forwarding_error forwarding_udp_releaseEntry(forwarding_udp udp, uint16_t localPort) {
+	if (!reinterpret_cast<forwarding::UdpForwarder*>(udp)->ReleaseEntry(localPort)) {
+		return FORWARDING_ENTRY_NOT_FOUND;
+	}
+	return FORWARDING_OK;
+}
+uint32_t forwarding_udp_restoreSnapshot(forwarding_udp udp, forwarding_snapshot snapshot) {
+	return static_cast<uint32_t>(reinterpret_cast<forwarding::UdpForwarder*>(udp)->RestoreSnapshot(*reinterpret_cast<forwarding::EntrySnapshot*>(snapshot)));
+}
+forwarding_error forwarding_udp_getEntryStats(forwarding_udp udp, uint16_t localPort, forwarding_udp_entry_stats* stats) {
+	forwarding::UdpEntryStats result;
+	if (!reinterpret_cast<forwarding::UdpForwarder*>(udp)->GetEntryStats(localPort, result)) {
+		return FORWARDING_ENTRY_NOT_FOUND;
+	}
+	stats->flows = result.flows;
+	stats->rateLimitedPackets = result.rateLimitedPackets;
+	stats->rateLimitedBytes = result.rateLimitedBytes;
+	stats->queuedPackets = result.queuedPackets;
+	stats->queueDroppedPackets = result.queueDroppedPackets;
+	stats->queueDroppedBytes = result.queueDroppedBytes;
+	stats->maxReplyQueueDelayUs = result.maxReplyQueueDelayUs;
+	return FORWARDING_OK;
+}
+forwarding_error forwarding_udp_setEntryRateLimit(forwarding_udp udp, uint16_t localPort, const forwarding_rate_limit* entry, const forwarding_rate_limit* perClient) {
+	if (!reinterpret_cast<forwarding::UdpForwarder*>(udp)->SetEntryRateLimit(localPort, toRateLimit(entry), toRateLimit(perClient))) {
+		return FORWARDING_ENTRY_NOT_FOUND;
+	}
+	return FORWARDING_OK;
+}
+
+forwarding_error forwarding_udp_addBackend(forwarding_udp udp, uint16_t localPort, uint32_t remotePort, char* remoteAddress, uint32_t weight) {
+	try {
+		if (!reinterpret_cast<forwarding::UdpForwarder*>(udp)->AddBackend(localPort, remotePort, remoteAddress, weight)) {
+			return FORWARDING_ENTRY_NOT_FOUND;
+		}
+		return FORWARDING_OK;
+	}
+	catch (forwarding::TransportErrorException& ex) {
+		return toForwardingError(ex);
+	}
+	catch (...) {
+		return FORWARDING_UNKNOWN_ERROR;
+	}
+}
+forwarding_error forwarding_udp_removeBackend(forwarding_udp udp, uint16_t localPort, uint32_t remotePort, char* remoteAddress) {
+	if (!reinterpret_cast<forwarding::UdpForwarder*>(udp)->RemoveBackend(localPort, remotePort, remoteAddress)) {
+		return FORWARDING_ENTRY_NOT_FOUND;
+	}
+	return FORWARDING_OK;
+}
+forwarding_error forwarding_udp_setBalancingPolicy(forwarding_udp udp, uint16_t localPort, forwarding_balancing_policy policy) {
+	if (!reinterpret_cast<forwarding::UdpForwarder*>(udp)->SetBalancingPolicy(localPort, toBalancingPolicy(policy))) {
+		return FORWARDING_ENTRY_NOT_FOUND;
+	}
+	return FORWARDING_OK;
+}
 
+forwarding_error forwarding_udp_setHealthCheck(forwarding_udp udp, uint16_t localPort, uint32_t intervalMs, uint32_t timeoutMs, uint32_t unhealthyThreshold, uint32_t healthyThreshold,
+	char* probePayload, uint32_t probePayloadLength, char* expectedReply, uint32_t expectedReplyLength) {
+	forwarding::HealthCheck check;
+	check.intervalMs = intervalMs;
+	check.timeoutMs = timeoutMs;
+	check.unhealthyThreshold = unhealthyThreshold;
+	check.healthyThreshold = healthyThreshold;
+	if (probePayload) {
+		check.probePayload.assign(probePayload, probePayloadLength);
+	}
+	if (expectedReply) {
+		check.expectedReply.assign(expectedReply, expectedReplyLength);
+	}
+	if (!reinterpret_cast<forwarding::UdpForwarder*>(udp)->SetHealthCheck(localPort, check)) {
+		return FORWARDING_ENTRY_NOT_FOUND;
+	}
+	return FORWARDING_OK;
+}
+forwarding_error forwarding_udp_getBackendHealth(forwarding_udp udp, uint16_t localPort, uint32_t remotePort, char* remoteAddress, forwarding_backend_health* health) {
+	forwarding::BackendHealth result;
+	if (!reinterpret_cast<forwarding::UdpForwarder*>(udp)->GetBackendHealth(localPort, remotePort, remoteAddress, result)) {
+		return FORWARDING_ENTRY_NOT_FOUND;
+	}
+	*health = toBackendHealth(result);
+	return FORWARDING_OK;
+}
 forwarding_tcp forwarding_tcp_new() {
 	return reinterpret_cast<forwarding_tcp>(new forwarding::TcpForwarder());
 }
+forwarding_tcp forwarding_tcp_newOnRuntime(forwarding_runtime runtime) {
+	return reinterpret_cast<forwarding_tcp>(new forwarding::TcpForwarder(*reinterpret_cast<forwarding::Runtime*>(runtime)));
+}
 void forwarding_tcp_delete(forwarding_tcp tcp) {
 	delete reinterpret_cast<forwarding::TcpForwarder*>(tcp);
 }
@@ -56,20 +282,276 @@ forwarding_error forwarding_tcp_addEntry(forwarding_tcp tcp, uint16_t localPort,
 		return FORWARDING_OK;
 	}
 	catch (forwarding::TransportErrorException& ex) {
-		switch (ex.Error)
-		{
-		case forwarding::TransportError::NameResolutionFailed:
-			return FORWARDING_NAME_RESOLUTION_FAILED;
-		case forwarding::TransportError::BindFailed:
-			return FORWARDING_BIND_FAILED;
-		default:
-			return FORWARDING_UNKNOWN_ERROR;
+		return toForwardingError(ex);
+	}
+	catch (...) {
+		return FORWARDING_UNKNOWN_ERROR;
+	}
+}
+forwarding_error forwarding_tcp_addTlsEntry(forwarding_tcp tcp, uint16_t localPort, uint32_t remotePort, char* remoteAddress, char* pfx, uint32_t pfxLength, char* password) {
+	try {
+		forwarding::TlsCertificate certificate;
+		certificate.pfx.assign(pfx, pfx + pfxLength);
+		if (password) {
+			certificate.password = password;
+		}
+		reinterpret_cast<forwarding::TcpForwarder*>(tcp)->AddEntry(localPort, remotePort, remoteAddress, certificate);
+		return FORWARDING_OK;
+	}
+	catch (forwarding::TransportErrorException& ex) {
+		return toForwardingError(ex);
+	}
+	catch (...) {
+		return FORWARDING_UNKNOWN_ERROR;
+	}
+}
+forwarding_error forwarding_tcp_addRangeEntry(forwarding_tcp tcp, uint16_t localPortStart, uint16_t count, uint32_t remotePortStart, char* remoteAddress) {
+	try {
+		reinterpret_cast<forwarding::TcpForwarder*>(tcp)->AddRangeEntry(localPortStart, count, remotePortStart, remoteAddress);
+		return FORWARDING_OK;
+	}
+	catch (forwarding::TransportErrorException& ex) {
+		return toForwardingError(ex);
+	}
+	catch (...) {
+		return FORWARDING_UNKNOWN_ERROR;
+	}
+}
+forwarding_error forwarding_tcp_addBackend(forwarding_tcp tcp, uint16_t localPort, uint32_t remotePort, char* remoteAddress, uint32_t weight) {
+	try {
+		if (!reinterpret_cast<forwarding::TcpForwarder*>(tcp)->AddBackend(localPort, remotePort, remoteAddress, weight)) {
+			return FORWARDING_ENTRY_NOT_FOUND;
 		}
+		return FORWARDING_OK;
+	}
+	catch (forwarding::TransportErrorException& ex) {
+		return toForwardingError(ex);
 	}
 	catch (...) {
 		return FORWARDING_UNKNOWN_ERROR;
 	}
 }
+forwarding_error forwarding_tcp_removeBackend(forwarding_tcp tcp, uint16_t localPort, uint32_t remotePort, char* remoteAddress) {
+	if (!reinterpret_cast<forwarding::TcpForwarder*>(tcp)->RemoveBackend(localPort, remotePort, remoteAddress)) {
+		return FORWARDING_ENTRY_NOT_FOUND;
+	}
+	return FORWARDING_OK;
+}
+forwarding_error forwarding_tcp_setBalancingPolicy(forwarding_tcp tcp, uint16_t localPort, forwarding_balancing_policy policy) {
+	if (!reinterpret_cast<forwarding::TcpForwarder*>(tcp)->SetBalancingPolicy(localPort, toBalancingPolicy(policy))) {
+		return FORWARDING_ENTRY_NOT_FOUND;
+	}
+	return FORWARDING_OK;
+}
+forwarding_error forwarding_tcp_setHealthCheck(forwarding_tcp tcp, uint16_t localPort, uint32_t intervalMs, uint32_t timeoutMs, uint32_t unhealthyThreshold, uint32_t healthyThreshold) {
+	forwarding::HealthCheck check;
+	check.intervalMs = intervalMs;
+	check.timeoutMs = timeoutMs;
+	check.unhealthyThreshold = unhealthyThreshold;
+	check.healthyThreshold = healthyThreshold;
+	if (!reinterpret_cast<forwarding::TcpForwarder*>(tcp)->SetHealthCheck(localPort, check)) {
+		return FORWARDING_ENTRY_NOT_FOUND;
+	}
+	return FORWARDING_OK;
+}
+forwarding_error forwarding_tcp_getBackendHealth(forwarding_tcp tcp, uint16_t localPort, uint32_t remotePort, char* remoteAddress, forwarding_backend_health* health) {
+	forwarding::BackendHealth result;
+	if (!reinterpret_cast<forwarding::TcpForwarder*>(tcp)->GetBackendHealth(localPort, remotePort, remoteAddress, result)) {
+		return FORWARDING_ENTRY_NOT_FOUND;
+	}
+	*health = toBackendHealth(result);
+	return FORWARDING_OK;
+}
 void forwarding_tcp_removeEntry(forwarding_tcp tcp, uint16_t localPort) {
 	reinterpret_cast<forwarding::TcpForwarder*>(tcp)->RemoveEntry(localPort);
-}
\ No newline at end of file
+}
+forwarding_error forwarding_tcp_updateEntryRemote(forwarding_tcp tcp, uint16_t localPort, uint32_t remotePortStart, char* remoteAddress) {
+	try {
+		if (!reinterpret_cast<forwarding::TcpForwarder*>(tcp)->UpdateEntryRemote(localPort, remotePortStart, remoteAddress)) {
+			return FORWARDING_ENTRY_NOT_FOUND;
+		}
+		return FORWARDING_OK;
+	}
+	catch (forwarding::TransportErrorException& ex) {
+		return toForwardingError(ex);
+	}
+	catch (...) {
+		return FORWARDING_UNKNOWN_ERROR;
+	}
+}
+forwarding_error forwarding_tcp_duplicateEntry(forwarding_tcp tcp, uint16_t localPort, uint32_t processId, char* handoff, uint32_t handoffCapacity, uint32_t* handoffLength) {
+	return duplicateEntry(reinterpret_cast<forwarding::TcpForwarder*>(tcp), localPort, processId, handoff, handoffCapacity, handoffLength);
+}
+forwarding_error forwarding_tcp_adoptRangeEntry(forwarding_tcp tcp, uint16_t localPortStart, uint16_t count, uint32_t remotePortStart, char* remoteAddress, char* handoff, uint32_t handoffLength) {
+	return adoptRangeEntry(reinterpret_cast<forwarding::TcpForwarder*>(tcp), localPortStart, count, remotePortStart, remoteAddress, handoff, handoffLength);
+}
+forwarding_error forwarding_tcp_releaseEntry(forwarding_tcp tcp, uint16_t localPort) {
+	if (!reinterpret_cast<forwarding::TcpForwarder*>(tcp)->ReleaseEntry(localPort)) {
+		return FORWARDING_ENTRY_NOT_FOUND;
+	}
+	return FORWARDING_OK;
+}
+uint32_t forwarding_tcp_restoreSnapshot(forwarding_tcp tcp, forwarding_snapshot snapshot) {
+	return static_cast<uint32_t>(reinterpret_cast<forwarding::TcpForwarder*>(tcp)->RestoreSnapshot(*reinterpret_cast<forwarding::EntrySnapshot*>(snapshot)));
+}
+uint64_t forwarding_tcp_activeConnections(forwarding_tcp tcp) {
+	return reinterpret_cast<forwarding::TcpForwarder*>(tcp)->ActiveConnections();
+}
+forwarding_error forwarding_tcp_setEntryLimits(forwarding_tcp tcp, uint16_t localPort, uint32_t maxConnections, uint32_t idleTimeoutMs, uint64_t maxQueuedBytes, forwarding_overload_policy overloadPolicy) {
+	forwarding::TcpEntryLimits limits;
+	limits.maxConnections = maxConnections;
+	limits.idleTimeoutMs = idleTimeoutMs;
+	limits.maxQueuedBytes = maxQueuedBytes;
+	limits.overloadPolicy = overloadPolicy == FORWARDING_OVERLOAD_PAUSE_ACCEPT ? forwarding::OverloadPolicy::PauseAccept : forwarding::OverloadPolicy::Refuse;
+	if (!reinterpret_cast<forwarding::TcpForwarder*>(tcp)->SetEntryLimits(localPort, limits)) {
+		return FORWARDING_ENTRY_NOT_FOUND;
+	}
+	return FORWARDING_OK;
+}
+forwarding_error forwarding_tcp_getEntryStats(forwarding_tcp tcp, uint16_t localPort, forwarding_tcp_entry_stats* stats) {
+	forwarding::TcpEntryStats result;
+	if (!reinterpret_cast<forwarding::TcpForwarder*>(tcp)->GetEntryStats(localPort, result)) {
+		return FORWARDING_ENTRY_NOT_FOUND;
+	}
+	stats->activeConnections = result.activeConnections;
+	stats->acceptedConnections = result.acceptedConnections;
+	stats->queuedBytes = result.queuedBytes;
+	stats->connectionLimitTrips = result.connectionLimitTrips;
+	stats->queuedBytesLimitTrips = result.queuedBytesLimitTrips;
+	stats->idleTimeoutTrips = result.idleTimeoutTrips;
+	stats->socketExhaustionTrips = result.socketExhaustionTrips;
+	stats->autoTuningSwitches = result.autoTuningSwitches;
+	stats->bytesToRemote = result.bytesToRemote;
+	stats->bytesToLocal = result.bytesToLocal;
+	stats->noBackendRefusals = result.noBackendRefusals;
+	stats->zeroCopySends = result.zeroCopySends;
+	stats->zeroCopyBytes = result.zeroCopyBytes;
+	stats->tlsHandshakes = result.tlsHandshakes;
+	stats->tlsHandshakeFailures = result.tlsHandshakeFailures;
+	stats->firstBytePairs = result.firstBytePairs;
+	stats->firstByteLatencyUs = result.firstByteLatencyUs;
+	stats->maxFirstByteLatencyUs = result.maxFirstByteLatencyUs;
+	stats->budgetYields = result.budgetYields;
+	stats->rateLimitPauses = result.rateLimitPauses;
+	stats->fastOpenConnects = result.fastOpenConnects;
+	stats->fastOpenBytes = result.fastOpenBytes;
+	stats->fastOpenSavedUs = result.fastOpenSavedUs;
+	stats->fastOpenFallbacks = result.fastOpenFallbacks;
+	return FORWARDING_OK;
+}
+uint32_t forwarding_tcp_getBridgeStats(forwarding_tcp tcp, forwarding_tcp_bridge_stats* stats, uint32_t capacity) {
+	auto result = reinterpret_cast<forwarding::TcpForwarder*>(tcp)->GetBridgeStats();
+	uint32_t count = 0;
+	for (auto& bridge : result) {
+		if (count == capacity) {
+			break;
+		}
+		stats[count].pairs = bridge.pairs;
+		stats[count].busiestSlotPairs = bridge.busiestSlotPairs;
+		stats[count].idlestSlotPairs = bridge.idlestSlotPairs;
+		++count;
+	}
+	return count;
+}
+forwarding_error forwarding_tcp_setEntryTuning(forwarding_tcp tcp, uint16_t localPort, forwarding_tuning_profile profile) {
+	forwarding::TuningProfile tuning;
+	switch (profile)
+	{
+	case FORWARDING_TUNING_LATENCY:
+		tuning = forwarding::TuningProfile::Latency;
+		break;
+	case FORWARDING_TUNING_THROUGHPUT:
+		tuning = forwarding::TuningProfile::Throughput;
+		break;
+	case FORWARDING_TUNING_AUTO:
+		tuning = forwarding::TuningProfile::Auto;
+		break;
+	default:
+		tuning = forwarding::TuningProfile::Default;
+		break;
+	}
+	if (!reinterpret_cast<forwarding::TcpForwarder*>(tcp)->SetEntryTuning(localPort, tuning)) {
+		return FORWARDING_ENTRY_NOT_FOUND;
+	}
+	return FORWARDING_OK;
+}
+forwarding_error forwarding_tcp_setEntryZeroCopy(forwarding_tcp tcp, uint16_t localPort, uint32_t thresholdBytes) {
+	if (!reinterpret_cast<forwarding::TcpForwarder*>(tcp)->SetEntryZeroCopy(localPort, thresholdBytes)) {
+		return FORWARDING_ENTRY_NOT_FOUND;
+	}
+	return FORWARDING_OK;
+}
+forwarding_error forwarding_tcp_setEntryInteractive(forwarding_tcp tcp, uint16_t localPort, int interactive) {
+	if (!reinterpret_cast<forwarding::TcpForwarder*>(tcp)->SetEntryInteractive(localPort, interactive != 0)) {
+		return FORWARDING_ENTRY_NOT_FOUND;
+	}
+	return FORWARDING_OK;
+}
+forwarding_error forwarding_tcp_setEntryRateLimit(forwarding_tcp tcp, uint16_t localPort, const forwarding_rate_limit* entry, const forwarding_rate_limit* perClient) {
+	if (!reinterpret_cast<forwarding::TcpForwarder*>(tcp)->SetEntryRateLimit(localPort, toRateLimit(entry), toRateLimit(perClient))) {
+		return FORWARDING_ENTRY_NOT_FOUND;
+	}
+	return FORWARDING_OK;
+}
+uint32_t forwarding_flightRecorder_snapshot(forwarding_flight_record* records, uint32_t capacity) {
+	auto snapshot = forwarding::SnapshotFlightRecorder();
+	auto count = static_cast<uint32_t>(std::min<std::size_t>(snapshot.size(), capacity));
+	auto first = snapshot.size() - count;
+	for (uint32_t i = 0; i < count; ++i) {
+		auto& record = snapshot[first + i];
+		records[i].timestampUs = record.timestampUs;
+		records[i].threadId = record.threadId;
+		records[i].connectionId = record.connectionId;
+		records[i].event = static_cast<forwarding_flight_event>(record.event);
+		records[i].localPort = record.localPort;
+		records[i].value = record.value;
+		records[i].bytesToRemote = record.bytesToRemote;
+		records[i].bytesToLocal = record.bytesToLocal;
+	}
+	return count;
+}
+forwarding_error forwarding_tcp_setEntryLatencyCritical(forwarding_tcp tcp, uint16_t localPort, int latencyCritical) {
+	if (!reinterpret_cast<forwarding::TcpForwarder*>(tcp)->SetEntryLatencyCritical(localPort, latencyCritical != 0)) {
+		return FORWARDING_ENTRY_NOT_FOUND;
+	}
+	return FORWARDING_OK;
+}
+forwarding_error forwarding_tcp_setEntryFastOpen(forwarding_tcp tcp, uint16_t localPort, int fastOpen) {
+	if (!reinterpret_cast<forwarding::TcpForwarder*>(tcp)->SetEntryFastOpen(localPort, fastOpen != 0)) {
+		return FORWARDING_ENTRY_NOT_FOUND;
+	}
+	return FORWARDING_OK;
+}
+forwarding_error forwarding_snapshot_open(const char* path, forwarding_snapshot* snapshot) {
+	try {
+		*snapshot = new forwarding::EntrySnapshot(path);
+		return FORWARDING_OK;
+	}
+	catch (forwarding::TransportErrorException& ex) {
+		return toForwardingError(ex);
+	}
+	catch (...) {
+		return FORWARDING_UNKNOWN_ERROR;
+	}
+}
+void forwarding_snapshot_delete(forwarding_snapshot snapshot) {
+	delete reinterpret_cast<forwarding::EntrySnapshot*>(snapshot);
+}
+forwarding_error forwarding_snapshot_entries(forwarding_snapshot snapshot, forwarding_snapshot_entry* entries, uint32_t capacity, uint32_t* count) {
+	auto recorded = reinterpret_cast<forwarding::EntrySnapshot*>(snapshot)->Entries();
+	*count = static_cast<uint32_t>(recorded.size());
+	if (recorded.size() > capacity) {
+		return FORWARDING_BUFFER_TOO_SMALL;
+	}
+	for (std::size_t i = 0; i < recorded.size(); ++i) {
+		auto& entry = recorded[i];
+		entries[i].udp = entry.protocol == forwarding::SnapshotProtocol::Udp ? 1 : 0;
+		entries[i].localPort = entry.localPort;
+		entries[i].count = entry.count;
+		entries[i].remotePort = entry.remotePort;
+		auto length = std::min<std::size_t>(entry.remoteAddress.size(), sizeof(entries[i].remoteAddress) - 1);
+		memcpy(entries[i].remoteAddress, entry.remoteAddress.data(), length);
+		entries[i].remoteAddress[length] = 0;
+	}
+	return FORWARDING_OK;
+}
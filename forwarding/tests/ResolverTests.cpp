@@ -0,0 +1,137 @@
+#include "harness.h"
+#include "Resolver.h"
+#include <atomic>
+#include <thread>
+// the name cache of the forwarders over an overridden resolver, with the ttls running on the virtual clock of a simulation
+
+using namespace forwarding;
+using namespace forwarding::tests;
+using namespace std::chrono;
+
+namespace {
+	// what the overridden resolver answers. Shared with the resolver threads, which can still be running a refresh when a
+	// test ends
+	struct FakeDns {
+		std::atomic<int> calls{ 0 };
+		std::atomic<bool> failing{ false };
+		// refreshes wait for it, so that tests can look at a name while it is being refreshed
+		std::atomic<bool> released{ true };
+		std::atomic<const char*> address{ "10.0.0.1" };
+		std::chrono::seconds ttl{ 10 };
+	};
+
+	class ResolverOverride {
+	public:
+		explicit ResolverOverride(std::shared_ptr<FakeDns> dns) {
+			overrideResolver([dns](const char*, int, seconds& ttl) {
+				++dns->calls;
+				WaitUntil([&dns]() {return dns->released.load(); });
+				if (dns->failing) {
+					throw TransportErrorException{ TransportError::NameResolutionFailed };
+				}
+				ttl = dns->ttl;
+				return Resolve(dns->address, 0);
+			});
+		}
+		ResolverOverride(const ResolverOverride&) = delete;
+		ResolverOverride& operator =(const ResolverOverride&) = delete;
+		~ResolverOverride() {
+			resetResolver();
+		}
+	};
+
+	std::uint32_t Ipv4(const std::shared_ptr<const ResolvedAddress>& address) {
+		CHECK(address->Family() == AF_INET);
+		return ntohl(reinterpret_cast<const sockaddr_in*>(address->SockAddr())->sin_addr.s_addr);
+	}
+
+	const std::uint32_t FirstAddress = 0x0a000001;
+	const std::uint32_t SecondAddress = 0x0a000002;
+}
+
+FORWARDING_TEST(ResolverCachesNames)
+{
+	auto dns = std::make_shared<FakeDns>();
+	ResolverOverride resolver(dns);
+	auto name = ResolveName("backend.test", SOCK_STREAM);
+	CHECK(Ipv4(name->Current()) == FirstAddress);
+	CHECK(ResolveName("backend.test", SOCK_STREAM) == name);
+	CHECK(dns->calls == 1);
+	// the cache is per socket type
+	auto udpName = ResolveName("backend.test", SOCK_DGRAM);
+	CHECK(udpName != name);
+	CHECK(dns->calls == 2);
+	// numeric addresses never reach the resolver
+	CHECK(Ipv4(ResolveName("10.0.0.3", SOCK_STREAM)->Current()) == 0x0a000003);
+	CHECK(dns->calls == 2);
+}
+
+FORWARDING_TEST(ResolverRefreshesExpiredNamesInTheBackground)
+{
+	Simulation simulation;
+	auto dns = std::make_shared<FakeDns>();
+	ResolverOverride resolver(dns);
+	auto name = ResolveName("backend.test", SOCK_STREAM);
+	dns->address = "10.0.0.2";
+
+	simulation.Network().Advance(seconds(9));
+	CHECK(Ipv4(name->Current()) == FirstAddress);
+	CHECK(dns->calls == 1);
+
+	// past the ttl, the previous address is served until the refresh completes
+	dns->released = false;
+	simulation.Network().Advance(seconds(2));
+	CHECK(Ipv4(name->Current()) == FirstAddress);
+	CHECK(WaitUntil([&]() {return dns->calls == 2; }));
+	CHECK(Ipv4(name->Current()) == FirstAddress);
+	CHECK(dns->calls == 2);
+	dns->released = true;
+	CHECK(WaitUntil([&]() {return Ipv4(name->Current()) == SecondAddress; }));
+	CHECK(dns->calls == 2);
+}
+
+FORWARDING_TEST(ResolverRetriesFailedRefreshes)
+{
+	Simulation simulation;
+	auto dns = std::make_shared<FakeDns>();
+	ResolverOverride resolver(dns);
+	auto name = ResolveName("backend.test", SOCK_STREAM);
+
+	dns->failing = true;
+	simulation.Network().Advance(seconds(11));
+	name->Current();
+	CHECK(WaitUntil([&]() {return dns->calls == 2; }));
+	// the failure keeps the previous address, and the next attempt waits for the retry delay
+	std::this_thread::sleep_for(milliseconds(50));
+	CHECK(Ipv4(name->Current()) == FirstAddress);
+	simulation.Network().Advance(seconds(4));
+	CHECK(Ipv4(name->Current()) == FirstAddress);
+	std::this_thread::sleep_for(milliseconds(50));
+	CHECK(dns->calls == 2);
+
+	dns->failing = false;
+	dns->address = "10.0.0.2";
+	simulation.Network().Advance(seconds(1));
+	name->Current();
+	CHECK(WaitUntil([&]() {return Ipv4(name->Current()) == SecondAddress; }));
+	CHECK(dns->calls == 3);
+}
+
+FORWARDING_TEST(ResolverReportsFirstResolutionFailures)
+{
+	auto dns = std::make_shared<FakeDns>();
+	dns->failing = true;
+	ResolverOverride resolver(dns);
+	auto error = TransportError::InvalidSocket;
+	try {
+		ResolveName("backend.test", SOCK_STREAM);
+	}
+	catch (const TransportErrorException& ex) {
+		error = ex.Error;
+	}
+	CHECK(error == TransportError::NameResolutionFailed);
+	// nothing is cached for a failed name, the next entry tries again
+	dns->failing = false;
+	CHECK(Ipv4(ResolveName("backend.test", SOCK_STREAM)->Current()) == FirstAddress);
+	CHECK(dns->calls == 2);
+}
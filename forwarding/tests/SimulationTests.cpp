@@ -0,0 +1,252 @@
+#include "harness.h"
+#include "Tuning.h"
+#include <async.h>
+#include <client.h>
+#include <atomic>
+#include <thread>
+// the forwarders over a SimulatedNetwork: the data path against partial sends, small buffers and a clock that only moves
+// when the test says so
+
+using namespace forwarding;
+using namespace forwarding::tests;
+using namespace std::chrono;
+
+namespace {
+	// sends the rest of payload while the upstream drains, until it received all of it
+	std::string Transfer(SOCKET client, SOCKET upstream, const std::string& payload, std::size_t& sent) {
+		std::string received;
+		CHECK(WaitUntil([&]() {
+			sent += SendSome(client, payload.data() + sent, payload.size() - sent);
+			ReceiveSome(upstream, received);
+			return received.size() >= payload.size();
+		}));
+		return received;
+	}
+
+	// the state of the forwarders is only read from the test thread: give their loop a moment to act on what the test
+	// expects to change nothing
+	void Settle() {
+		std::this_thread::sleep_for(milliseconds(50));
+	}
+
+	bool FailsToBind(const std::function<void()>& add) {
+		try {
+			add();
+		}
+		catch (const TransportErrorException& ex) {
+			return ex.Error == TransportError::BindFailed;
+		}
+		return false;
+	}
+}
+
+FORWARDING_TEST(TcpForwardsThroughPartialSends)
+{
+	Simulation simulation;
+	simulation.Network().SetMaxWriteSize(7);
+	Runtime runtime(1);
+	TcpForwarder forwarder(runtime);
+	SafeSocket server(ListenOn(9001));
+	forwarder.AddEntry(8001, 9001, "127.0.0.1");
+	forwarder.Start();
+
+	SafeSocket client(ConnectTo(8001));
+	SafeSocket upstream(AcceptFrom(server.Get()));
+	auto request = Pattern(32 * 1024);
+	std::size_t sent = 0;
+	CHECK(Transfer(client.Get(), upstream.Get(), request, sent) == request);
+
+	auto reply = Pattern(20000);
+	sent = 0;
+	CHECK(Transfer(upstream.Get(), client.Get(), reply, sent) == reply);
+}
+
+FORWARDING_TEST(RangeEntriesAddedAgainMustMatch)
+{
+	Simulation simulation;
+	Runtime runtime(1);
+	TcpForwarder tcp(runtime);
+	UdpForwarder udp(runtime);
+	SafeSocket server(ListenOn(9011));
+	tcp.AddRangeEntry(8010, 4, 9010, "127.0.0.1");
+	udp.AddRangeEntry(8010, 4, 9010, "127.0.0.1");
+	tcp.Start();
+
+	// the same range again changes nothing, another count or remote at the same start is refused
+	tcp.AddRangeEntry(8010, 4, 9010, "127.0.0.1");
+	udp.AddRangeEntry(8010, 4, 9010, "127.0.0.1");
+	CHECK(FailsToBind([&]() {tcp.AddRangeEntry(8010, 6, 9010, "127.0.0.1"); }));
+	CHECK(FailsToBind([&]() {tcp.AddRangeEntry(8010, 4, 9020, "127.0.0.1"); }));
+	CHECK(FailsToBind([&]() {tcp.AddRangeEntry(8010, 4, 9010, "127.0.0.2"); }));
+	CHECK(FailsToBind([&]() {udp.AddRangeEntry(8010, 2, 9010, "127.0.0.1"); }));
+	CHECK(FailsToBind([&]() {udp.AddRangeEntry(8010, 4, 9020, "127.0.0.1"); }));
+
+	// the range still forwards where it was first added to
+	SafeSocket client(ConnectTo(8011));
+	SafeSocket upstream(AcceptFrom(server.Get()));
+	std::size_t sent = 0;
+	CHECK(Transfer(client.Get(), upstream.Get(), "ping", sent) == "ping");
+}
+
+FORWARDING_TEST(TcpCollectsClosedPairs)
+{
+	Simulation simulation;
+	Runtime runtime(1);
+	TcpForwarder forwarder(runtime);
+	SafeSocket server(ListenOn(9002));
+	forwarder.AddEntry(8002, 9002, "127.0.0.1");
+	forwarder.Start();
+	auto idleSockets = simulation.Network().SocketCount();
+	{
+		SafeSocket client(ConnectTo(8002));
+		SafeSocket upstream(AcceptFrom(server.Get()));
+		auto request = Pattern(1000);
+		std::size_t sent = 0;
+		CHECK(Transfer(client.Get(), upstream.Get(), request, sent) == request);
+		CHECK(forwarder.ActiveConnections() == 1);
+
+		// the close of the client is forwarded, and the pair collected once the upstream closed too
+		client.Close();
+		std::string rest;
+		CHECK(WaitUntil([&]() {return !ReceiveSome(upstream.Get(), rest); }));
+		CHECK(rest.empty());
+		upstream.Close();
+		CHECK(WaitUntil([&]() {return forwarder.ActiveConnections() == 0; }));
+	}
+	CHECK(WaitUntil([&]() {return simulation.Network().SocketCount() == idleSockets; }));
+	TcpEntryStats stats;
+	CHECK(forwarder.GetEntryStats(8002, stats));
+	CHECK(stats.acceptedConnections == 1);
+	CHECK(stats.activeConnections == 0);
+	CHECK(stats.queuedBytes == 0);
+}
+
+FORWARDING_TEST(TcpPausesReadingAtQueueThreshold)
+{
+	const std::size_t bufferSize = 16 * 1024;
+	Simulation simulation;
+	simulation.Network().SetReceiveBufferSize(bufferSize);
+	Runtime runtime(1);
+	TcpForwarder forwarder(runtime);
+	SafeSocket server(ListenOn(9003));
+	forwarder.AddEntry(8003, 9003, "127.0.0.1");
+	forwarder.Start();
+
+	SafeSocket client(ConnectTo(8003));
+	SafeSocket upstream(AcceptFrom(server.Get()));
+	auto request = Pattern(256 * 1024);
+	std::size_t sent = 0;
+	// the upstream does not read: once its buffer is full the forwarder queues up to the threshold, then stops reading the
+	// client, whose sends block when the buffer of the forwarder side is full
+	int stalls = 0;
+	CHECK(WaitUntil([&]() {
+		auto more = SendSome(client.Get(), request.data() + sent, request.size() - sent);
+		sent += more;
+		stalls = more == 0 ? stalls + 1 : 0;
+		return stalls >= 50;
+	}));
+	CHECK(sent < request.size());
+	CHECK(sent <= bufferSize + DefaultQueueThreshold + bufferSize);
+	TcpEntryStats stats;
+	CHECK(forwarder.GetEntryStats(8003, stats));
+	CHECK(stats.queuedBytes > 0);
+	CHECK(stats.queuedBytes <= DefaultQueueThreshold);
+	Settle();
+	CHECK(0 == SendSome(client.Get(), request.data() + sent, request.size() - sent));
+
+	// reading resumes as the upstream drains the queue
+	CHECK(Transfer(client.Get(), upstream.Get(), request, sent) == request);
+	CHECK(WaitUntil([&]() {return forwarder.GetEntryStats(8003, stats) && stats.queuedBytes == 0; }));
+}
+
+FORWARDING_TEST(TcpIdleTimeoutRunsOnTheVirtualClock)
+{
+	Simulation simulation;
+	Runtime runtime(1);
+	TcpForwarder forwarder(runtime);
+	SafeSocket server(ListenOn(9004));
+	forwarder.AddEntry(8004, 9004, "127.0.0.1");
+	TcpEntryLimits limits;
+	limits.idleTimeoutMs = 1000;
+	CHECK(forwarder.SetEntryLimits(8004, limits));
+	forwarder.Start();
+
+	SafeSocket client(ConnectTo(8004));
+	SafeSocket upstream(AcceptFrom(server.Get()));
+	auto request = Pattern(100);
+	std::size_t sent = 0;
+	CHECK(Transfer(client.Get(), upstream.Get(), request, sent) == request);
+
+	simulation.Network().Advance(milliseconds(500));
+	Settle();
+	CHECK(forwarder.ActiveConnections() == 1);
+	simulation.Network().Advance(milliseconds(1000));
+	CHECK(WaitUntil([&]() {return forwarder.ActiveConnections() == 0; }));
+	TcpEntryStats stats;
+	CHECK(forwarder.GetEntryStats(8004, stats));
+	CHECK(stats.idleTimeoutTrips == 1);
+}
+
+FORWARDING_TEST(UdpFlowsExpireOnTheVirtualClock)
+{
+	Simulation simulation;
+	Runtime runtime(1);
+	UdpForwarder forwarder(runtime);
+	SafeSocket server(BindUdp(9005));
+	forwarder.AddEntry(8005, 9005, "127.0.0.1");
+	forwarder.Start();
+	auto idleSockets = simulation.Network().SocketCount();
+
+	SafeSocket client(BindUdp(7005));
+	sockaddr_in target;
+	ZeroMemory(&target, sizeof(target));
+	target.sin_family = AF_INET;
+	target.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	target.sin_port = htons(8005);
+	char datagram[] = "ping";
+	CHECK(sizeof(datagram) == socketApi().SendTo(client.Get(), datagram, sizeof(datagram), reinterpret_cast<const sockaddr*>(&target), sizeof(target)));
+	char received[64];
+	CHECK(WaitUntil([&]() {return sizeof(datagram) == socketApi().RecvFrom(server.Get(), received, sizeof(received), nullptr, nullptr); }));
+	UdpEntryStats stats;
+	CHECK(forwarder.GetEntryStats(8005, stats));
+	CHECK(stats.flows == 1);
+
+	// flows expire after 30s without traffic
+	simulation.Network().Advance(seconds(10));
+	Settle();
+	CHECK(forwarder.GetEntryStats(8005, stats));
+	CHECK(stats.flows == 1);
+	simulation.Network().Advance(seconds(25));
+	CHECK(WaitUntil([&]() {return forwarder.GetEntryStats(8005, stats) && stats.flows == 0; }));
+	// the client socket and nothing left of the flow
+	CHECK(WaitUntil([&]() {return simulation.Network().SocketCount() == idleSockets + 1; }));
+}
+
+FORWARDING_TEST(ConnectTimeoutRunsOnTheVirtualClock)
+{
+	Simulation simulation;
+	simulation.Network().SetConnectDelay(seconds(5));
+	Runtime runtime(1);
+	EventLoop loop(runtime);
+	loop.Start();
+	SafeSocket server(ListenOn(9006));
+	auto address = Resolve("127.0.0.1", 9006);
+
+	std::atomic<int> result{ 0 };
+	Spawn(loop, [](EventLoop& loop, const ResolvedAddress& address, std::atomic<int>& result) -> Task<void> {
+		try {
+			co_await ConnectToAsync(loop, address, milliseconds(1000));
+			result = 1;
+		}
+		catch (const TransportErrorException& ex) {
+			result = ex.Error == TransportError::ConnectFailed ? 2 : 3;
+		}
+	}(loop, *address, result));
+
+	Settle();
+	CHECK(result == 0);
+	simulation.Network().Advance(seconds(2));
+	CHECK(WaitUntil([&]() {return result != 0; }));
+	CHECK(result == 2);
+	loop.Stop();
+}
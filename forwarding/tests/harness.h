@@ -0,0 +1,65 @@
+#pragma once
+#include <simulation.h>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+// a test is a function registered with FORWARDING_TEST, failing by throwing from CHECK. main runs them all, or the ones
+// whose name is given on the command line
+namespace forwarding {
+	namespace tests {
+		struct TestCase {
+			const char* name;
+			std::function<void()> run;
+		};
+		std::vector<TestCase>& registry();
+
+		struct Registration {
+			Registration(const char* name, std::function<void()> run) {
+				registry().push_back(TestCase{ name, std::move(run) });
+			}
+		};
+
+		struct CheckFailed {
+			std::string message;
+		};
+		void Check(bool condition, const char* expression, const char* file, int line);
+
+		// polls condition, as the forwarders run on the threads of their runtime
+		bool WaitUntil(const std::function<bool()>& condition, std::chrono::milliseconds timeout = std::chrono::seconds(5));
+
+		// installs a SimulatedNetwork as the socket api and its virtual clock as the clock for the duration of a test
+		class Simulation {
+		private:
+			std::shared_ptr<SimulatedNetwork> _network;
+		public:
+			Simulation();
+			Simulation(const Simulation&) = delete;
+			Simulation& operator =(const Simulation&) = delete;
+			~Simulation();
+			SimulatedNetwork& Network() {
+				return *_network;
+			}
+		};
+
+		// simulated sockets on 127.0.0.1, for SafeSocket to close
+		SOCKET ListenOn(std::uint16_t port);
+		// the connect completes asynchronously, through the forwarder when port is forwarded
+		SOCKET ConnectTo(std::uint16_t port);
+		SOCKET AcceptFrom(SOCKET listener);
+		SOCKET BindUdp(std::uint16_t port);
+		// sends what the socket takes, returning the bytes sent
+		std::size_t SendSome(SOCKET s, const char* data, std::size_t size);
+		// appends what is available to received, returning false once the peer closed
+		bool ReceiveSome(SOCKET s, std::string& received);
+		std::string Pattern(std::size_t size);
+	}
+}
+
+#define FORWARDING_TEST(name) \
+	static void name(); \
+	static forwarding::tests::Registration name##Registration(#name, name); \
+	static void name()
+
+#define CHECK(condition) forwarding::tests::Check((condition), #condition, __FILE__, __LINE__)
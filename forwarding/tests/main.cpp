@@ -0,0 +1,163 @@
+#include "harness.h"
+#include "compat.h"
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+#include <thread>
+
+using namespace forwarding;
+using namespace forwarding::tests;
+using namespace std::chrono;
+
+std::vector<TestCase>& forwarding::tests::registry()
+{
+	static std::vector<TestCase> tests;
+	return tests;
+}
+
+void forwarding::tests::Check(bool condition, const char* expression, const char* file, int line)
+{
+	if (!condition) {
+		std::ostringstream message;
+		message << file << "(" << line << "): " << expression;
+		throw CheckFailed{ message.str() };
+	}
+}
+
+bool forwarding::tests::WaitUntil(const std::function<bool()>& condition, milliseconds timeout)
+{
+	auto until = steady_clock::now() + timeout;
+	while (!condition()) {
+		if (steady_clock::now() >= until) {
+			return false;
+		}
+		std::this_thread::sleep_for(milliseconds(1));
+	}
+	return true;
+}
+
+forwarding::tests::Simulation::Simulation() : _network(std::make_shared<SimulatedNetwork>())
+{
+	overrideSocketApi(_network);
+	overrideClock(_network->VirtualClock());
+}
+
+forwarding::tests::Simulation::~Simulation()
+{
+	resetClock();
+	resetSocketApi();
+}
+
+namespace {
+	sockaddr_in Loopback(std::uint16_t port) {
+		sockaddr_in address;
+		ZeroMemory(&address, sizeof(address));
+		address.sin_family = AF_INET;
+		address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		address.sin_port = htons(port);
+		return address;
+	}
+}
+
+SOCKET forwarding::tests::ListenOn(std::uint16_t port)
+{
+	auto s = socketApi().Socket(AF_INET, SOCK_STREAM, 0);
+	auto address = Loopback(port);
+	CHECK(0 == socketApi().Bind(s, reinterpret_cast<const sockaddr*>(&address), sizeof(address)));
+	CHECK(0 == socketApi().Listen(s, SOMAXCONN));
+	return s;
+}
+
+SOCKET forwarding::tests::ConnectTo(std::uint16_t port)
+{
+	auto s = socketApi().Socket(AF_INET, SOCK_STREAM, 0);
+	auto address = Loopback(port);
+	auto result = socketApi().Connect(s, reinterpret_cast<const sockaddr*>(&address), sizeof(address));
+	CHECK(result == 0 || WSAGetLastError() == WSAEWOULDBLOCK);
+	return s;
+}
+
+SOCKET forwarding::tests::AcceptFrom(SOCKET listener)
+{
+	auto accepted = INVALID_SOCKET;
+	CHECK(WaitUntil([&]() {
+		accepted = socketApi().Accept(listener, nullptr, nullptr);
+		return accepted != INVALID_SOCKET;
+	}));
+	return accepted;
+}
+
+SOCKET forwarding::tests::BindUdp(std::uint16_t port)
+{
+	auto s = socketApi().Socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+	auto address = Loopback(port);
+	CHECK(0 == socketApi().Bind(s, reinterpret_cast<const sockaddr*>(&address), sizeof(address)));
+	return s;
+}
+
+std::size_t forwarding::tests::SendSome(SOCKET s, const char* data, std::size_t size)
+{
+	std::size_t sent = 0;
+	while (sent < size) {
+		auto written = socketApi().Send(s, data + sent, static_cast<int>(size - sent));
+		if (written <= 0) {
+			CHECK(WSAGetLastError() == WSAEWOULDBLOCK);
+			break;
+		}
+		sent += written;
+	}
+	return sent;
+}
+
+bool forwarding::tests::ReceiveSome(SOCKET s, std::string& received)
+{
+	char buffer[4096];
+	for (;;) {
+		auto read = socketApi().Recv(s, buffer, sizeof(buffer));
+		if (read == 0) {
+			return false;
+		}
+		if (read < 0) {
+			CHECK(WSAGetLastError() == WSAEWOULDBLOCK);
+			return true;
+		}
+		received.append(buffer, read);
+	}
+}
+
+std::string forwarding::tests::Pattern(std::size_t size)
+{
+	std::string pattern(size, '\0');
+	for (std::size_t i = 0; i < size; ++i) {
+		pattern[i] = static_cast<char>('a' + (i * 7 + i / 251) % 26);
+	}
+	return pattern;
+}
+
+int main(int argc, char** argv)
+{
+	init_transport();
+	int failed = 0;
+	int run = 0;
+	for (auto& test : registry()) {
+		if (argc > 1 && std::none_of(argv + 1, argv + argc, [&test](const char* name) {return 0 == strcmp(name, test.name); })) {
+			continue;
+		}
+		++run;
+		try {
+			test.run();
+			std::cout << "PASS " << test.name << std::endl;
+		}
+		catch (const CheckFailed& failure) {
+			++failed;
+			std::cout << "FAIL " << test.name << ": " << failure.message << std::endl;
+		}
+		catch (const TransportErrorException& ex) {
+			++failed;
+			std::cout << "FAIL " << test.name << ": transport error " << static_cast<int>(ex.Error) << std::endl;
+		}
+	}
+	std::cout << run - failed << "/" << run << " passed" << std::endl;
+	return failed == 0 ? 0 : 1;
+}
@@ -0,0 +1,216 @@
+package main
+
+import (
+	"encoding/json"
+	"errors"
+	"fmt"
+	"net"
+	"os"
+	"time"
+
+	"github.com/Microsoft/go-winio"
+)
+
+// a new instance connects to the running one through this pipe to take its listening and udp sockets over, so that
+// restarting the forwarder does not refuse connections or drop datagrams
+const handoffPipe = `\\.\pipe\localhost-forwarder-handoff`
+
+// only administrators and the system account can take the sockets over
+const handoffPipeSecurity = "D:P(A;;GA;;;BA)(A;;GA;;;SY)"
+
+// WSAPROTOCOL_INFOW, the per socket size of the blob returned by duplicateEntry
+const protocolInfoSize = 628
+
+// how long the previous instance waits for its connections to end before exiting anyway
+const drainTimeout = 2 * time.Minute
+
+type handoffRequest struct {
+	ProcessID uint32
+}
+
+type handoffEntry struct {
+	LocalPort     uint16
+	RemotePort    uint32
+	RemoteAddress string
+	Count         uint16
+	Sockets       []byte
+}
+
+// single ports are ranges of 1, which an instance that restored them from a snapshot may have sent as 0
+func (he *handoffEntry) entry() forwardEntry {
+	e := forwardEntry{localPort: he.LocalPort, remotePort: he.RemotePort, remoteAddress: he.RemoteAddress, count: he.Count}
+	if e.count < 1 {
+		e.count = 1
+	}
+	return e
+}
+
+type handoffState struct {
+	TCP []handoffEntry
+	UDP []handoffEntry
+}
+
+type handoffAck struct {
+	Adopted bool
+}
+
+// serveHandoff sends the connections of new instances on handoffs. The pipe name is only free once the previous instance has
+// handed its sockets over to us, so listening is retried until then
+func serveHandoff(handoffs chan<- net.Conn) {
+	var l net.Listener
+	for {
+		var err error
+		l, err = winio.ListenPipe(handoffPipe, &winio.PipeConfig{SecurityDescriptor: handoffPipeSecurity})
+		if err == nil {
+			break
+		}
+		time.Sleep(time.Second)
+	}
+	for {
+		conn, err := l.Accept()
+		if err != nil {
+			fmt.Fprintf(os.Stderr, "Handoff pipe failed: %s\n", err.Error())
+			return
+		}
+		handoffs <- conn
+	}
+}
+
+func duplicateEntry(duplicate func(uintptr, uint16, uint32, *byte, uint32, *uint32) error, native uintptr, e forwardEntry, processID uint32) ([]byte, error) {
+	count := int(e.count)
+	if count < 1 {
+		// the native side reports the size it needs when the buffer is too small
+		count = 1
+	}
+	buf := make([]byte, protocolInfoSize*count)
+	for {
+		var length uint32
+		err := duplicate(native, e.localPort, processID, &buf[0], uint32(len(buf)), &length)
+		if length > uint32(len(buf)) {
+			buf = make([]byte, length)
+			continue
+		}
+		if err != nil {
+			return nil, err
+		}
+		return buf[:length], nil
+	}
+}
+
+func handoffEntries(entries map[forwardEntry]struct{}, duplicate func(uintptr, uint16, uint32, *byte, uint32, *uint32) error, native uintptr, processID uint32) ([]handoffEntry, error) {
+	var result []handoffEntry
+	for e := range entries {
+		sockets, err := duplicateEntry(duplicate, native, e, processID)
+		if err != nil {
+			return nil, fmt.Errorf("can't duplicate %v: %s", e, err.Error())
+		}
+		result = append(result, handoffEntry{
+			LocalPort:     e.localPort,
+			RemotePort:    e.remotePort,
+			RemoteAddress: e.remoteAddress,
+			Count:         e.count,
+			Sockets:       sockets,
+		})
+	}
+	return result, nil
+}
+
+// handOff gives every entry to the new instance on conn. Once it acknowledged them, the entries stop accepting here and only the
+// established connections are left to drain
+func (f *forwarder) handOff(conn net.Conn) error {
+	defer conn.Close()
+	if f.closed {
+		return errors.New("forwarder is closed")
+	}
+	var req handoffRequest
+	dec := json.NewDecoder(conn)
+	enc := json.NewEncoder(conn)
+	if err := dec.Decode(&req); err != nil {
+		return err
+	}
+	var state handoffState
+	var err error
+	if state.TCP, err = handoffEntries(f.tcpEntries, forwarding_tcp_duplicateEntry, f.nativeTCP, req.ProcessID); err != nil {
+		return err
+	}
+	if state.UDP, err = handoffEntries(f.udpEntries, forwarding_udp_duplicateEntry, f.nativeUDP, req.ProcessID); err != nil {
+		return err
+	}
+	if err = enc.Encode(state); err != nil {
+		return err
+	}
+	var ack handoffAck
+	if err = dec.Decode(&ack); err != nil {
+		return err
+	}
+	if !ack.Adopted {
+		return errors.New("the new instance did not adopt the sockets")
+	}
+	for e := range f.tcpEntries {
+		forwarding_tcp_releaseEntry(f.nativeTCP, e.localPort)
+		delete(f.tcpEntries, e)
+	}
+	for e := range f.udpEntries {
+		forwarding_udp_releaseEntry(f.nativeUDP, e.localPort)
+		delete(f.udpEntries, e)
+	}
+	fmt.Printf("Handed %v tcp and %v udp entries over to process %v\n", len(state.TCP), len(state.UDP), req.ProcessID)
+	return nil
+}
+
+// drain waits for the connections left after a handoff to end
+func (f *forwarder) drain(timeout time.Duration) {
+	deadline := time.Now().Add(timeout)
+	for {
+		active := forwarding_tcp_activeConnections(f.nativeTCP)
+		if active == 0 {
+			return
+		}
+		if time.Now().After(deadline) {
+			fmt.Fprintf(os.Stderr, "Exiting with %v connections left\n", active)
+			return
+		}
+		time.Sleep(time.Second)
+	}
+}
+
+// adoptFromPrevious takes the entries of the running instance over, if any. Entries the next reconciliation would not keep are
+// removed by it like any other
+func (f *forwarder) adoptFromPrevious() error {
+	timeout := time.Second
+	conn, err := winio.DialPipe(handoffPipe, &timeout)
+	if err != nil {
+		// no previous instance
+		return nil
+	}
+	defer conn.Close()
+	dec := json.NewDecoder(conn)
+	enc := json.NewEncoder(conn)
+	if err = enc.Encode(handoffRequest{ProcessID: uint32(os.Getpid())}); err != nil {
+		return err
+	}
+	var state handoffState
+	if err = dec.Decode(&state); err != nil {
+		return err
+	}
+	for _, he := range state.TCP {
+		e := he.entry()
+		if len(he.Sockets) == 0 || forwarding_tcp_adoptRangeEntry(f.nativeTCP, e.localPort, e.count, e.remotePort, e.remoteAddress, &he.Sockets[0], uint32(len(he.Sockets))) != nil {
+			fmt.Fprintf(os.Stderr, "Failed to adopt tcp %v\n", e)
+			continue
+		}
+		f.tcpEntries[e] = struct{}{}
+		fmt.Printf("Adopted tcp %v\n", e)
+	}
+	for _, he := range state.UDP {
+		e := he.entry()
+		if len(he.Sockets) == 0 || forwarding_udp_adoptRangeEntry(f.nativeUDP, e.localPort, e.count, e.remotePort, e.remoteAddress, &he.Sockets[0], uint32(len(he.Sockets))) != nil {
+			fmt.Fprintf(os.Stderr, "Failed to adopt udp %v\n", e)
+			continue
+		}
+		f.udpEntries[e] = struct{}{}
+		fmt.Printf("Adopted udp %v\n", e)
+	}
+	// entries that could not be adopted are added again by the next reconciliation, once the previous instance closed its sockets
+	return enc.Encode(handoffAck{Adopted: true})
+}
@@ -1,12 +1,9 @@
 package main
 
 import (
-	"context"
 	"fmt"
+	"net"
 	"os"
-	"time"
-
-	"github.com/docker/docker/api/types"
 )
 
 func main() {
@@ -16,37 +13,35 @@ func main() {
 		fmt.Fprintf(os.Stderr, "Can't create reconciler: %s\n", err.Error())
 		return
 	}
+	if err = f.adoptFromPrevious(); err != nil {
+		fmt.Fprintf(os.Stderr, "Can't take over the previous instance: %s\n", err.Error())
+	}
+	// after adoption, which the restored entries must not overlap
+	if err = f.restoreSnapshot(snapshotPath()); err != nil {
+		fmt.Fprintf(os.Stderr, "Can't restore the forwarding table: %s\n", err.Error())
+	}
+	handoffs := make(chan net.Conn)
+	go serveHandoff(handoffs)
+	go r.watch()
 
-	ch := make(chan struct{})
-	go func() {
-		for {
-			ch <- struct{}{}
-			time.Sleep(20 * time.Second)
-		}
-	}()
-	go func() {
-		for {
-			evs, errs := r.docker.Events(context.Background(), types.EventsOptions{})
-			for {
-				select {
-				case <-errs:
-					break // re-launch event loop
-				case msg := <-evs:
-					if msg.Type == "container" &&
-						(msg.Action == "kill" || msg.Action == "pause" || msg.Action == "restart" || msg.Action == "start" || msg.Action == "stop" || msg.Action == "unpause" || msg.Action == "update") {
-						ch <- struct{}{}
-					}
-				}
-			}
-		}
-	}()
 	for {
-		<-ch
-		err = r.reconcile()
+		// the forwarder is only used by one goroutine at a time: reconciliation stops while a handoff is served
+		stop := make(chan struct{})
+		stopped := make(chan struct{})
+		go func() {
+			r.run(stop)
+			close(stopped)
+		}()
+		conn := <-handoffs
+		close(stop)
+		<-stopped
+		err = f.handOff(conn)
 		if err != nil {
-			fmt.Fprintf(os.Stderr, "Reconciliation failed: %s\n", err.Error())
-		} else {
-			fmt.Printf("Reconciliation succeeded\n")
+			fmt.Fprintf(os.Stderr, "Handoff failed: %s\n", err.Error())
+			continue
 		}
+		f.drain(drainTimeout)
+		f.Close()
+		return
 	}
 }
@@ -2,14 +2,57 @@ package main
 
 import (
 	"context"
+	"fmt"
+	"os"
+	"strconv"
+	"time"
 
 	"github.com/docker/docker/api/types"
+	"github.com/docker/docker/api/types/events"
 	"github.com/docker/docker/client"
+	"github.com/docker/go-connections/nat"
 )
 
+// containers are inspected as their events come in; listing them all is only a consistency check for missed events
+const fullCheckInterval = 5 * time.Minute
+
+// concurrent container inspections
+const inspectWorkers = 8
+
+// the ports a container publishes, as single port entries
+type containerPorts struct {
+	tcp []forwardEntry
+	udp []forwardEntry
+}
+
+type inspectResult struct {
+	id string
+	// nil when the container is gone or stopped
+	ports *containerPorts
+	err   error
+}
+
+// containerEvent is either a container to inspect again, or a container known to be gone. An empty id asks for a full check
+type containerEvent struct {
+	id   string
+	gone bool
+}
+
+// reconciler keeps the forwarder entries in sync with the published ports of the running containers. Its state is only
+// touched from the goroutine running its loop; inspections run concurrently and report back to it
 type reconciler struct {
-	docker client.APIClient
-	f      *forwarder
+	docker     client.APIClient
+	f          *forwarder
+	containers map[string]containerPorts
+	// containers being inspected, true when another inspection was asked for meanwhile
+	inflight map[string]bool
+	// entries are left alone until the containers of a first successful listing are all inspected, so that the entries
+	// adopted from a previous instance are not removed in the meantime
+	listed  bool
+	synced  bool
+	events  chan containerEvent
+	results chan inspectResult
+	slots   chan struct{}
 }
 
 func newReconciler(f *forwarder) (*reconciler, error) {
@@ -21,50 +64,225 @@ func newReconciler(f *forwarder) (*reconciler, error) {
 	if err != nil {
 		return nil, err
 	}
-	return &reconciler{docker: c, f: f}, nil
+	return &reconciler{
+		docker:     c,
+		f:          f,
+		containers: make(map[string]containerPorts),
+		inflight:   make(map[string]bool),
+		events:     make(chan containerEvent),
+		results:    make(chan inspectResult),
+		slots:      make(chan struct{}, inspectWorkers),
+	}, nil
+}
+
+// watch sends the container events that can change published ports to run. The stream is reopened when it fails, with a full
+// check to catch up with the events missed meanwhile
+func (r *reconciler) watch() {
+	for {
+		ctx, cancel := context.WithCancel(context.Background())
+		evs, errs := r.docker.Events(ctx, types.EventsOptions{})
+	stream:
+		for {
+			select {
+			case err := <-errs:
+				fmt.Fprintf(os.Stderr, "Event stream failed: %s\n", err.Error())
+				break stream
+			case msg := <-evs:
+				if ev, ok := toContainerEvent(msg); ok {
+					r.events <- ev
+				}
+			}
+		}
+		cancel()
+		time.Sleep(time.Second)
+		r.events <- containerEvent{}
+	}
+}
+
+func toContainerEvent(msg events.Message) (containerEvent, bool) {
+	switch msg.Type {
+	case "container":
+		switch msg.Action {
+		case "die", "stop", "destroy":
+			return containerEvent{id: msg.Actor.ID, gone: true}, true
+		case "kill", "pause", "restart", "start", "unpause", "update":
+			return containerEvent{id: msg.Actor.ID}, true
+		}
+	case "network":
+		// the address of a container changes with the networks it is connected to
+		if id := msg.Actor.Attributes["container"]; id != "" && (msg.Action == "connect" || msg.Action == "disconnect") {
+			return containerEvent{id: id}, true
+		}
+	}
+	return containerEvent{}, false
+}
+
+func (r *reconciler) onEvent(ev containerEvent) {
+	switch {
+	case ev.id == "":
+		r.fullCheck()
+	case ev.gone:
+		if _, ok := r.inflight[ev.id]; ok {
+			// the running inspection may predate the event: have it done again
+			r.inflight[ev.id] = true
+		}
+		r.forget(ev.id)
+	default:
+		r.schedule(ev.id)
+	}
+}
+
+// schedule inspects a container in the background. Events for a container being inspected are coalesced into a single
+// inspection run after the current one
+func (r *reconciler) schedule(id string) {
+	if _, ok := r.inflight[id]; ok {
+		r.inflight[id] = true
+		return
+	}
+	r.inflight[id] = false
+	go func() {
+		r.slots <- struct{}{}
+		ports, err := r.inspect(id)
+		<-r.slots
+		r.results <- inspectResult{id: id, ports: ports, err: err}
+	}()
+}
+
+func (r *reconciler) onInspected(res inspectResult) {
+	again := r.inflight[res.id]
+	delete(r.inflight, res.id)
+	defer r.checkSynced()
+	if again {
+		// the result may already be stale
+		r.schedule(res.id)
+		return
+	}
+	if res.err != nil {
+		fmt.Fprintf(os.Stderr, "Can't inspect container %s: %s\n", res.id, res.err.Error())
+		return
+	}
+	if res.ports == nil {
+		r.forget(res.id)
+		return
+	}
+	r.containers[res.id] = *res.ports
+	r.apply()
 }
 
-func (r *reconciler) reconcile() error {
-	tcpEntries := make(map[forwardEntry]struct{})
-	udpEntries := make(map[forwardEntry]struct{})
+func (r *reconciler) checkSynced() {
+	if !r.synced && r.listed && len(r.inflight) == 0 {
+		r.synced = true
+		r.apply()
+	}
+}
+
+func (r *reconciler) forget(id string) {
+	if _, ok := r.containers[id]; !ok {
+		return
+	}
+	delete(r.containers, id)
+	r.apply()
+}
+
+func (r *reconciler) apply() {
+	if !r.synced {
+		return
+	}
+	var tcpEntries, udpEntries []forwardEntry
+	for _, c := range r.containers {
+		tcpEntries = append(tcpEntries, c.tcp...)
+		udpEntries = append(udpEntries, c.udp...)
+	}
+	if err := r.f.apply(coalesceRanges(tcpEntries), coalesceRanges(udpEntries)); err != nil {
+		fmt.Fprintf(os.Stderr, "Reconciliation failed: %s\n", err.Error())
+	}
+}
+
+// fullCheck lists the running containers to catch up with missed events: known containers that are gone are forgotten and
+// the others are inspected again
+func (r *reconciler) fullCheck() {
 	containers, err := r.docker.ContainerList(context.Background(), types.ContainerListOptions{})
 	if err != nil {
-		return err
+		fmt.Fprintf(os.Stderr, "Can't list containers: %s\n", err.Error())
+		return
 	}
+	listed := make(map[string]struct{})
 	for _, c := range containers {
 		if len(c.Ports) == 0 {
 			continue
 		}
-		details, err := r.docker.ContainerInspect(context.Background(), c.ID)
-		if err != nil {
-			return err
+		listed[c.ID] = struct{}{}
+		r.schedule(c.ID)
+	}
+	for id := range r.containers {
+		if _, ok := listed[id]; !ok {
+			r.forget(id)
 		}
-		if details.NetworkSettings == nil {
-			continue
+	}
+	r.listed = true
+	r.checkSynced()
+}
+
+func (r *reconciler) inspect(id string) (*containerPorts, error) {
+	details, err := r.docker.ContainerInspect(context.Background(), id)
+	if err != nil {
+		if client.IsErrNotFound(err) {
+			return nil, nil
 		}
-		ip := details.NetworkSettings.IPAddress
-		if ip == "" {
-			for _, n := range details.NetworkSettings.Networks {
-				ip = n.IPAddress
-				if ip != "" {
-					break
-				}
+		return nil, err
+	}
+	if details.ContainerJSONBase == nil || details.State == nil || !details.State.Running || details.NetworkSettings == nil {
+		return nil, nil
+	}
+	ip := details.NetworkSettings.IPAddress
+	if ip == "" {
+		for _, n := range details.NetworkSettings.Networks {
+			ip = n.IPAddress
+			if ip != "" {
+				break
 			}
 		}
-		if ip == "" {
-			continue
-		}
-		for _, p := range c.Ports {
-			if p.PublicPort == 0 {
+	}
+	if ip == "" {
+		return nil, nil
+	}
+	return publishedPorts(details.NetworkSettings.Ports, ip), nil
+}
+
+func publishedPorts(ports nat.PortMap, ip string) *containerPorts {
+	var result containerPorts
+	for port, bindings := range ports {
+		for _, b := range bindings {
+			public, err := strconv.ParseUint(b.HostPort, 10, 16)
+			if err != nil || public == 0 {
 				continue
 			}
-			if p.Type == "tcp" {
-				tcpEntries[forwardEntry{localPort: uint16(p.PublicPort), remotePort: uint32(p.PrivatePort), remoteAddress: ip}] = struct{}{}
-			} else if p.Type == "udp" {
-				udpEntries[forwardEntry{localPort: uint16(p.PublicPort), remotePort: uint32(p.PrivatePort), remoteAddress: ip}] = struct{}{}
+			e := forwardEntry{localPort: uint16(public), remotePort: uint32(port.Int()), remoteAddress: ip}
+			if port.Proto() == "tcp" {
+				result.tcp = append(result.tcp, e)
+			} else if port.Proto() == "udp" {
+				result.udp = append(result.udp, e)
 			}
+		}
+	}
+	return &result
+}
 
+// run applies container changes as they come until stop is closed. Inspections still running then report to the next run
+func (r *reconciler) run(stop <-chan struct{}) {
+	check := time.NewTicker(fullCheckInterval)
+	defer check.Stop()
+	r.fullCheck()
+	for {
+		select {
+		case ev := <-r.events:
+			r.onEvent(ev)
+		case res := <-r.results:
+			r.onInspected(res)
+		case <-check.C:
+			r.fullCheck()
+		case <-stop:
+			return
 		}
 	}
-	return r.f.apply(tcpEntries, udpEntries)
 }
@@ -0,0 +1,89 @@
+package main
+
+import (
+	"fmt"
+	"os"
+	"path/filepath"
+)
+
+// the forwarding table is persisted there, so that a restarted instance forwards right away instead of waiting for docker to
+// list and inspect every container
+func snapshotPath() string {
+	return filepath.Join(os.Getenv("ProgramData"), "localhost-forwarder", "entries.snapshot")
+}
+
+// forwarding_snapshot_entry
+type snapshotEntry struct {
+	udp           int32
+	localPort     uint16
+	count         uint16
+	remotePort    uint32
+	remoteAddress [233]byte
+}
+
+func (se *snapshotEntry) entry() forwardEntry {
+	// single ports are ranges of 1, as coalesceRanges makes them
+	e := forwardEntry{localPort: se.localPort, remotePort: se.remotePort, count: se.count}
+	if e.count < 1 {
+		e.count = 1
+	}
+	for i, b := range se.remoteAddress {
+		if b == 0 {
+			e.remoteAddress = string(se.remoteAddress[:i])
+			break
+		}
+	}
+	return e
+}
+
+func snapshotEntries(snapshot uintptr) ([]snapshotEntry, error) {
+	buf := make([]snapshotEntry, 64)
+	for {
+		var count uint32
+		err := forwarding_snapshot_entries(snapshot, &buf[0], uint32(len(buf)), &count)
+		if count > uint32(len(buf)) {
+			buf = make([]snapshotEntry, count)
+			continue
+		}
+		if err != nil {
+			return nil, err
+		}
+		return buf[:count], nil
+	}
+}
+
+// restoreSnapshot forwards the entries recorded at path by the last instance, except those adopted from a running one, and
+// keeps recording the entries from then on. Entries the next reconciliation would not keep are removed by it like any other
+func (f *forwarder) restoreSnapshot(path string) error {
+	if err := os.MkdirAll(filepath.Dir(path), 0700); err != nil {
+		return err
+	}
+	var snapshot uintptr
+	if err := forwarding_snapshot_open(path, &snapshot); err != nil {
+		return err
+	}
+	// the forwarders keep the snapshot open
+	defer forwarding_snapshot_delete(snapshot)
+	tcp := forwarding_tcp_restoreSnapshot(f.nativeTCP, snapshot)
+	udp := forwarding_udp_restoreSnapshot(f.nativeUDP, snapshot)
+	entries, err := snapshotEntries(snapshot)
+	if err != nil {
+		return err
+	}
+	for i := range entries {
+		e := entries[i].entry()
+		if entries[i].udp != 0 {
+			if _, ok := f.udpEntries[e]; !ok {
+				f.udpEntries[e] = struct{}{}
+				fmt.Printf("Restored udp %v\n", e)
+			}
+			continue
+		}
+		if _, ok := f.tcpEntries[e]; !ok {
+			f.tcpEntries[e] = struct{}{}
+			fmt.Printf("Restored tcp %v\n", e)
+		}
+	}
+	fmt.Printf("Restored %v tcp and %v udp entries from %s\n", tcp, udp, path)
+	return nil
+}
@@ -37,18 +37,34 @@ func errnoErr(e syscall.Errno) error {
 var (
 	modforwarding = syscall.NewLazyDLL("forwarding.dll")
 
-	procforwarding_udp_new         = modforwarding.NewProc("forwarding_udp_new")
-	procforwarding_udp_delete      = modforwarding.NewProc("forwarding_udp_delete")
-	procforwarding_udp_start       = modforwarding.NewProc("forwarding_udp_start")
-	procforwarding_udp_stop        = modforwarding.NewProc("forwarding_udp_stop")
-	procforwarding_udp_addEntry    = modforwarding.NewProc("forwarding_udp_addEntry")
-	procforwarding_udp_removeEntry = modforwarding.NewProc("forwarding_udp_removeEntry")
-	procforwarding_tcp_new         = modforwarding.NewProc("forwarding_tcp_new")
-	procforwarding_tcp_delete      = modforwarding.NewProc("forwarding_tcp_delete")
-	procforwarding_tcp_start       = modforwarding.NewProc("forwarding_tcp_start")
-	procforwarding_tcp_stop        = modforwarding.NewProc("forwarding_tcp_stop")
-	procforwarding_tcp_addEntry    = modforwarding.NewProc("forwarding_tcp_addEntry")
-	procforwarding_tcp_removeEntry = modforwarding.NewProc("forwarding_tcp_removeEntry")
+	procforwarding_udp_new               = modforwarding.NewProc("forwarding_udp_new")
+	procforwarding_udp_delete            = modforwarding.NewProc("forwarding_udp_delete")
+	procforwarding_udp_start             = modforwarding.NewProc("forwarding_udp_start")
+	procforwarding_udp_stop              = modforwarding.NewProc("forwarding_udp_stop")
+	procforwarding_udp_addEntry          = modforwarding.NewProc("forwarding_udp_addEntry")
+	procforwarding_udp_addRangeEntry     = modforwarding.NewProc("forwarding_udp_addRangeEntry")
+	procforwarding_udp_removeEntry       = modforwarding.NewProc("forwarding_udp_removeEntry")
+	procforwarding_udp_updateEntryRemote = modforwarding.NewProc("forwarding_udp_updateEntryRemote")
+	procforwarding_udp_duplicateEntry    = modforwarding.NewProc("forwarding_udp_duplicateEntry")
+	procforwarding_udp_adoptRangeEntry   = modforwarding.NewProc("forwarding_udp_adoptRangeEntry")
+	procforwarding_udp_releaseEntry      = modforwarding.NewProc("forwarding_udp_releaseEntry")
+	procforwarding_udp_restoreSnapshot   = modforwarding.NewProc("forwarding_udp_restoreSnapshot")
+	procforwarding_tcp_new               = modforwarding.NewProc("forwarding_tcp_new")
+	procforwarding_tcp_delete            = modforwarding.NewProc("forwarding_tcp_delete")
+	procforwarding_tcp_start             = modforwarding.NewProc("forwarding_tcp_start")
+	procforwarding_tcp_stop              = modforwarding.NewProc("forwarding_tcp_stop")
+	procforwarding_tcp_addEntry          = modforwarding.NewProc("forwarding_tcp_addEntry")
+	procforwarding_tcp_addRangeEntry     = modforwarding.NewProc("forwarding_tcp_addRangeEntry")
+	procforwarding_tcp_removeEntry       = modforwarding.NewProc("forwarding_tcp_removeEntry")
+	procforwarding_tcp_updateEntryRemote = modforwarding.NewProc("forwarding_tcp_updateEntryRemote")
+	procforwarding_tcp_duplicateEntry    = modforwarding.NewProc("forwarding_tcp_duplicateEntry")
+	procforwarding_tcp_adoptRangeEntry   = modforwarding.NewProc("forwarding_tcp_adoptRangeEntry")
+	procforwarding_tcp_releaseEntry      = modforwarding.NewProc("forwarding_tcp_releaseEntry")
+	procforwarding_tcp_restoreSnapshot   = modforwarding.NewProc("forwarding_tcp_restoreSnapshot")
+	procforwarding_tcp_activeConnections = modforwarding.NewProc("forwarding_tcp_activeConnections")
+	procforwarding_snapshot_open         = modforwarding.NewProc("forwarding_snapshot_open")
+	procforwarding_snapshot_delete       = modforwarding.NewProc("forwarding_snapshot_delete")
+	procforwarding_snapshot_entries      = modforwarding.NewProc("forwarding_snapshot_entries")
 )
 
 func forwarding_udp_new() (ptr uintptr) {
@@ -93,11 +109,104 @@ func _forwarding_udp_addEntry(ptr uintptr, localport uint16, remotePort uint32,
 	return
 }
 
+func forwarding_udp_addRangeEntry(ptr uintptr, localPortStart uint16, count uint16, remotePortStart uint32, remoteAddress string) (err error) {
+	var _p0 *byte
+	_p0, err = syscall.BytePtrFromString(remoteAddress)
+	if err != nil {
+		return
+	}
+	return _forwarding_udp_addRangeEntry(ptr, localPortStart, count, remotePortStart, _p0)
+}
+
+func _forwarding_udp_addRangeEntry(ptr uintptr, localPortStart uint16, count uint16, remotePortStart uint32, remoteAddress *byte) (err error) {
+	r1, _, e1 := syscall.Syscall6(procforwarding_udp_addRangeEntry.Addr(), 5, uintptr(ptr), uintptr(localPortStart), uintptr(count), uintptr(remotePortStart), uintptr(unsafe.Pointer(remoteAddress)), 0)
+	if r1 != 0 {
+		if e1 != 0 {
+			err = errnoErr(e1)
+		} else {
+			err = syscall.EINVAL
+		}
+	}
+	return
+}
+
 func forwarding_udp_removeEntry(ptr uintptr, localport uint16) {
 	syscall.Syscall(procforwarding_udp_removeEntry.Addr(), 2, uintptr(ptr), uintptr(localport), 0)
 	return
 }
 
+func forwarding_udp_updateEntryRemote(ptr uintptr, localport uint16, remotePortStart uint32, remoteAddress string) (err error) {
+	var _p0 *byte
+	_p0, err = syscall.BytePtrFromString(remoteAddress)
+	if err != nil {
+		return
+	}
+	return _forwarding_udp_updateEntryRemote(ptr, localport, remotePortStart, _p0)
+}
+
+func _forwarding_udp_updateEntryRemote(ptr uintptr, localport uint16, remotePortStart uint32, remoteAddress *byte) (err error) {
+	r1, _, e1 := syscall.Syscall6(procforwarding_udp_updateEntryRemote.Addr(), 4, uintptr(ptr), uintptr(localport), uintptr(remotePortStart), uintptr(unsafe.Pointer(remoteAddress)), 0, 0)
+	if r1 != 0 {
+		if e1 != 0 {
+			err = errnoErr(e1)
+		} else {
+			err = syscall.EINVAL
+		}
+	}
+	return
+}
+
+func forwarding_udp_duplicateEntry(ptr uintptr, localport uint16, processID uint32, handoff *byte, handoffCapacity uint32, handoffLength *uint32) (err error) {
+	r1, _, e1 := syscall.Syscall6(procforwarding_udp_duplicateEntry.Addr(), 6, uintptr(ptr), uintptr(localport), uintptr(processID), uintptr(unsafe.Pointer(handoff)), uintptr(handoffCapacity), uintptr(unsafe.Pointer(handoffLength)))
+	if r1 != 0 {
+		if e1 != 0 {
+			err = errnoErr(e1)
+		} else {
+			err = syscall.EINVAL
+		}
+	}
+	return
+}
+
+func forwarding_udp_adoptRangeEntry(ptr uintptr, localPortStart uint16, count uint16, remotePortStart uint32, remoteAddress string, handoff *byte, handoffLength uint32) (err error) {
+	var _p0 *byte
+	_p0, err = syscall.BytePtrFromString(remoteAddress)
+	if err != nil {
+		return
+	}
+	return _forwarding_udp_adoptRangeEntry(ptr, localPortStart, count, remotePortStart, _p0, handoff, handoffLength)
+}
+
+func _forwarding_udp_adoptRangeEntry(ptr uintptr, localPortStart uint16, count uint16, remotePortStart uint32, remoteAddress *byte, handoff *byte, handoffLength uint32) (err error) {
+	r1, _, e1 := syscall.Syscall9(procforwarding_udp_adoptRangeEntry.Addr(), 7, uintptr(ptr), uintptr(localPortStart), uintptr(count), uintptr(remotePortStart), uintptr(unsafe.Pointer(remoteAddress)), uintptr(unsafe.Pointer(handoff)), uintptr(handoffLength), 0, 0)
+	if r1 != 0 {
+		if e1 != 0 {
+			err = errnoErr(e1)
+		} else {
+			err = syscall.EINVAL
+		}
+	}
+	return
+}
+
+func forwarding_udp_releaseEntry(ptr uintptr, localport uint16) (err error) {
+	r1, _, e1 := syscall.Syscall(procforwarding_udp_releaseEntry.Addr(), 2, uintptr(ptr), uintptr(localport), 0)
+	if r1 != 0 {
+		if e1 != 0 {
+			err = errnoErr(e1)
+		} else {
+			err = syscall.EINVAL
+		}
+	}
+	return
+}
+
+func forwarding_udp_restoreSnapshot(ptr uintptr, snapshot uintptr) (count uint32) {
+	r0, _, _ := syscall.Syscall(procforwarding_udp_restoreSnapshot.Addr(), 2, uintptr(ptr), uintptr(snapshot), 0)
+	count = uint32(r0)
+	return
+}
+
 func forwarding_tcp_new() (ptr uintptr) {
 	r0, _, _ := syscall.Syscall(procforwarding_tcp_new.Addr(), 0, 0, 0, 0)
 	ptr = uintptr(r0)
@@ -140,7 +249,144 @@ func _forwarding_tcp_addEntry(ptr uintptr, localport uint16, remotePort uint32,
 	return
 }
 
+func forwarding_tcp_addRangeEntry(ptr uintptr, localPortStart uint16, count uint16, remotePortStart uint32, remoteAddress string) (err error) {
+	var _p0 *byte
+	_p0, err = syscall.BytePtrFromString(remoteAddress)
+	if err != nil {
+		return
+	}
+	return _forwarding_tcp_addRangeEntry(ptr, localPortStart, count, remotePortStart, _p0)
+}
+
+func _forwarding_tcp_addRangeEntry(ptr uintptr, localPortStart uint16, count uint16, remotePortStart uint32, remoteAddress *byte) (err error) {
+	r1, _, e1 := syscall.Syscall6(procforwarding_tcp_addRangeEntry.Addr(), 5, uintptr(ptr), uintptr(localPortStart), uintptr(count), uintptr(remotePortStart), uintptr(unsafe.Pointer(remoteAddress)), 0)
+	if r1 != 0 {
+		if e1 != 0 {
+			err = errnoErr(e1)
+		} else {
+			err = syscall.EINVAL
+		}
+	}
+	return
+}
+
 func forwarding_tcp_removeEntry(ptr uintptr, localport uint16) {
 	syscall.Syscall(procforwarding_tcp_removeEntry.Addr(), 2, uintptr(ptr), uintptr(localport), 0)
 	return
 }
+
+func forwarding_tcp_updateEntryRemote(ptr uintptr, localport uint16, remotePortStart uint32, remoteAddress string) (err error) {
+	var _p0 *byte
+	_p0, err = syscall.BytePtrFromString(remoteAddress)
+	if err != nil {
+		return
+	}
+	return _forwarding_tcp_updateEntryRemote(ptr, localport, remotePortStart, _p0)
+}
+
+func _forwarding_tcp_updateEntryRemote(ptr uintptr, localport uint16, remotePortStart uint32, remoteAddress *byte) (err error) {
+	r1, _, e1 := syscall.Syscall6(procforwarding_tcp_updateEntryRemote.Addr(), 4, uintptr(ptr), uintptr(localport), uintptr(remotePortStart), uintptr(unsafe.Pointer(remoteAddress)), 0, 0)
+	if r1 != 0 {
+		if e1 != 0 {
+			err = errnoErr(e1)
+		} else {
+			err = syscall.EINVAL
+		}
+	}
+	return
+}
+
+func forwarding_tcp_duplicateEntry(ptr uintptr, localport uint16, processID uint32, handoff *byte, handoffCapacity uint32, handoffLength *uint32) (err error) {
+	r1, _, e1 := syscall.Syscall6(procforwarding_tcp_duplicateEntry.Addr(), 6, uintptr(ptr), uintptr(localport), uintptr(processID), uintptr(unsafe.Pointer(handoff)), uintptr(handoffCapacity), uintptr(unsafe.Pointer(handoffLength)))
+	if r1 != 0 {
+		if e1 != 0 {
+			err = errnoErr(e1)
+		} else {
+			err = syscall.EINVAL
+		}
+	}
+	return
+}
+
+func forwarding_tcp_adoptRangeEntry(ptr uintptr, localPortStart uint16, count uint16, remotePortStart uint32, remoteAddress string, handoff *byte, handoffLength uint32) (err error) {
+	var _p0 *byte
+	_p0, err = syscall.BytePtrFromString(remoteAddress)
+	if err != nil {
+		return
+	}
+	return _forwarding_tcp_adoptRangeEntry(ptr, localPortStart, count, remotePortStart, _p0, handoff, handoffLength)
+}
+
+func _forwarding_tcp_adoptRangeEntry(ptr uintptr, localPortStart uint16, count uint16, remotePortStart uint32, remoteAddress *byte, handoff *byte, handoffLength uint32) (err error) {
+	r1, _, e1 := syscall.Syscall9(procforwarding_tcp_adoptRangeEntry.Addr(), 7, uintptr(ptr), uintptr(localPortStart), uintptr(count), uintptr(remotePortStart), uintptr(unsafe.Pointer(remoteAddress)), uintptr(unsafe.Pointer(handoff)), uintptr(handoffLength), 0, 0)
+	if r1 != 0 {
+		if e1 != 0 {
+			err = errnoErr(e1)
+		} else {
+			err = syscall.EINVAL
+		}
+	}
+	return
+}
+
+func forwarding_tcp_releaseEntry(ptr uintptr, localport uint16) (err error) {
+	r1, _, e1 := syscall.Syscall(procforwarding_tcp_releaseEntry.Addr(), 2, uintptr(ptr), uintptr(localport), 0)
+	if r1 != 0 {
+		if e1 != 0 {
+			err = errnoErr(e1)
+		} else {
+			err = syscall.EINVAL
+		}
+	}
+	return
+}
+
+func forwarding_tcp_restoreSnapshot(ptr uintptr, snapshot uintptr) (count uint32) {
+	r0, _, _ := syscall.Syscall(procforwarding_tcp_restoreSnapshot.Addr(), 2, uintptr(ptr), uintptr(snapshot), 0)
+	count = uint32(r0)
+	return
+}
+
+func forwarding_tcp_activeConnections(ptr uintptr) (count uint64) {
+	r0, _, _ := syscall.Syscall(procforwarding_tcp_activeConnections.Addr(), 1, uintptr(ptr), 0, 0)
+	count = uint64(r0)
+	return
+}
+
+func forwarding_snapshot_open(path string, snapshot *uintptr) (err error) {
+	var _p0 *byte
+	_p0, err = syscall.BytePtrFromString(path)
+	if err != nil {
+		return
+	}
+	return _forwarding_snapshot_open(_p0, snapshot)
+}
+
+func _forwarding_snapshot_open(path *byte, snapshot *uintptr) (err error) {
+	r1, _, e1 := syscall.Syscall(procforwarding_snapshot_open.Addr(), 2, uintptr(unsafe.Pointer(path)), uintptr(unsafe.Pointer(snapshot)), 0)
+	if r1 != 0 {
+		if e1 != 0 {
+			err = errnoErr(e1)
+		} else {
+			err = syscall.EINVAL
+		}
+	}
+	return
+}
+
+func forwarding_snapshot_delete(ptr uintptr) {
+	syscall.Syscall(procforwarding_snapshot_delete.Addr(), 1, uintptr(ptr), 0, 0)
+	return
+}
+
+func forwarding_snapshot_entries(ptr uintptr, entries *snapshotEntry, capacity uint32, count *uint32) (err error) {
+	r1, _, e1 := syscall.Syscall6(procforwarding_snapshot_entries.Addr(), 4, uintptr(ptr), uintptr(unsafe.Pointer(entries)), uintptr(capacity), uintptr(unsafe.Pointer(count)), 0, 0)
+	if r1 != 0 {
+		if e1 != 0 {
+			err = errnoErr(e1)
+		} else {
+			err = syscall.EINVAL
+		}
+	}
+	return
+}